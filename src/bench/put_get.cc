@@ -6,12 +6,18 @@
 #include "gflags/gflags.h"
 
 #include "objstore.h"
+#include "objstore_aws.h"
 
+#include <algorithm>
 #include <filesystem>
 #include <fstream>
+#include <future>
+#include <memory>
+#include <mutex>
 #include <string>
 #include <string_view>
 #include <sys/errno.h>
+#include <vector>
 
 DEFINE_string(provider, "local",
               "provider of objstore, only support local or aws");
@@ -24,6 +30,93 @@ DEFINE_bool(
     "whether to use https or not, which will be ignored by local objstore");
 DEFINE_string(bucket, "test_bucket",
               "bucket, which will be used for this test");
+DEFINE_uint64(multipart_threshold, 64 * 1024 * 1024,
+              "objects larger than it are uploaded by multipart upload");
+DEFINE_uint64(part_size, 16 * 1024 * 1024, "part size of multipart upload");
+DEFINE_uint64(max_parallel_parts, 8,
+              "max number of parts of one object uploaded in parallel");
+DEFINE_uint64(cache_memory_bytes, 0,
+              "memory of the read-through cache, 0 to disable it");
+DEFINE_string(cache_disk_path, "",
+              "directory of the disk tier of the read-through cache");
+DEFINE_uint64(cache_disk_bytes, 0, "size of the disk tier of the cache");
+DEFINE_uint64(cache_block_size, 1024 * 1024, "block size of the cache");
+DEFINE_string(local_durability, "none",
+              "durability of local writes: none, per_object or group_commit");
+DEFINE_uint64(max_retries, 3, "retries of a request failed transiently");
+DEFINE_bool(hedge_reads, false,
+            "send the reads slower than the p95 latency once more");
+DEFINE_uint64(max_connections, 64, "connections of the s3 client");
+DEFINE_uint64(connect_timeout_ms, 1000, "connect timeout of s3 requests");
+DEFINE_uint64(request_timeout_ms, 3000, "request timeout of s3 requests");
+DEFINE_string(http_client, "", "http client of s3: curl, or the default");
+DEFINE_bool(share_s3_client, false,
+            "share one s3 client among the object stores");
+DEFINE_bool(enable_metrics, false,
+            "record the requests, and print the metrics of the store shared "
+            "by the concurrent benchmarks at the end");
+DEFINE_bool(sdk_buffer_pool, false,
+            "allocate the memory of the aws sdk from the buffer pool, if it "
+            "is built with -DCUSTOM_MEMORY_MANAGEMENT=ON");
+DEFINE_bool(checksums, false,
+            "send and check the crc32c of the objects");
+DEFINE_string(compression, "none",
+              "compress the objects at rest: none, zstd or lz4");
+DEFINE_int32(compression_level, 0, "level of the codec, 0 for its default");
+DEFINE_bool(coalesce_reads, false,
+            "share one request between concurrent identical reads");
+
+// the options configured by the flags.
+objstore::ObjectStoreOptions flag_options() {
+  objstore::ObjectStoreOptions options;
+  options.multipart_threshold = FLAGS_multipart_threshold;
+  options.part_size = FLAGS_part_size;
+  options.max_parallel_parts = FLAGS_max_parallel_parts;
+  options.cache_memory_bytes = FLAGS_cache_memory_bytes;
+  options.cache_disk_path = FLAGS_cache_disk_path;
+  options.cache_disk_bytes = FLAGS_cache_disk_bytes;
+  options.cache_block_size = FLAGS_cache_block_size;
+  options.max_retries = FLAGS_max_retries;
+  options.hedge_reads = FLAGS_hedge_reads;
+  options.max_connections = FLAGS_max_connections;
+  options.connect_timeout_ms = FLAGS_connect_timeout_ms;
+  options.request_timeout_ms = FLAGS_request_timeout_ms;
+  options.http_client = FLAGS_http_client;
+  options.share_s3_client = FLAGS_share_s3_client;
+  options.enable_metrics = FLAGS_enable_metrics;
+  options.enable_checksums = FLAGS_checksums;
+  options.compression_level = FLAGS_compression_level;
+  options.coalesce_reads = FLAGS_coalesce_reads;
+  if (FLAGS_local_durability == "per_object") {
+    options.local_durability = objstore::Durability::kPerObject;
+  } else if (FLAGS_local_durability == "group_commit") {
+    options.local_durability = objstore::Durability::kGroupCommit;
+  }
+  if (FLAGS_compression == "zstd") {
+    options.compression = objstore::Compression::kZstd;
+  } else if (FLAGS_compression == "lz4") {
+    options.compression = objstore::Compression::kLz4;
+  }
+  return options;
+}
+
+objstore::ObjectStore *create_obj_store(
+    const objstore::ObjectStoreOptions &options) {
+  std::string_view endpoint = FLAGS_endpoint;
+  return objstore::create_object_store(
+      FLAGS_provider, FLAGS_region, endpoint.size() == 0 ? nullptr : &endpoint,
+      FLAGS_use_https, options);
+}
+
+// the store configured by the flags, with max_connections overridden unless
+// it is 0.
+objstore::ObjectStore *create_obj_store(size_t max_connections = 0) {
+  objstore::ObjectStoreOptions options = flag_options();
+  if (max_connections > 0) {
+    options.max_connections = max_connections;
+  }
+  return create_obj_store(options);
+}
 
 std::string format_bytes(uint64_t bytes) {
   uint64_t size = static_cast<double>(bytes);
@@ -65,6 +158,20 @@ int remove_file(std::string_view path) {
   return deleted ? 0 : -ENOENT;
 }
 
+// count how each file copy of the local object store since before was done.
+void report_local_copies(const objstore::LocalCopyStats &before,
+                         benchmark::State &state) {
+  if (FLAGS_provider != "local") {
+    return;
+  }
+  const objstore::LocalCopyStats after = objstore::get_local_copy_stats();
+  state.counters["reflink"] = after.reflink - before.reflink;
+  state.counters["copy_file_range"] =
+      after.copy_file_range - before.copy_file_range;
+  state.counters["sendfile"] = after.sendfile - before.sendfile;
+  state.counters["userspace"] = after.userspace - before.userspace;
+}
+
 void create_file_put_to_s3_delete_file(std::string_view prefix, size_t fsize,
                                        benchmark::State &state) {
   const std::string filepath(assemble_file_path(prefix, fsize));
@@ -72,13 +179,14 @@ void create_file_put_to_s3_delete_file(std::string_view prefix, size_t fsize,
   int ret = create_file(filepath, fsize);
   assert(ret == 0);
 
-  objstore::ObjectStore *obj_store = objstore::create_object_store(
-      FLAGS_provider, FLAGS_region, nullptr, false);
+  objstore::ObjectStore *obj_store = create_obj_store();
   assert(obj_store != nullptr);
 
+  const objstore::LocalCopyStats before = objstore::get_local_copy_stats();
   for ([[maybe_unused]] auto _ : state) {
     obj_store->put_object_from_file(FLAGS_bucket, objkey, filepath.c_str());
   }
+  report_local_copies(before, state);
 
   destroy_object_store(obj_store);
   remove_file(filepath);
@@ -86,20 +194,300 @@ void create_file_put_to_s3_delete_file(std::string_view prefix, size_t fsize,
 
 void get_from_s3_put_file(std::string_view prefix, size_t fsize,
                           benchmark::State &state) {
-  const std::string obj_key(assemble_file_path(prefix, fsize));
+  const std::string obj_key(assemble_file_path(prefix, fsize) + "_get");
   const std::string filepath = obj_key + ".s3";
 
-  objstore::ObjectStore *obj_store = objstore::create_object_store(
-      FLAGS_provider, FLAGS_region, nullptr, false);
+  objstore::ObjectStore *obj_store = create_obj_store();
   assert(obj_store != nullptr);
 
+  // put the object to get, instead of relying on the put benchmark of the
+  // same size having run before.
+  int ret = create_file(obj_key, fsize);
+  assert(ret == 0);
+  objstore::Status status =
+      obj_store->put_object_from_file(FLAGS_bucket, obj_key, obj_key);
+  remove_file(obj_key);
+  if (!status.is_succ()) {
+    state.SkipWithError(std::string(status.error_message()).c_str());
+    destroy_object_store(obj_store);
+    return;
+  }
+
+  const objstore::LocalCopyStats before = objstore::get_local_copy_stats();
   for ([[maybe_unused]] auto _ : state) {
     obj_store->get_object_to_file(FLAGS_bucket, obj_key, filepath.c_str());
   }
+  report_local_copies(before, state);
+
+  obj_store->delete_object(FLAGS_bucket, obj_key);
+  destroy_object_store(obj_store);
+  remove_file(filepath);
+}
+
+// shared by all the threads of a multithreaded benchmark.
+objstore::ObjectStore *shared_obj_store() {
+  static objstore::ObjectStore *obj_store = create_obj_store();
+  assert(obj_store != nullptr);
+  return obj_store;
+}
+
+// every thread puts and gets its own key in a loop, so the throughput should
+// scale with the thread count as long as the object store does not serialize
+// operations on different keys.
+void put_get_concurrently(std::string_view prefix, size_t fsize,
+                          benchmark::State &state) {
+  const std::string obj_key = assemble_file_path(prefix, fsize) + "_" +
+                              std::to_string(state.thread_index());
+  const std::string value(fsize, 'x');
+  std::string body;
+
+  objstore::ObjectStore *obj_store = shared_obj_store();
+  for ([[maybe_unused]] auto _ : state) {
+    obj_store->put_object(FLAGS_bucket, obj_key, value);
+    obj_store->get_object(FLAGS_bucket, obj_key, body);
+  }
+  obj_store->delete_object(FLAGS_bucket, obj_key);
+
+  state.SetItemsProcessed(state.iterations() * 2);
+  state.SetBytesProcessed(state.iterations() * 2 * fsize);
+}
+
+// every thread puts its own key and gets it back as a ranged buffer, which
+// comes from the buffer pool as the allocations of the aws sdk do with
+// --sdk_buffer_pool, and the pool is enabled if state.range(0) is 1.
+void put_get_pooled(std::string_view prefix, size_t fsize,
+                    benchmark::State &state) {
+  const std::string obj_key = assemble_file_path(prefix, fsize) + "_" +
+                              std::to_string(state.thread_index());
+  const std::string value(fsize, 'x');
+  std::shared_ptr<const objstore::ObjectBuffer> body;
+
+  objstore::ObjectStore *obj_store = shared_obj_store();
+  objstore::BufferPoolStats before;
+  if (state.thread_index() == 0) {
+    objstore::enable_buffer_pool(state.range(0) != 0);
+    before = objstore::get_buffer_pool_stats();
+  }
+  for ([[maybe_unused]] auto _ : state) {
+    obj_store->put_object(FLAGS_bucket, obj_key, value);
+    obj_store->get_object_buffer(FLAGS_bucket, obj_key, 0, fsize,
+                                 objstore::AccessPattern::kNormal, body);
+  }
+  obj_store->delete_object(FLAGS_bucket, obj_key);
+
+  state.SetItemsProcessed(state.iterations() * 2);
+  state.SetBytesProcessed(state.iterations() * 2 * fsize);
+  if (state.thread_index() == 0) {
+    // the other threads report their allocations every so often, so the
+    // rates are those of most of the run.
+    const objstore::BufferPoolStats after = objstore::get_buffer_pool_stats();
+    const double allocations =
+        std::max<double>(after.allocations - before.allocations, 1);
+    state.counters["thread_cache_hits"] =
+        (after.thread_cache_hits - before.thread_cache_hits) / allocations;
+    state.counters["shared_hits"] =
+        (after.shared_hits - before.shared_hits) / allocations;
+    state.counters["misses"] = (after.misses - before.misses) / allocations;
+    state.counters["unpooled"] =
+        (after.unpooled - before.unpooled) / allocations;
+    objstore::enable_buffer_pool(true);
+  }
+}
+
+// the gets sent to the provider by obj_store, which records its metrics.
+uint64_t provider_gets(objstore::ObjectStore *obj_store) {
+  objstore::ObjectStoreMetrics metrics;
+  obj_store->get_metrics(metrics);
+  for (auto &op : metrics.operations) {
+    if (op.op == "get") {
+      return op.count;
+    }
+  }
+  return 0;
+}
+
+// every thread gets the same object in a loop, as many readers opening a new
+// file at once do, through a store coalescing the concurrent gets if
+// state.range(0) is 1, and the gets sent to the provider per get are
+// reported.
+void get_stampede(std::string_view prefix, size_t fsize,
+                  benchmark::State &state) {
+  static objstore::ObjectStore *stores[2] = {nullptr, nullptr};
+  static std::once_flag once;
+  std::call_once(once, []() {
+    objstore::ObjectStoreOptions options = flag_options();
+    options.enable_metrics = true;
+    for (int coalesce = 0; coalesce < 2; ++coalesce) {
+      options.coalesce_reads = coalesce != 0;
+      stores[coalesce] = create_obj_store(options);
+      assert(stores[coalesce] != nullptr);
+    }
+  });
+  objstore::ObjectStore *obj_store = stores[state.range(0)];
+  const std::string obj_key = assemble_file_path(prefix, fsize);
+
+  uint64_t before = 0;
+  if (state.thread_index() == 0) {
+    obj_store->put_object(FLAGS_bucket, obj_key, std::string(fsize, 'x'));
+    before = provider_gets(obj_store);
+  }
+  std::string body;
+  for ([[maybe_unused]] auto _ : state) {
+    obj_store->get_object(FLAGS_bucket, obj_key, body);
+  }
+  state.SetItemsProcessed(state.iterations());
+  state.SetBytesProcessed(state.iterations() * fsize);
+  if (state.thread_index() == 0) {
+    const double gets =
+        std::max<double>(state.iterations() * state.threads(), 1);
+    state.counters["provider_gets"] =
+        (provider_gets(obj_store) - before) / gets;
+    obj_store->delete_object(FLAGS_bucket, obj_key);
+  }
+}
+
+// read the object by 1MiB reads from a reader which reads ahead up to
+// state.range(0) chunks, 0 fetches every chunk when it is needed.
+void scan_object(std::string_view prefix, size_t fsize,
+                 benchmark::State &state) {
+  const std::string obj_key = assemble_file_path(prefix, fsize);
+  objstore::ObjectStore *obj_store = create_obj_store();
+  assert(obj_store != nullptr);
+  obj_store->put_object(FLAGS_bucket, obj_key, std::string(fsize, 'x'));
+
+  objstore::ObjectReaderOptions options;
+  options.chunk_size = FLAGS_part_size;
+  options.max_read_ahead = state.range(0);
+  options.read_ahead = std::min<size_t>(options.read_ahead, state.range(0));
+  std::string buf(1024 * 1024, 0);
+  for ([[maybe_unused]] auto _ : state) {
+    std::unique_ptr<objstore::ObjectReader> reader;
+    obj_store->open_object_reader(FLAGS_bucket, obj_key, options, reader);
+    size_t read_len = 0;
+    do {
+      reader->read(buf.data(), buf.size(), read_len);
+    } while (read_len == buf.size());
+  }
+  state.SetBytesProcessed(state.iterations() * fsize);
+
+  obj_store->delete_object(FLAGS_bucket, obj_key);
+  destroy_object_store(obj_store);
+}
+
+// get fsize objects kGetsInFlight at a time through a client of
+// state.range(0) connections, which caps the requests on the wire.
+void get_with_connections(std::string_view prefix, size_t fsize,
+                          benchmark::State &state) {
+  constexpr size_t kGetsInFlight = 256;
+  const std::string obj_key = assemble_file_path(prefix, fsize);
+  objstore::ObjectStore *obj_store = create_obj_store(state.range(0));
+  assert(obj_store != nullptr);
+  obj_store->set_executor(
+      objstore::create_thread_pool_executor(kGetsInFlight, kGetsInFlight));
+  obj_store->put_object(FLAGS_bucket, obj_key, std::string(fsize, 'x'));
+
+  std::vector<std::string> bodies(kGetsInFlight);
+  std::vector<std::future<objstore::Status>> gets;
+  for ([[maybe_unused]] auto _ : state) {
+    for (std::string &body : bodies) {
+      gets.push_back(obj_store->get_object_async(FLAGS_bucket, obj_key, body));
+    }
+    for (auto &get : gets) {
+      get.get();
+    }
+    gets.clear();
+  }
+  state.SetItemsProcessed(state.iterations() * kGetsInFlight);
+  state.SetBytesProcessed(state.iterations() * kGetsInFlight * fsize);
+
+  obj_store->delete_object(FLAGS_bucket, obj_key);
+  destroy_object_store(obj_store);
+}
+
+// log lines of about fsize bytes, which compress about like real logs.
+std::string generate_logs(size_t fsize) {
+  static const char *kLevels[] = {"INFO", "INFO", "INFO", "WARN", "DEBUG"};
+  static const char *kMessages[] = {
+      "request served", "cache miss, fetching block", "compaction finished",
+      "retrying after throttling", "flushed memtable to level 0"};
+  std::string logs;
+  logs.reserve(fsize + 256);
+  uint64_t seed = 42;
+  char line[256];
+  for (uint64_t i = 0; logs.size() < fsize; ++i) {
+    seed = seed * 6364136223846793005ULL + 1442695040888963407ULL;
+    const uint64_t r = seed >> 33;
+    const int n = snprintf(
+        line, sizeof(line),
+        "2024-04-07T%02d:%02d:%02d.%06d %s [worker-%d] %s key=object_%llu "
+        "latency_us=%llu\n",
+        static_cast<int>(i / 3600000 % 24), static_cast<int>(i / 60000 % 60),
+        static_cast<int>(i / 1000 % 60), static_cast<int>(r % 1000000),
+        kLevels[r % 5], static_cast<int>(r % 16), kMessages[(r >> 4) % 5],
+        static_cast<unsigned long long>(r % 100000),
+        static_cast<unsigned long long>((r >> 8) % 5000));
+    logs.append(line, n);
+  }
+  logs.resize(fsize);
+  return logs;
+}
+
+// put, or get if get is set, fsize bytes of logs through a store compressing
+// them by the codec state.range(0), a Compression, at the level
+// state.range(1), and report the ratio of the body to the stored size.
+void put_get_compressed(std::string_view prefix, size_t fsize, bool get,
+                        benchmark::State &state) {
+  const std::string obj_key = assemble_file_path(prefix, fsize);
+  objstore::ObjectStoreOptions options = flag_options();
+  options.compression = static_cast<objstore::Compression>(state.range(0));
+  options.compression_level = state.range(1);
+  objstore::ObjectStore *obj_store = create_obj_store(options);
+  assert(obj_store != nullptr);
 
+  const std::string value = generate_logs(fsize);
+  objstore::Status status = obj_store->put_object(FLAGS_bucket, obj_key, value);
+  if (!status.is_succ()) {
+    state.SkipWithError(std::string(status.error_message()).c_str());
+    destroy_object_store(obj_store);
+    return;
+  }
+  std::string body;
+  for ([[maybe_unused]] auto _ : state) {
+    if (get) {
+      obj_store->get_object(FLAGS_bucket, obj_key, body);
+    } else {
+      obj_store->put_object(FLAGS_bucket, obj_key, value);
+    }
+  }
+  state.SetBytesProcessed(state.iterations() * fsize);
+
+  // the listing reports the stored sizes.
+  std::vector<objstore::ObjectMeta> objects;
+  obj_store->list_object(FLAGS_bucket, obj_key, objects);
+  for (auto &object : objects) {
+    if (object.key == obj_key && object.size > 0) {
+      state.counters["ratio"] = static_cast<double>(fsize) / object.size;
+    }
+  }
+  obj_store->delete_object(FLAGS_bucket, obj_key);
   destroy_object_store(obj_store);
 }
 
+// no compression, then the levels of zstd and lz4 from the fastest.
+void compression_args(benchmark::internal::Benchmark *b) {
+  const int64_t kNone = static_cast<int64_t>(objstore::Compression::kNone);
+  const int64_t kZstd = static_cast<int64_t>(objstore::Compression::kZstd);
+  const int64_t kLz4 = static_cast<int64_t>(objstore::Compression::kLz4);
+  b->ArgNames({"codec", "level"});
+  b->Args({kNone, 0});
+  for (int64_t level : {-5, 1, 3, 9, 19}) {
+    b->Args({kZstd, level});
+  }
+  for (int64_t level : {1, 9}) {
+    b->Args({kLz4, level});
+  }
+}
+
 void Benchmark_Put32B(benchmark::State &state) {
   create_file_put_to_s3_delete_file("object", 32, state);
 }
@@ -140,6 +528,62 @@ void Benchmark_Get2G(benchmark::State &state) {
   get_from_s3_put_file("object", 2ULL * 1024 * 1024 * 1024, state);
 }
 
+void Benchmark_CompressedPut4K(benchmark::State &state) {
+  put_get_compressed("logs", 4096, false, state);
+}
+
+void Benchmark_CompressedGet4K(benchmark::State &state) {
+  put_get_compressed("logs", 4096, true, state);
+}
+
+void Benchmark_CompressedPut2M(benchmark::State &state) {
+  put_get_compressed("logs", 2 * 1024 * 1024, false, state);
+}
+
+void Benchmark_CompressedGet2M(benchmark::State &state) {
+  put_get_compressed("logs", 2 * 1024 * 1024, true, state);
+}
+
+void Benchmark_CompressedPut128M(benchmark::State &state) {
+  put_get_compressed("logs", 128 * 1024 * 1024, false, state);
+}
+
+void Benchmark_CompressedGet128M(benchmark::State &state) {
+  put_get_compressed("logs", 128 * 1024 * 1024, true, state);
+}
+
+void Benchmark_Scan128M(benchmark::State &state) {
+  scan_object("object", 128 * 1024 * 1024, state);
+}
+
+void Benchmark_Connections4K(benchmark::State &state) {
+  get_with_connections("object", 4 * 1024, state);
+}
+
+void Benchmark_PooledPutGet32B(benchmark::State &state) {
+  put_get_pooled("pool_object", 32, state);
+}
+
+void Benchmark_PooledPutGet4K(benchmark::State &state) {
+  put_get_pooled("pool_object", 4096, state);
+}
+
+void Benchmark_Stampede4K(benchmark::State &state) {
+  get_stampede("stampede_object", 4096, state);
+}
+
+void Benchmark_Stampede2M(benchmark::State &state) {
+  get_stampede("stampede_object", 2 * 1024 * 1024, state);
+}
+
+void Benchmark_ConcurrentPutGet4K(benchmark::State &state) {
+  put_get_concurrently("mt_object", 4096, state);
+}
+
+void Benchmark_ConcurrentPutGet2M(benchmark::State &state) {
+  put_get_concurrently("mt_object", 2 * 1024 * 1024, state);
+}
+
 BENCHMARK(Benchmark_Put32B)->Iterations(10);
 BENCHMARK(Benchmark_Get32B)->Iterations(10);
 BENCHMARK(Benchmark_Put4K)->Iterations(10);
@@ -150,9 +594,68 @@ BENCHMARK(Benchmark_Put128M)->Iterations(10);
 BENCHMARK(Benchmark_Get128M)->Iterations(10);
 BENCHMARK(Benchmark_Put2G)->Iterations(10);
 BENCHMARK(Benchmark_Get2G)->Iterations(10);
+BENCHMARK(Benchmark_CompressedPut4K)->Apply(compression_args)->Iterations(100);
+BENCHMARK(Benchmark_CompressedGet4K)->Apply(compression_args)->Iterations(100);
+BENCHMARK(Benchmark_CompressedPut2M)
+    ->Apply(compression_args)
+    ->Iterations(10)
+    ->UseRealTime();
+BENCHMARK(Benchmark_CompressedGet2M)
+    ->Apply(compression_args)
+    ->Iterations(10)
+    ->UseRealTime();
+BENCHMARK(Benchmark_CompressedPut128M)
+    ->Apply(compression_args)
+    ->Iterations(3)
+    ->UseRealTime();
+BENCHMARK(Benchmark_CompressedGet128M)
+    ->Apply(compression_args)
+    ->Iterations(3)
+    ->UseRealTime();
+BENCHMARK(Benchmark_Scan128M)->Arg(0)->Arg(8)->Iterations(10);
+BENCHMARK(Benchmark_Connections4K)
+    ->RangeMultiplier(2)
+    ->Range(8, 256)
+    ->UseRealTime();
+BENCHMARK(Benchmark_PooledPutGet32B)
+    ->Arg(0)
+    ->Arg(1)
+    ->ThreadRange(1, 16)
+    ->UseRealTime();
+BENCHMARK(Benchmark_PooledPutGet4K)
+    ->Arg(0)
+    ->Arg(1)
+    ->ThreadRange(1, 16)
+    ->UseRealTime();
+BENCHMARK(Benchmark_Stampede4K)
+    ->Arg(0)
+    ->Arg(1)
+    ->Threads(16)
+    ->UseRealTime();
+BENCHMARK(Benchmark_Stampede2M)
+    ->Arg(0)
+    ->Arg(1)
+    ->Threads(16)
+    ->UseRealTime();
+BENCHMARK(Benchmark_ConcurrentPutGet4K)->ThreadRange(1, 16)->UseRealTime();
+BENCHMARK(Benchmark_ConcurrentPutGet2M)->ThreadRange(1, 16)->UseRealTime();
 
 int main(int argc, char **argv) {
+  // take the flags of the benchmark library, e.g. --benchmark_filter, out
+  // before gflags rejects them.
+  benchmark::Initialize(&argc, argv);
   gflags::ParseCommandLineFlags(&argc, &argv, true);
+  if (FLAGS_sdk_buffer_pool) {
+    Aws::SDKOptions options;
+    options.memoryManagementOptions.memoryManager =
+        objstore::get_buffer_pool_memory_manager();
+    objstore::set_aws_sdk_options(options);
+  }
   benchmark::RunSpecifiedBenchmarks();
+  if (FLAGS_enable_metrics) {
+    objstore::ObjectStoreMetrics metrics;
+    shared_obj_store()->get_metrics(metrics);
+    printf("%s", metrics.to_prometheus().c_str());
+  }
   return 0;
 }
@@ -0,0 +1,572 @@
+// a closed-loop workload driver: threads keep requests in flight against an
+// object store for a while, drawing the operations from a mix, the keys from
+// a uniform or zipfian distribution and the object sizes from a size
+// distribution, then report the throughput and latency percentiles of every
+// operation. see the readme for examples.
+#include <stdio.h>
+
+#include "gflags/gflags.h"
+
+#include "lib/metrics.h"
+#include "objstore.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+DEFINE_string(provider, "local",
+              "provider of objstore, only support local or aws");
+DEFINE_string(region, "/tmp/",
+              "region of the objstore, direcotry for local objstore");
+DEFINE_string(endpoint, "",
+              "endpoint, e.g. 127.0.0.1:9000 of a local s3-compatible server, "
+              "ignored by local objstore");
+DEFINE_bool(
+    use_https, false,
+    "whether to use https or not, which will be ignored by local objstore");
+DEFINE_string(bucket, "test_bucket",
+              "bucket, which will be used for this workload");
+DEFINE_uint64(max_retries, 3, "retries of a request failed transiently");
+DEFINE_uint64(max_connections, 64, "connections of the s3 client");
+DEFINE_uint64(cache_memory_bytes, 0,
+              "memory of the read-through cache, 0 to disable it");
+
+DEFINE_uint64(threads, 4, "threads issuing requests");
+DEFINE_uint64(in_flight, 1,
+              "requests each thread keeps in flight, more than 1 runs them "
+              "on a thread pool");
+DEFINE_uint64(duration_s, 10, "seconds the workload runs");
+DEFINE_uint64(seed, 1, "seed of the random choices");
+
+DEFINE_uint64(keys, 1000, "objects in the key space");
+DEFINE_string(key_prefix, "workload_", "prefix of the keys");
+DEFINE_double(zipf_theta, 0,
+              "skew of the key popularity in [0, 1), 0 for uniform, 0.99 for "
+              "a few very hot keys");
+DEFINE_string(sizes, "fixed:4K",
+              "object sizes: fixed:SIZE, uniform:MIN:MAX or "
+              "lognormal:MEDIAN:SIGMA, sizes take a K, M or G suffix");
+DEFINE_string(mix, "get:90,put:10",
+              "weights of the operations: get, put, head, list and delete");
+DEFINE_string(read_pattern, "whole",
+              "how get reads an object: whole, random ranges or sequential "
+              "ranges");
+DEFINE_string(range_size, "64K", "size of the ranged reads");
+DEFINE_uint64(list_page_size, 100, "keys of one list page");
+DEFINE_bool(preload, true,
+            "put every key before the run, so that reads find their objects");
+DEFINE_bool(cleanup, true, "delete the keys after the run");
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+using objstore::MetricsOp;
+
+enum class Op { kGet, kPut, kHead, kList, kDelete, kNumOps };
+
+constexpr const char *kOpNames[] = {"get", "put", "head", "list", "delete"};
+
+// parse a size like 4096, 64K or 2M, false if malformed.
+bool parse_size(const std::string &str, size_t &size) {
+  char *end = nullptr;
+  const double value = strtod(str.c_str(), &end);
+  if (end == str.c_str() || value < 0) {
+    return false;
+  }
+  double scale = 1;
+  const std::string suffix(end);
+  if (suffix == "K" || suffix == "k") {
+    scale = 1024;
+  } else if (suffix == "M" || suffix == "m") {
+    scale = 1024 * 1024;
+  } else if (suffix == "G" || suffix == "g") {
+    scale = 1024 * 1024 * 1024;
+  } else if (!suffix.empty()) {
+    return false;
+  }
+  size = static_cast<size_t>(value * scale);
+  return true;
+}
+
+std::vector<std::string> split(const std::string &str, char sep) {
+  std::vector<std::string> parts;
+  size_t begin = 0;
+  while (true) {
+    const size_t end = str.find(sep, begin);
+    parts.push_back(str.substr(begin, end - begin));
+    if (end == std::string::npos) {
+      return parts;
+    }
+    begin = end + 1;
+  }
+}
+
+class SizeDistribution {
+ public:
+  // parse fixed:SIZE, uniform:MIN:MAX or lognormal:MEDIAN:SIGMA.
+  bool parse(const std::string &spec) {
+    const std::vector<std::string> parts = split(spec, ':');
+    if (parts.size() == 2 && parts[0] == "fixed") {
+      kind_ = Kind::kFixed;
+      return parse_size(parts[1], min_);
+    } else if (parts.size() == 3 && parts[0] == "uniform") {
+      kind_ = Kind::kUniform;
+      return parse_size(parts[1], min_) && parse_size(parts[2], max_) &&
+             min_ <= max_;
+    } else if (parts.size() == 3 && parts[0] == "lognormal") {
+      kind_ = Kind::kLogNormal;
+      char *end = nullptr;
+      sigma_ = strtod(parts[2].c_str(), &end);
+      if (!parse_size(parts[1], min_) || min_ == 0 || *end != '\0' ||
+          sigma_ < 0) {
+        return false;
+      }
+      // clip the sizes at 4 sigmas, or 1GiB, since puts send a prefix of a
+      // body of the largest size.
+      max_ = static_cast<size_t>(std::min(
+          min_ * std::exp(4 * sigma_), 1024.0 * 1024 * 1024));
+      max_ = std::max(max_, min_);
+      return true;
+    }
+    return false;
+  }
+
+  size_t next(std::mt19937_64 &rng) const {
+    switch (kind_) {
+      case Kind::kFixed:
+        return min_;
+      case Kind::kUniform:
+        return std::uniform_int_distribution<size_t>(min_, max_)(rng);
+      case Kind::kLogNormal: {
+        // min_ is the median, max_ clips the long tail.
+        const double size = std::lognormal_distribution<double>(
+            std::log(static_cast<double>(min_)), sigma_)(rng);
+        return static_cast<size_t>(
+            std::clamp(size, 1.0, static_cast<double>(max_)));
+      }
+    }
+    return min_;
+  }
+
+  size_t max() const { return kind_ == Kind::kFixed ? min_ : max_; }
+
+ private:
+  enum class Kind { kFixed, kUniform, kLogNormal };
+
+  Kind kind_{Kind::kFixed};
+  size_t min_{0};
+  size_t max_{0};
+  double sigma_{0};
+};
+
+// the ranks [0, n) drawn with probability proportional to 1 / (rank + 1) ^
+// theta, by the method of gray et al., "quickly generating billion-record
+// synthetic databases", as ycsb does. theta 0 draws them uniformly.
+class ZipfGenerator {
+ public:
+  ZipfGenerator(uint64_t n, double theta) : n_(n), theta_(theta) {
+    if (theta_ > 0) {
+      double zetan = 0;
+      for (uint64_t i = 1; i <= n_; ++i) {
+        zetan += 1 / std::pow(static_cast<double>(i), theta_);
+      }
+      const double zeta2 = 1 + 1 / std::pow(2.0, theta_);
+      zetan_ = zetan;
+      alpha_ = 1 / (1 - theta_);
+      eta_ = (1 - std::pow(2.0 / n_, 1 - theta_)) / (1 - zeta2 / zetan);
+      half_pow_theta_ = 1 + std::pow(0.5, theta_);
+    }
+  }
+
+  uint64_t next(std::mt19937_64 &rng) const {
+    if (theta_ <= 0) {
+      return std::uniform_int_distribution<uint64_t>(0, n_ - 1)(rng);
+    }
+    const double u = std::uniform_real_distribution<double>(0, 1)(rng);
+    const double uz = u * zetan_;
+    if (uz < 1) {
+      return 0;
+    } else if (uz < half_pow_theta_ && n_ > 1) {
+      return 1;
+    }
+    return std::min<uint64_t>(
+        n_ - 1,
+        static_cast<uint64_t>(n_ * std::pow(eta_ * u - eta_ + 1, alpha_)));
+  }
+
+ private:
+  const uint64_t n_;
+  const double theta_;
+  double zetan_{0};
+  double alpha_{0};
+  double eta_{0};
+  double half_pow_theta_{0};
+};
+
+std::string key_of(uint64_t index) {
+  char buf[32];
+  snprintf(buf, sizeof(buf), "%010llu",
+           static_cast<unsigned long long>(index));
+  return FLAGS_key_prefix + buf;
+}
+
+uint64_t elapsed_us(Clock::time_point start) {
+  return std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() -
+                                                               start)
+      .count();
+}
+
+// the state shared by the threads of a run.
+struct Workload {
+  objstore::ObjectStore *store;
+  std::shared_ptr<objstore::Executor> executor;  // nullptr if in_flight is 1
+  objstore::Metrics metrics;
+
+  SizeDistribution sizes;
+  std::unique_ptr<ZipfGenerator> keys;
+  std::discrete_distribution<int> mix;
+  size_t range_size{0};
+  // the size of every key, or -1 once it is deleted. a guess while puts and
+  // deletes of the key race, which is enough to aim the reads.
+  std::vector<std::atomic<int64_t>> object_sizes;
+  // a body of the largest size, puts send a prefix of it.
+  std::string body;
+
+  std::atomic<bool> stop{false};
+
+  explicit Workload(size_t num_keys) : object_sizes(num_keys) {
+    for (auto &size : object_sizes) {
+      size.store(-1, std::memory_order_relaxed);
+    }
+  }
+};
+
+// a thread of the workload, which keeps up to in_flight requests going.
+class Worker {
+ public:
+  Worker(Workload &workload, uint64_t seed)
+      : workload_(workload), rng_(seed) {}
+
+  void run() {
+    while (!workload_.stop.load(std::memory_order_relaxed)) {
+      if (workload_.executor == nullptr) {
+        draw()();
+        continue;
+      }
+      {
+        std::unique_lock<std::mutex> lock(mutex_);
+        done_cv_.wait(lock, [&]() { return in_flight_ < FLAGS_in_flight; });
+        ++in_flight_;
+      }
+      // draw the request here, the rng belongs to this thread.
+      auto request = draw();
+      workload_.executor->submit([this, request]() {
+        request();
+        const std::lock_guard<std::mutex> _(mutex_);
+        --in_flight_;
+        done_cv_.notify_all();
+      });
+    }
+    std::unique_lock<std::mutex> lock(mutex_);
+    done_cv_.wait(lock, [&]() { return in_flight_ == 0; });
+  }
+
+ private:
+  // pick the next request, which records itself when run.
+  std::function<void()> draw() {
+    const Op op = static_cast<Op>(workload_.mix(rng_));
+    uint64_t index = workload_.keys->next(rng_);
+    Workload &w = workload_;
+    switch (op) {
+      case Op::kGet: {
+        if (FLAGS_read_pattern == "sequential") {
+          // read the current object range by range, then pick another.
+          if (cursor_key_ < 0 ||
+              cursor_off_ >= static_cast<size_t>(std::max<int64_t>(
+                                 w.object_sizes[cursor_key_].load(), 0))) {
+            cursor_key_ = static_cast<int64_t>(index);
+            cursor_off_ = 0;
+          }
+          index = cursor_key_;
+          const size_t off = cursor_off_;
+          cursor_off_ += w.range_size;
+          return [&w, index, off]() { get_range(w, index, off); };
+        } else if (FLAGS_read_pattern == "random") {
+          const int64_t size = w.object_sizes[index].load();
+          const size_t ranges =
+              size > 0 ? (size + w.range_size - 1) / w.range_size : 1;
+          const size_t off =
+              std::uniform_int_distribution<size_t>(0, ranges - 1)(rng_) *
+              w.range_size;
+          return [&w, index, off]() { get_range(w, index, off); };
+        }
+        return [&w, index]() {
+          std::string body;
+          const Clock::time_point start = Clock::now();
+          objstore::Status status =
+              w.store->get_object(FLAGS_bucket, key_of(index), body);
+          w.metrics.record(MetricsOp::kGet, elapsed_us(start), body.size(),
+                           status);
+        };
+      }
+      case Op::kPut: {
+        const size_t size = w.sizes.next(rng_);
+        return [&w, index, size]() {
+          const Clock::time_point start = Clock::now();
+          objstore::Status status = w.store->put_object(
+              FLAGS_bucket, key_of(index), std::string_view(w.body).substr(
+                                               0, size));
+          if (status.is_succ()) {
+            w.object_sizes[index].store(static_cast<int64_t>(size));
+          }
+          w.metrics.record(MetricsOp::kPut, elapsed_us(start), size, status);
+        };
+      }
+      case Op::kHead:
+        return [&w, index]() {
+          objstore::ObjectMeta meta;
+          const Clock::time_point start = Clock::now();
+          objstore::Status status =
+              w.store->get_object_meta(FLAGS_bucket, key_of(index), meta);
+          w.metrics.record(MetricsOp::kHead, elapsed_us(start), 0, status);
+        };
+      case Op::kList:
+        // the first page of the keys, continuation tokens are opaque.
+        return [&w]() {
+          std::vector<objstore::ObjectMeta> objects;
+          std::string next_token;
+          const Clock::time_point start = Clock::now();
+          objstore::Status status = w.store->list_object(
+              FLAGS_bucket, FLAGS_key_prefix, "", FLAGS_list_page_size,
+              objects, next_token);
+          w.metrics.record(MetricsOp::kList, elapsed_us(start), 0, status);
+        };
+      case Op::kDelete:
+        return [&w, index]() {
+          const Clock::time_point start = Clock::now();
+          objstore::Status status =
+              w.store->delete_object(FLAGS_bucket, key_of(index));
+          if (status.is_succ()) {
+            w.object_sizes[index].store(-1);
+          }
+          w.metrics.record(MetricsOp::kDelete, elapsed_us(start), 0, status);
+        };
+      case Op::kNumOps:
+        break;
+    }
+    return []() {};
+  }
+
+  static void get_range(Workload &w, uint64_t index, size_t off) {
+    std::string body;
+    const Clock::time_point start = Clock::now();
+    objstore::Status status = w.store->get_object(
+        FLAGS_bucket, key_of(index), off, w.range_size, body);
+    w.metrics.record(MetricsOp::kGetRange, elapsed_us(start), body.size(),
+                     status);
+  }
+
+ private:
+  Workload &workload_;
+  std::mt19937_64 rng_;
+  // the object and offset of the sequential reads.
+  int64_t cursor_key_{-1};
+  size_t cursor_off_{0};
+
+  std::mutex mutex_;
+  std::condition_variable done_cv_;
+  size_t in_flight_{0};
+};
+
+bool parse_mix(const std::string &spec, std::vector<double> &weights) {
+  weights.assign(static_cast<size_t>(Op::kNumOps), 0);
+  for (const std::string &entry : split(spec, ',')) {
+    const std::vector<std::string> parts = split(entry, ':');
+    if (parts.size() != 2) {
+      return false;
+    }
+    const auto name = std::find(std::begin(kOpNames), std::end(kOpNames),
+                                parts[0]);
+    char *end = nullptr;
+    const double weight = strtod(parts[1].c_str(), &end);
+    if (name == std::end(kOpNames) || *end != '\0' || weight < 0) {
+      return false;
+    }
+    weights[name - std::begin(kOpNames)] = weight;
+  }
+  return std::any_of(weights.begin(), weights.end(),
+                     [](double weight) { return weight > 0; });
+}
+
+objstore::ObjectStore *create_obj_store() {
+  std::string_view endpoint = FLAGS_endpoint;
+  objstore::ObjectStoreOptions options;
+  options.max_retries = FLAGS_max_retries;
+  options.max_connections = FLAGS_max_connections;
+  options.cache_memory_bytes = FLAGS_cache_memory_bytes;
+  return objstore::create_object_store(
+      FLAGS_provider, FLAGS_region, endpoint.size() == 0 ? nullptr : &endpoint,
+      FLAGS_use_https, options);
+}
+
+// run fn(i) for i in [0, n) on threads threads.
+void run_parallel(size_t n, size_t threads,
+                  const std::function<void(size_t)> &fn) {
+  std::atomic<size_t> next{0};
+  std::vector<std::thread> workers;
+  for (size_t t = 0; t < threads; ++t) {
+    workers.emplace_back([&]() {
+      for (size_t i = next++; i < n; i = next++) {
+        fn(i);
+      }
+    });
+  }
+  for (auto &worker : workers) {
+    worker.join();
+  }
+}
+
+void print_report(const objstore::ObjectStoreMetrics &metrics,
+                  double seconds) {
+  printf("%-10s %10s %10s %10s %8s %10s %10s %10s\n", "op", "requests",
+         "req/s", "MiB/s", "errors", "p50(us)", "p99(us)", "p999(us)");
+  uint64_t total = 0;
+  uint64_t total_bytes = 0;
+  for (const objstore::OperationMetrics &op : metrics.operations) {
+    printf("%-10s %10llu %10.0f %10.2f %8llu %10llu %10llu %10llu\n",
+           op.op.c_str(), static_cast<unsigned long long>(op.count),
+           op.count / seconds, op.bytes / seconds / (1024 * 1024),
+           static_cast<unsigned long long>(op.errors),
+           static_cast<unsigned long long>(op.latency.percentile(0.5)),
+           static_cast<unsigned long long>(op.latency.percentile(0.99)),
+           static_cast<unsigned long long>(op.latency.percentile(0.999)));
+    for (const auto &[code, count] : op.error_codes) {
+      printf("%-10s   error %d: %llu\n", "", code,
+             static_cast<unsigned long long>(count));
+    }
+    total += op.count;
+    total_bytes += op.bytes;
+  }
+  printf("%-10s %10llu %10.0f %10.2f\n", "total",
+         static_cast<unsigned long long>(total), total / seconds,
+         total_bytes / seconds / (1024 * 1024));
+}
+
+}  // anonymous namespace
+
+int main(int argc, char **argv) {
+  gflags::ParseCommandLineFlags(&argc, &argv, true);
+
+  if (FLAGS_keys == 0 || FLAGS_threads == 0 || FLAGS_in_flight == 0 ||
+      FLAGS_zipf_theta < 0 || FLAGS_zipf_theta >= 1) {
+    fprintf(stderr, "keys, threads and in_flight must be positive and "
+                    "zipf_theta in [0, 1)\n");
+    return 1;
+  }
+  auto workload = std::make_unique<Workload>(FLAGS_keys);
+  std::vector<double> weights;
+  if (!workload->sizes.parse(FLAGS_sizes)) {
+    fprintf(stderr, "bad --sizes: %s\n", FLAGS_sizes.c_str());
+    return 1;
+  } else if (!parse_mix(FLAGS_mix, weights)) {
+    fprintf(stderr, "bad --mix: %s\n", FLAGS_mix.c_str());
+    return 1;
+  } else if (!parse_size(FLAGS_range_size, workload->range_size) ||
+             workload->range_size == 0) {
+    fprintf(stderr, "bad --range_size: %s\n", FLAGS_range_size.c_str());
+    return 1;
+  } else if (FLAGS_read_pattern != "whole" &&
+             FLAGS_read_pattern != "random" &&
+             FLAGS_read_pattern != "sequential") {
+    fprintf(stderr, "bad --read_pattern: %s\n", FLAGS_read_pattern.c_str());
+    return 1;
+  }
+  workload->mix = std::discrete_distribution<int>(weights.begin(),
+                                                  weights.end());
+  workload->keys =
+      std::make_unique<ZipfGenerator>(FLAGS_keys, FLAGS_zipf_theta);
+  workload->body.assign(workload->sizes.max(), 'x');
+
+  std::unique_ptr<objstore::ObjectStore> store(create_obj_store());
+  if (store == nullptr) {
+    fprintf(stderr, "fail to create the object store\n");
+    return 1;
+  }
+  store->create_bucket(FLAGS_bucket);
+  workload->store = store.get();
+  const size_t concurrency = FLAGS_threads * FLAGS_in_flight;
+  if (FLAGS_in_flight > 1) {
+    workload->executor =
+        objstore::create_thread_pool_executor(concurrency, concurrency);
+  }
+
+  if (FLAGS_preload) {
+    std::mt19937_64 rng(FLAGS_seed);
+    std::vector<size_t> sizes(FLAGS_keys);
+    for (size_t &size : sizes) {
+      size = workload->sizes.next(rng);
+    }
+    const Clock::time_point start = Clock::now();
+    run_parallel(FLAGS_keys, concurrency, [&](size_t i) {
+      objstore::Status status = store->put_object(
+          FLAGS_bucket, key_of(i),
+          std::string_view(workload->body).substr(0, sizes[i]));
+      if (status.is_succ()) {
+        workload->object_sizes[i].store(static_cast<int64_t>(sizes[i]));
+      }
+    });
+    printf("preloaded %llu keys in %.1fs\n",
+           static_cast<unsigned long long>(FLAGS_keys),
+           elapsed_us(start) / 1e6);
+  }
+
+  std::vector<std::unique_ptr<Worker>> workers;
+  std::vector<std::thread> threads;
+  for (size_t i = 0; i < FLAGS_threads; ++i) {
+    workers.push_back(std::make_unique<Worker>(*workload, FLAGS_seed + i + 1));
+  }
+  const Clock::time_point start = Clock::now();
+  for (auto &worker : workers) {
+    threads.emplace_back([&worker]() { worker->run(); });
+  }
+  std::this_thread::sleep_for(std::chrono::seconds(FLAGS_duration_s));
+  workload->stop = true;
+  for (auto &thread : threads) {
+    thread.join();
+  }
+  const double seconds = elapsed_us(start) / 1e6;
+
+  objstore::ObjectStoreMetrics metrics;
+  workload->metrics.snapshot(metrics);
+  printf("%s: %llu threads x %llu in flight, %.1fs, keys %llu, theta %.2f, "
+         "sizes %s, mix %s, reads %s\n",
+         FLAGS_provider.c_str(), static_cast<unsigned long long>(FLAGS_threads),
+         static_cast<unsigned long long>(FLAGS_in_flight), seconds,
+         static_cast<unsigned long long>(FLAGS_keys), FLAGS_zipf_theta,
+         FLAGS_sizes.c_str(), FLAGS_mix.c_str(), FLAGS_read_pattern.c_str());
+  print_report(metrics, seconds);
+
+  workload->executor.reset();
+  if (FLAGS_cleanup) {
+    std::vector<std::string> keys;
+    std::vector<objstore::Status> results;
+    for (size_t i = 0; i < FLAGS_keys; ++i) {
+      keys.push_back(key_of(i));
+      if (keys.size() == 1000 || i + 1 == FLAGS_keys) {
+        store->delete_objects(FLAGS_bucket, keys, results);
+        keys.clear();
+      }
+    }
+  }
+  return 0;
+}
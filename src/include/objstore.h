@@ -2,6 +2,11 @@
 #define OBJSTORE_OBJSTORE_H_INCLUDED
 
 #include <cstdint>
+#include <functional>
+#include <future>
+#include <map>
+#include <memory>
+#include <mutex>
 #include <string>
 #include <string_view>
 #include <vector>
@@ -36,8 +41,256 @@ struct ObjectMeta {
   std::string key;
   int64_t last_modified; // timestamp in milliseconds since epoch.
   long long size;        // body size
+  std::string etag;      // changes whenever the object is overwritten
 };
 
+// the bytes [off, off + len) of an object.
+struct Range {
+  size_t off;
+  size_t len;
+};
+
+// a read-only object body held by shared_ptr, whose memory stays valid as
+// long as the buffer does. it may map the object file instead of holding a
+// copy of it.
+class ObjectBuffer {
+ public:
+  virtual ~ObjectBuffer() = default;
+
+  virtual const char *data() const = 0;
+  virtual size_t size() const = 0;
+  std::string_view view() const { return std::string_view(data(), size()); }
+};
+
+// how an ObjectBuffer will be read, a hint for the page cache of a mapping.
+enum class AccessPattern {
+  kNormal,
+  kSequential,
+  kRandom,
+  kWillNeed,  // read soon, start reading ahead now
+};
+
+// how the writes of the local object store survive a crash. objects are
+// always written to a temporary file renamed into place, so readers and
+// crashes never see a half-written object whatever the durability.
+enum class Durability {
+  kNone,         // left to the page cache, a crash may lose recent writes
+  kPerObject,    // every put syncs its object before returning
+  kGroupCommit,  // a background flusher syncs the puts waiting for it at once
+};
+
+// the codec compressing the object bodies at rest.
+enum class Compression {
+  kNone,
+  kZstd,
+  kLz4,
+};
+
+// tunables of an object store, the defaults suit most workloads.
+struct ObjectStoreOptions {
+  // objects larger than this are uploaded by multipart upload, whose parts
+  // are sent in parallel.
+  size_t multipart_threshold = 64 * 1024 * 1024;
+  // size of each uploaded part and downloaded range. s3 requires at least
+  // 5MiB for a part but the last one, and the part size is enlarged if an
+  // object would need more than 10000 parts.
+  size_t part_size = 16 * 1024 * 1024;
+  // max number of parts or ranges of one object transferred in parallel,
+  // which also bounds the memory of a download to the file.
+  size_t max_parallel_parts = 8;
+
+  // durability of the writes of the local object store.
+  Durability local_durability = Durability::kNone;
+
+  // read-through cache, enabled if either tier is. objects are cached by
+  // blocks of cache_block_size bytes, in memory up to cache_memory_bytes and
+  // on the local disk under cache_disk_path up to cache_disk_bytes. the disk
+  // tier is laid out like the local object store and survives restarts.
+  size_t cache_memory_bytes = 0;
+  std::string cache_disk_path;
+  size_t cache_disk_bytes = 0;
+  size_t cache_block_size = 1024 * 1024;
+  // a cached object is trusted for this long after its etag was validated by
+  // get_object_meta(). writes through the same object store invalidate the
+  // cache at once, this only bounds how stale the writes of others can be.
+  // the ranged gets of compressed objects trust their chunk index alike.
+  uint64_t cache_validate_interval_ms = 5000;
+
+  // share one request between the concurrent gets of the same object, or of
+  // the same range of it, and between the concurrent get_object_meta() of
+  // the same object, e.g. when many threads open a new file at once. the
+  // gets into an ObjectBuffer share the body read without copying it.
+  // nothing is kept once the request completes. a read starting after a
+  // write through the same store never shares a request started before it,
+  // though it may share one started before a write of others.
+  bool coalesce_reads = false;
+
+  // retries of the requests failed by transient errors: throttling, 5xx and
+  // network failures. the n-th retry waits a random time up to
+  // min(retry_max_delay_ms, retry_base_delay_ms * 2^n). retries are also
+  // bounded by a budget: every request earns retry_budget_ratio token,
+  // every retry or hedged request spends one, and at most
+  // retry_budget_tokens are saved, so a failing service sees little extra
+  // load. with no retries and no hedging, s3 keeps the retries of the sdk.
+  size_t max_retries = 3;
+  uint64_t retry_base_delay_ms = 20;
+  uint64_t retry_max_delay_ms = 1000;
+  double retry_budget_ratio = 0.1;
+  size_t retry_budget_tokens = 10;
+  // hedge the gets into strings and get_object_meta(): a request slower
+  // than the p95 latency of the recent ones, and than hedge_min_delay_ms, is
+  // sent again and the first success is taken.
+  bool hedge_reads = false;
+  uint64_t hedge_min_delay_ms = 10;
+
+  // http client of s3. max_connections bounds the requests in flight, which
+  // should cover the parallelism of the callers, parts and async threads.
+  size_t max_connections = 64;
+  uint64_t connect_timeout_ms = 1000;
+  uint64_t request_timeout_ms = 3000;
+  bool tcp_keep_alive = true;
+  uint64_t tcp_keep_alive_interval_ms = 30000;
+  // compress the bodies of the requests supporting it from this size on.
+  bool request_compression = true;
+  size_t request_compression_min_bytes = 10240;
+  // "curl", "winhttp" or "wininet", empty for the default of the platform.
+  std::string http_client;
+  // share one client, and so its connection pool, with the other stores
+  // created with the same settings, whatever their buckets. a store alone
+  // owns its client otherwise.
+  bool share_s3_client = false;
+
+  // record the requests sent to the provider, see ObjectStore::get_metrics().
+  bool enable_metrics = false;
+
+  // end-to-end crc32c of the object bodies. s3 sends it with every put and
+  // part, which the service checks, and the local store keeps it in an xattr
+  // of the object file. the whole-object gets check the body against it and
+  // fail by EBADMSG on a mismatch. ranged gets can't be checked, the crc
+  // covers the whole object, nor can the objects uploaded by parts to s3,
+  // whose checksum covers those of their parts. a local store on a file
+  // system without user xattrs keeps no checksum, which its
+  // checksums_available() tells.
+  bool enable_checksums = false;
+
+  // compress the object bodies before they are stored. an object is cut into
+  // chunks of compression_chunk_size bytes compressed one by one, so a ranged
+  // get fetches and decompresses only the chunks it covers. objects smaller
+  // than compression_min_bytes are stored as they are, as are the objects put
+  // at once which do not shrink, and the objects not compressed read as they
+  // are stored. a compressed object records its codec, so any store with
+  // compression reads it. compression_level is that of the codec, 0 for its
+  // default: 1 to 19 for zstd, whose negative levels are faster, and 1 to 12
+  // for lz4, the levels above 1 being lz4hc.
+  //
+  // the sizes differ by interface: get_object_meta() and open_object_reader()
+  // report the size of the body, but list_object() reports the size of the
+  // stored object, compressed or not. finding the body size of a listed
+  // object would take a read of its footer. size buffers and readers by
+  // get_object_meta(), never by a listing.
+  Compression compression = Compression::kNone;
+  int compression_level = 0;
+  size_t compression_min_bytes = 4096;
+  size_t compression_chunk_size = 256 * 1024;
+};
+
+// a latency distribution recorded into log-linear buckets like an hdr
+// histogram: every power of two is split into 8 buckets, so a percentile is
+// within 1/8 of the recorded latency.
+struct LatencyHistogram {
+  // the inclusive upper bound in microseconds and the count of the
+  // non-empty buckets, in order.
+  std::vector<std::pair<uint64_t, uint64_t>> buckets;
+  uint64_t count = 0;
+  uint64_t sum_us = 0;
+
+  // the upper bound of the bucket holding the p-th quantile, p in [0, 1], or
+  // 0 if nothing was recorded.
+  uint64_t percentile(double p) const;
+};
+
+// the requests of one operation, e.g. "get_range" or "head".
+struct OperationMetrics {
+  std::string op;
+  uint64_t count = 0;
+  uint64_t bytes = 0;  // put or got
+  uint64_t errors = 0;
+  // the failures by Status::error_code(). a thread tracks a few codes per
+  // operation, the rarer ones are only counted in errors.
+  std::map<int, uint64_t> error_codes;
+  LatencyHistogram latency;
+  // the time to the first byte of the body of every get sent by s3.
+  LatencyHistogram ttfb;
+};
+
+struct ObjectStoreMetrics {
+  // the operations done at least once.
+  std::vector<OperationMetrics> operations;
+
+  // the metrics in the prometheus text exposition format, named prefix_*.
+  std::string to_prometheus(const std::string_view &prefix = "objstore") const;
+};
+
+// an object written incrementally, see ObjectStore::open_object_writer().
+// nothing is visible under the key until close() succeeds. a writer which is
+// destroyed without being closed is aborted.
+class ObjectWriter {
+ public:
+  virtual ~ObjectWriter() = default;
+
+  // append data to the object, which may be uploaded before close(). after a
+  // failure the writer is aborted and every further call fails.
+  virtual Status write(const std::string_view &data) = 0;
+  // finish the object and make it visible.
+  virtual Status close() = 0;
+  // discard what was written, the key is left untouched.
+  virtual void abort() = 0;
+};
+
+// an object read in bounded chunks, see ObjectStore::open_object_reader().
+class ObjectReader {
+ public:
+  virtual ~ObjectReader() = default;
+
+  // read up to len bytes at the current position into buf and advance past
+  // them. read_len is less than len only at the end of the object, where it
+  // is 0.
+  virtual Status read(char *buf, size_t len, size_t &read_len) = 0;
+  // move the current position to off, at most size(). a seek out of the
+  // read-ahead window cancels the chunks fetched ahead, and the reads after
+  // it are not read ahead until they turn out to be sequential again.
+  virtual Status seek(size_t off) = 0;
+  // size of the object when the reader was opened.
+  virtual size_t size() const = 0;
+};
+
+// how an ObjectReader fetches the object.
+struct ObjectReaderOptions {
+  // bytes fetched by one ranged get.
+  size_t chunk_size = 8 * 1024 * 1024;
+  // chunks fetched ahead of the one being read while the reads are
+  // sequential. the window starts at read_ahead and adapts to the fetch
+  // latency and the read throughput up to max_read_ahead, which bounds the
+  // memory of the reader to (max_read_ahead + 1) * chunk_size.
+  size_t read_ahead = 2;
+  size_t max_read_ahead = 8;
+};
+
+// runs the tasks of the asynchronous interfaces of ObjectStore.
+class Executor {
+ public:
+  virtual ~Executor() = default;
+
+  // run task in background. an executor with a bounded queue blocks the
+  // caller while the queue is full, which gives backpressure to producers.
+  virtual void submit(std::function<void()> task) = 0;
+};
+
+// create a pool of num_threads threads whose queue holds at most
+// max_queue_depth pending tasks.
+std::shared_ptr<Executor> create_thread_pool_executor(size_t num_threads,
+                                                      size_t max_queue_depth);
+
 class ObjectStore {
  public:
   virtual ~ObjectStore() = default;
@@ -61,16 +314,139 @@ class ObjectStore {
   virtual Status get_object(const std::string_view &bucket,
                             const std::string_view &key, size_t off, size_t len,
                             std::string &body) = 0;
+  // read the object straight into the caller-provided buffer of buf_size
+  // bytes. body_size is set to the object size, ENOBUFS is returned if the
+  // buffer is too small to hold it.
+  virtual Status get_object(const std::string_view &bucket,
+                            const std::string_view &key, char *buf,
+                            size_t buf_size, size_t &body_size) = 0;
+  // read the range [off, off + len) straight into buf, which holds at least
+  // len bytes. read_len is less than len if the object ends before off + len.
+  virtual Status get_object(const std::string_view &bucket,
+                            const std::string_view &key, size_t off, size_t len,
+                            char *buf, size_t &read_len) = 0;
+  // read the object, or the range [off, off + len) of it, into a buffer. the
+  // local object store maps the object file without copying it, advised by
+  // access. the default reads the body into a string.
+  virtual Status get_object_buffer(const std::string_view &bucket,
+                                   const std::string_view &key,
+                                   AccessPattern access,
+                                   std::shared_ptr<const ObjectBuffer> &buffer);
+  virtual Status get_object_buffer(const std::string_view &bucket,
+                                   const std::string_view &key, size_t off,
+                                   size_t len, AccessPattern access,
+                                   std::shared_ptr<const ObjectBuffer> &buffer);
+  // read many ranges of one object, bodies[i] is set to the bytes of
+  // ranges[i], cut short if the object ends before. ranges no more than
+  // max_gap bytes apart, e.g. kDefaultRangeGap, are coalesced into one read
+  // and the reads are issued in parallel.
+  virtual Status get_ranges(const std::string_view &bucket,
+                            const std::string_view &key,
+                            const std::vector<Range> &ranges, size_t max_gap,
+                            std::vector<std::string> &bodies);
   virtual Status get_object_meta(const std::string_view &bucket,
                                  const std::string_view &key,
                                  ObjectMeta &meta) = 0;
+  // write an object incrementally without holding it in memory: s3 uploads
+  // it by multipart upload part by part, the local object store appends to
+  // a temporary file renamed into place on close().
+  virtual Status open_object_writer(const std::string_view &bucket,
+                                    const std::string_view &key,
+                                    std::unique_ptr<ObjectWriter> &writer) = 0;
+  // read an object in chunks, which are fetched ahead of sequential reads.
+  // the default issues ranged gets on the executor of this object store,
+  // which must outlive the reader.
+  virtual Status open_object_reader(const std::string_view &bucket,
+                                    const std::string_view &key,
+                                    const ObjectReaderOptions &options,
+                                    std::unique_ptr<ObjectReader> &reader);
+  // whether open_object_reader() returns a reader of this store's own rather
+  // than the default one, e.g. one reading a local file. the stores wrapping
+  // another hand the readers on to it only then.
+  virtual bool has_native_reader() const { return false; }
 
   virtual Status list_object(const std::string_view &bucket,
                              const std::string_view &prefix,
                              std::vector<ObjectMeta> &objects) = 0;
+  // list one page of at most max_keys objects in key order. pass an empty
+  // continuation_token for the first page, then the next_continuation_token
+  // of the previous page, which is set empty after the last page. s3 caps a
+  // page at 1000 keys.
+  virtual Status list_object(const std::string_view &bucket,
+                             const std::string_view &prefix,
+                             const std::string_view &continuation_token,
+                             size_t max_keys, std::vector<ObjectMeta> &objects,
+                             std::string &next_continuation_token) = 0;
+  // list the objects and the common prefixes right under prefix: the keys
+  // containing delimiter after prefix are rolled up into one common prefix,
+  // which ends at that delimiter, like the sub-directories of a directory.
+  virtual Status list_object(const std::string_view &bucket,
+                             const std::string_view &prefix,
+                             const std::string_view &delimiter,
+                             std::vector<ObjectMeta> &objects,
+                             std::vector<std::string> &common_prefixes) = 0;
+  // list objects page by page, on_batch is called with every page as it
+  // arrives and may stop the listing by returning false. memory is bounded by
+  // one page, however many objects the bucket holds.
+  Status list_object_stream(
+      const std::string_view &bucket, const std::string_view &prefix,
+      size_t batch_size,
+      const std::function<bool(std::vector<ObjectMeta> &batch)> &on_batch);
 
   virtual Status delete_object(const std::string_view &bucket,
                                const std::string_view &key) = 0;
+  // delete a batch of objects, results[i] is the result of keys[i] and the
+  // first failure is returned. deleting a non-existing key succeeds. the
+  // default deletes the keys one by one.
+  virtual Status delete_objects(const std::string_view &bucket,
+                                const std::vector<std::string> &keys,
+                                std::vector<Status> &results);
+
+  // asynchronous interfaces, which run the synchronous ones above on the
+  // executor of this object store. bucket, key and prefix are copied, but the
+  // output parameters must stay valid until the returned future is ready, and
+  // the object store must outlive all the pending futures.
+  // put_object_async() owns its data, move the buffer in to avoid a copy.
+  std::future<Status> put_object_async(const std::string_view &bucket,
+                                       const std::string_view &key,
+                                       std::string data);
+  std::future<Status> get_object_async(const std::string_view &bucket,
+                                       const std::string_view &key,
+                                       std::string &body);
+  std::future<Status> get_object_async(const std::string_view &bucket,
+                                       const std::string_view &key, size_t off,
+                                       size_t len, std::string &body);
+  std::future<Status> get_object_meta_async(const std::string_view &bucket,
+                                            const std::string_view &key,
+                                            ObjectMeta &meta);
+  std::future<Status> list_object_async(const std::string_view &bucket,
+                                        const std::string_view &prefix,
+                                        std::vector<ObjectMeta> &objects);
+  std::future<Status> delete_object_async(const std::string_view &bucket,
+                                          const std::string_view &key);
+
+  // the metrics of the requests sent to the provider so far. returns
+  // ENOTSUP unless the store was created with enable_metrics.
+  virtual Status get_metrics(ObjectStoreMetrics &metrics);
+
+  // replace the executor of the asynchronous interfaces, by default a thread
+  // pool of kDefaultAsyncThreads threads is created on the first use.
+  void set_executor(std::shared_ptr<Executor> executor);
+
+  // reading a gap of this size costs about as much as one more request.
+  static constexpr size_t kDefaultRangeGap = 64 * 1024;
+  static constexpr size_t kDefaultAsyncThreads = 16;
+  static constexpr size_t kDefaultAsyncQueueDepth = 1024;
+
+ protected:
+  friend class PrefetchingObjectReader;
+
+  // run fn on the executor of this object store.
+  std::future<Status> run_async(std::function<Status()> fn);
+
+ private:
+  std::mutex executor_mutex_;
+  std::shared_ptr<Executor> executor_;
 };
 
 // create ObjectStore based credentials in credentials dir or environment
@@ -79,9 +455,43 @@ ObjectStore *create_object_store(const std::string_view &provider,
                                  const std::string_view region,
                                  const std::string_view *endpoint,
                                  bool use_https = true);
+ObjectStore *create_object_store(const std::string_view &provider,
+                                 const std::string_view region,
+                                 const std::string_view *endpoint,
+                                 bool use_https,
+                                 const ObjectStoreOptions &options);
 
 void destroy_object_store(ObjectStore *obj_store);
 
+// how the local object store copied files in put_object_from_file() and
+// get_object_to_file(), counted over the process. each copy takes the first
+// way the file systems support, in this order.
+struct LocalCopyStats {
+  uint64_t reflink = 0;          // FICLONE, shares the extents, copies nothing
+  uint64_t copy_file_range = 0;  // copied in the kernel, maybe offloaded
+  uint64_t sendfile = 0;         // copied in the kernel
+  uint64_t userspace = 0;        // read and written through a buffer
+};
+
+LocalCopyStats get_local_copy_stats();
+
+// the scratch buffers and pooled bodies of the object stores, and the aws
+// sdk when installed as its memory manager, see objstore_aws.h, come from a
+// process-wide pool of size-classed buffers cached per thread. it is enabled
+// by default, a disabled pool allocates from malloc.
+void enable_buffer_pool(bool enable);
+
+// how the buffers of the pool were allocated, counted over the process.
+struct BufferPoolStats {
+  uint64_t allocations = 0;
+  uint64_t thread_cache_hits = 0;  // reused from the cache of the thread
+  uint64_t shared_hits = 0;        // reused from the lists of all threads
+  uint64_t misses = 0;             // pooled size, but none was free
+  uint64_t unpooled = 0;           // too large or the pool is disabled
+};
+
+BufferPoolStats get_buffer_pool_stats();
+
 }  // namespace objstore
 
 #endif  // OBJSTORE_OBJSTORE_H_INCLUDED
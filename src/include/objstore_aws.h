@@ -0,0 +1,28 @@
+#ifndef OBJSTORE_OBJSTORE_AWS_H_INCLUDED
+#define OBJSTORE_OBJSTORE_AWS_H_INCLUDED
+
+#include <aws/core/Aws.h>
+#include <aws/core/utils/memory/MemorySystemInterface.h>
+
+namespace objstore {
+
+// the aws sdk is initialized by Aws::InitAPI() when the first s3 object store
+// is created and shut down by Aws::ShutdownAPI() once the last one is
+// destroyed, so programs using the local object store only never pay for it.
+
+// set the options the sdk is initialized with, e.g. the log level, a custom
+// memory manager or the crypto and http factories. returns false, keeping
+// the current options, if the sdk is initialized already.
+bool set_aws_sdk_options(const Aws::SDKOptions &options);
+
+// a memory manager allocating from the buffer pool of the object stores, see
+// enable_buffer_pool(), to be set as the memoryManagementOptions.memoryManager
+// of the sdk options. the sdk only calls it if it is built with
+// -DCUSTOM_MEMORY_MANAGEMENT=ON, which the bundled one is not: the flag makes
+// Aws::String a string of another allocator, which this library does not
+// build against.
+Aws::Utils::Memory::MemorySystemInterface *get_buffer_pool_memory_manager();
+
+}  // namespace objstore
+
+#endif  // OBJSTORE_OBJSTORE_AWS_H_INCLUDED
@@ -0,0 +1,221 @@
+#include "buffer_pool.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <new>
+
+namespace objstore {
+
+namespace {
+
+// precedes every buffer. the class of a pooled buffer, or kNumClasses and
+// the address malloc returned for an unpooled one.
+struct alignas(16) BlockHeader {
+  void *base;
+  size_t size_class;
+};
+static_assert(sizeof(BlockHeader) == 16, "the header keeps 16B alignment");
+
+constexpr size_t kHeaderSize = sizeof(BlockHeader);
+// the free buffers a thread caches, in bytes per class.
+constexpr size_t kThreadCacheBytes = 256 * 1024;
+constexpr size_t kMaxThreadCacheBlocks = 64;
+// the free buffers shared by all threads, in bytes per class.
+constexpr size_t kSharedBytes = 16 * 1024 * 1024;
+constexpr size_t kMaxSharedBlocks = 1024;
+// a thread folds its counters into the stats every this many allocations.
+constexpr uint64_t kStatsInterval = 256;
+
+BlockHeader *header_of(void *ptr) {
+  return reinterpret_cast<BlockHeader *>(static_cast<char *>(ptr) -
+                                         kHeaderSize);
+}
+
+// a free buffer links to the next one by its first bytes.
+void *&next_of(void *ptr) { return *static_cast<void **>(ptr); }
+
+// set once the cache of the thread is destroyed, a trivially destructible
+// thread_local so that it is still valid in the destructors running later.
+thread_local bool t_cache_destroyed = false;
+
+}  // anonymous namespace
+
+struct BufferPool::ThreadCache {
+  void *heads[kNumClasses] = {};
+  size_t counts[kNumClasses] = {};
+  BufferPoolStats stats;
+
+  ~ThreadCache() {
+    BufferPool &pool = BufferPool::instance();
+    for (size_t c = 0; c < kNumClasses; ++c) {
+      while (heads[c] != nullptr) {
+        void *ptr = heads[c];
+        heads[c] = next_of(ptr);
+        if (!pool.push_shared(c, ptr)) {
+          std::free(header_of(ptr));
+        }
+      }
+    }
+    pool.add_stats(stats);
+    t_cache_destroyed = true;
+  }
+};
+
+BufferPool &BufferPool::instance() {
+  // leaked on purpose, see the header.
+  static BufferPool *pool = new BufferPool();
+  return *pool;
+}
+
+size_t BufferPool::size_class(size_t size) {
+  if (size > kMaxBlockSize) {
+    return kNumClasses;
+  }
+  size_t c = 0;
+  while (block_size(c) < size) {
+    ++c;
+  }
+  return c;
+}
+
+size_t BufferPool::thread_cache_limit(size_t size_class) {
+  return std::clamp<size_t>(kThreadCacheBytes / block_size(size_class), 1,
+                            kMaxThreadCacheBlocks);
+}
+
+size_t BufferPool::shared_limit(size_t size_class) {
+  return std::clamp<size_t>(kSharedBytes / block_size(size_class), 4,
+                            kMaxSharedBlocks);
+}
+
+BufferPool::ThreadCache *BufferPool::thread_cache() {
+  if (t_cache_destroyed) {
+    return nullptr;
+  }
+  thread_local ThreadCache cache;
+  return &cache;
+}
+
+void *BufferPool::allocate(size_t size, size_t alignment) {
+  ThreadCache *cache = thread_cache();
+  BufferPoolStats local;
+  BufferPoolStats &stats = cache != nullptr ? cache->stats : local;
+  ++stats.allocations;
+
+  const size_t c = size_class(size);
+  void *ptr = nullptr;
+  if (c < kNumClasses && alignment <= kHeaderSize && enabled()) {
+    if (cache != nullptr && cache->heads[c] != nullptr) {
+      ptr = cache->heads[c];
+      cache->heads[c] = next_of(ptr);
+      --cache->counts[c];
+      ++stats.thread_cache_hits;
+    } else if ((ptr = pop_shared(c)) != nullptr) {
+      ++stats.shared_hits;
+    } else {
+      void *base = std::malloc(kHeaderSize + block_size(c));
+      if (base == nullptr) {
+        throw std::bad_alloc();
+      }
+      new (base) BlockHeader{base, c};
+      ptr = static_cast<char *>(base) + kHeaderSize;
+      ++stats.misses;
+    }
+  } else {
+    alignment = std::max(alignment, kHeaderSize);
+    void *base = std::malloc(kHeaderSize + size + alignment - 1);
+    if (base == nullptr) {
+      throw std::bad_alloc();
+    }
+    const uintptr_t addr = reinterpret_cast<uintptr_t>(base) + kHeaderSize;
+    ptr = reinterpret_cast<void *>((addr + alignment - 1) & ~(alignment - 1));
+    new (header_of(ptr)) BlockHeader{base, kNumClasses};
+    ++stats.unpooled;
+  }
+
+  if (cache == nullptr) {
+    add_stats(local);
+  } else if (stats.allocations >= kStatsInterval) {
+    add_stats(stats);
+    stats = BufferPoolStats();
+  }
+  return ptr;
+}
+
+void BufferPool::release(void *ptr) {
+  if (ptr == nullptr) {
+    return;
+  }
+  BlockHeader *header = header_of(ptr);
+  const size_t c = header->size_class;
+  if (c >= kNumClasses) {
+    std::free(header->base);
+    return;
+  }
+  ThreadCache *cache = thread_cache();
+  if (cache != nullptr && cache->counts[c] < thread_cache_limit(c)) {
+    next_of(ptr) = cache->heads[c];
+    cache->heads[c] = ptr;
+    ++cache->counts[c];
+  } else if (!push_shared(c, ptr)) {
+    std::free(header);
+  }
+}
+
+void *BufferPool::pop_shared(size_t size_class) {
+  SharedList &list = shared_[size_class];
+  const std::lock_guard<std::mutex> _(list.mutex);
+  void *ptr = list.head;
+  if (ptr != nullptr) {
+    list.head = next_of(ptr);
+    --list.count;
+  }
+  return ptr;
+}
+
+bool BufferPool::push_shared(size_t size_class, void *ptr) {
+  SharedList &list = shared_[size_class];
+  const std::lock_guard<std::mutex> _(list.mutex);
+  if (list.count >= shared_limit(size_class)) {
+    return false;
+  }
+  next_of(ptr) = list.head;
+  list.head = ptr;
+  ++list.count;
+  return true;
+}
+
+void BufferPool::add_stats(const BufferPoolStats &stats) {
+  allocations_.fetch_add(stats.allocations, std::memory_order_relaxed);
+  thread_cache_hits_.fetch_add(stats.thread_cache_hits,
+                               std::memory_order_relaxed);
+  shared_hits_.fetch_add(stats.shared_hits, std::memory_order_relaxed);
+  misses_.fetch_add(stats.misses, std::memory_order_relaxed);
+  unpooled_.fetch_add(stats.unpooled, std::memory_order_relaxed);
+}
+
+BufferPoolStats BufferPool::stats() {
+  // the counters of the calling thread are always up to date.
+  ThreadCache *cache = thread_cache();
+  if (cache != nullptr) {
+    add_stats(cache->stats);
+    cache->stats = BufferPoolStats();
+  }
+  BufferPoolStats stats;
+  stats.allocations = allocations_.load(std::memory_order_relaxed);
+  stats.thread_cache_hits = thread_cache_hits_.load(std::memory_order_relaxed);
+  stats.shared_hits = shared_hits_.load(std::memory_order_relaxed);
+  stats.misses = misses_.load(std::memory_order_relaxed);
+  stats.unpooled = unpooled_.load(std::memory_order_relaxed);
+  return stats;
+}
+
+void enable_buffer_pool(bool enable) {
+  BufferPool::instance().set_enabled(enable);
+}
+
+BufferPoolStats get_buffer_pool_stats() {
+  return BufferPool::instance().stats();
+}
+
+}  // namespace objstore
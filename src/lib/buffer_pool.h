@@ -0,0 +1,132 @@
+#ifndef MY_OBJSTORE_BUFFER_POOL_H_INCLUDED
+#define MY_OBJSTORE_BUFFER_POOL_H_INCLUDED
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+
+#include "objstore.h"
+
+namespace objstore {
+
+// a process-wide pool of buffers in power-of-two size classes. each thread
+// caches a few free buffers of every class and serves itself without
+// locking, the buffers overflowing its cache go to lists shared by all
+// threads. larger or over-aligned buffers come from malloc.
+//
+// every buffer is preceded by a small header, so release() needs no size
+// and a buffer may be released by another thread than the one allocating
+// it, as the memory manager of the aws sdk does.
+class BufferPool {
+ public:
+  static constexpr size_t kMinBlockSize = 64;
+  static constexpr size_t kMaxBlockSize = 1024 * 1024;
+  static constexpr size_t kNumClasses = 15;  // 64B, 128B, ..., 1MiB
+
+  // the pool is never destroyed, so buffers may be released while the
+  // process exits.
+  static BufferPool &instance();
+
+  // never returns nullptr for size 0. alignment is a power of two.
+  void *allocate(size_t size, size_t alignment = alignof(std::max_align_t));
+  void release(void *ptr);
+
+  // when disabled, new buffers come from malloc, the pooled ones already
+  // allocated are still released into the pool.
+  void set_enabled(bool enabled) {
+    enabled_.store(enabled, std::memory_order_relaxed);
+  }
+  bool enabled() const { return enabled_.load(std::memory_order_relaxed); }
+
+  // the counters of the other threads are folded in every so often, so the
+  // stats may lag their recent allocations a little.
+  BufferPoolStats stats();
+
+ private:
+  struct ThreadCache;
+
+  BufferPool() = default;
+
+  // the class of a buffer of size bytes, kNumClasses if it is too large.
+  static size_t size_class(size_t size);
+  static size_t block_size(size_t size_class) {
+    return kMinBlockSize << size_class;
+  }
+  // the free buffers of a class a thread keeps at most.
+  static size_t thread_cache_limit(size_t size_class);
+  static size_t shared_limit(size_t size_class);
+
+  // the cache of the calling thread, nullptr once it is destroyed.
+  static ThreadCache *thread_cache();
+
+  // take a free buffer of the class from the shared lists, nullptr if none.
+  void *pop_shared(size_t size_class);
+  // false if the shared list of the class is full.
+  bool push_shared(size_t size_class, void *ptr);
+
+  void add_stats(const BufferPoolStats &stats);
+
+ private:
+  struct SharedList {
+    std::mutex mutex;
+    void *head{nullptr};
+    size_t count{0};
+  };
+
+  std::atomic<bool> enabled_{true};
+  SharedList shared_[kNumClasses];
+
+  std::atomic<uint64_t> allocations_{0};
+  std::atomic<uint64_t> thread_cache_hits_{0};
+  std::atomic<uint64_t> shared_hits_{0};
+  std::atomic<uint64_t> misses_{0};
+  std::atomic<uint64_t> unpooled_{0};
+};
+
+// a buffer of the pool released when it goes out of scope.
+class PooledBuffer {
+ public:
+  PooledBuffer() = default;
+  explicit PooledBuffer(size_t size)
+      : data_(static_cast<char *>(BufferPool::instance().allocate(size))),
+        size_(size) {}
+  ~PooledBuffer() { reset(); }
+
+  PooledBuffer(PooledBuffer &&other) noexcept
+      : data_(other.data_), size_(other.size_) {
+    other.data_ = nullptr;
+    other.size_ = 0;
+  }
+  PooledBuffer &operator=(PooledBuffer &&other) noexcept {
+    if (this != &other) {
+      reset();
+      data_ = other.data_;
+      size_ = other.size_;
+      other.data_ = nullptr;
+      other.size_ = 0;
+    }
+    return *this;
+  }
+  PooledBuffer(const PooledBuffer &) = delete;
+  PooledBuffer &operator=(const PooledBuffer &) = delete;
+
+  char *data() const { return data_; }
+  size_t size() const { return size_; }
+
+  void reset() {
+    if (data_ != nullptr) {
+      BufferPool::instance().release(data_);
+      data_ = nullptr;
+      size_ = 0;
+    }
+  }
+
+ private:
+  char *data_{nullptr};
+  size_t size_{0};
+};
+
+}  // namespace objstore
+
+#endif  // MY_OBJSTORE_BUFFER_POOL_H_INCLUDED
@@ -0,0 +1,536 @@
+#include "cache.h"
+
+#include <errno.h>
+
+#include <algorithm>
+#include <cstring>
+#include <filesystem>
+#include <functional>
+#include <utility>
+
+#include "local.h"
+
+namespace fs = std::filesystem;
+
+namespace objstore {
+
+namespace {
+
+// bucket names never contain '\0', so it separates the parts of cache keys.
+std::string object_id(const std::string_view &bucket,
+                      const std::string_view &key) {
+  std::string id(bucket);
+  id.push_back('\0');
+  id.append(key);
+  return id;
+}
+
+// what tells the versions of an object apart, the etag if the store has one.
+std::string object_version(const ObjectMeta &meta) {
+  if (!meta.etag.empty()) {
+    return meta.etag;
+  }
+  return std::to_string(meta.last_modified) + "-" + std::to_string(meta.size);
+}
+
+std::string block_id(const std::string_view &bucket,
+                     const std::string_view &key, const ObjectMeta &meta,
+                     size_t index) {
+  std::string id = object_id(bucket, key);
+  id.push_back('\0');
+  id.append(object_version(meta));
+  id.push_back('\0');
+  id.append(std::to_string(index));
+  return id;
+}
+
+// the key of a block on the disk tier. the ".cache" suffix keeps the blocks
+// of key out of the way of the objects whose keys start with key + "/".
+std::string disk_block_key(const std::string_view &key, const ObjectMeta &meta,
+                           size_t index) {
+  return std::string(key) + ".cache/" + object_version(meta) + "/" +
+         std::to_string(index);
+}
+
+// a writer of the underlying store, which invalidates the object once its
+// new version is visible.
+class InvalidatingObjectWriter : public ObjectWriter {
+ public:
+  InvalidatingObjectWriter(std::unique_ptr<ObjectWriter> base,
+                           std::function<void()> invalidate)
+      : base_(std::move(base)), invalidate_(std::move(invalidate)) {}
+
+  Status write(const std::string_view &data) override {
+    return base_->write(data);
+  }
+  Status close() override {
+    Status status = base_->close();
+    invalidate_();
+    return status;
+  }
+  void abort() override { base_->abort(); }
+
+ private:
+  std::unique_ptr<ObjectWriter> base_;
+  std::function<void()> invalidate_;
+};
+
+}  // anonymous namespace
+
+CachingObjectStore::CachingObjectStore(ObjectStore *base, ObjectStore *disk,
+                                       const ObjectStoreOptions &options)
+    : base_(base),
+      disk_(disk),
+      options_(options),
+      metas_(kMaxCachedMetas),
+      memory_blocks_(options.cache_memory_bytes),
+      disk_blocks_(disk != nullptr ? options.cache_disk_bytes : 0) {
+  options_.cache_block_size = std::max<size_t>(options_.cache_block_size, 1);
+}
+
+void CachingObjectStore::recover_disk_blocks() {
+  if (disk_ == nullptr) {
+    return;
+  }
+
+  std::vector<std::pair<std::string, ObjectMeta>> blocks;
+  std::error_code errcode;
+  fs::directory_iterator it(options_.cache_disk_path, errcode);
+  for (; !errcode && it != fs::directory_iterator(); it.increment(errcode)) {
+    std::error_code type_errcode;
+    if (!it->is_directory(type_errcode)) {
+      continue;
+    }
+    const std::string bucket = it->path().filename().native();
+    std::vector<ObjectMeta> objects;
+    if (!disk_->list_object(bucket, "", objects).is_succ()) {
+      continue;
+    }
+    for (auto &object : objects) {
+      blocks.emplace_back(bucket, std::move(object));
+    }
+  }
+
+  std::sort(blocks.begin(), blocks.end(), [](const auto &a, const auto &b) {
+    return a.second.last_modified < b.second.last_modified;
+  });
+  std::vector<std::string> evicted;
+  for (auto &[bucket, meta] : blocks) {
+    disk_blocks_.put(object_id(bucket, meta.key), true, meta.size, &evicted);
+  }
+  for (auto &entry : evicted) {
+    const size_t sep = entry.find('\0');
+    disk_->delete_object(entry.substr(0, sep), entry.substr(sep + 1));
+  }
+}
+
+Status CachingObjectStore::create_bucket(const std::string_view &bucket) {
+  return base_->create_bucket(bucket);
+}
+
+Status CachingObjectStore::delete_bucket(const std::string_view &bucket) {
+  Status status = base_->delete_bucket(bucket);
+  invalidate_all();
+  return status;
+}
+
+Status CachingObjectStore::put_object_from_file(
+    const std::string_view &bucket, const std::string_view &key,
+    const std::string_view &data_file_path) {
+  Status status = base_->put_object_from_file(bucket, key, data_file_path);
+  invalidate(bucket, key);
+  return status;
+}
+
+Status CachingObjectStore::get_object_to_file(
+    const std::string_view &bucket, const std::string_view &key,
+    const std::string_view &output_file_path) {
+  // whole files are downloaded in parallel ranges, caching them does not pay.
+  return base_->get_object_to_file(bucket, key, output_file_path);
+}
+
+Status CachingObjectStore::put_object(const std::string_view &bucket,
+                                      const std::string_view &key,
+                                      const std::string_view &data) {
+  Status status = base_->put_object(bucket, key, data);
+  invalidate(bucket, key);
+  return status;
+}
+
+Status CachingObjectStore::open_object_writer(
+    const std::string_view &bucket, const std::string_view &key,
+    std::unique_ptr<ObjectWriter> &writer) {
+  std::unique_ptr<ObjectWriter> base_writer;
+  Status status = base_->open_object_writer(bucket, key, base_writer);
+  if (status.is_succ()) {
+    writer = std::make_unique<InvalidatingObjectWriter>(
+        std::move(base_writer),
+        [this, bucket = std::string(bucket), key = std::string(key)]() {
+          invalidate(bucket, key);
+        });
+  }
+  return status;
+}
+
+Status CachingObjectStore::get_object(const std::string_view &bucket,
+                                      const std::string_view &key,
+                                      std::string &body) {
+  ObjectMeta meta;
+  Status status = lookup_meta(bucket, key, meta);
+  if (!status.is_succ()) {
+    return status;
+  }
+  // an object larger than the whole cache would only flush it.
+  const size_t size = static_cast<size_t>(meta.size);
+  if (size > std::max(options_.cache_memory_bytes,
+                      disk_ != nullptr ? options_.cache_disk_bytes : 0)) {
+    return base_->get_object(bucket, key, body);
+  }
+
+  body.resize(size);
+  status = read_blocks(bucket, key, meta, 0, size, body.data());
+  if (!status.is_succ()) {
+    body.clear();
+  }
+  return status;
+}
+
+Status CachingObjectStore::get_object(const std::string_view &bucket,
+                                      const std::string_view &key, size_t off,
+                                      size_t len, std::string &body) {
+  ObjectMeta meta;
+  Status status = lookup_meta(bucket, key, meta);
+  if (!status.is_succ()) {
+    return status;
+  }
+  // let the underlying store report an out of range read its own way.
+  const size_t size = static_cast<size_t>(meta.size);
+  if (off >= size) {
+    return base_->get_object(bucket, key, off, len, body);
+  }
+
+  len = std::min(len, size - off);
+  body.resize(len);
+  status = read_blocks(bucket, key, meta, off, len, body.data());
+  if (!status.is_succ()) {
+    body.clear();
+  }
+  return status;
+}
+
+Status CachingObjectStore::get_object(const std::string_view &bucket,
+                                      const std::string_view &key, char *buf,
+                                      size_t buf_size, size_t &body_size) {
+  ObjectMeta meta;
+  Status status = lookup_meta(bucket, key, meta);
+  if (!status.is_succ()) {
+    return status;
+  }
+  body_size = static_cast<size_t>(meta.size);
+  if (body_size > buf_size) {
+    return Status(ENOBUFS, "buffer too small to hold the object");
+  }
+  return read_blocks(bucket, key, meta, 0, body_size, buf);
+}
+
+Status CachingObjectStore::get_object(const std::string_view &bucket,
+                                      const std::string_view &key, size_t off,
+                                      size_t len, char *buf,
+                                      size_t &read_len) {
+  read_len = 0;
+  ObjectMeta meta;
+  Status status = lookup_meta(bucket, key, meta);
+  if (!status.is_succ()) {
+    return status;
+  }
+  const size_t size = static_cast<size_t>(meta.size);
+  if (off >= size) {
+    return base_->get_object(bucket, key, off, len, buf, read_len);
+  }
+
+  len = std::min(len, size - off);
+  status = read_blocks(bucket, key, meta, off, len, buf);
+  if (status.is_succ()) {
+    read_len = len;
+  }
+  return status;
+}
+
+Status CachingObjectStore::get_object_meta(const std::string_view &bucket,
+                                           const std::string_view &key,
+                                           ObjectMeta &meta) {
+  return lookup_meta(bucket, key, meta);
+}
+
+Status CachingObjectStore::list_object(const std::string_view &bucket,
+                                       const std::string_view &prefix,
+                                       std::vector<ObjectMeta> &objects) {
+  return base_->list_object(bucket, prefix, objects);
+}
+
+Status CachingObjectStore::list_object(
+    const std::string_view &bucket, const std::string_view &prefix,
+    const std::string_view &continuation_token, size_t max_keys,
+    std::vector<ObjectMeta> &objects, std::string &next_continuation_token) {
+  return base_->list_object(bucket, prefix, continuation_token, max_keys,
+                            objects, next_continuation_token);
+}
+
+Status CachingObjectStore::list_object(
+    const std::string_view &bucket, const std::string_view &prefix,
+    const std::string_view &delimiter, std::vector<ObjectMeta> &objects,
+    std::vector<std::string> &common_prefixes) {
+  return base_->list_object(bucket, prefix, delimiter, objects,
+                            common_prefixes);
+}
+
+Status CachingObjectStore::delete_object(const std::string_view &bucket,
+                                         const std::string_view &key) {
+  Status status = base_->delete_object(bucket, key);
+  invalidate(bucket, key);
+  return status;
+}
+
+Status CachingObjectStore::delete_objects(const std::string_view &bucket,
+                                          const std::vector<std::string> &keys,
+                                          std::vector<Status> &results) {
+  Status status = base_->delete_objects(bucket, keys, results);
+  for (auto &key : keys) {
+    invalidate(bucket, key);
+  }
+  return status;
+}
+
+Status CachingObjectStore::get_metrics(ObjectStoreMetrics &metrics) {
+  return base_->get_metrics(metrics);
+}
+
+Status CachingObjectStore::lookup_meta(const std::string_view &bucket,
+                                       const std::string_view &key,
+                                       ObjectMeta &meta) {
+  const std::string id = object_id(bucket, key);
+  std::shared_ptr<const CachedMeta> cached;
+  if (metas_.get(id, cached) &&
+      std::chrono::steady_clock::now() - cached->validated <
+          std::chrono::milliseconds(options_.cache_validate_interval_ms)) {
+    meta = cached->meta;
+    return Status();
+  }
+
+  // a read starting after a write must not join a validation started before
+  // it, so the flights are told apart by the write sequence too.
+  uint64_t seq = 0;
+  {
+    const std::lock_guard<std::mutex> _(write_mutex_);
+    seq = write_seq_;
+  }
+  Status status = meta_flight_.run(
+      id + '\0' + std::to_string(seq), cached,
+      [&](std::shared_ptr<const CachedMeta> &fetched) {
+        auto fresh = std::make_shared<CachedMeta>();
+        Status st = base_->get_object_meta(bucket, key, fresh->meta);
+        if (!st.is_succ()) {
+          return st;
+        }
+        fresh->validated = std::chrono::steady_clock::now();
+        fetched = fresh;
+
+        const std::lock_guard<std::mutex> _(write_mutex_);
+        if (write_seq_ == seq) {
+          metas_.put(id, fetched, 1);
+        }
+        return Status();
+      });
+  if (!status.is_succ()) {
+    return status;
+  }
+  meta = cached->meta;
+  return Status();
+}
+
+Status CachingObjectStore::read_blocks(const std::string_view &bucket,
+                                       const std::string_view &key,
+                                       const ObjectMeta &meta, size_t off,
+                                       size_t len, char *buf) {
+  const size_t block_size = options_.cache_block_size;
+  const size_t end = off + len;
+  // copy the part of the index-th block within [off, end) into buf.
+  auto copy = [&](size_t index, const std::string &data) {
+    const size_t block_off = index * block_size;
+    const size_t from = std::max(off, block_off);
+    const size_t to = std::min(end, block_off + data.size());
+    memcpy(buf + (from - off), data.data() + (from - block_off), to - from);
+  };
+
+  const size_t end_index = (end + block_size - 1) / block_size;
+  for (size_t index = off / block_size; index < end_index;) {
+    // the blocks in a row cached on neither tier are fetched by one get, so
+    // a cold read costs a request rather than one per block.
+    size_t missing = 0;
+    while (index + missing < end_index &&
+           !is_cached(bucket, key, meta, index + missing)) {
+      ++missing;
+    }
+    if (missing > 1) {
+      std::vector<Block> blocks;
+      Status status = fetch_blocks(bucket, key, meta, index, missing, blocks);
+      if (!status.is_succ()) {
+        return status;
+      }
+      for (auto &block : blocks) {
+        copy(index++, *block);
+      }
+      continue;
+    }
+
+    Block block;
+    Status status = get_block(bucket, key, meta, index, block);
+    if (!status.is_succ()) {
+      return status;
+    }
+    copy(index++, *block);
+  }
+  return Status();
+}
+
+bool CachingObjectStore::is_cached(const std::string_view &bucket,
+                                   const std::string_view &key,
+                                   const ObjectMeta &meta, size_t index) {
+  Block block;
+  if (memory_blocks_.get(block_id(bucket, key, meta, index), block)) {
+    return true;
+  }
+  bool on_disk = false;
+  return disk_ != nullptr &&
+         disk_blocks_.get(object_id(bucket, disk_block_key(key, meta, index)),
+                          on_disk);
+}
+
+Status CachingObjectStore::fetch_blocks(const std::string_view &bucket,
+                                        const std::string_view &key,
+                                        const ObjectMeta &meta, size_t first,
+                                        size_t count,
+                                        std::vector<Block> &blocks) {
+  const size_t block_size = options_.cache_block_size;
+  const size_t off = first * block_size;
+  const size_t len =
+      std::min(count * block_size, static_cast<size_t>(meta.size) - off);
+  std::string body;
+  Status status = base_->get_object(bucket, key, off, len, body);
+  if (!status.is_succ()) {
+    return status;
+  }
+  if (body.size() != len) {
+    invalidate(bucket, key);
+    return Status(EIO, "object changed while being read");
+  }
+
+  blocks.clear();
+  for (size_t pos = 0; pos < len; pos += block_size) {
+    const size_t index = first + pos / block_size;
+    auto data = std::make_shared<std::string>(body, pos, block_size);
+    const std::string id = block_id(bucket, key, meta, index);
+    memory_blocks_.put(id, data, data->size() + id.size());
+    if (disk_ != nullptr) {
+      put_disk_block(bucket, disk_block_key(key, meta, index), *data);
+    }
+    blocks.push_back(std::move(data));
+  }
+  return Status();
+}
+
+Status CachingObjectStore::get_block(const std::string_view &bucket,
+                                     const std::string_view &key,
+                                     const ObjectMeta &meta, size_t index,
+                                     Block &block) {
+  const std::string id = block_id(bucket, key, meta, index);
+  if (memory_blocks_.get(id, block)) {
+    return Status();
+  }
+
+  return block_flight_.run(id, block, [&](Block &fetched) {
+    const size_t block_size = options_.cache_block_size;
+    const size_t off = index * block_size;
+    const size_t len =
+        std::min(block_size, static_cast<size_t>(meta.size) - off);
+    auto data = std::make_shared<std::string>();
+
+    std::string disk_key;
+    if (disk_ != nullptr) {
+      disk_key = disk_block_key(key, meta, index);
+      bool on_disk = false;
+      if (disk_blocks_.get(object_id(bucket, disk_key), on_disk) &&
+          disk_->get_object(bucket, disk_key, *data).is_succ() &&
+          data->size() == len) {
+        memory_blocks_.put(id, data, data->size() + id.size());
+        fetched = std::move(data);
+        return Status();
+      }
+    }
+
+    Status status = base_->get_object(bucket, key, off, len, *data);
+    if (!status.is_succ()) {
+      return status;
+    }
+    if (data->size() != len) {
+      invalidate(bucket, key);
+      return Status(EIO, "object changed while being read");
+    }
+    memory_blocks_.put(id, data, data->size() + id.size());
+    if (disk_ != nullptr) {
+      put_disk_block(bucket, disk_key, *data);
+    }
+    fetched = std::move(data);
+    return Status();
+  });
+}
+
+void CachingObjectStore::put_disk_block(const std::string_view &bucket,
+                                        const std::string &disk_key,
+                                        const std::string &data) {
+  if (data.size() > options_.cache_disk_bytes ||
+      !disk_->put_object(bucket, disk_key, data).is_succ()) {
+    return;
+  }
+  std::vector<std::string> evicted;
+  disk_blocks_.put(object_id(bucket, disk_key), true, data.size(), &evicted);
+  for (auto &entry : evicted) {
+    const size_t sep = entry.find('\0');
+    disk_->delete_object(entry.substr(0, sep), entry.substr(sep + 1));
+  }
+}
+
+void CachingObjectStore::invalidate(const std::string_view &bucket,
+                                    const std::string_view &key) {
+  const std::lock_guard<std::mutex> _(write_mutex_);
+  ++write_seq_;
+  metas_.erase(object_id(bucket, key));
+}
+
+void CachingObjectStore::invalidate_all() {
+  const std::lock_guard<std::mutex> _(write_mutex_);
+  ++write_seq_;
+  metas_.clear();
+}
+
+ObjectStore *create_caching_objstore(ObjectStore *base,
+                                     const ObjectStoreOptions &options) {
+  if (base == nullptr) {
+    return nullptr;
+  }
+
+  ObjectStore *disk = nullptr;
+  if (!options.cache_disk_path.empty()) {
+    disk = create_local_objstore(options.cache_disk_path, nullptr, false);
+    if (disk == nullptr) {
+      delete base;
+      return nullptr;
+    }
+  }
+
+  auto *cache = new CachingObjectStore(base, disk, options);
+  cache->recover_disk_blocks();
+  return cache;
+}
+
+}  // namespace objstore
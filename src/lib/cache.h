@@ -0,0 +1,147 @@
+#ifndef MY_OBJSTORE_CACHE_H_INCLUDED
+#define MY_OBJSTORE_CACHE_H_INCLUDED
+
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "lru_cache.h"
+#include "objstore.h"
+#include "single_flight.h"
+
+namespace objstore {
+
+// a read-through cache in front of another object store. reads are served by
+// fixed-size blocks, which are looked up in memory, then on the local disk,
+// and are fetched from the underlying store by ranged gets on a miss. the
+// missing blocks in a row are fetched by one get, and the concurrent misses
+// of a single block share one fetch.
+//
+// blocks are keyed by the etag of their object, which is validated at most
+// every cache_validate_interval_ms, so the blocks of an overwritten object
+// are never served again and simply age out. an object overwritten by others
+// while its blocks are being fetched may be read mixed from both versions
+// until the next validation, so the cache suits objects which are written
+// once, like sst files.
+class CachingObjectStore : public ObjectStore {
+ public:
+  // takes the ownership of base. disk is the disk tier, nullptr for none.
+  CachingObjectStore(ObjectStore *base, ObjectStore *disk,
+                     const ObjectStoreOptions &options);
+  virtual ~CachingObjectStore() = default;
+
+  Status create_bucket(const std::string_view &bucket) override;
+
+  Status delete_bucket(const std::string_view &bucket) override;
+
+  Status put_object_from_file(const std::string_view &bucket,
+                              const std::string_view &key,
+                              const std::string_view &data_file_path) override;
+  Status get_object_to_file(const std::string_view &bucket,
+                            const std::string_view &key,
+                            const std::string_view &output_file_path) override;
+
+  Status put_object(const std::string_view &bucket, const std::string_view &key,
+                    const std::string_view &data) override;
+  Status open_object_writer(const std::string_view &bucket,
+                            const std::string_view &key,
+                            std::unique_ptr<ObjectWriter> &writer) override;
+  Status get_object(const std::string_view &bucket, const std::string_view &key,
+                    std::string &body) override;
+  Status get_object(const std::string_view &bucket, const std::string_view &key,
+                    size_t off, size_t len, std::string &body) override;
+  Status get_object(const std::string_view &bucket, const std::string_view &key,
+                    char *buf, size_t buf_size, size_t &body_size) override;
+  Status get_object(const std::string_view &bucket, const std::string_view &key,
+                    size_t off, size_t len, char *buf,
+                    size_t &read_len) override;
+  Status get_object_meta(const std::string_view &bucket,
+                         const std::string_view &key,
+                         ObjectMeta &meta) override;
+
+  Status list_object(const std::string_view &bucket,
+                     const std::string_view &prefix,
+                     std::vector<ObjectMeta> &objects) override;
+  Status list_object(const std::string_view &bucket,
+                     const std::string_view &prefix,
+                     const std::string_view &continuation_token,
+                     size_t max_keys, std::vector<ObjectMeta> &objects,
+                     std::string &next_continuation_token) override;
+  Status list_object(const std::string_view &bucket,
+                     const std::string_view &prefix,
+                     const std::string_view &delimiter,
+                     std::vector<ObjectMeta> &objects,
+                     std::vector<std::string> &common_prefixes) override;
+
+  Status delete_object(const std::string_view &bucket,
+                       const std::string_view &key) override;
+  Status delete_objects(const std::string_view &bucket,
+                        const std::vector<std::string> &keys,
+                        std::vector<Status> &results) override;
+
+  Status get_metrics(ObjectStoreMetrics &metrics) override;
+
+  // index the blocks left on the disk tier by a previous run, the oldest
+  // ones are evicted first.
+  void recover_disk_blocks();
+
+ private:
+  struct CachedMeta {
+    ObjectMeta meta;
+    std::chrono::steady_clock::time_point validated;
+  };
+  using Block = std::shared_ptr<const std::string>;
+
+  // the meta of the object, validated within the validate interval.
+  Status lookup_meta(const std::string_view &bucket,
+                     const std::string_view &key, ObjectMeta &meta);
+  // copy [off, off + len) of the object, which must lie within meta.size,
+  // into buf block by block.
+  Status read_blocks(const std::string_view &bucket,
+                     const std::string_view &key, const ObjectMeta &meta,
+                     size_t off, size_t len, char *buf);
+  // whether the index-th block is on either tier.
+  bool is_cached(const std::string_view &bucket, const std::string_view &key,
+                 const ObjectMeta &meta, size_t index);
+  // fetch count blocks from the first-th by one ranged get and cache them.
+  Status fetch_blocks(const std::string_view &bucket,
+                      const std::string_view &key, const ObjectMeta &meta,
+                      size_t first, size_t count, std::vector<Block> &blocks);
+  Status get_block(const std::string_view &bucket, const std::string_view &key,
+                   const ObjectMeta &meta, size_t index, Block &block);
+  void put_disk_block(const std::string_view &bucket,
+                      const std::string &disk_key, const std::string &data);
+  // drop the cached meta after a write, the blocks go with the old etag.
+  void invalidate(const std::string_view &bucket, const std::string_view &key);
+  void invalidate_all();
+
+ private:
+  static constexpr size_t kMaxCachedMetas = 64 * 1024;
+
+  std::unique_ptr<ObjectStore> base_;
+  std::unique_ptr<ObjectStore> disk_;
+  ObjectStoreOptions options_;
+
+  LruCache<std::shared_ptr<const CachedMeta>> metas_;
+  // guards write_seq_, which every write bumps so that a meta fetched
+  // concurrently with a write is not cached.
+  std::mutex write_mutex_;
+  uint64_t write_seq_{0};
+  SingleFlight<std::shared_ptr<const CachedMeta>> meta_flight_;
+
+  LruCache<Block> memory_blocks_;
+  // the blocks on the disk tier, keyed by bucket + '\0' + key on the disk.
+  LruCache<bool> disk_blocks_;
+  SingleFlight<Block> block_flight_;
+};
+
+// wrap base, whose ownership is taken, into a read-through cache configured
+// by options. returns nullptr and destroys base if the disk tier fails.
+ObjectStore *create_caching_objstore(ObjectStore *base,
+                                     const ObjectStoreOptions &options);
+
+}  // namespace objstore
+
+#endif  // MY_OBJSTORE_CACHE_H_INCLUDED
@@ -0,0 +1,319 @@
+#include "coalesce.h"
+
+#include <errno.h>
+
+#include <cstring>
+#include <functional>
+#include <utility>
+
+namespace objstore {
+
+namespace {
+
+// a writer of the underlying store, which tells the store once the new
+// version of its object is visible.
+class NotifyingObjectWriter : public ObjectWriter {
+ public:
+  NotifyingObjectWriter(std::unique_ptr<ObjectWriter> base,
+                        std::function<void()> on_close)
+      : base_(std::move(base)), on_close_(std::move(on_close)) {}
+
+  Status write(const std::string_view &data) override {
+    return base_->write(data);
+  }
+  Status close() override {
+    Status status = base_->close();
+    on_close_();
+    return status;
+  }
+  void abort() override { base_->abort(); }
+
+ private:
+  std::unique_ptr<ObjectWriter> base_;
+  std::function<void()> on_close_;
+};
+
+// a copy of a body read for the callers sharing it.
+class StringObjectBuffer : public ObjectBuffer {
+ public:
+  explicit StringObjectBuffer(std::string &&body) : body_(std::move(body)) {}
+
+  const char *data() const override { return body_.data(); }
+  size_t size() const override { return body_.size(); }
+
+ private:
+  std::string body_;
+};
+
+std::shared_ptr<const ObjectBuffer> copy_buffer(const char *data,
+                                                size_t size) {
+  return std::make_shared<StringObjectBuffer>(std::string(data, size));
+}
+
+std::string object_id(const std::string_view &bucket,
+                      const std::string_view &key) {
+  std::string id(bucket);
+  id.push_back('\0');
+  id.append(key);
+  return id;
+}
+
+size_t write_slot(const std::string &id) {
+  return std::hash<std::string>()(id) % CoalescingObjectStore::kWriteSlots;
+}
+
+std::string range_id(size_t off, size_t len) {
+  return std::to_string(off) + "+" + std::to_string(len);
+}
+
+}  // anonymous namespace
+
+CoalescingObjectStore::CoalescingObjectStore(ObjectStore *base)
+    : base_(base) {}
+
+Status CoalescingObjectStore::create_bucket(const std::string_view &bucket) {
+  return base_->create_bucket(bucket);
+}
+
+Status CoalescingObjectStore::delete_bucket(const std::string_view &bucket) {
+  Status status = base_->delete_bucket(bucket);
+  invalidate_all();
+  return status;
+}
+
+Status CoalescingObjectStore::put_object_from_file(
+    const std::string_view &bucket, const std::string_view &key,
+    const std::string_view &data_file_path) {
+  Status status = base_->put_object_from_file(bucket, key, data_file_path);
+  invalidate(bucket, key);
+  return status;
+}
+
+Status CoalescingObjectStore::get_object_to_file(
+    const std::string_view &bucket, const std::string_view &key,
+    const std::string_view &output_file_path) {
+  // every caller needs a file of its own.
+  return base_->get_object_to_file(bucket, key, output_file_path);
+}
+
+Status CoalescingObjectStore::put_object(const std::string_view &bucket,
+                                         const std::string_view &key,
+                                         const std::string_view &data) {
+  Status status = base_->put_object(bucket, key, data);
+  invalidate(bucket, key);
+  return status;
+}
+
+Status CoalescingObjectStore::open_object_writer(
+    const std::string_view &bucket, const std::string_view &key,
+    std::unique_ptr<ObjectWriter> &writer) {
+  std::unique_ptr<ObjectWriter> base_writer;
+  Status status = base_->open_object_writer(bucket, key, base_writer);
+  if (status.is_succ()) {
+    writer = std::make_unique<NotifyingObjectWriter>(
+        std::move(base_writer),
+        [this, bucket = std::string(bucket), key = std::string(key)]() {
+          invalidate(bucket, key);
+        });
+  }
+  return status;
+}
+
+Status CoalescingObjectStore::get_object(const std::string_view &bucket,
+                                         const std::string_view &key,
+                                         std::string &body) {
+  // the get_object() of the base checks the checksum, unlike the mapped
+  // buffers of the local store.
+  Buffer buffer;
+  Status status = body_flight_.run_shared(
+      flight_id(bucket, key, "body"), buffer,
+      [&]() { return base_->get_object(bucket, key, body); },
+      [&]() { return copy_buffer(body.data(), body.size()); });
+  if (status.is_succ() && buffer != nullptr) {
+    body.assign(buffer->data(), buffer->size());
+  }
+  return status;
+}
+
+Status CoalescingObjectStore::get_object(const std::string_view &bucket,
+                                         const std::string_view &key,
+                                         size_t off, size_t len,
+                                         std::string &body) {
+  Buffer buffer;
+  Status status = body_flight_.run_shared(
+      flight_id(bucket, key, range_id(off, len)), buffer,
+      [&]() { return base_->get_object(bucket, key, off, len, body); },
+      [&]() { return copy_buffer(body.data(), body.size()); });
+  if (status.is_succ() && buffer != nullptr) {
+    body.assign(buffer->data(), buffer->size());
+  }
+  return status;
+}
+
+Status CoalescingObjectStore::get_object(const std::string_view &bucket,
+                                         const std::string_view &key,
+                                         char *buf, size_t buf_size,
+                                         size_t &body_size) {
+  // the body may not fit buf while it fits the buffers of the others, so it
+  // is read into a buffer of its own, by the get_object() of the base.
+  Buffer buffer;
+  Status status = body_flight_.run(
+      flight_id(bucket, key, "body"), buffer, [&](Buffer &fetched) {
+        return base_->ObjectStore::get_object_buffer(
+            bucket, key, AccessPattern::kNormal, fetched);
+      });
+  if (!status.is_succ()) {
+    return status;
+  }
+  body_size = buffer->size();
+  if (body_size > buf_size) {
+    return Status(ENOBUFS, "buffer too small to hold the object");
+  }
+  memcpy(buf, buffer->data(), body_size);
+  return Status();
+}
+
+Status CoalescingObjectStore::get_object(const std::string_view &bucket,
+                                         const std::string_view &key,
+                                         size_t off, size_t len, char *buf,
+                                         size_t &read_len) {
+  Buffer buffer;
+  Status status = body_flight_.run_shared(
+      flight_id(bucket, key, range_id(off, len)), buffer,
+      [&]() { return base_->get_object(bucket, key, off, len, buf, read_len); },
+      [&]() { return copy_buffer(buf, read_len); });
+  if (status.is_succ() && buffer != nullptr) {
+    read_len = buffer->size();
+    memcpy(buf, buffer->data(), read_len);
+  }
+  return status;
+}
+
+Status CoalescingObjectStore::get_object_buffer(
+    const std::string_view &bucket, const std::string_view &key,
+    AccessPattern access, std::shared_ptr<const ObjectBuffer> &buffer) {
+  // the access hint is that of the first caller.
+  return body_flight_.run(
+      flight_id(bucket, key, "buffer"), buffer, [&](Buffer &fetched) {
+        return base_->get_object_buffer(bucket, key, access, fetched);
+      });
+}
+
+Status CoalescingObjectStore::get_object_buffer(
+    const std::string_view &bucket, const std::string_view &key, size_t off,
+    size_t len, AccessPattern access,
+    std::shared_ptr<const ObjectBuffer> &buffer) {
+  return body_flight_.run(
+      flight_id(bucket, key, range_id(off, len)), buffer,
+      [&](Buffer &fetched) {
+        return base_->get_object_buffer(bucket, key, off, len, access,
+                                        fetched);
+      });
+}
+
+Status CoalescingObjectStore::get_ranges(const std::string_view &bucket,
+                                         const std::string_view &key,
+                                         const std::vector<Range> &ranges,
+                                         size_t max_gap,
+                                         std::vector<std::string> &bodies) {
+  // the spans of the ranges hardly ever match those of another call.
+  return base_->get_ranges(bucket, key, ranges, max_gap, bodies);
+}
+
+Status CoalescingObjectStore::get_object_meta(const std::string_view &bucket,
+                                              const std::string_view &key,
+                                              ObjectMeta &meta) {
+  std::shared_ptr<const ObjectMeta> shared;
+  Status status = meta_flight_.run(
+      flight_id(bucket, key, "meta"), shared,
+      [&](std::shared_ptr<const ObjectMeta> &fetched) {
+        auto fresh = std::make_shared<ObjectMeta>();
+        Status st = base_->get_object_meta(bucket, key, *fresh);
+        fetched = std::move(fresh);
+        return st;
+      });
+  if (status.is_succ()) {
+    meta = *shared;
+  }
+  return status;
+}
+
+Status CoalescingObjectStore::list_object(const std::string_view &bucket,
+                                          const std::string_view &prefix,
+                                          std::vector<ObjectMeta> &objects) {
+  return base_->list_object(bucket, prefix, objects);
+}
+
+Status CoalescingObjectStore::list_object(
+    const std::string_view &bucket, const std::string_view &prefix,
+    const std::string_view &continuation_token, size_t max_keys,
+    std::vector<ObjectMeta> &objects, std::string &next_continuation_token) {
+  return base_->list_object(bucket, prefix, continuation_token, max_keys,
+                            objects, next_continuation_token);
+}
+
+Status CoalescingObjectStore::list_object(
+    const std::string_view &bucket, const std::string_view &prefix,
+    const std::string_view &delimiter, std::vector<ObjectMeta> &objects,
+    std::vector<std::string> &common_prefixes) {
+  return base_->list_object(bucket, prefix, delimiter, objects,
+                            common_prefixes);
+}
+
+Status CoalescingObjectStore::delete_object(const std::string_view &bucket,
+                                            const std::string_view &key) {
+  Status status = base_->delete_object(bucket, key);
+  invalidate(bucket, key);
+  return status;
+}
+
+Status CoalescingObjectStore::delete_objects(
+    const std::string_view &bucket, const std::vector<std::string> &keys,
+    std::vector<Status> &results) {
+  Status status = base_->delete_objects(bucket, keys, results);
+  for (auto &key : keys) {
+    invalidate(bucket, key);
+  }
+  return status;
+}
+
+Status CoalescingObjectStore::get_metrics(ObjectStoreMetrics &metrics) {
+  return base_->get_metrics(metrics);
+}
+
+// bucket names never contain '\0', so it separates the parts of the ids. a
+// read starting after a write of the object must not join a read started
+// before it, so the flights are told apart by the write sequence too.
+std::string CoalescingObjectStore::flight_id(const std::string_view &bucket,
+                                             const std::string_view &key,
+                                             const std::string &what) const {
+  std::string id = object_id(bucket, key);
+  const uint64_t seq =
+      write_seqs_[write_slot(id)].load(std::memory_order_acquire);
+  id.push_back('\0');
+  id.append(what);
+  id.push_back('\0');
+  id.append(std::to_string(seq));
+  return id;
+}
+
+void CoalescingObjectStore::invalidate(const std::string_view &bucket,
+                                       const std::string_view &key) {
+  write_seqs_[write_slot(object_id(bucket, key))].fetch_add(
+      1, std::memory_order_release);
+}
+
+void CoalescingObjectStore::invalidate_all() {
+  for (auto &seq : write_seqs_) {
+    seq.fetch_add(1, std::memory_order_release);
+  }
+}
+
+ObjectStore *create_coalescing_objstore(ObjectStore *base) {
+  if (base == nullptr) {
+    return nullptr;
+  }
+  return new CoalescingObjectStore(base);
+}
+
+}  // namespace objstore
@@ -0,0 +1,120 @@
+#ifndef MY_OBJSTORE_COALESCE_H_INCLUDED
+#define MY_OBJSTORE_COALESCE_H_INCLUDED
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <string>
+
+#include "objstore.h"
+#include "single_flight.h"
+
+namespace objstore {
+
+// coalesces the concurrent identical reads of another object store, see
+// ObjectStoreOptions::coalesce_reads. the gets of the same object, or of the
+// same range of it, and the get_object_meta() of the same object share one
+// request of the underlying store while it runs, and the body it read, which
+// the gets into an ObjectBuffer share without a copy. a get into memory of
+// the caller is read there, and copied for the others only if any joined it.
+// nothing is kept once the request completes, unlike CachingObjectStore.
+class CoalescingObjectStore : public ObjectStore {
+ public:
+  // takes the ownership of base.
+  explicit CoalescingObjectStore(ObjectStore *base);
+  virtual ~CoalescingObjectStore() = default;
+
+  Status create_bucket(const std::string_view &bucket) override;
+
+  Status delete_bucket(const std::string_view &bucket) override;
+
+  Status put_object_from_file(const std::string_view &bucket,
+                              const std::string_view &key,
+                              const std::string_view &data_file_path) override;
+  Status get_object_to_file(const std::string_view &bucket,
+                            const std::string_view &key,
+                            const std::string_view &output_file_path) override;
+
+  Status put_object(const std::string_view &bucket, const std::string_view &key,
+                    const std::string_view &data) override;
+  Status open_object_writer(const std::string_view &bucket,
+                            const std::string_view &key,
+                            std::unique_ptr<ObjectWriter> &writer) override;
+  Status get_object(const std::string_view &bucket, const std::string_view &key,
+                    std::string &body) override;
+  Status get_object(const std::string_view &bucket, const std::string_view &key,
+                    size_t off, size_t len, std::string &body) override;
+  Status get_object(const std::string_view &bucket, const std::string_view &key,
+                    char *buf, size_t buf_size, size_t &body_size) override;
+  Status get_object(const std::string_view &bucket, const std::string_view &key,
+                    size_t off, size_t len, char *buf,
+                    size_t &read_len) override;
+  Status get_object_buffer(
+      const std::string_view &bucket, const std::string_view &key,
+      AccessPattern access,
+      std::shared_ptr<const ObjectBuffer> &buffer) override;
+  Status get_object_buffer(
+      const std::string_view &bucket, const std::string_view &key, size_t off,
+      size_t len, AccessPattern access,
+      std::shared_ptr<const ObjectBuffer> &buffer) override;
+  Status get_ranges(const std::string_view &bucket,
+                    const std::string_view &key,
+                    const std::vector<Range> &ranges, size_t max_gap,
+                    std::vector<std::string> &bodies) override;
+  Status get_object_meta(const std::string_view &bucket,
+                         const std::string_view &key,
+                         ObjectMeta &meta) override;
+
+  Status list_object(const std::string_view &bucket,
+                     const std::string_view &prefix,
+                     std::vector<ObjectMeta> &objects) override;
+  Status list_object(const std::string_view &bucket,
+                     const std::string_view &prefix,
+                     const std::string_view &continuation_token,
+                     size_t max_keys, std::vector<ObjectMeta> &objects,
+                     std::string &next_continuation_token) override;
+  Status list_object(const std::string_view &bucket,
+                     const std::string_view &prefix,
+                     const std::string_view &delimiter,
+                     std::vector<ObjectMeta> &objects,
+                     std::vector<std::string> &common_prefixes) override;
+
+  Status delete_object(const std::string_view &bucket,
+                       const std::string_view &key) override;
+  Status delete_objects(const std::string_view &bucket,
+                        const std::vector<std::string> &keys,
+                        std::vector<Status> &results) override;
+
+  Status get_metrics(ObjectStoreMetrics &metrics) override;
+
+  // the objects share kWriteSlots write sequences by the hash of their ids,
+  // a write splits the flights of the objects of its slot only.
+  static constexpr size_t kWriteSlots = 1024;
+
+ private:
+  using Buffer = std::shared_ptr<const ObjectBuffer>;
+
+  // the flight of a read of bucket/key, told apart by what, e.g. a range.
+  std::string flight_id(const std::string_view &bucket,
+                        const std::string_view &key,
+                        const std::string &what) const;
+  void invalidate(const std::string_view &bucket, const std::string_view &key);
+  void invalidate_all();
+
+ private:
+  std::unique_ptr<ObjectStore> base_;
+  // bumped by every write once it is visible, so that a read starting after
+  // a write of its object never joins a read started before it.
+  std::array<std::atomic<uint64_t>, kWriteSlots> write_seqs_{};
+  SingleFlight<std::shared_ptr<const ObjectMeta>> meta_flight_;
+  SingleFlight<Buffer> body_flight_;
+};
+
+// wrap base, whose ownership is taken, into a store coalescing the
+// concurrent identical reads.
+ObjectStore *create_coalescing_objstore(ObjectStore *base);
+
+}  // namespace objstore
+
+#endif  // MY_OBJSTORE_COALESCE_H_INCLUDED
@@ -0,0 +1,950 @@
+#include "compress.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <lz4.h>
+#include <lz4hc.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <zstd.h>
+
+#include <algorithm>
+#include <cstring>
+#include <thread>
+#include <utility>
+
+#include "buffer_pool.h"
+#include "crc32c.h"
+#include "executor.h"
+
+namespace objstore {
+
+namespace {
+
+// chunks are at least this large, and at most so large that their stored
+// sizes leave the top bit of their index entries free.
+constexpr size_t kMinChunkSize = 4 * 1024;
+constexpr size_t kMaxChunkSize = 64 * 1024 * 1024;
+// chunks compressed by one thread at a time, which bounds the memory of the
+// compression to their outputs. fewer chunks are not worth a thread.
+constexpr size_t kChunksPerThread = 4;
+// the tail of an object read to find its frame, which holds the index of a
+// 4GiB object of 256KiB chunks.
+constexpr size_t kTailReadSize = 64 * 1024;
+
+void put_u32(char *p, uint32_t v) {
+  for (int i = 0; i < 4; ++i) {
+    p[i] = static_cast<char>(v >> (8 * i));
+  }
+}
+
+void put_u64(char *p, uint64_t v) {
+  put_u32(p, static_cast<uint32_t>(v));
+  put_u32(p + 4, static_cast<uint32_t>(v >> 32));
+}
+
+uint32_t get_u32(const char *p) {
+  uint32_t v = 0;
+  for (int i = 3; i >= 0; --i) {
+    v = (v << 8) | static_cast<uint8_t>(p[i]);
+  }
+  return v;
+}
+
+uint64_t get_u64(const char *p) {
+  return get_u32(p) | static_cast<uint64_t>(get_u32(p + 4)) << 32;
+}
+
+// bucket names never contain '\0', so it separates the parts of cache keys.
+std::string object_id(const std::string_view &bucket,
+                      const std::string_view &key) {
+  std::string id(bucket);
+  id.push_back('\0');
+  id.append(key);
+  return id;
+}
+
+// what tells the versions of an object apart, the etag if the store has one.
+std::string object_version(const ObjectMeta &meta) {
+  if (!meta.etag.empty()) {
+    return meta.etag;
+  }
+  return std::to_string(meta.last_modified) + "-" + std::to_string(meta.size);
+}
+
+// zstd contexts hold hundreds of KiB of tables, so they are reused by all the
+// threads instead of being created by every call.
+template <typename Ctx, Ctx *(*Create)(), size_t (*Free)(Ctx *)>
+class ContextPool {
+ public:
+  static Ctx *acquire() {
+    ContextPool &pool = instance();
+    {
+      const std::lock_guard<std::mutex> _(pool.mutex_);
+      if (!pool.free_.empty()) {
+        Ctx *ctx = pool.free_.back();
+        pool.free_.pop_back();
+        return ctx;
+      }
+    }
+    return Create();
+  }
+
+  static void release(Ctx *ctx) {
+    ContextPool &pool = instance();
+    {
+      const std::lock_guard<std::mutex> _(pool.mutex_);
+      if (pool.free_.size() < kMaxFree) {
+        pool.free_.push_back(ctx);
+        return;
+      }
+    }
+    Free(ctx);
+  }
+
+ private:
+  static constexpr size_t kMaxFree = 64;
+
+  // never destroyed, threads may still release contexts at exit.
+  static ContextPool &instance() {
+    static ContextPool *pool = new ContextPool();
+    return *pool;
+  }
+
+  std::mutex mutex_;
+  std::vector<Ctx *> free_;
+};
+
+using CCtxPool = ContextPool<ZSTD_CCtx, ZSTD_createCCtx, ZSTD_freeCCtx>;
+using DCtxPool = ContextPool<ZSTD_DCtx, ZSTD_createDCtx, ZSTD_freeDCtx>;
+
+size_t compress_bound(Compression codec, size_t len) {
+  if (codec == Compression::kZstd) {
+    return ZSTD_compressBound(len);
+  }
+  return LZ4_compressBound(static_cast<int>(len));
+}
+
+// compress src into dst of compress_bound() bytes, returns the compressed
+// size or 0 on failure.
+size_t compress_chunk(Compression codec, int level, const char *src,
+                      size_t len, char *dst, size_t capacity) {
+  if (codec == Compression::kZstd) {
+    ZSTD_CCtx *cctx = CCtxPool::acquire();
+    const size_t n = ZSTD_compressCCtx(cctx, dst, capacity, src, len, level);
+    CCtxPool::release(cctx);
+    return ZSTD_isError(n) ? 0 : n;
+  }
+  const int src_len = static_cast<int>(len);
+  const int dst_len = static_cast<int>(capacity);
+  const int n = level > 1 ? LZ4_compress_HC(src, dst, src_len, dst_len, level)
+                          : LZ4_compress_fast(src, dst, src_len, dst_len,
+                                              level < 0 ? -level : 1);
+  return n > 0 ? n : 0;
+}
+
+bool decompress_chunk(Compression codec, const char *src, size_t len,
+                      char *dst, size_t size) {
+  if (codec == Compression::kZstd) {
+    ZSTD_DCtx *dctx = DCtxPool::acquire();
+    const size_t n = ZSTD_decompressDCtx(dctx, dst, size, src, len);
+    DCtxPool::release(dctx);
+    return !ZSTD_isError(n) && n == size;
+  }
+  const int n = LZ4_decompress_safe(src, dst, static_cast<int>(len),
+                                    static_cast<int>(size));
+  return n >= 0 && static_cast<size_t>(n) == size;
+}
+
+void append_header(Compression codec, std::string &out) {
+  char header[CompressedFrame::kHeaderSize] = {};
+  put_u32(header, CompressedFrame::kMagic);
+  header[4] = static_cast<char>(CompressedFrame::kVersion);
+  header[5] = static_cast<char>(codec);
+  out.append(header, sizeof(header));
+}
+
+// the frame of a whole stored body, false if it is not compressed.
+bool parse_body(const std::string_view &stored, CompressedFrame &frame) {
+  size_t tail_needed = 0;
+  return stored.size() >= CompressedFrame::kHeaderSize &&
+         get_u32(stored.data()) == CompressedFrame::kMagic &&
+         static_cast<uint8_t>(stored[4]) == CompressedFrame::kVersion &&
+         frame.parse(stored, stored.size(), tail_needed) &&
+         static_cast<uint8_t>(stored[5]) ==
+             static_cast<uint8_t>(frame.codec);
+}
+
+size_t chunk_body_size(const CompressedFrame &frame, size_t i) {
+  return std::min<uint64_t>(frame.chunk_size,
+                            frame.size - i * frame.chunk_size);
+}
+
+// the threads worth working on count chunks, at most parallelism.
+size_t chunk_threads(size_t count, size_t parallelism) {
+  return std::min(parallelism,
+                  (count + kChunksPerThread - 1) / kChunksPerThread);
+}
+
+// decompress [off, off + len) of the body of frame into buf, up to
+// parallelism chunks at a time. stored holds the stored bytes of the chunks
+// covering the range.
+Status decompress_range(const CompressedFrame &frame, const char *stored,
+                        size_t off, size_t len, char *buf,
+                        size_t parallelism) {
+  const size_t end = off + len;
+  const size_t first = off / frame.chunk_size;
+  const size_t count = (end - 1) / frame.chunk_size - first + 1;
+  return parallel_run(count, chunk_threads(count, parallelism), [&](size_t j) {
+    const size_t i = first + j;
+    const uint32_t entry = frame.chunks[i];
+    const char *src = stored + (frame.offsets[i] - frame.offsets[first]);
+    const size_t src_len = entry & ~CompressedFrame::kStoredFlag;
+    const size_t chunk_off = i * frame.chunk_size;
+    const size_t chunk_len = chunk_body_size(frame, i);
+    // a chunk covered whole is decompressed in place, the partial ones at
+    // the ends of the range through a scratch buffer.
+    const bool whole = chunk_off >= off && chunk_off + chunk_len <= end;
+    PooledBuffer scratch;
+    if (!whole) {
+      scratch = PooledBuffer(chunk_len);
+    }
+    char *dst = whole ? buf + (chunk_off - off) : scratch.data();
+
+    if (entry & CompressedFrame::kStoredFlag) {
+      memcpy(dst, src, chunk_len);
+    } else if (!decompress_chunk(frame.codec, src, src_len, dst, chunk_len)) {
+      return Status(EBADMSG, "corrupt compressed chunk");
+    }
+    if (!whole) {
+      const size_t lo = std::max(off, chunk_off);
+      const size_t hi = std::min(end, chunk_off + chunk_len);
+      memcpy(buf + (lo - off), scratch.data() + (lo - chunk_off), hi - lo);
+    }
+    return Status();
+  });
+}
+
+int pwrite_full(int fd, const char *buf, size_t len, size_t off) {
+  size_t written = 0;
+  while (written < len) {
+    ssize_t ret = ::pwrite(fd, buf + written, len - written, off + written);
+    if (ret < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return errno;
+    }
+    written += ret;
+  }
+  return 0;
+}
+
+int pread_full(int fd, char *buf, size_t len, size_t off, size_t &read_len) {
+  read_len = 0;
+  while (read_len < len) {
+    ssize_t ret = ::pread(fd, buf + read_len, len - read_len, off + read_len);
+    if (ret < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return errno;
+    }
+    if (ret == 0) {
+      break;
+    }
+    read_len += ret;
+  }
+  return 0;
+}
+
+}  // anonymous namespace
+
+bool CompressedFrame::parse(const std::string_view &tail, uint64_t stored_size,
+                            size_t &tail_needed) {
+  tail_needed = 0;
+  if (tail.size() < kFooterSize || stored_size < kHeaderSize + kFooterSize) {
+    return false;
+  }
+  const char *footer = tail.data() + tail.size() - kFooterSize;
+  const uint64_t body_size = get_u64(footer);
+  const uint32_t chunk_len = get_u32(footer + 8);
+  const uint32_t count = get_u32(footer + 12);
+  const uint8_t codec_id = static_cast<uint8_t>(footer[16]);
+  if (get_u32(footer + 24) != kMagic ||
+      static_cast<uint8_t>(footer[17]) != kVersion ||
+      (codec_id != static_cast<uint8_t>(Compression::kZstd) &&
+       codec_id != static_cast<uint8_t>(Compression::kLz4)) ||
+      chunk_len == 0 || body_size == 0 ||
+      count != (body_size - 1) / chunk_len + 1) {
+    return false;
+  }
+  const uint64_t index_size = 4 * static_cast<uint64_t>(count);
+  if (kHeaderSize + index_size + kFooterSize > stored_size) {
+    return false;
+  }
+  if (index_size + kFooterSize > tail.size()) {
+    tail_needed = index_size + kFooterSize;
+    return false;
+  }
+  const char *index = footer - index_size;
+  if (crc32c(index, index_size + 20) != get_u32(footer + 20)) {
+    return false;
+  }
+
+  std::vector<uint32_t> entries(count);
+  std::vector<uint64_t> ends(count + 1);
+  ends[0] = kHeaderSize;
+  for (uint32_t i = 0; i < count; ++i) {
+    entries[i] = get_u32(index + 4 * i);
+    const uint64_t len = entries[i] & ~kStoredFlag;
+    const uint64_t raw_len =
+        std::min<uint64_t>(chunk_len, body_size - uint64_t{i} * chunk_len);
+    if ((entries[i] & kStoredFlag) && len != raw_len) {
+      return false;
+    }
+    ends[i + 1] = ends[i] + len;
+  }
+  if (ends[count] + index_size + kFooterSize != stored_size) {
+    return false;
+  }
+
+  compressed = true;
+  codec = static_cast<Compression>(codec_id);
+  size = body_size;
+  chunk_size = chunk_len;
+  chunks = std::move(entries);
+  offsets = std::move(ends);
+  return true;
+}
+
+// compresses the object as it is written by batches of chunks, compressed in
+// parallel, into a writer of the underlying store, which is opened once the
+// object reaches compression_min_bytes. a smaller object is put as it is on
+// close().
+class CompressingObjectWriter : public ObjectWriter {
+ public:
+  CompressingObjectWriter(CompressingObjectStore &store,
+                          const std::string_view &bucket,
+                          const std::string_view &key)
+      : store_(store), bucket_(bucket), key_(key) {}
+  ~CompressingObjectWriter() override { abort(); }
+
+  Status write(const std::string_view &data) override {
+    if (done_) {
+      return status_.is_succ() ? Status(EINVAL, "writer is closed") : status_;
+    }
+    pending_.append(data.data(), data.size());
+    if (base_ == nullptr &&
+        pending_.size() < store_.options_.compression_min_bytes) {
+      return Status();
+    }
+    const size_t batch_size = store_.batch_size();
+    if (base_ != nullptr && pending_.size() < batch_size) {
+      return Status();
+    }
+    Status status = upload(pending_.size() / batch_size * batch_size);
+    if (!status.is_succ()) {
+      fail(status);
+    }
+    return status;
+  }
+
+  Status close() override {
+    if (done_) {
+      return status_.is_succ() ? Status(EINVAL, "writer is closed") : status_;
+    }
+    Status status;
+    if (base_ == nullptr) {
+      status = store_.base_->put_object(bucket_, key_, pending_);
+    } else {
+      status = upload(pending_.size());
+      if (status.is_succ()) {
+        store_.append_footer(chunks_, size_, out_);
+        status = base_->write(out_);
+      }
+      if (status.is_succ()) {
+        status = base_->close();
+      }
+    }
+    store_.invalidate(bucket_, key_);
+    if (!status.is_succ()) {
+      fail(status);
+      return status;
+    }
+    done_ = true;
+    pending_.clear();
+    return Status();
+  }
+
+  void abort() override {
+    if (done_) {
+      return;
+    }
+    done_ = true;
+    if (base_ != nullptr) {
+      base_->abort();
+    }
+    pending_.clear();
+    out_.clear();
+  }
+
+ private:
+  // compress the first len bytes pending, which are whole chunks but at
+  // close(), and write them to the underlying writer.
+  Status upload(size_t len) {
+    if (base_ == nullptr) {
+      Status status = store_.base_->open_object_writer(bucket_, key_, base_);
+      if (!status.is_succ()) {
+        return status;
+      }
+      append_header(store_.options_.compression, out_);
+    }
+    store_.compress_chunks(pending_.data(), len, out_, chunks_);
+    size_ += len;
+    pending_.erase(0, len);
+    if (out_.empty()) {
+      return Status();
+    }
+    Status status = base_->write(out_);
+    out_.clear();
+    return status;
+  }
+
+  void fail(const Status &status) {
+    status_ = status;
+    abort();
+  }
+
+  CompressingObjectStore &store_;
+  const std::string bucket_;
+  const std::string key_;
+  std::unique_ptr<ObjectWriter> base_;
+  std::string pending_;  // written but not compressed yet
+  std::string out_;      // compressed but not written to base_ yet
+  std::vector<uint32_t> chunks_;
+  uint64_t size_{0};
+  bool done_{false};
+  Status status_;
+};
+
+CompressingObjectStore::CompressingObjectStore(
+    ObjectStore *base, const ObjectStoreOptions &options)
+    : base_(base),
+      options_(options),
+      chunk_size_(std::clamp(options.compression_chunk_size, kMinChunkSize,
+                             kMaxChunkSize)),
+      parallelism_(std::clamp<size_t>(std::thread::hardware_concurrency(), 1,
+                                      std::max<size_t>(
+                                          options.max_parallel_parts, 1))),
+      frames_(kMaxCachedFrameBytes) {
+  // an empty object is never compressed.
+  options_.compression_min_bytes =
+      std::max<size_t>(options_.compression_min_bytes, 1);
+}
+
+Status CompressingObjectStore::create_bucket(const std::string_view &bucket) {
+  return base_->create_bucket(bucket);
+}
+
+Status CompressingObjectStore::delete_bucket(const std::string_view &bucket) {
+  Status status = base_->delete_bucket(bucket);
+  invalidate_all();
+  return status;
+}
+
+Status CompressingObjectStore::put_object_from_file(
+    const std::string_view &bucket, const std::string_view &key,
+    const std::string_view &data_file_path) {
+  const std::string path(data_file_path);
+  struct stat st;
+  if (::stat(path.c_str(), &st) != 0 ||
+      static_cast<size_t>(st.st_size) < options_.compression_min_bytes) {
+    // the underlying store reports a missing file its own way.
+    Status status = base_->put_object_from_file(bucket, key, data_file_path);
+    invalidate(bucket, key);
+    return status;
+  }
+
+  const int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    return Status(EIO, "Error unable to open input file");
+  }
+  // the file is compressed batch by batch through a writer, which puts it
+  // by multipart upload once it is large enough.
+  CompressingObjectWriter writer(*this, bucket, key);
+  PooledBuffer buf(batch_size());
+  Status status;
+  for (size_t off = 0; status.is_succ();) {
+    size_t read_len = 0;
+    if (pread_full(fd, buf.data(), buf.size(), off, read_len) != 0) {
+      status = Status(EIO, "Error unable to read input file");
+      break;
+    }
+    if (read_len == 0) {
+      break;
+    }
+    status = writer.write(std::string_view(buf.data(), read_len));
+    off += read_len;
+  }
+  ::close(fd);
+  if (!status.is_succ()) {
+    writer.abort();
+    return status;
+  }
+  return writer.close();
+}
+
+Status CompressingObjectStore::get_object_to_file(
+    const std::string_view &bucket, const std::string_view &key,
+    const std::string_view &output_file_path) {
+  // a whole download is worth validating the frame first.
+  ObjectMeta meta;
+  Frame frame;
+  Status status = fetch_frame(bucket, key, meta, frame);
+  if (!status.is_succ()) {
+    return status;
+  }
+  if (!frame->compressed) {
+    return base_->get_object_to_file(bucket, key, output_file_path);
+  }
+
+  int fd = ::open(std::string(output_file_path).c_str(),
+                  O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if (fd < 0) {
+    return Status(EIO, "Error unable to open output file");
+  }
+
+  // fetch and decompress the object by ranges of whole chunks in parallel,
+  // every range is written at its offset of the file.
+  const size_t range_size =
+      std::max<size_t>(options_.part_size / frame->chunk_size, 1) *
+      frame->chunk_size;
+  const size_t num_ranges = (frame->size + range_size - 1) / range_size;
+  // the ranges are fetched like the parts of a base store, a thread each.
+  const size_t parallel_ranges =
+      std::max<size_t>(options_.max_parallel_parts, 1);
+  status = parallel_run(num_ranges, parallel_ranges, [&](size_t i) {
+    const size_t off = i * range_size;
+    const size_t len = std::min<uint64_t>(range_size, frame->size - off);
+    PooledBuffer buf(len);
+    Status status = read_chunks(bucket, key, *frame, off, len, buf.data(), 1);
+    if (!status.is_succ()) {
+      return status;
+    }
+    if (pwrite_full(fd, buf.data(), len, off) != 0) {
+      return Status(EIO, "unable to write key's value into file");
+    }
+    return Status();
+  });
+
+  if (::close(fd) != 0 && status.is_succ()) {
+    status = Status(EIO, "unable to write key's value into file");
+  }
+  return status;
+}
+
+Status CompressingObjectStore::put_object(const std::string_view &bucket,
+                                          const std::string_view &key,
+                                          const std::string_view &data) {
+  Status status;
+  if (data.size() < options_.compression_min_bytes) {
+    status = base_->put_object(bucket, key, data);
+  } else {
+    std::string stored;
+    std::vector<uint32_t> chunks;
+    append_header(options_.compression, stored);
+    compress_chunks(data.data(), data.size(), stored, chunks);
+    append_footer(chunks, data.size(), stored);
+    // an object which does not shrink is read faster as it is.
+    status =
+        base_->put_object(bucket, key, stored.size() < data.size() ? stored
+                                                                   : data);
+  }
+  invalidate(bucket, key);
+  return status;
+}
+
+Status CompressingObjectStore::open_object_writer(
+    const std::string_view &bucket, const std::string_view &key,
+    std::unique_ptr<ObjectWriter> &writer) {
+  writer = std::make_unique<CompressingObjectWriter>(*this, bucket, key);
+  return Status();
+}
+
+Status CompressingObjectStore::get_object(const std::string_view &bucket,
+                                          const std::string_view &key,
+                                          std::string &body) {
+  Status status = base_->get_object(bucket, key, body);
+  CompressedFrame frame;
+  if (!status.is_succ() || !parse_body(body, frame)) {
+    return status;
+  }
+
+  std::string stored;
+  stored.swap(body);
+  body.resize(frame.size);
+  status = decompress_range(frame, stored.data() + frame.offsets[0], 0,
+                            frame.size, body.data(), parallelism_);
+  if (!status.is_succ()) {
+    body.clear();
+  }
+  return status;
+}
+
+Status CompressingObjectStore::get_object(const std::string_view &bucket,
+                                          const std::string_view &key,
+                                          size_t off, size_t len,
+                                          std::string &body) {
+  Frame frame;
+  Status status = lookup_frame(bucket, key, frame);
+  if (!status.is_succ()) {
+    return status;
+  }
+  // let the underlying store read the objects stored as they are. the
+  // offsets past the body of a compressed one would read its index.
+  if (!frame->compressed) {
+    return base_->get_object(bucket, key, off, len, body);
+  }
+  if (off >= frame->size) {
+    body.clear();
+    return Status(ERANGE, "offset out of range");
+  }
+
+  len = std::min<uint64_t>(len, frame->size - off);
+  body.resize(len);
+  if (len > 0) {
+    status = read_chunks(bucket, key, *frame, off, len, body.data(),
+                         parallelism_);
+  }
+  if (!status.is_succ()) {
+    body.clear();
+  }
+  return status;
+}
+
+Status CompressingObjectStore::get_object(const std::string_view &bucket,
+                                          const std::string_view &key,
+                                          char *buf, size_t buf_size,
+                                          size_t &body_size) {
+  Status status = base_->get_object(bucket, key, buf, buf_size, body_size);
+  if (status.is_succ()) {
+    CompressedFrame frame;
+    if (body_size < CompressedFrame::kHeaderSize ||
+        get_u32(buf) != CompressedFrame::kMagic) {
+      return status;
+    }
+    // the body is decompressed out of a copy of the stored one into buf.
+    PooledBuffer stored(body_size);
+    memcpy(stored.data(), buf, body_size);
+    if (!parse_body(std::string_view(stored.data(), body_size), frame)) {
+      return status;
+    }
+    body_size = frame.size;
+    if (body_size > buf_size) {
+      return Status(ENOBUFS, "buffer too small to hold the object");
+    }
+    return decompress_range(frame, stored.data() + frame.offsets[0], 0,
+                            body_size, buf, parallelism_);
+  } else if (status.error_code() != ENOBUFS) {
+    return status;
+  }
+
+  // the stored object does not fit, but the body may if it is compressed by
+  // chunks which did not shrink.
+  Frame frame;
+  status = lookup_frame(bucket, key, frame);
+  if (!status.is_succ()) {
+    return status;
+  }
+  body_size = frame->size;
+  if (!frame->compressed || body_size > buf_size) {
+    return Status(ENOBUFS, "buffer too small to hold the object");
+  }
+  return read_chunks(bucket, key, *frame, 0, body_size, buf, parallelism_);
+}
+
+Status CompressingObjectStore::get_object(const std::string_view &bucket,
+                                          const std::string_view &key,
+                                          size_t off, size_t len, char *buf,
+                                          size_t &read_len) {
+  read_len = 0;
+  Frame frame;
+  Status status = lookup_frame(bucket, key, frame);
+  if (!status.is_succ()) {
+    return status;
+  }
+  if (!frame->compressed) {
+    return base_->get_object(bucket, key, off, len, buf, read_len);
+  }
+  if (off >= frame->size) {
+    return Status(ERANGE, "offset out of range");
+  }
+
+  len = std::min<uint64_t>(len, frame->size - off);
+  if (len > 0) {
+    status = read_chunks(bucket, key, *frame, off, len, buf, parallelism_);
+  }
+  if (status.is_succ()) {
+    read_len = len;
+  }
+  return status;
+}
+
+Status CompressingObjectStore::get_object_meta(const std::string_view &bucket,
+                                               const std::string_view &key,
+                                               ObjectMeta &meta) {
+  Frame frame;
+  return fetch_frame(bucket, key, meta, frame);
+}
+
+Status CompressingObjectStore::list_object(const std::string_view &bucket,
+                                           const std::string_view &prefix,
+                                           std::vector<ObjectMeta> &objects) {
+  return base_->list_object(bucket, prefix, objects);
+}
+
+Status CompressingObjectStore::list_object(
+    const std::string_view &bucket, const std::string_view &prefix,
+    const std::string_view &continuation_token, size_t max_keys,
+    std::vector<ObjectMeta> &objects, std::string &next_continuation_token) {
+  return base_->list_object(bucket, prefix, continuation_token, max_keys,
+                            objects, next_continuation_token);
+}
+
+Status CompressingObjectStore::list_object(
+    const std::string_view &bucket, const std::string_view &prefix,
+    const std::string_view &delimiter, std::vector<ObjectMeta> &objects,
+    std::vector<std::string> &common_prefixes) {
+  return base_->list_object(bucket, prefix, delimiter, objects,
+                            common_prefixes);
+}
+
+Status CompressingObjectStore::delete_object(const std::string_view &bucket,
+                                             const std::string_view &key) {
+  Status status = base_->delete_object(bucket, key);
+  invalidate(bucket, key);
+  return status;
+}
+
+Status CompressingObjectStore::delete_objects(
+    const std::string_view &bucket, const std::vector<std::string> &keys,
+    std::vector<Status> &results) {
+  Status status = base_->delete_objects(bucket, keys, results);
+  for (auto &key : keys) {
+    invalidate(bucket, key);
+  }
+  return status;
+}
+
+Status CompressingObjectStore::get_metrics(ObjectStoreMetrics &metrics) {
+  return base_->get_metrics(metrics);
+}
+
+size_t CompressingObjectStore::batch_size() const {
+  return kChunksPerThread * parallelism_ * chunk_size_;
+}
+
+void CompressingObjectStore::compress_chunks(
+    const char *data, size_t len, std::string &out,
+    std::vector<uint32_t> &chunks) const {
+  const Compression codec = options_.compression;
+  const size_t bound = compress_bound(codec, chunk_size_);
+  const size_t count = (len + chunk_size_ - 1) / chunk_size_;
+  const size_t batch = std::min(kChunksPerThread * parallelism_, count);
+  std::vector<PooledBuffer> buffers(batch);
+  std::vector<size_t> sizes(batch);
+  for (size_t first = 0; first < count; first += batch) {
+    const size_t n = std::min(batch, count - first);
+    parallel_run(n, chunk_threads(n, parallelism_), [&](size_t j) {
+      const size_t off = (first + j) * chunk_size_;
+      if (buffers[j].data() == nullptr) {
+        buffers[j] = PooledBuffer(bound);
+      }
+      sizes[j] = compress_chunk(codec, options_.compression_level, data + off,
+                                std::min(chunk_size_, len - off),
+                                buffers[j].data(), bound);
+      return Status();
+    });
+
+    // a chunk which does not shrink is kept as it is.
+    for (size_t j = 0; j < n; ++j) {
+      const size_t off = (first + j) * chunk_size_;
+      const size_t raw_len = std::min(chunk_size_, len - off);
+      if (sizes[j] == 0 || sizes[j] >= raw_len) {
+        out.append(data + off, raw_len);
+        chunks.push_back(
+            static_cast<uint32_t>(raw_len) | CompressedFrame::kStoredFlag);
+      } else {
+        out.append(buffers[j].data(), sizes[j]);
+        chunks.push_back(static_cast<uint32_t>(sizes[j]));
+      }
+    }
+  }
+}
+
+void CompressingObjectStore::append_footer(const std::vector<uint32_t> &chunks,
+                                           uint64_t size,
+                                           std::string &out) const {
+  const size_t index_off = out.size();
+  const size_t index_size = 4 * chunks.size();
+  out.resize(index_off + index_size + CompressedFrame::kFooterSize);
+  char *p = out.data() + index_off;
+  for (uint32_t entry : chunks) {
+    put_u32(p, entry);
+    p += 4;
+  }
+  put_u64(p, size);
+  put_u32(p + 8, static_cast<uint32_t>(chunk_size_));
+  put_u32(p + 12, static_cast<uint32_t>(chunks.size()));
+  p[16] = static_cast<char>(options_.compression);
+  p[17] = static_cast<char>(CompressedFrame::kVersion);
+  put_u32(p + 20, crc32c(out.data() + index_off, index_size + 20));
+  put_u32(p + 24, CompressedFrame::kMagic);
+}
+
+Status CompressingObjectStore::lookup_frame(const std::string_view &bucket,
+                                            const std::string_view &key,
+                                            Frame &frame) {
+  const std::string id = object_id(bucket, key);
+  std::shared_ptr<const CachedFrame> cached;
+  if (frames_.get(id, cached) &&
+      std::chrono::steady_clock::now() - cached->validated <
+          std::chrono::milliseconds(options_.cache_validate_interval_ms)) {
+    frame = cached->frame;
+    return Status();
+  }
+
+  // a read starting after a write must not join a validation started before
+  // it, so the flights are told apart by the write sequence too.
+  uint64_t seq = 0;
+  {
+    const std::lock_guard<std::mutex> _(write_mutex_);
+    seq = write_seq_;
+  }
+  return frame_flight_.run(id + '\0' + std::to_string(seq), frame,
+                           [&](Frame &fetched) {
+                             ObjectMeta meta;
+                             return fetch_frame(bucket, key, meta, fetched);
+                           });
+}
+
+Status CompressingObjectStore::fetch_frame(const std::string_view &bucket,
+                                           const std::string_view &key,
+                                           ObjectMeta &meta, Frame &frame) {
+  const std::string id = object_id(bucket, key);
+  uint64_t seq = 0;
+  {
+    const std::lock_guard<std::mutex> _(write_mutex_);
+    seq = write_seq_;
+  }
+  Status status = base_->get_object_meta(bucket, key, meta);
+  if (!status.is_succ()) {
+    return status;
+  }
+
+  const std::string version = object_version(meta);
+  std::shared_ptr<const CachedFrame> cached;
+  if (frames_.get(id, cached) && cached->version == version) {
+    frame = cached->frame;
+  } else {
+    status = read_frame(bucket, key, meta.size, frame);
+    if (!status.is_succ()) {
+      return status;
+    }
+  }
+  meta.size = frame->size;
+
+  auto fresh = std::make_shared<CachedFrame>();
+  fresh->version = version;
+  fresh->frame = frame;
+  fresh->validated = std::chrono::steady_clock::now();
+  const size_t charge = id.size() + sizeof(CompressedFrame) +
+                        12 * frame->chunks.size();
+  const std::lock_guard<std::mutex> _(write_mutex_);
+  if (write_seq_ == seq) {
+    frames_.put(id, std::move(fresh), charge);
+  }
+  return Status();
+}
+
+Status CompressingObjectStore::read_frame(const std::string_view &bucket,
+                                          const std::string_view &key,
+                                          uint64_t stored_size, Frame &frame) {
+  auto parsed = std::make_shared<CompressedFrame>();
+  parsed->size = stored_size;
+  size_t tail_len = std::min<uint64_t>(stored_size, kTailReadSize);
+  while (stored_size >= CompressedFrame::kHeaderSize +
+                            CompressedFrame::kFooterSize) {
+    std::string tail;
+    Status status =
+        base_->get_object(bucket, key, stored_size - tail_len, tail_len, tail);
+    if (!status.is_succ()) {
+      return status;
+    }
+    if (tail.size() != tail_len) {
+      return Status(EIO, "object changed while being read");
+    }
+    // the index of a large object may not be all in the first tail read.
+    size_t tail_needed = 0;
+    if (parsed->parse(tail, stored_size, tail_needed) ||
+        tail_needed <= tail_len) {
+      break;
+    }
+    tail_len = tail_needed;
+  }
+  frame = std::move(parsed);
+  return Status();
+}
+
+Status CompressingObjectStore::read_chunks(const std::string_view &bucket,
+                                           const std::string_view &key,
+                                           const CompressedFrame &frame,
+                                           size_t off, size_t len, char *buf,
+                                           size_t parallelism) {
+  const size_t first = off / frame.chunk_size;
+  const size_t last = (off + len - 1) / frame.chunk_size;
+  const uint64_t stored_off = frame.offsets[first];
+  const size_t stored_len = frame.offsets[last + 1] - stored_off;
+  PooledBuffer stored(stored_len);
+  size_t read_len = 0;
+  Status status = base_->get_object(bucket, key, stored_off, stored_len,
+                                    stored.data(), read_len);
+  if (!status.is_succ()) {
+    return status;
+  }
+  if (read_len != stored_len) {
+    invalidate(bucket, key);
+    return Status(EIO, "object changed while being read");
+  }
+  status =
+      decompress_range(frame, stored.data(), off, len, buf, parallelism);
+  if (!status.is_succ()) {
+    // the object may have been overwritten since its index was read.
+    invalidate(bucket, key);
+  }
+  return status;
+}
+
+void CompressingObjectStore::invalidate(const std::string_view &bucket,
+                                        const std::string_view &key) {
+  const std::lock_guard<std::mutex> _(write_mutex_);
+  ++write_seq_;
+  frames_.erase(object_id(bucket, key));
+}
+
+void CompressingObjectStore::invalidate_all() {
+  const std::lock_guard<std::mutex> _(write_mutex_);
+  ++write_seq_;
+  frames_.clear();
+}
+
+ObjectStore *create_compressing_objstore(ObjectStore *base,
+                                         const ObjectStoreOptions &options) {
+  if (base == nullptr) {
+    return nullptr;
+  }
+  return new CompressingObjectStore(base, options);
+}
+
+}  // namespace objstore
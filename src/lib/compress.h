@@ -0,0 +1,177 @@
+#ifndef MY_OBJSTORE_COMPRESS_H_INCLUDED
+#define MY_OBJSTORE_COMPRESS_H_INCLUDED
+
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "lru_cache.h"
+#include "objstore.h"
+#include "single_flight.h"
+
+namespace objstore {
+
+// the layout of a compressed object, the integers are little endian:
+//   header  "OBJZ", version u8, codec u8, 2 reserved bytes
+//   chunks  every chunk_size bytes of the body compressed alone, or kept as
+//           they are if that does not shrink them
+//   index   u32 per chunk: its stored size, the top bit set if kept as is
+//   footer  body size u64, chunk size u32, chunk count u32, codec u8,
+//           version u8, 2 reserved bytes, crc32c u32 of the index and the
+//           footer before it, "OBJZ"
+// the footer locates the chunks of a range from the tail of the object.
+struct CompressedFrame {
+  static constexpr uint32_t kMagic = 0x5a4a424f;  // "OBJZ"
+  static constexpr uint8_t kVersion = 1;
+  static constexpr size_t kHeaderSize = 8;
+  static constexpr size_t kFooterSize = 28;
+  static constexpr uint32_t kStoredFlag = 1u << 31;
+
+  // false if the object is stored as it is.
+  bool compressed = false;
+  Compression codec = Compression::kNone;
+  uint64_t size = 0;  // of the body
+  size_t chunk_size = 0;
+  // the index entries, and the offset in the object of every chunk and of
+  // the end of the last one.
+  std::vector<uint32_t> chunks;
+  std::vector<uint64_t> offsets;
+
+  // parse the frame of a stored object of stored_size bytes from its last
+  // tail.size() bytes. returns false if the object is not compressed, sets
+  // tail_needed and returns false as well if the index is not all in tail.
+  bool parse(const std::string_view &tail, uint64_t stored_size,
+             size_t &tail_needed);
+};
+
+// compresses the bodies of another object store, see
+// ObjectStoreOptions::compression. the index of a compressed object is kept
+// for its ranged gets, validated like the metas of CachingObjectStore.
+class CompressingObjectStore : public ObjectStore {
+ public:
+  // takes the ownership of base.
+  CompressingObjectStore(ObjectStore *base, const ObjectStoreOptions &options);
+  virtual ~CompressingObjectStore() = default;
+
+  Status create_bucket(const std::string_view &bucket) override;
+
+  Status delete_bucket(const std::string_view &bucket) override;
+
+  Status put_object_from_file(const std::string_view &bucket,
+                              const std::string_view &key,
+                              const std::string_view &data_file_path) override;
+  Status get_object_to_file(const std::string_view &bucket,
+                            const std::string_view &key,
+                            const std::string_view &output_file_path) override;
+
+  Status put_object(const std::string_view &bucket, const std::string_view &key,
+                    const std::string_view &data) override;
+  Status open_object_writer(const std::string_view &bucket,
+                            const std::string_view &key,
+                            std::unique_ptr<ObjectWriter> &writer) override;
+  Status get_object(const std::string_view &bucket, const std::string_view &key,
+                    std::string &body) override;
+  Status get_object(const std::string_view &bucket, const std::string_view &key,
+                    size_t off, size_t len, std::string &body) override;
+  Status get_object(const std::string_view &bucket, const std::string_view &key,
+                    char *buf, size_t buf_size, size_t &body_size) override;
+  Status get_object(const std::string_view &bucket, const std::string_view &key,
+                    size_t off, size_t len, char *buf,
+                    size_t &read_len) override;
+  Status get_object_meta(const std::string_view &bucket,
+                         const std::string_view &key,
+                         ObjectMeta &meta) override;
+
+  Status list_object(const std::string_view &bucket,
+                     const std::string_view &prefix,
+                     std::vector<ObjectMeta> &objects) override;
+  Status list_object(const std::string_view &bucket,
+                     const std::string_view &prefix,
+                     const std::string_view &continuation_token,
+                     size_t max_keys, std::vector<ObjectMeta> &objects,
+                     std::string &next_continuation_token) override;
+  Status list_object(const std::string_view &bucket,
+                     const std::string_view &prefix,
+                     const std::string_view &delimiter,
+                     std::vector<ObjectMeta> &objects,
+                     std::vector<std::string> &common_prefixes) override;
+
+  Status delete_object(const std::string_view &bucket,
+                       const std::string_view &key) override;
+  Status delete_objects(const std::string_view &bucket,
+                        const std::vector<std::string> &keys,
+                        std::vector<Status> &results) override;
+
+  Status get_metrics(ObjectStoreMetrics &metrics) override;
+
+ private:
+  friend class CompressingObjectWriter;
+
+  using Frame = std::shared_ptr<const CompressedFrame>;
+  struct CachedFrame {
+    std::string version;  // of the stored object
+    Frame frame;
+    std::chrono::steady_clock::time_point validated;
+  };
+
+  // compress the chunks of [data, data + len) in parallel, appending them to
+  // out and their index entries to chunks. only the last chunk of an object
+  // may be shorter than chunk_size_.
+  void compress_chunks(const char *data, size_t len, std::string &out,
+                       std::vector<uint32_t> &chunks) const;
+  // the index and footer of a compressed body of size bytes.
+  void append_footer(const std::vector<uint32_t> &chunks, uint64_t size,
+                     std::string &out) const;
+  // the bytes compressed at once, kChunksPerThread chunks per thread.
+  size_t batch_size() const;
+
+  // the frame of the object, trusted for the validate interval.
+  Status lookup_frame(const std::string_view &bucket,
+                      const std::string_view &key, Frame &frame);
+  // the meta of the stored object and its frame, read from its tail unless
+  // the cached one is of the same version.
+  Status fetch_frame(const std::string_view &bucket,
+                     const std::string_view &key, ObjectMeta &meta,
+                     Frame &frame);
+  // parse the frame of the stored object of stored_size bytes from its tail.
+  Status read_frame(const std::string_view &bucket,
+                    const std::string_view &key, uint64_t stored_size,
+                    Frame &frame);
+  // fetch the chunks covering [off, off + len) of a compressed object, which
+  // lies within its body, and decompress the range into buf, up to
+  // parallelism chunks at a time.
+  Status read_chunks(const std::string_view &bucket,
+                     const std::string_view &key, const CompressedFrame &frame,
+                     size_t off, size_t len, char *buf, size_t parallelism);
+  void invalidate(const std::string_view &bucket, const std::string_view &key);
+  void invalidate_all();
+
+ private:
+  // the index of a 1GiB object of 256KiB chunks takes 16KiB.
+  static constexpr size_t kMaxCachedFrameBytes = 64 * 1024 * 1024;
+
+  std::unique_ptr<ObjectStore> base_;
+  ObjectStoreOptions options_;
+  size_t chunk_size_;
+  // compression is bound by the cpu, a thread per core is enough.
+  size_t parallelism_;
+
+  LruCache<std::shared_ptr<const CachedFrame>> frames_;
+  // guards write_seq_, which every write bumps so that a frame fetched
+  // concurrently with a write is not cached.
+  std::mutex write_mutex_;
+  uint64_t write_seq_{0};
+  SingleFlight<Frame> frame_flight_;
+};
+
+// wrap base, whose ownership is taken, into a store compressing the objects
+// as configured by options.
+ObjectStore *create_compressing_objstore(ObjectStore *base,
+                                         const ObjectStoreOptions &options);
+
+}  // namespace objstore
+
+#endif  // MY_OBJSTORE_COMPRESS_H_INCLUDED
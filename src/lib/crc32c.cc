@@ -0,0 +1,242 @@
+#include "crc32c.h"
+
+#include <algorithm>
+#include <cstring>
+
+#if defined(__x86_64__)
+#include <nmmintrin.h>
+#elif defined(__aarch64__) && defined(__ARM_FEATURE_CRC32)
+#include <arm_acle.h>
+#endif
+
+namespace objstore {
+
+namespace {
+
+// the polynomial, reflected.
+constexpr uint32_t kPoly = 0x82f63b78;
+
+// the crc instruction takes 3 cycles but a new one starts every cycle, so
+// the x86 kernel runs three streams over adjacent blocks at once and then
+// shifts their crcs together by tables.
+constexpr size_t kLongBlock = 4096;
+constexpr size_t kShortBlock = 256;
+
+// crc32c_copy() checksums then copies chunks of this size, small enough to
+// stay in the l1 cache between the two, so the data is read from memory once.
+constexpr size_t kCopyChunk = 3 * kLongBlock;
+
+// a * b modulo the polynomial, where the polynomials are reflected: bit 31
+// is x^0. a is not 0.
+uint32_t multmodp(uint32_t a, uint32_t b) {
+  uint32_t m = 1u << 31;
+  uint32_t p = 0;
+  while (true) {
+    if (a & m) {
+      p ^= b;
+      if ((a & (m - 1)) == 0) {
+        break;
+      }
+    }
+    m >>= 1;
+    b = b & 1 ? (b >> 1) ^ kPoly : b >> 1;
+  }
+  return p;
+}
+
+struct Tables {
+  // bytes[i][b] is the crc of the byte b followed by i zero bytes, which
+  // the portable kernel takes 8 bytes at a time by.
+  uint32_t bytes[8][256];
+  // x^(2^k) modulo the polynomial, enough for any 64-bit byte count.
+  uint32_t x2n[64 + 3];
+  // multiply a crc by x^(8 * kLongBlock) or x^(8 * kShortBlock), one byte of
+  // it at a time: appends that many zero bytes to the data it covers.
+  uint32_t shift_long[4][256];
+  uint32_t shift_short[4][256];
+
+  Tables() {
+    for (uint32_t b = 0; b < 256; ++b) {
+      uint32_t crc = b;
+      for (int k = 0; k < 8; ++k) {
+        crc = crc & 1 ? (crc >> 1) ^ kPoly : crc >> 1;
+      }
+      bytes[0][b] = crc;
+    }
+    for (int i = 1; i < 8; ++i) {
+      for (uint32_t b = 0; b < 256; ++b) {
+        bytes[i][b] =
+            (bytes[i - 1][b] >> 8) ^ bytes[0][bytes[i - 1][b] & 0xff];
+      }
+    }
+
+    uint32_t p = 1u << 30;  // x^1
+    for (uint32_t &x : x2n) {
+      x = p;
+      p = multmodp(p, p);
+    }
+    fill_shift(shift_long, x8nmodp(kLongBlock));
+    fill_shift(shift_short, x8nmodp(kShortBlock));
+  }
+
+  // x^(8 * n) modulo the polynomial.
+  uint32_t x8nmodp(uint64_t n) const {
+    uint32_t p = 1u << 31;  // x^0
+    for (size_t k = 3; n != 0; n >>= 1, ++k) {
+      if (n & 1) {
+        p = multmodp(x2n[k], p);
+      }
+    }
+    return p;
+  }
+
+  // the multiplication by power is linear, so it is the xor of the
+  // multiplications of every byte.
+  void fill_shift(uint32_t (&table)[4][256], uint32_t power) {
+    for (int i = 0; i < 4; ++i) {
+      for (uint32_t b = 0; b < 256; ++b) {
+        table[i][b] = multmodp(power, b << (8 * i));
+      }
+    }
+  }
+};
+
+const Tables &tables() {
+  static const Tables tables;
+  return tables;
+}
+
+inline uint32_t shift(const uint32_t (&table)[4][256], uint32_t crc) {
+  return table[0][crc & 0xff] ^ table[1][(crc >> 8) & 0xff] ^
+         table[2][(crc >> 16) & 0xff] ^ table[3][crc >> 24];
+}
+
+inline uint64_t load64(const uint8_t *p) {
+  uint64_t v;
+  memcpy(&v, p, sizeof(v));
+  return v;
+}
+
+uint32_t extend_portable(uint32_t crc, const uint8_t *p, size_t len) {
+  const Tables &t = tables();
+  crc = ~crc;
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+  for (; len >= 8; p += 8, len -= 8) {
+    const uint64_t v = load64(p) ^ crc;
+    crc = t.bytes[7][v & 0xff] ^ t.bytes[6][(v >> 8) & 0xff] ^
+          t.bytes[5][(v >> 16) & 0xff] ^ t.bytes[4][(v >> 24) & 0xff] ^
+          t.bytes[3][(v >> 32) & 0xff] ^ t.bytes[2][(v >> 40) & 0xff] ^
+          t.bytes[1][(v >> 48) & 0xff] ^ t.bytes[0][v >> 56];
+  }
+#endif
+  for (; len > 0; ++p, --len) {
+    crc = (crc >> 8) ^ t.bytes[0][(crc ^ *p) & 0xff];
+  }
+  return ~crc;
+}
+
+#if defined(__x86_64__)
+
+__attribute__((target("sse4.2"))) uint32_t extend_sse42(uint32_t crc,
+                                                        const uint8_t *p,
+                                                        size_t len) {
+  const Tables &t = tables();
+  uint64_t crc0 = ~crc;
+  for (; len > 0 && (reinterpret_cast<uintptr_t>(p) & 7) != 0; ++p, --len) {
+    crc0 = _mm_crc32_u8(static_cast<uint32_t>(crc0), *p);
+  }
+
+  // the crc of block 0 shifted over block 1 is that of both when the crc
+  // of block 1 started from 0 is xored in, and so on for block 2.
+  while (len >= 3 * kLongBlock) {
+    uint64_t crc1 = 0;
+    uint64_t crc2 = 0;
+    for (const uint8_t *end = p + kLongBlock; p < end; p += 8) {
+      crc0 = _mm_crc32_u64(crc0, load64(p));
+      crc1 = _mm_crc32_u64(crc1, load64(p + kLongBlock));
+      crc2 = _mm_crc32_u64(crc2, load64(p + 2 * kLongBlock));
+    }
+    crc0 = shift(t.shift_long, static_cast<uint32_t>(crc0)) ^ crc1;
+    crc0 = shift(t.shift_long, static_cast<uint32_t>(crc0)) ^ crc2;
+    p += 2 * kLongBlock;
+    len -= 3 * kLongBlock;
+  }
+  while (len >= 3 * kShortBlock) {
+    uint64_t crc1 = 0;
+    uint64_t crc2 = 0;
+    for (const uint8_t *end = p + kShortBlock; p < end; p += 8) {
+      crc0 = _mm_crc32_u64(crc0, load64(p));
+      crc1 = _mm_crc32_u64(crc1, load64(p + kShortBlock));
+      crc2 = _mm_crc32_u64(crc2, load64(p + 2 * kShortBlock));
+    }
+    crc0 = shift(t.shift_short, static_cast<uint32_t>(crc0)) ^ crc1;
+    crc0 = shift(t.shift_short, static_cast<uint32_t>(crc0)) ^ crc2;
+    p += 2 * kShortBlock;
+    len -= 3 * kShortBlock;
+  }
+
+  for (; len >= 8; p += 8, len -= 8) {
+    crc0 = _mm_crc32_u64(crc0, load64(p));
+  }
+  for (; len > 0; ++p, --len) {
+    crc0 = _mm_crc32_u8(static_cast<uint32_t>(crc0), *p);
+  }
+  return ~static_cast<uint32_t>(crc0);
+}
+
+#elif defined(__aarch64__) && defined(__ARM_FEATURE_CRC32)
+
+uint32_t extend_armv8(uint32_t crc, const uint8_t *p, size_t len) {
+  crc = ~crc;
+  for (; len >= 8; p += 8, len -= 8) {
+    crc = __crc32cd(crc, load64(p));
+  }
+  for (; len > 0; ++p, --len) {
+    crc = __crc32cb(crc, *p);
+  }
+  return ~crc;
+}
+
+#endif
+
+using ExtendFn = uint32_t (*)(uint32_t, const uint8_t *, size_t);
+
+ExtendFn select_extend() {
+#if defined(__x86_64__)
+  if (__builtin_cpu_supports("sse4.2")) {
+    return extend_sse42;
+  }
+#elif defined(__aarch64__) && defined(__ARM_FEATURE_CRC32)
+  return extend_armv8;
+#endif
+  return extend_portable;
+}
+
+ExtendFn extend_fn() {
+  static const ExtendFn extend = select_extend();
+  return extend;
+}
+
+}  // anonymous namespace
+
+uint32_t crc32c_extend(uint32_t crc, const char *buf, size_t len) {
+  return extend_fn()(crc, reinterpret_cast<const uint8_t *>(buf), len);
+}
+
+uint32_t crc32c_combine(uint32_t crc_a, uint32_t crc_b, size_t len_b) {
+  return multmodp(tables().x8nmodp(len_b), crc_a) ^ crc_b;
+}
+
+uint32_t crc32c_copy(uint32_t crc, char *dst, const char *src, size_t len) {
+  const ExtendFn extend = extend_fn();
+  for (size_t off = 0; off < len; off += kCopyChunk) {
+    const size_t n = std::min(kCopyChunk, len - off);
+    crc = extend(crc, reinterpret_cast<const uint8_t *>(src + off), n);
+    memcpy(dst + off, src + off, n);
+  }
+  return crc;
+}
+
+bool crc32c_hardware() { return extend_fn() != extend_portable; }
+
+}  // namespace objstore
@@ -0,0 +1,32 @@
+#ifndef MY_OBJSTORE_CRC32C_H_INCLUDED
+#define MY_OBJSTORE_CRC32C_H_INCLUDED
+
+#include <cstddef>
+#include <cstdint>
+
+namespace objstore {
+
+// crc32c (castagnoli), the checksum of iscsi, ext4 and s3's
+// x-amz-checksum-crc32c. computed by the crc32 instruction of sse4.2 or
+// armv8 when the cpu has it, by tables otherwise.
+
+// the crc of data followed by len bytes, crc is the crc of data, 0 for none.
+uint32_t crc32c_extend(uint32_t crc, const char *buf, size_t len);
+
+inline uint32_t crc32c(const char *buf, size_t len) {
+  return crc32c_extend(0, buf, len);
+}
+
+// the crc of a followed by b, from the crcs of both and the length of b.
+uint32_t crc32c_combine(uint32_t crc_a, uint32_t crc_b, size_t len_b);
+
+// copy len bytes of src to dst and extend crc with them, in one pass: the
+// bytes are checksummed while they are in the cache for the copy.
+uint32_t crc32c_copy(uint32_t crc, char *dst, const char *src, size_t len);
+
+// whether the crc is computed by the cpu instruction.
+bool crc32c_hardware();
+
+}  // namespace objstore
+
+#endif  // MY_OBJSTORE_CRC32C_H_INCLUDED
@@ -0,0 +1,162 @@
+#include "executor.h"
+
+#include <errno.h>
+
+#include <algorithm>
+#include <atomic>
+#include <exception>
+#include <memory>
+#include <new>
+
+namespace objstore {
+
+namespace {
+
+// the pool the current thread belongs to, nullptr for non-pool threads.
+thread_local const ThreadPoolExecutor *t_current_pool = nullptr;
+
+// the threads and queue depth of shared_executor().
+constexpr size_t kSharedThreads = 64;
+constexpr size_t kSharedQueueDepth = 1024;
+
+}  // anonymous namespace
+
+ThreadPoolExecutor::ThreadPoolExecutor(size_t num_threads,
+                                       size_t max_queue_depth)
+    : max_queue_depth_(std::max<size_t>(max_queue_depth, 1)) {
+  num_threads = std::max<size_t>(num_threads, 1);
+  workers_.reserve(num_threads);
+  for (size_t i = 0; i < num_threads; ++i) {
+    workers_.emplace_back(&ThreadPoolExecutor::worker_loop, this);
+  }
+}
+
+ThreadPoolExecutor::~ThreadPoolExecutor() {
+  {
+    const std::lock_guard<std::mutex> _(mutex_);
+    stopping_ = true;
+  }
+  not_empty_.notify_all();
+  // the pending tasks are drained before the workers exit.
+  for (auto &worker : workers_) {
+    worker.join();
+  }
+}
+
+void ThreadPoolExecutor::submit(std::function<void()> task) {
+  if (t_current_pool == this) {
+    // blocking a worker on its own full queue may deadlock the pool.
+    task();
+    return;
+  }
+
+  {
+    std::unique_lock<std::mutex> lock(mutex_);
+    not_full_.wait(lock, [this]() { return tasks_.size() < max_queue_depth_; });
+    tasks_.push_back(std::move(task));
+  }
+  not_empty_.notify_one();
+}
+
+void ThreadPoolExecutor::worker_loop() {
+  t_current_pool = this;
+  while (true) {
+    std::function<void()> task;
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      not_empty_.wait(lock, [this]() { return stopping_ || !tasks_.empty(); });
+      if (tasks_.empty()) {
+        // stopping and drained.
+        break;
+      }
+      task = std::move(tasks_.front());
+      tasks_.pop_front();
+    }
+    not_full_.notify_one();
+    task();
+  }
+  t_current_pool = nullptr;
+}
+
+ThreadPoolExecutor &shared_executor() {
+  // leaked, so that the helpers left queued at exit never run on a
+  // destroyed pool.
+  static auto *executor =
+      new ThreadPoolExecutor(kSharedThreads, kSharedQueueDepth);
+  return *executor;
+}
+
+std::shared_ptr<Executor> create_thread_pool_executor(size_t num_threads,
+                                                      size_t max_queue_depth) {
+  return std::make_shared<ThreadPoolExecutor>(num_threads, max_queue_depth);
+}
+
+Status parallel_run(size_t num_tasks, size_t parallelism,
+                    const std::function<Status(size_t)> &task) {
+  // shared with the helpers on the pool, which may start after the call
+  // returns. only those joining before it is done run tasks.
+  struct State {
+    std::atomic<size_t> next_task{0};
+    std::atomic<bool> failed{false};
+    std::mutex mutex;
+    std::condition_variable idle;
+    Status first_error;
+    // the helpers running tasks, and whether the call stopped waiting.
+    size_t active = 0;
+    bool done = false;
+  };
+  auto state = std::make_shared<State>();
+
+  auto fail = [](State &state, Status status) {
+    const std::lock_guard<std::mutex> _(state.mutex);
+    if (!state.failed.exchange(true)) {
+      state.first_error = std::move(status);
+    }
+  };
+  // a task throwing, e.g. std::bad_alloc, fails the call rather than the
+  // thread running it.
+  auto run_tasks = [&task, num_tasks, fail](State &state) {
+    size_t i;
+    while (!state.failed && (i = state.next_task++) < num_tasks) {
+      Status status;
+      try {
+        status = task(i);
+      } catch (const std::bad_alloc &) {
+        status = Status(ENOMEM, "out of memory");
+      } catch (const std::exception &e) {
+        status = Status(EIO, e.what());
+      } catch (...) {
+        status = Status(EIO, "task threw");
+      }
+      if (!status.is_succ()) {
+        fail(state, std::move(status));
+      }
+    }
+  };
+
+  parallelism = std::min(std::max<size_t>(parallelism, 1), num_tasks);
+  for (size_t i = 1; i < parallelism; ++i) {
+    shared_executor().submit([state, run_tasks]() {
+      {
+        const std::lock_guard<std::mutex> _(state->mutex);
+        if (state->done) {
+          return;
+        }
+        ++state->active;
+      }
+      run_tasks(*state);
+      const std::lock_guard<std::mutex> _(state->mutex);
+      if (--state->active == 0) {
+        state->idle.notify_all();
+      }
+    });
+  }
+  run_tasks(*state);
+
+  std::unique_lock<std::mutex> lock(state->mutex);
+  state->done = true;
+  state->idle.wait(lock, [&]() { return state->active == 0; });
+  return state->first_error;
+}
+
+}  // namespace objstore
@@ -0,0 +1,53 @@
+#ifndef MY_OBJSTORE_EXECUTOR_H_INCLUDED
+#define MY_OBJSTORE_EXECUTOR_H_INCLUDED
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "objstore.h"
+
+namespace objstore {
+
+// a fixed-size thread pool with a bounded task queue. submit() blocks while
+// the queue is full, except when called from one of the pool's own threads,
+// which runs the task inline instead of waiting on itself.
+class ThreadPoolExecutor : public Executor {
+ public:
+  ThreadPoolExecutor(size_t num_threads, size_t max_queue_depth);
+  virtual ~ThreadPoolExecutor();
+
+  void submit(std::function<void()> task) override;
+
+ private:
+  void worker_loop();
+
+ private:
+  const size_t max_queue_depth_;
+
+  std::mutex mutex_;
+  std::condition_variable not_empty_;
+  std::condition_variable not_full_;
+  std::deque<std::function<void()>> tasks_;
+  bool stopping_{false};
+
+  std::vector<std::thread> workers_;
+};
+
+// the pool shared by the parallel work of all the object stores, e.g. the
+// parts of an upload, so the threads are bounded however many run at once.
+ThreadPoolExecutor &shared_executor();
+
+// run task(0) .. task(num_tasks - 1) on up to parallelism threads, the
+// calling thread and those of shared_executor(). no task is started after
+// the first failure, whose status is returned, and a task throwing fails
+// with EIO, or ENOMEM for std::bad_alloc.
+Status parallel_run(size_t num_tasks, size_t parallelism,
+                    const std::function<Status(size_t)> &task);
+
+}  // namespace objstore
+
+#endif  // MY_OBJSTORE_EXECUTOR_H_INCLUDED
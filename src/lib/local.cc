@@ -1,14 +1,32 @@
 #include "local.h"
+#include "buffer_pool.h"
+#include "crc32c.h"
+#include "ranges.h"
 
 #include <assert.h>
 #include <cerrno>
-#include <chrono>
+#include <fcntl.h>
+#include <linux/fs.h>
 #include <sys/errno.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/sendfile.h>
+#include <limits.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <sys/xattr.h>
+#include <unistd.h>
 
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
 #include <cstdlib>
 #include <filesystem>
+#include <functional>
 #include <fstream>
 #include <iostream>
+#include <mutex>
+#include <set>
 #include <system_error>
 
 namespace objstore {
@@ -33,36 +51,687 @@ int rm_f(std::string_view path) {
   return errcode.value();
 }
 
-// if the path is invalid, an execption will be throw
-bool is_dir_empty(std::string_view path) { return fs::is_empty(path); }
+// closes the owned file descriptor when going out of scope.
+class ScopedFd {
+ public:
+  ScopedFd() = default;
+  explicit ScopedFd(int fd) : fd_(fd) {}
+  ~ScopedFd() { reset(); }
 
-int get_obj_meta_from_file(fs::path path, ObjectMeta &meta) {
-  std::error_code errcode;
+  ScopedFd(const ScopedFd &) = delete;
+  ScopedFd &operator=(const ScopedFd &) = delete;
+
+  int get() const { return fd_; }
+  // give up the ownership of the descriptor.
+  int release() {
+    int fd = fd_;
+    fd_ = -1;
+    return fd;
+  }
+  void reset(int fd = -1) {
+    if (fd_ >= 0) {
+      ::close(fd_);
+    }
+    fd_ = fd;
+  }
+
+ private:
+  int fd_{-1};
+};
+
+// an object body mapped from its file. the file is never truncated in place,
+// writers rename a new one over it, so the mapping keeps the body it was
+// created with.
+class MappedObjectBuffer : public ObjectBuffer {
+ public:
+  MappedObjectBuffer(void *addr, size_t map_len, size_t skip, size_t size)
+      : addr_(addr), map_len_(map_len), skip_(skip), size_(size) {}
+  ~MappedObjectBuffer() override {
+    if (addr_ != nullptr) {
+      ::munmap(addr_, map_len_);
+    }
+  }
+
+  MappedObjectBuffer(const MappedObjectBuffer &) = delete;
+  MappedObjectBuffer &operator=(const MappedObjectBuffer &) = delete;
+
+  const char *data() const override {
+    return static_cast<const char *>(addr_) + skip_;
+  }
+  size_t size() const override { return size_; }
+
+ private:
+  void *addr_;
+  size_t map_len_;
+  // mappings start at a page boundary, the body starts skip_ bytes in.
+  size_t skip_;
+  size_t size_;
+};
+
+int madvise_flag(AccessPattern access) {
+  switch (access) {
+    case AccessPattern::kSequential:
+      return MADV_SEQUENTIAL;
+    case AccessPattern::kRandom:
+      return MADV_RANDOM;
+    case AccessPattern::kWillNeed:
+      return MADV_WILLNEED;
+    default:
+      return MADV_NORMAL;
+  }
+}
+
+// objects are written into temporary files in their directories, which the
+// listings skip. a key collides with them only if named like one on purpose.
+constexpr std::string_view kTempFilePrefix = ".objstore-tmp.";
+
+std::atomic<uint64_t> g_temp_file_seq{0};
+
+bool is_temp_file(const std::string_view &name) {
+  return name.substr(0, kTempFilePrefix.size()) == kTempFilePrefix;
+}
+
+// a temporary file next to key_path, unique across processes and threads.
+std::string temp_file_path(const std::string &key_path) {
+  std::string name(kTempFilePrefix);
+  name += std::to_string(::getpid()) + "." + std::to_string(++g_temp_file_seq);
+  return (fs::path(key_path).parent_path() / name).native();
+}
+
+// buffer size of the copies in the user space.
+constexpr size_t kCopyBufferSize = 1024 * 1024;
+
+// write len bytes of buf to fd, retrying short writes. returns errno.
+int write_full(int fd, const char *buf, size_t len) {
+  size_t written = 0;
+  while (written < len) {
+    ssize_t ret = ::write(fd, buf + written, len - written);
+    if (ret < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return errno;
+    }
+    written += ret;
+  }
+  return 0;
+}
+
+// fdatasync(2) the file at path, or fsync(2) the directory at path, which
+// makes the renames in it durable. returns errno.
+int sync_path(const std::string &path, bool is_dir) {
+  int fd = ::open(path.c_str(),
+                  O_RDONLY | O_CLOEXEC | (is_dir ? O_DIRECTORY : 0));
+  if (fd < 0) {
+    return errno;
+  }
+  int ret = (is_dir ? ::fsync(fd) : ::fdatasync(fd)) != 0 ? errno : 0;
+  ::close(fd);
+  return ret;
+}
+
+// read len bytes at off into buf, retrying short reads. read_len is less than
+// len only if the file ends before off + len. returns errno on failure.
+int pread_full(int fd, char *buf, size_t len, size_t off, size_t &read_len) {
+  read_len = 0;
+  while (read_len < len) {
+    ssize_t ret = ::pread(fd, buf + read_len, len - read_len, off + read_len);
+    if (ret < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return errno;
+    } else if (ret == 0) {
+      break;
+    }
+    read_len += ret;
+  }
+  return 0;
+}
+
+// preadv(2) the file from off into iov until it is full or the file ends,
+// read_len is the bytes read. iov is consumed. returns errno on failure.
+int preadv_full(int fd, std::vector<struct iovec> &iov, size_t off,
+                size_t &read_len) {
+  read_len = 0;
+  size_t first = 0;
+  while (first < iov.size()) {
+    const int count =
+        static_cast<int>(std::min<size_t>(iov.size() - first, IOV_MAX));
+    ssize_t ret = ::preadv(fd, iov.data() + first, count, off + read_len);
+    if (ret < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return errno;
+    } else if (ret == 0) {
+      break;
+    }
+    read_len += ret;
+
+    // skip the filled buffers, then advance into the partially filled one.
+    size_t left = ret;
+    while (first < iov.size() && left >= iov[first].iov_len) {
+      left -= iov[first].iov_len;
+      ++first;
+    }
+    if (left > 0) {
+      iov[first].iov_base = static_cast<char *>(iov[first].iov_base) + left;
+      iov[first].iov_len -= left;
+    }
+  }
+  return 0;
+}
+
+// the crc32c of an object body, kept in an extended attribute of its file
+// so that it is renamed into place along with the body.
+constexpr const char *kCrc32cXattr = "user.objstore.crc32c";
+
+// the bytes checksummed at a time by the reads and writes, which are then
+// still in the cache for the copy to or from the kernel.
+constexpr size_t kChecksumChunk = 256 * 1024;
+
+// whether the file system of path keeps user xattrs, and so the crcs.
+bool has_user_xattrs(const std::string &path) {
+  char buf[9];
+  return ::getxattr(path.c_str(), kCrc32cXattr, buf, 8) >= 0 ||
+         errno != ENOTSUP;
+}
+
+// store crc on the file at path as 8 hex digits. a file system without user
+// xattrs leaves the object unchecked. returns errno.
+int set_file_crc32c(const std::string &path, uint32_t crc) {
+  char buf[9];
+  snprintf(buf, sizeof(buf), "%08x", crc);
+  if (::setxattr(path.c_str(), kCrc32cXattr, buf, 8, 0) != 0) {
+    return errno == ENOTSUP ? 0 : errno;
+  }
+  return 0;
+}
+
+// false if the file at path has no crc, e.g. it was written with the
+// checksums disabled.
+bool get_file_crc32c(const std::string &path, uint32_t &crc) {
+  char buf[9] = {};
+  if (::getxattr(path.c_str(), kCrc32cXattr, buf, 8) != 8) {
+    return false;
+  }
+  char *end = nullptr;
+  const unsigned long value = strtoul(buf, &end, 16);
+  if (end != buf + 8) {
+    return false;
+  }
+  crc = static_cast<uint32_t>(value);
+  return true;
+}
+
+// write_full() extending crc with the bytes written.
+int write_checksummed(int fd, const char *buf, size_t len, uint32_t &crc) {
+  for (size_t off = 0; off < len; off += kChecksumChunk) {
+    const size_t n = std::min(kChecksumChunk, len - off);
+    crc = crc32c_extend(crc, buf + off, n);
+    int ret = write_full(fd, buf + off, n);
+    if (ret != 0) {
+      return ret;
+    }
+  }
+  return 0;
+}
+
+// read the whole file at path, open as fd, like pread_full() and check the
+// bytes against the crc it was written with, if any. returns errno, EBADMSG
+// if the crc does not match.
+int read_verified(int fd, const std::string &path, char *buf, size_t len,
+                  size_t &read_len) {
+  read_len = 0;
+  uint32_t crc = 0;
+  while (read_len < len) {
+    size_t chunk_len = 0;
+    int ret = pread_full(fd, buf + read_len,
+                         std::min(kChecksumChunk, len - read_len), read_len,
+                         chunk_len);
+    if (ret != 0) {
+      return ret;
+    }
+    crc = crc32c_extend(crc, buf + read_len, chunk_len);
+    read_len += chunk_len;
+    if (chunk_len == 0) {
+      break;
+    }
+  }
+  uint32_t expected = 0;
+  if (get_file_crc32c(path, expected) && expected != crc) {
+    return EBADMSG;
+  }
+  return 0;
+}
+
+// the status of a read failed by errno ret.
+Status read_status(int ret) {
+  if (ret == EBADMSG) {
+    return Status(EBADMSG, "crc32c mismatch");
+  }
+  return ret != 0 ? Status(EIO, "read fail") : Status();
+}
+
+std::atomic<uint64_t> g_reflink_copies{0};
+std::atomic<uint64_t> g_copy_file_range_copies{0};
+std::atomic<uint64_t> g_sendfile_copies{0};
+std::atomic<uint64_t> g_userspace_copies{0};
+
+// copy the file src_path to dst_path, which is created or truncated, the
+// cheapest way the file systems allow: a reflink, then copy_file_range(2),
+// then sendfile(2), and at last read(2) and write(2). a way failing half way
+// is taken over by the next one. if crc is not nullptr, the bytes are copied
+// by read(2) and write(2), which checksum them into it. returns errno.
+int copy_file(const std::string &src_path, const std::string &dst_path,
+              uint32_t *crc = nullptr) {
+  ScopedFd src(::open(src_path.c_str(), O_RDONLY | O_CLOEXEC));
+  if (src.get() < 0) {
+    return errno;
+  }
+  struct stat st;
+  if (::fstat(src.get(), &st) != 0) {
+    return errno;
+  }
+  const size_t size = st.st_size;
+  ScopedFd dst(
+      ::open(dst_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644));
+  if (dst.get() < 0) {
+    return errno;
+  }
+
+  if (crc != nullptr) {
+    *crc = 0;
+    PooledBuffer buf(kCopyBufferSize);
+    off_t off = 0;
+    while (true) {
+      size_t read_len = 0;
+      int ret =
+          pread_full(src.get(), buf.data(), kCopyBufferSize, off, read_len);
+      if (ret != 0) {
+        return ret;
+      }
+      if (read_len == 0) {
+        break;
+      }
+      ret = write_checksummed(dst.get(), buf.data(), read_len, *crc);
+      if (ret != 0) {
+        return ret;
+      }
+      off += read_len;
+    }
+    ++g_userspace_copies;
+    return 0;
+  }
+
+  if (::ioctl(dst.get(), FICLONE, src.get()) == 0) {
+    ++g_reflink_copies;
+    return 0;
+  }
+
+  loff_t src_off = 0;
+  loff_t dst_off = 0;
+  while (static_cast<size_t>(src_off) < size) {
+    ssize_t ret = ::copy_file_range(src.get(), &src_off, dst.get(), &dst_off,
+                                    size - src_off, 0);
+    if (ret < 0 && errno == EINTR) {
+      continue;
+    } else if (ret <= 0) {
+      break;
+    }
+  }
+  if (static_cast<size_t>(src_off) >= size) {
+    ++g_copy_file_range_copies;
+    return 0;
+  }
 
-  fs::file_time_type ftime = fs::last_write_time(path, errcode);
-  if (errcode.value() != 0) {
-    return errcode.value();
+  // sendfile() writes at the file offset of dst.
+  off_t off = src_off;
+  if (::lseek(dst.get(), off, SEEK_SET) < 0) {
+    return errno;
+  }
+  while (static_cast<size_t>(off) < size) {
+    ssize_t ret = ::sendfile(dst.get(), src.get(), &off, size - off);
+    if (ret < 0 && errno == EINTR) {
+      continue;
+    } else if (ret <= 0) {
+      break;
+    }
+  }
+  if (static_cast<size_t>(off) >= size) {
+    ++g_sendfile_copies;
+    return 0;
   }
-  int64_t epoch_in_ms = std::chrono::duration_cast<std::chrono::milliseconds>(
-                            ftime.time_since_epoch())
-                            .count();
 
-  errcode.clear();
-  std::uintmax_t fsize = fs::file_size(path, errcode);
-  if (errcode.value() != 0) {
-    return errcode.value();
+  PooledBuffer buf(kCopyBufferSize);
+  while (true) {
+    size_t read_len = 0;
+    int ret = pread_full(src.get(), buf.data(), kCopyBufferSize, off, read_len);
+    if (ret != 0) {
+      return ret;
+    }
+    if (read_len == 0) {
+      break;
+    }
+    ret = write_full(dst.get(), buf.data(), read_len);
+    if (ret != 0) {
+      return ret;
+    }
+    off += read_len;
   }
+  ++g_userspace_copies;
+  return 0;
+}
+
+// open the object file for reading, file_size is set to its size.
+Status open_object_file(const std::string &path, ScopedFd &fd,
+                        size_t &file_size) {
+  fd.reset(::open(path.c_str(), O_RDONLY | O_CLOEXEC));
+  if (fd.get() < 0) {
+    return Status(EIO, "Couldn't open file");
+  }
+
+  struct stat st;
+  if (::fstat(fd.get(), &st) != 0) {
+    return Status(EIO, "Couldn't stat file");
+  }
+  file_size = st.st_size;
+  return Status();
+}
 
-  meta.last_modified = epoch_in_ms;
-  meta.size = fsize;
+int get_obj_meta_from_file(const fs::path &path, ObjectMeta &meta) {
+  // the epoch of fs::file_time_type is implementation defined (libstdc++
+  // counts from 2174), so use stat(2), which also costs one syscall only.
+  struct stat st;
+  if (::stat(path.c_str(), &st) != 0) {
+    return errno;
+  }
+
+  meta.last_modified = static_cast<int64_t>(st.st_mtim.tv_sec) * 1000 +
+                       st.st_mtim.tv_nsec / 1000000;
+  meta.size = st.st_size;
+  // every write renames a new file in, but inodes are reused, so tell the
+  // versions apart by the inode, the modification time and the size.
+  char etag[64];
+  snprintf(etag, sizeof(etag), "%lx-%llx-%llx",
+           static_cast<unsigned long>(st.st_ino),
+           static_cast<unsigned long long>(st.st_mtim.tv_sec) * 1000000000ULL +
+               st.st_mtim.tv_nsec,
+           static_cast<unsigned long long>(st.st_size));
+  meta.etag = etag;
 
   return 0;
 }
 
+// max keys of a page when the caller does not limit it, like s3.
+constexpr size_t kDefaultMaxKeys = 1000;
+
+bool starts_with(const std::string_view &str, const std::string_view &prefix) {
+  return str.substr(0, prefix.size()) == prefix;
+}
+
+// visit the objects under dir in key order, dir_key is the key prefix of dir
+// itself: empty for the bucket, otherwise ending with '/'. only the objects
+// whose keys start with prefix and sort after start_after are visited, and
+// only the directories which may hold such keys are read, so a prefix or a
+// continuation token skips whole subtrees. the walk stops once visitor
+// returns false. returns errno on failure.
+int walk_objects(const fs::path &dir, const std::string &dir_key,
+                 const std::string_view &prefix,
+                 const std::string_view &start_after,
+                 const std::function<bool(ObjectMeta &)> &visitor,
+                 bool *stopped = nullptr) {
+  struct Entry {
+    // a directory's key ends with '/', which sorts it among its siblings just
+    // like the keys it holds.
+    std::string key;
+    fs::path path;
+    bool is_dir;
+  };
+  std::vector<Entry> entries;
+
+  // objects are not locked while listing, so entries may come and go under
+  // the iterator: use the non-throwing interfaces and skip vanished ones.
+  std::error_code errcode;
+  fs::directory_iterator it(dir, errcode);
+  for (; !errcode && it != fs::directory_iterator(); it.increment(errcode)) {
+    // directory_entry caches the file type from readdir, no stat is needed.
+    std::error_code type_errcode;
+    bool is_dir = it->is_directory(type_errcode);
+    if (!is_dir && (!it->is_regular_file(type_errcode) ||
+                    is_temp_file(it->path().filename().native()))) {
+      continue;
+    }
+
+    std::string key = dir_key + it->path().filename().native();
+    if (is_dir) {
+      key.push_back('/');
+      // the keys under it start with key, so they can match the prefix and
+      // sort after start_after only if key does.
+      size_t n = std::min(key.size(), prefix.size());
+      if (key.compare(0, n, prefix.data(), n) != 0 ||
+          (key < start_after && !starts_with(start_after, key))) {
+        continue;
+      }
+    } else if (!starts_with(key, prefix) || key <= start_after) {
+      continue;
+    }
+    entries.push_back({std::move(key), it->path(), is_dir});
+  }
+  if (errcode) {
+    return errcode == std::errc::no_such_file_or_directory ? 0
+                                                            : errcode.value();
+  }
+
+  std::sort(entries.begin(), entries.end(),
+            [](const Entry &a, const Entry &b) { return a.key < b.key; });
+
+  bool stop = false;
+  for (auto &entry : entries) {
+    if (entry.is_dir) {
+      int ret = walk_objects(entry.path, entry.key, prefix, start_after,
+                             visitor, &stop);
+      if (ret != 0) {
+        return ret;
+      }
+    } else {
+      ObjectMeta meta;
+      meta.key = std::move(entry.key);
+      int ret = get_obj_meta_from_file(entry.path, meta);
+      if (ret == ENOENT) {
+        continue;
+      } else if (ret != 0) {
+        return ret;
+      }
+      stop = !visitor(meta);
+    }
+    if (stop) {
+      break;
+    }
+  }
+  if (stopped != nullptr) {
+    *stopped = stop;
+  }
+  return 0;
+}
+
+// whether an object is stored under dir, at any depth. a directory may be
+// left without one by a writer in progress, and the walk stops at the first
+// object. returns errno on failure.
+int holds_object(const fs::path &dir, const std::string &dir_key,
+                 bool &found) {
+  found = false;
+  return walk_objects(dir, dir_key, "", "", [&](ObjectMeta &) {
+    found = true;
+    return false;
+  });
+}
+
+// reads an object file through a descriptor opened once. writers rename new
+// files over the key, so the reader keeps the object it was opened on. the
+// page cache reads the chunks ahead of sequential reads by posix_fadvise(2),
+// the window doubles every time it is refreshed. a seek out of the window
+// turns the kernel read-ahead off until two reads in a row are contiguous.
+class LocalObjectReader : public ObjectReader {
+ public:
+  LocalObjectReader(int fd, size_t size, const ObjectReaderOptions &options)
+      : fd_(fd),
+        size_(size),
+        chunk_size_(std::max<size_t>(options.chunk_size, 1)),
+        read_ahead_(options.read_ahead),
+        max_read_ahead_(std::max(options.max_read_ahead, options.read_ahead)),
+        window_(options.read_ahead) {
+    ::posix_fadvise(fd_.get(), 0, 0, POSIX_FADV_SEQUENTIAL);
+  }
+
+  Status read(char *buf, size_t len, size_t &read_len) override {
+    read_len = 0;
+    if (pos_ >= size_) {
+      return Status();
+    }
+    if (sequential_) {
+      advise();
+    }
+    int ret = pread_full(fd_.get(), buf, std::min(len, size_ - pos_), pos_,
+                         read_len);
+    pos_ += read_len;
+    if (!sequential_ && read_len > 0) {
+      // the next read continues this one unless the reader seeks.
+      sequential_ = true;
+      advised_ = pos_;
+      ::posix_fadvise(fd_.get(), 0, 0, POSIX_FADV_SEQUENTIAL);
+    }
+    return ret != 0 ? Status(EIO, "read fail") : Status();
+  }
+
+  Status seek(size_t off) override {
+    if (off > size_) {
+      return Status(ERANGE, "offset out of range");
+    }
+    if (sequential_ && off >= pos_ && off < advised_) {
+      pos_ = off;
+      return Status();
+    }
+    pos_ = off;
+    sequential_ = false;
+    window_ = read_ahead_;
+    ::posix_fadvise(fd_.get(), 0, 0, POSIX_FADV_RANDOM);
+    return Status();
+  }
+
+  size_t size() const override { return size_; }
+
+ private:
+  // once less than a chunk is left ahead of the reader, ask for the chunks
+  // up to the window after the current one.
+  void advise() {
+    if (window_ == 0 || advised_ >= size_ ||
+        advised_ >= pos_ + chunk_size_) {
+      return;
+    }
+    const size_t start = std::max(advised_, pos_);
+    const size_t end = std::min(size_, pos_ + (window_ + 1) * chunk_size_);
+    ::posix_fadvise(fd_.get(), start, end - start, POSIX_FADV_WILLNEED);
+    if (advised_ > 0) {
+      window_ = std::min(window_ * 2, max_read_ahead_);
+    }
+    advised_ = end;
+  }
+
+ private:
+  ScopedFd fd_;
+  const size_t size_;
+  const size_t chunk_size_;
+  const size_t read_ahead_;
+  const size_t max_read_ahead_;
+  size_t window_;
+  size_t pos_{0};
+  // the page cache was asked to read up to here.
+  size_t advised_{0};
+  // whether the reads look sequential, which a reader is opened to be.
+  bool sequential_{true};
+};
+
 }  // anonymous namespace
 
+// appends to a temporary file which close() renames over the key. the key
+// lock is only taken by close(), so a slow writer never blocks the readers.
+class LocalObjectWriter : public ObjectWriter {
+ public:
+  LocalObjectWriter(LocalObjectStore &store, std::string bucket_path,
+                    std::string key_path, std::string tmp_path, int fd)
+      : store_(store),
+        bucket_path_(std::move(bucket_path)),
+        key_path_(std::move(key_path)),
+        tmp_path_(std::move(tmp_path)),
+        fd_(fd) {}
+  ~LocalObjectWriter() override { abort(); }
+
+  Status write(const std::string_view &data) override {
+    if (fd_.get() < 0) {
+      return Status(EINVAL, "writer is closed");
+    }
+    int ret = store_.checksums_
+                  ? write_checksummed(fd_.get(), data.data(), data.size(),
+                                      crc_)
+                  : write_full(fd_.get(), data.data(), data.size());
+    if (ret != 0) {
+      abort();
+      return Status(EIO, "write fail");
+    }
+    return Status();
+  }
+
+  Status close() override {
+    if (fd_.get() < 0) {
+      return Status(EINVAL, "writer is closed");
+    }
+    fd_.reset();
+    const std::shared_lock<std::shared_mutex> bucket_lock(
+        store_.bucket_mutex_);
+    Status status;
+    if (store_.checksums_) {
+      int ret = set_file_crc32c(tmp_path_, crc_);
+      if (ret != 0) {
+        ::unlink(tmp_path_.c_str());
+        status = Status(ret, std::generic_category().message(ret));
+      }
+    }
+    if (status.is_succ()) {
+      const std::lock_guard<std::shared_mutex> key_lock(
+          store_.key_mutex(key_path_));
+      status = store_.commit_temp_file(tmp_path_, key_path_);
+    }
+    if (!status.is_succ()) {
+      store_.prune_dirs(bucket_path_, key_path_);
+    }
+    return status;
+  }
+
+  void abort() override {
+    if (fd_.get() >= 0) {
+      fd_.reset();
+      ::unlink(tmp_path_.c_str());
+      const std::shared_lock<std::shared_mutex> bucket_lock(
+          store_.bucket_mutex_);
+      store_.prune_dirs(bucket_path_, key_path_);
+    }
+  }
+
+ private:
+  LocalObjectStore &store_;
+  const std::string bucket_path_;
+  const std::string key_path_;
+  const std::string tmp_path_;
+  // the temporary file, closed once the writer is closed or aborted.
+  ScopedFd fd_;
+  // the crc32c of the bytes written, if the store checksums them.
+  uint32_t crc_{0};
+};
+
 Status LocalObjectStore::create_bucket(const std::string_view &bucket) {
-  const std::lock_guard<std::mutex> _(mutex_);
+  const std::lock_guard<std::shared_mutex> _(bucket_mutex_);
 
   if (!is_valid_key(bucket)) {
     return Status(EINVAL, "invalid bucket");
@@ -73,7 +742,7 @@ Status LocalObjectStore::create_bucket(const std::string_view &bucket) {
 }
 
 Status LocalObjectStore::delete_bucket(const std::string_view &bucket) {
-  const std::lock_guard<std::mutex> _(mutex_);
+  const std::lock_guard<std::shared_mutex> _(bucket_mutex_);
 
   if (!is_valid_key(bucket)) {
     return Status(EINVAL, "invalid bucket");
@@ -86,129 +755,369 @@ Status LocalObjectStore::delete_bucket(const std::string_view &bucket) {
 Status LocalObjectStore::put_object_from_file(
     const std::string_view &bucket, const std::string_view &key,
     const std::string_view &data_file_path) {
-  const std::lock_guard<std::mutex> _(mutex_);
-
   if (!is_valid_key(key)) {
     return Status(EINVAL, "invalid key");
   }
 
   std::string key_path = generate_path(bucket, key);
-  // key may contains '/', so if its parent directory does not exists, we create
-  // for it.
-  int ret = mkdir_p(fs::path(key_path).parent_path().native());
-  assert(!ret);
-  std::error_code errcode;
-  fs::copy(data_file_path, key_path, fs::copy_options::overwrite_existing,
-           errcode);
-  return Status(errcode.value(), errcode.message());
+  const std::shared_lock<std::shared_mutex> bucket_lock(bucket_mutex_);
+  const std::lock_guard<std::shared_mutex> key_lock(key_mutex(key_path));
+
+  return write_object_file(bucket, key_path, [&](const std::string &tmp_path) {
+    uint32_t crc = 0;
+    int ret = copy_file(std::string(data_file_path), tmp_path,
+                        checksums_ ? &crc : nullptr);
+    if (ret == 0 && checksums_) {
+      ret = set_file_crc32c(tmp_path, crc);
+    }
+    return Status(ret, std::generic_category().message(ret));
+  });
 }
 
 Status LocalObjectStore::get_object_to_file(
     const std::string_view &bucket, const std::string_view &key,
     const std::string_view &output_file_path) {
-  const std::lock_guard<std::mutex> _(mutex_);
-
   if (!is_valid_key(key)) {
     return Status(EINVAL, "invalid key");
   }
 
   std::string key_path = generate_path(bucket, key);
-  std::error_code errcode;
-  fs::copy(key_path, output_file_path, fs::copy_options::overwrite_existing,
-           errcode);
-  return Status(errcode.value(), errcode.message());
+  const std::shared_lock<std::shared_mutex> bucket_lock(bucket_mutex_);
+  const std::shared_lock<std::shared_mutex> key_lock(key_mutex(key_path));
+
+  uint32_t crc = 0;
+  int ret = copy_file(key_path, std::string(output_file_path),
+                      checksums_ ? &crc : nullptr);
+  uint32_t expected = 0;
+  if (ret == 0 && checksums_ && get_file_crc32c(key_path, expected) &&
+      crc != expected) {
+    return Status(EBADMSG, "crc32c mismatch");
+  }
+  return Status(ret, std::generic_category().message(ret));
 }
 
 Status LocalObjectStore::put_object(const std::string_view &bucket,
                                     const std::string_view &key,
                                     const std::string_view &data) {
-  const std::lock_guard<std::mutex> _(mutex_);
-
   if (!is_valid_key(key)) {
     return Status(EINVAL, "invalid key");
   }
 
   std::string key_path = generate_path(bucket, key);
-  // key may contains '/', so if its parent directory does not exists, we create
-  // for it.
-  int ret = mkdir_p(fs::path(key_path).parent_path().native());
-  assert(!ret);
-  std::ofstream output_file(key_path, std::ios::binary | std::ios::trunc);
-  if (!output_file) {
-    return Status(EIO, "Couldn't open file");
-  }
+  const std::shared_lock<std::shared_mutex> bucket_lock(bucket_mutex_);
+  const std::lock_guard<std::shared_mutex> key_lock(key_mutex(key_path));
 
-  bool fail = !output_file.write(data.data(), data.size());
-  output_file.close();
-  return fail ? Status(EIO, "write fail") : Status();
+  return write_object_file(bucket, key_path, [&](const std::string &tmp_path) {
+    ScopedFd fd(::open(tmp_path.c_str(), O_WRONLY | O_CLOEXEC));
+    if (fd.get() < 0) {
+      return Status(EIO, "Couldn't open file");
+    }
+    if (!checksums_) {
+      int ret = write_full(fd.get(), data.data(), data.size());
+      return ret != 0 ? Status(EIO, "write fail") : Status();
+    }
+    uint32_t crc = 0;
+    int ret = write_checksummed(fd.get(), data.data(), data.size(), crc);
+    if (ret != 0) {
+      return Status(EIO, "write fail");
+    }
+    ret = set_file_crc32c(tmp_path, crc);
+    return Status(ret, std::generic_category().message(ret));
+  });
 }
 
 Status LocalObjectStore::get_object(const std::string_view &bucket,
                                     const std::string_view &key,
                                     std::string &body) {
-  const std::lock_guard<std::mutex> _(mutex_);
-
   if (!is_valid_key(key)) {
     return Status(EINVAL, "invalid key");
   }
 
   std::string key_path = generate_path(bucket, key);
-  std::ifstream input_file(key_path, std::ios::binary);
-  if (!input_file) {
-    return Status(EIO, "Couldn't open file");
-  }
+  const std::shared_lock<std::shared_mutex> bucket_lock(bucket_mutex_);
+  const std::shared_lock<std::shared_mutex> key_lock(key_mutex(key_path));
 
-  input_file.seekg(0, std::ios::end);
-  std::streamsize fileSize = input_file.tellg();
-  input_file.seekg(0, std::ios::beg);
+  ScopedFd fd;
+  size_t file_size = 0;
+  Status status = open_object_file(key_path, fd, file_size);
+  if (!status.is_succ()) {
+    return status;
+  }
 
-  body.resize(fileSize);
-  bool fail = !input_file.read(body.data(), body.size());
-  input_file.close();
-  return fail ? Status(EIO, "read fail") : Status();
+  body.resize(file_size);
+  size_t read_len = 0;
+  int ret = checksums_ ? read_verified(fd.get(), key_path, body.data(),
+                                       file_size, read_len)
+                       : pread_full(fd.get(), body.data(), file_size, 0,
+                                    read_len);
+  body.resize(read_len);
+  return read_status(ret);
 }
 
 Status LocalObjectStore::get_object(const std::string_view &bucket,
                                     const std::string_view &key, size_t off,
                                     size_t len, std::string &body) {
-  const std::lock_guard<std::mutex> _(mutex_);
+  body.resize(len);
+  size_t read_len = 0;
+  Status status = get_object(bucket, key, off, len, body.data(), read_len);
+  body.resize(read_len);
+  return status;
+}
 
+Status LocalObjectStore::get_object(const std::string_view &bucket,
+                                    const std::string_view &key, char *buf,
+                                    size_t buf_size, size_t &body_size) {
   if (!is_valid_key(key)) {
     return Status(EINVAL, "invalid key");
   }
 
   std::string key_path = generate_path(bucket, key);
-  std::ifstream input_file(key_path, std::ios::binary);
-  if (!input_file) {
-    return Status(EIO, "Couldn't open file");
+  const std::shared_lock<std::shared_mutex> bucket_lock(bucket_mutex_);
+  const std::shared_lock<std::shared_mutex> key_lock(key_mutex(key_path));
+
+  ScopedFd fd;
+  Status status = open_object_file(key_path, fd, body_size);
+  if (!status.is_succ()) {
+    return status;
+  }
+  if (body_size > buf_size) {
+    return Status(ENOBUFS, "buffer too small to hold the object");
+  }
+
+  size_t read_len = 0;
+  int ret = checksums_
+                ? read_verified(fd.get(), key_path, buf, body_size, read_len)
+                : pread_full(fd.get(), buf, body_size, 0, read_len);
+  body_size = read_len;
+  return read_status(ret);
+}
+
+Status LocalObjectStore::get_object(const std::string_view &bucket,
+                                    const std::string_view &key, size_t off,
+                                    size_t len, char *buf, size_t &read_len) {
+  read_len = 0;
+  if (!is_valid_key(key)) {
+    return Status(EINVAL, "invalid key");
+  }
+
+  std::string key_path = generate_path(bucket, key);
+  const std::shared_lock<std::shared_mutex> bucket_lock(bucket_mutex_);
+  const std::shared_lock<std::shared_mutex> key_lock(key_mutex(key_path));
+
+  ScopedFd fd;
+  size_t file_size = 0;
+  Status status = open_object_file(key_path, fd, file_size);
+  if (!status.is_succ()) {
+    return status;
+  }
+  if (off >= file_size) {
+    return Status(ERANGE, "offset out of range");
   }
 
-  input_file.seekg(0, std::ios::end);
-  std::streamsize fileSize = input_file.tellg();
-  if (off >= fileSize) {
+  int ret = pread_full(fd.get(), buf, std::min(len, file_size - off), off,
+                       read_len);
+  return ret != 0 ? Status(EIO, "read fail") : Status();
+}
+
+Status LocalObjectStore::get_object_buffer(
+    const std::string_view &bucket, const std::string_view &key,
+    AccessPattern access, std::shared_ptr<const ObjectBuffer> &buffer) {
+  return map_object(bucket, key, nullptr, access, buffer);
+}
+
+Status LocalObjectStore::get_object_buffer(
+    const std::string_view &bucket, const std::string_view &key, size_t off,
+    size_t len, AccessPattern access,
+    std::shared_ptr<const ObjectBuffer> &buffer) {
+  const Range range{off, len};
+  return map_object(bucket, key, &range, access, buffer);
+}
+
+Status LocalObjectStore::map_object(
+    const std::string_view &bucket, const std::string_view &key,
+    const Range *range, AccessPattern access,
+    std::shared_ptr<const ObjectBuffer> &buffer) {
+  if (!is_valid_key(key)) {
+    return Status(EINVAL, "invalid key");
+  }
+
+  std::string key_path = generate_path(bucket, key);
+  const std::shared_lock<std::shared_mutex> bucket_lock(bucket_mutex_);
+  const std::shared_lock<std::shared_mutex> key_lock(key_mutex(key_path));
+
+  ScopedFd fd;
+  size_t file_size = 0;
+  Status status = open_object_file(key_path, fd, file_size);
+  if (!status.is_succ()) {
+    return status;
+  }
+  const size_t off = range != nullptr ? range->off : 0;
+  if (range != nullptr && off >= file_size) {
     return Status(ERANGE, "offset out of range");
   }
+  const size_t len =
+      range != nullptr ? std::min(range->len, file_size - off) : file_size;
+  if (len == 0) {
+    // mmap() refuses empty mappings.
+    buffer = std::make_shared<MappedObjectBuffer>(nullptr, 0, 0, 0);
+    return Status();
+  }
 
-  input_file.seekg(off);
-  body.resize(len);
-  bool fail = !input_file.read(body.data(), len);
-  body.resize(input_file.gcount());
-  if (input_file.eof() && input_file.gcount() > 0) {
-    fail = false;
+  static const size_t page_size = ::sysconf(_SC_PAGESIZE);
+  const size_t map_off = off / page_size * page_size;
+  const size_t map_len = off - map_off + len;
+  void *addr = ::mmap(nullptr, map_len, PROT_READ, MAP_SHARED, fd.get(),
+                      static_cast<off_t>(map_off));
+  if (addr == MAP_FAILED) {
+    return Status(errno, std::generic_category().message(errno));
+  }
+  if (access != AccessPattern::kNormal) {
+    ::madvise(addr, map_len, madvise_flag(access));
   }
-  input_file.close();
-  return fail ? Status(EIO, "read fail") : Status();
+  // the mapping holds the file open, the descriptor is closed on return.
+  buffer = std::make_shared<MappedObjectBuffer>(addr, map_len, off - map_off,
+                                                len);
+  return Status();
+}
+
+Status LocalObjectStore::get_ranges(const std::string_view &bucket,
+                                    const std::string_view &key,
+                                    const std::vector<Range> &ranges,
+                                    size_t max_gap,
+                                    std::vector<std::string> &bodies) {
+  bodies.assign(ranges.size(), std::string());
+  if (!is_valid_key(key)) {
+    return Status(EINVAL, "invalid key");
+  }
+
+  std::string key_path = generate_path(bucket, key);
+  const std::shared_lock<std::shared_mutex> bucket_lock(bucket_mutex_);
+  const std::shared_lock<std::shared_mutex> key_lock(key_mutex(key_path));
+
+  ScopedFd fd;
+  size_t file_size = 0;
+  Status status = open_object_file(key_path, fd, file_size);
+  if (!status.is_succ()) {
+    return status;
+  }
+  for (size_t i = 0; i < ranges.size(); ++i) {
+    if (ranges[i].len == 0) {
+      continue;
+    }
+    if (ranges[i].off >= file_size) {
+      return Status(ERANGE, "offset out of range");
+    }
+    bodies[i].resize(std::min(ranges[i].len, file_size - ranges[i].off));
+  }
+
+  // read every span by one preadv() straight into the bodies, the gaps go to
+  // a scratch buffer. a range overlapping the ones before it is read apart.
+  PooledBuffer gap_buf;
+  std::vector<size_t> overlapped;
+  std::vector<struct iovec> iov;
+  for (const RangeSpan &span : coalesce_ranges(ranges, max_gap)) {
+    iov.clear();
+    size_t pos = span.off;
+    size_t max_gap_len = 0;
+    for (size_t index : span.indexes) {
+      const size_t off = ranges[index].off;
+      if (off < pos) {
+        overlapped.push_back(index);
+        continue;
+      }
+      if (off > pos) {
+        iov.push_back({nullptr, off - pos});
+        max_gap_len = std::max(max_gap_len, off - pos);
+      }
+      iov.push_back({bodies[index].data(), bodies[index].size()});
+      pos = off + bodies[index].size();
+    }
+    if (gap_buf.size() < max_gap_len) {
+      gap_buf = PooledBuffer(max_gap_len);
+    }
+    for (auto &vec : iov) {
+      if (vec.iov_base == nullptr) {
+        vec.iov_base = gap_buf.data();
+      }
+    }
+
+    size_t read_len = 0;
+    int ret = preadv_full(fd.get(), iov, span.off, read_len);
+    if (ret != 0 || read_len != pos - span.off) {
+      return Status(EIO, "read fail");
+    }
+  }
+  for (size_t index : overlapped) {
+    size_t read_len = 0;
+    int ret = pread_full(fd.get(), bodies[index].data(), bodies[index].size(),
+                         ranges[index].off, read_len);
+    if (ret != 0 || read_len != bodies[index].size()) {
+      return Status(EIO, "read fail");
+    }
+  }
+  return Status();
+}
+
+Status LocalObjectStore::open_object_writer(
+    const std::string_view &bucket, const std::string_view &key,
+    std::unique_ptr<ObjectWriter> &writer) {
+  if (!is_valid_key(key)) {
+    return Status(EINVAL, "invalid key");
+  }
+
+  std::string bucket_path = generate_path(bucket);
+  std::string key_path = generate_path(bucket, key);
+  const std::shared_lock<std::shared_mutex> bucket_lock(bucket_mutex_);
+  std::string tmp_path;
+  Status status = create_temp_file(key_path, tmp_path);
+  if (!status.is_succ()) {
+    prune_dirs(bucket_path, key_path);
+    return status;
+  }
+  int fd = ::open(tmp_path.c_str(), O_WRONLY | O_CLOEXEC);
+  if (fd < 0) {
+    ::unlink(tmp_path.c_str());
+    prune_dirs(bucket_path, key_path);
+    return Status(EIO, "Couldn't open file");
+  }
+  writer = std::make_unique<LocalObjectWriter>(
+      *this, std::move(bucket_path), std::move(key_path), std::move(tmp_path),
+      fd);
+  return Status();
+}
+
+Status LocalObjectStore::open_object_reader(
+    const std::string_view &bucket, const std::string_view &key,
+    const ObjectReaderOptions &options,
+    std::unique_ptr<ObjectReader> &reader) {
+  if (!is_valid_key(key)) {
+    return Status(EINVAL, "invalid key");
+  }
+
+  std::string key_path = generate_path(bucket, key);
+  const std::shared_lock<std::shared_mutex> bucket_lock(bucket_mutex_);
+  const std::shared_lock<std::shared_mutex> key_lock(key_mutex(key_path));
+
+  ScopedFd fd;
+  size_t file_size = 0;
+  Status status = open_object_file(key_path, fd, file_size);
+  if (!status.is_succ()) {
+    return status;
+  }
+  reader = std::make_unique<LocalObjectReader>(fd.release(), file_size,
+                                               options);
+  return Status();
 }
 
 Status LocalObjectStore::get_object_meta(const std::string_view &bucket,
                                          const std::string_view &key,
                                          ObjectMeta &meta) {
-  const std::lock_guard<std::mutex> _(mutex_);
-
   if (!is_valid_key(key)) {
     return Status(EINVAL, "invalid key");
   }
   fs::path key_path = fs::path(generate_path(bucket, key));
+  const std::shared_lock<std::shared_mutex> bucket_lock(bucket_mutex_);
+  const std::shared_lock<std::shared_mutex> key_lock(key_mutex(key_path));
 
   int ret = get_obj_meta_from_file(key_path, meta);
   if (ret != 0) {
@@ -223,78 +1132,318 @@ Status LocalObjectStore::get_object_meta(const std::string_view &bucket,
 }
 
 Status LocalObjectStore::list_object(const std::string_view &bucket,
-                                     const std::string_view &prefix
-                                     [[maybe_unused]],
+                                     const std::string_view &prefix,
                                      std::vector<ObjectMeta> &objects) {
-  const std::lock_guard<std::mutex> _(mutex_);
+  const std::shared_lock<std::shared_mutex> bucket_lock(bucket_mutex_);
 
-  std::string bucket_path = generate_path(bucket);
   objects.clear();
-  for (const auto &entry : fs::recursive_directory_iterator(bucket_path)) {
-    if (fs::is_directory(entry)) {
-      // when we encounter an dir, it should have some child, otherwise there
-      // is some error.
-      assert(!is_dir_empty(std::string_view(entry.path().c_str())));
-    } else if (fs::is_regular_file(entry)) {
+  int ret = walk_objects(generate_path(bucket), "", prefix, "",
+                         [&objects](ObjectMeta &meta) {
+                           objects.push_back(std::move(meta));
+                           return true;
+                         });
+  if (ret != 0) {
+    return Status(ret, std::generic_category().message(ret));
+  }
+  return Status();
+}
+
+Status LocalObjectStore::list_object(const std::string_view &bucket,
+                                     const std::string_view &prefix,
+                                     const std::string_view &continuation_token,
+                                     size_t max_keys,
+                                     std::vector<ObjectMeta> &objects,
+                                     std::string &next_continuation_token) {
+  const std::shared_lock<std::shared_mutex> bucket_lock(bucket_mutex_);
+
+  // the continuation token is simply the last key of the previous page.
+  const size_t limit = max_keys == 0 ? kDefaultMaxKeys : max_keys;
+  bool truncated = false;
+  objects.clear();
+  next_continuation_token.clear();
+  int ret = walk_objects(generate_path(bucket), "", prefix, continuation_token,
+                         [&](ObjectMeta &meta) {
+                           if (objects.size() == limit) {
+                             truncated = true;
+                             return false;
+                           }
+                           objects.push_back(std::move(meta));
+                           return true;
+                         });
+  if (ret != 0) {
+    return Status(ret, std::generic_category().message(ret));
+  }
+  if (truncated) {
+    next_continuation_token = objects.back().key;
+  }
+  return Status();
+}
+
+Status LocalObjectStore::list_object(
+    const std::string_view &bucket, const std::string_view &prefix,
+    const std::string_view &delimiter, std::vector<ObjectMeta> &objects,
+    std::vector<std::string> &common_prefixes) {
+  const std::shared_lock<std::shared_mutex> bucket_lock(bucket_mutex_);
+
+  objects.clear();
+  common_prefixes.clear();
+  const std::string bucket_path = generate_path(bucket);
+  if (delimiter != "/") {
+    // keys are not stored by other delimiters, roll them up from the walk,
+    // the keys of one common prefix are adjacent in key order.
+    int ret = walk_objects(
+        bucket_path, "", prefix, "", [&](ObjectMeta &meta) {
+          size_t pos = delimiter.empty()
+                           ? std::string::npos
+                           : meta.key.find(delimiter, prefix.size());
+          if (pos == std::string::npos) {
+            objects.push_back(std::move(meta));
+          } else {
+            std::string common_prefix =
+                meta.key.substr(0, pos + delimiter.size());
+            if (common_prefixes.empty() ||
+                common_prefixes.back() != common_prefix) {
+              common_prefixes.push_back(std::move(common_prefix));
+            }
+          }
+          return true;
+        });
+    if (ret != 0) {
+      return Status(ret, std::generic_category().message(ret));
+    }
+    return Status();
+  }
+
+  // with '/', the common prefixes are the sub-directories of the directory
+  // holding prefix, so a single readdir of it is enough.
+  const size_t slash = prefix.rfind('/');
+  const std::string dir_key(
+      prefix.substr(0, slash == std::string_view::npos ? 0 : slash + 1));
+  const std::string_view name_prefix = prefix.substr(dir_key.size());
+
+  std::error_code errcode;
+  fs::directory_iterator it(bucket_path + "/" + dir_key, errcode);
+  for (; !errcode && it != fs::directory_iterator(); it.increment(errcode)) {
+    const std::string name = it->path().filename().native();
+    if (!starts_with(name, name_prefix)) {
+      continue;
+    }
+    std::error_code type_errcode;
+    if (it->is_directory(type_errcode)) {
+      // like the flat listing, a directory holding no object yet is not
+      // listed.
+      std::string common_prefix = dir_key + name + "/";
+      bool found = false;
+      int ret = holds_object(it->path(), common_prefix, found);
+      if (ret != 0) {
+        return Status(ret, std::generic_category().message(ret));
+      }
+      if (found) {
+        common_prefixes.push_back(std::move(common_prefix));
+      }
+    } else if (it->is_regular_file(type_errcode) && !is_temp_file(name)) {
       ObjectMeta meta;
-      // use lexically_relative() to remove the bucket prefix
-      // example: entry: bucket/key_prefix_dir/key -> key_prefix_dir/key
-      meta.key = entry.path().lexically_relative(bucket_path).c_str();
-      if (prefix.size() > 0 && std::string_view(meta.key).find(prefix) != 0) {
+      meta.key = dir_key + name;
+      int ret = get_obj_meta_from_file(it->path(), meta);
+      if (ret == ENOENT) {
         continue;
-      }
-      int ret = get_obj_meta_from_file(entry.path(), meta);
-      if (ret != 0) {
+      } else if (ret != 0) {
         return Status(ret, "fail to get object meta");
       }
-      objects.push_back(meta);
+      objects.push_back(std::move(meta));
     }
   }
+  if (errcode && errcode != std::errc::no_such_file_or_directory) {
+    return Status(errcode.value(), errcode.message());
+  }
+
+  std::sort(objects.begin(), objects.end(),
+            [](const ObjectMeta &a, const ObjectMeta &b) {
+              return a.key < b.key;
+            });
+  std::sort(common_prefixes.begin(), common_prefixes.end());
   return Status();
 }
 
 Status LocalObjectStore::delete_object(const std::string_view &bucket,
                                        const std::string_view &key) {
-  const std::lock_guard<std::mutex> _(mutex_);
-
   if (!is_valid_key(key)) {
     return Status(EINVAL, "invalid key");
   }
 
   const std::string key_path_str = generate_path(bucket, key);
   const std::string bucket_path_str = generate_path(bucket);
-  bool key_parent = false;
+  const std::shared_lock<std::shared_mutex> bucket_lock(bucket_mutex_);
+  {
+    const std::lock_guard<std::shared_mutex> key_lock(key_mutex(key_path_str));
+    // deleting a non-existing key succeeds, just like s3.
+    std::error_code errcode;
+    fs::remove(key_path_str, errcode);
+    if (errcode.value() != 0) {
+      return Status(errcode.value(), errcode.message());
+    }
+  }
 
-  fs::path key_path = fs::path(key_path_str);
-  while (key_path.native().size() > bucket_path_str.size()) {
-    assert(fs::is_directory(key_path) == key_parent);
-    int ret = rm_f(key_path.c_str());
-    if (ret != 0) {
-      if (key_parent) {
-        // delete the child file successfully, but failed to delete the parent.
-        abort();
-      } else {
-        return Status(ret, std::generic_category().message(ret));
+  // if this entry is the last entry in the parent directory, we need to
+  // remove the parent directory in a recursive way.
+  prune_dirs(bucket_path_str, key_path_str);
+  return Status();
+}
+
+Status LocalObjectStore::delete_objects(const std::string_view &bucket,
+                                        const std::vector<std::string> &keys,
+                                        std::vector<Status> &results) {
+  results.assign(keys.size(), Status());
+  Status first_failure;
+  // every directory which may become empty, a directory sorts before all the
+  // paths below it, so the reverse order visits children first.
+  std::set<std::string> dirs;
+
+  const std::string bucket_path_str = generate_path(bucket);
+  const std::shared_lock<std::shared_mutex> bucket_lock(bucket_mutex_);
+  for (size_t i = 0; i < keys.size(); ++i) {
+    if (!is_valid_key(keys[i])) {
+      results[i] = Status(EINVAL, "invalid key");
+    } else {
+      const std::string key_path_str = generate_path(bucket, keys[i]);
+      {
+        const std::lock_guard<std::shared_mutex> key_lock(
+            key_mutex(key_path_str));
+        std::error_code errcode;
+        fs::remove(key_path_str, errcode);
+        if (errcode.value() != 0) {
+          results[i] = Status(errcode.value(), errcode.message());
+        }
       }
+      fs::path dir = fs::path(key_path_str).parent_path();
+      while (dir.native().size() > bucket_path_str.size() &&
+             dirs.insert(dir.native()).second) {
+        dir = dir.parent_path();
+      }
+    }
+    if (first_failure.is_succ() && !results[i].is_succ()) {
+      first_failure = results[i];
     }
+  }
 
-    key_path = key_path.parent_path();
-    key_parent = true;
+  // prune the directories once for the whole batch, instead of once per key.
+  for (auto it = dirs.rbegin(); it != dirs.rend(); ++it) {
+    const std::lock_guard<std::shared_mutex> dir_lock(dir_mutex(*it));
+    std::error_code errcode;
+    fs::remove(*it, errcode);
+  }
+  return first_failure;
+}
 
-    // if this entry is the last entry in the parent directory, we need to
-    // remove the parent directory in a recursive way.
-    if (!is_dir_empty(std::string_view(key_path.c_str()))) {
-      break;
+Status LocalObjectStore::write_object_file(
+    const std::string_view &bucket, const std::string &key_path,
+    const std::function<Status(const std::string &tmp_path)> &fill) {
+  std::string tmp_path;
+  Status status = create_temp_file(key_path, tmp_path);
+  if (status.is_succ()) {
+    status = fill(tmp_path);
+    if (status.is_succ()) {
+      status = commit_temp_file(tmp_path, key_path);
+    } else {
+      ::unlink(tmp_path.c_str());
     }
   }
+  // a failed put leaves no directory behind which it created.
+  if (!status.is_succ()) {
+    prune_dirs(generate_path(bucket), key_path);
+  }
+  return status;
+}
+
+Status LocalObjectStore::create_temp_file(const std::string &key_path,
+                                          std::string &tmp_path) {
+  const std::string dir_path = fs::path(key_path).parent_path().native();
+  tmp_path = temp_file_path(key_path);
+  const std::shared_lock<std::shared_mutex> dir_lock(dir_mutex(dir_path));
+  // key may contains '/', so if its parent directory does not exists, we
+  // create for it. the temporary file then keeps it from being pruned. the
+  // lock keeps dir_path itself, but not its parents, from being pruned
+  // meanwhile, so a parent removed under mkdir_p() is created again.
+  int ret = 0;
+  do {
+    ret = mkdir_p(dir_path);
+  } while (ret == ENOENT);
+  if (ret != 0) {
+    return Status(ret, std::generic_category().message(ret));
+  }
+  ScopedFd fd(::open(tmp_path.c_str(),
+                     O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0644));
+  if (fd.get() < 0) {
+    return Status(EIO, "Couldn't open file");
+  }
   return Status();
 }
 
+Status LocalObjectStore::commit_temp_file(const std::string &tmp_path,
+                                          const std::string &key_path) {
+  // the body has to be durable before the rename is, or a crash could leave
+  // a renamed but empty object behind.
+  Status status;
+  if (durability_ == Durability::kPerObject) {
+    int ret = sync_path(tmp_path, false);
+    if (ret != 0) {
+      status = Status(ret, std::generic_category().message(ret));
+    }
+  } else if (durability_ == Durability::kGroupCommit) {
+    status = committer_->sync();
+  }
+  if (!status.is_succ()) {
+    ::unlink(tmp_path.c_str());
+    return status;
+  }
+
+  // readers see the old object or the new one, never a half-written one.
+  if (::rename(tmp_path.c_str(), key_path.c_str()) != 0) {
+    int ret = errno;
+    ::unlink(tmp_path.c_str());
+    return Status(ret, std::generic_category().message(ret));
+  }
+  if (durability_ == Durability::kPerObject) {
+    const std::string dir_path = fs::path(key_path).parent_path().native();
+    int ret = sync_path(dir_path, true);
+    if (ret != 0) {
+      return Status(ret, std::generic_category().message(ret));
+    }
+  } else if (durability_ == Durability::kGroupCommit) {
+    return committer_->sync();
+  }
+  return Status();
+}
+
+void LocalObjectStore::prune_dirs(const std::string &bucket_path,
+                                  const std::string &key_path) {
+  // fs::remove() only removes an empty directory, so the pruning stops at
+  // the first one still in use. the keys right in the bucket prune nothing
+  // and take no lock.
+  fs::path dir = fs::path(key_path).parent_path();
+  while (dir.native().size() > bucket_path.size()) {
+    const std::lock_guard<std::shared_mutex> dir_lock(dir_mutex(dir.native()));
+    std::error_code errcode;
+    if (!fs::remove(dir, errcode)) {
+      break;
+    }
+    dir = dir.parent_path();
+  }
+}
+
 bool LocalObjectStore::is_valid_key(const std::string_view &key) {
   // key in s3, should be no more than 1024 bytes.
   return key.size() > 0 && key.size() <= 1024;
 }
 
+std::shared_mutex &LocalObjectStore::key_mutex(const std::string &key_path) {
+  return key_mutexes_[std::hash<std::string>()(key_path) % kKeyLockStripes];
+}
+
+std::shared_mutex &LocalObjectStore::dir_mutex(const std::string &dir_path) {
+  return dir_mutexes_[std::hash<std::string>()(dir_path) % kDirLockStripes];
+}
+
 std::string LocalObjectStore::generate_path(const std::string_view &bucket) {
   return std::string(basepath_) + "/" + std::string(bucket);
 }
@@ -306,17 +1455,91 @@ std::string LocalObjectStore::generate_path(const std::string_view &bucket,
          std::string(key_buf);
 }
 
+GroupCommitter::GroupCommitter(const std::string &path)
+    : fd_(::open(path.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC)),
+      flusher_([this]() { run(); }) {}
+
+GroupCommitter::~GroupCommitter() {
+  {
+    const std::lock_guard<std::mutex> _(mutex_);
+    stop_ = true;
+  }
+  pending_cv_.notify_one();
+  flusher_.join();
+  if (fd_ >= 0) {
+    ::close(fd_);
+  }
+}
+
+Status GroupCommitter::sync() {
+  if (fd_ < 0) {
+    return Status(EIO, "Couldn't open the directory to sync");
+  }
+
+  std::unique_lock<std::mutex> lock(mutex_);
+  if (pending_ == nullptr) {
+    pending_ = std::make_shared<Round>();
+    pending_cv_.notify_one();
+  }
+  const std::shared_ptr<Round> round = pending_;
+  done_cv_.wait(lock, [&round]() { return round->done; });
+  if (round->error != 0) {
+    return Status(round->error, std::generic_category().message(round->error));
+  }
+  return Status();
+}
+
+void GroupCommitter::run() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  while (true) {
+    pending_cv_.wait(lock, [this]() { return stop_ || pending_ != nullptr; });
+    if (pending_ == nullptr) {
+      return;
+    }
+    // the writers arriving during the sync wait for the next round, their
+    // writes may have missed this one.
+    const std::shared_ptr<Round> round = std::move(pending_);
+    pending_ = nullptr;
+    lock.unlock();
+    int error = ::syncfs(fd_) != 0 ? errno : 0;
+    lock.lock();
+    round->done = true;
+    round->error = error;
+    done_cv_.notify_all();
+  }
+}
+
+LocalObjectStore::LocalObjectStore(const std::string_view basepath,
+                                   const ObjectStoreOptions &options)
+    : basepath_(basepath),
+      durability_(options.local_durability),
+      checksums_(options.enable_checksums && has_user_xattrs(basepath_)) {
+  if (durability_ == Durability::kGroupCommit) {
+    committer_ = std::make_unique<GroupCommitter>(basepath_);
+  }
+}
+
+LocalCopyStats get_local_copy_stats() {
+  LocalCopyStats stats;
+  stats.reflink = g_reflink_copies;
+  stats.copy_file_range = g_copy_file_range_copies;
+  stats.sendfile = g_sendfile_copies;
+  stats.userspace = g_userspace_copies;
+  return stats;
+}
+
 LocalObjectStore *create_local_objstore(const std::string_view region,
                                         const std::string_view *endpoint
                                         [[maybe_unused]],
-                                        bool use_https [[maybe_unused]]) {
+                                        bool use_https [[maybe_unused]],
+                                        const ObjectStoreOptions &options) {
   int ret = mkdir_p(region);
   if (ret != 0) {
     return nullptr;
   }
 
-  LocalObjectStore *lobs =
-      new LocalObjectStore(region /* use region parameter as basepath */);
+  LocalObjectStore *lobs = new LocalObjectStore(
+      region /* use region parameter as basepath */, options);
 
   if (lobs == nullptr) {
     rm_f(region);
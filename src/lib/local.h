@@ -1,18 +1,62 @@
 #ifndef MY_OBJSTORE_LOCAL_H_INCLUDED
 #define MY_OBJSTORE_LOCAL_H_INCLUDED
 
+#include <array>
+#include <condition_variable>
+#include <memory>
 #include <mutex>
+#include <shared_mutex>
+#include <thread>
 
 #include "objstore.h"
 
 namespace objstore {
 
+// batches the syncs of many writers into one syncfs(2) of the file system
+// holding path. a writer waits for the next sync of a background flusher,
+// which serves all the writers waiting when it starts, so the number of
+// syncs stays low however many writers there are.
+class GroupCommitter {
+ public:
+  explicit GroupCommitter(const std::string &path);
+  ~GroupCommitter();
+
+  GroupCommitter(const GroupCommitter &) = delete;
+  GroupCommitter &operator=(const GroupCommitter &) = delete;
+
+  // block until everything written before the call is durable.
+  Status sync();
+
+ private:
+  struct Round {
+    bool done{false};
+    int error{0};
+  };
+
+  void run();
+
+ private:
+  int fd_;
+  std::mutex mutex_;
+  std::condition_variable pending_cv_;
+  std::condition_variable done_cv_;
+  // the round the writers arriving now wait for, nullptr if none is waiting.
+  std::shared_ptr<Round> pending_;
+  bool stop_{false};
+  std::thread flusher_;
+};
+
 class LocalObjectStore : public ObjectStore {
  public:
-  explicit LocalObjectStore(const std::string_view basepath)
-      : basepath_(basepath) {}
+  LocalObjectStore(const std::string_view basepath,
+                   const ObjectStoreOptions &options);
   virtual ~LocalObjectStore() = default;
 
+  // whether the objects are checksummed: enable_checksums is set and the file
+  // system of the store keeps the user xattrs holding the crcs. without them
+  // the objects are written and read unchecked.
+  bool checksums_available() const { return checksums_; }
+
   Status create_bucket(const std::string_view &bucket) override;
 
   Status delete_bucket(const std::string_view &bucket) override;
@@ -30,31 +74,113 @@ class LocalObjectStore : public ObjectStore {
                     std::string &input) override;
   Status get_object(const std::string_view &bucket, const std::string_view &key,
                     size_t off, size_t len, std::string &body) override;
+  Status get_object(const std::string_view &bucket, const std::string_view &key,
+                    char *buf, size_t buf_size, size_t &body_size) override;
+  Status get_object(const std::string_view &bucket, const std::string_view &key,
+                    size_t off, size_t len, char *buf,
+                    size_t &read_len) override;
+  Status get_object_buffer(
+      const std::string_view &bucket, const std::string_view &key,
+      AccessPattern access,
+      std::shared_ptr<const ObjectBuffer> &buffer) override;
+  Status get_object_buffer(
+      const std::string_view &bucket, const std::string_view &key, size_t off,
+      size_t len, AccessPattern access,
+      std::shared_ptr<const ObjectBuffer> &buffer) override;
+  Status get_ranges(const std::string_view &bucket, const std::string_view &key,
+                    const std::vector<Range> &ranges, size_t max_gap,
+                    std::vector<std::string> &bodies) override;
   Status get_object_meta(const std::string_view &bucket,
                          const std::string_view &key,
                          ObjectMeta &meta) override;
+  Status open_object_writer(const std::string_view &bucket,
+                            const std::string_view &key,
+                            std::unique_ptr<ObjectWriter> &writer) override;
+  Status open_object_reader(const std::string_view &bucket,
+                            const std::string_view &key,
+                            const ObjectReaderOptions &options,
+                            std::unique_ptr<ObjectReader> &reader) override;
+  bool has_native_reader() const override { return true; }
 
   Status list_object(const std::string_view &bucket,
                      const std::string_view &prefix,
                      std::vector<ObjectMeta> &objects) override;
+  Status list_object(const std::string_view &bucket,
+                     const std::string_view &prefix,
+                     const std::string_view &continuation_token,
+                     size_t max_keys, std::vector<ObjectMeta> &objects,
+                     std::string &next_continuation_token) override;
+  Status list_object(const std::string_view &bucket,
+                     const std::string_view &prefix,
+                     const std::string_view &delimiter,
+                     std::vector<ObjectMeta> &objects,
+                     std::vector<std::string> &common_prefixes) override;
 
   Status delete_object(const std::string_view &bucket,
                        const std::string_view &key) override;
+  Status delete_objects(const std::string_view &bucket,
+                        const std::vector<std::string> &keys,
+                        std::vector<Status> &results) override;
 
  private:
+  friend class LocalObjectWriter;
+
   bool is_valid_key(const std::string_view &key);
   std::string generate_path(const std::string_view &bucket);
   std::string generate_path(const std::string_view &bucket,
                             const std::string_view &key);
+  // map the range of the object, cut short at its end, or all of it if
+  // range is nullptr.
+  Status map_object(const std::string_view &bucket, const std::string_view &key,
+                    const Range *range, AccessPattern access,
+                    std::shared_ptr<const ObjectBuffer> &buffer);
+  // write the object at key_path in bucket: create a temporary file next to
+  // it, let fill() write the body into it by path, make it durable as
+  // configured and rename it over key_path, or prune the directories left
+  // empty on failure. the caller owns the key lock.
+  Status write_object_file(
+      const std::string_view &bucket, const std::string &key_path,
+      const std::function<Status(const std::string &tmp_path)> &fill);
+  // create the empty temporary file an object at key_path is written into.
+  Status create_temp_file(const std::string &key_path, std::string &tmp_path);
+  // make the written temporary file durable as configured and rename it over
+  // key_path, it is removed on failure. the caller owns the key lock.
+  Status commit_temp_file(const std::string &tmp_path,
+                          const std::string &key_path);
+  // remove the parent directories of key_path up to bucket_path, from the
+  // deepest, as long as they are empty. the caller shares the bucket lock.
+  void prune_dirs(const std::string &bucket_path, const std::string &key_path);
+  // the stripe lock guarding the object stored at key_path.
+  std::shared_mutex &key_mutex(const std::string &key_path);
+  // the stripe lock guarding the directory at dir_path against its pruning.
+  std::shared_mutex &dir_mutex(const std::string &dir_path);
 
  private:
-  std::mutex mutex_;
+  static constexpr size_t kKeyLockStripes = 64;
+  static constexpr size_t kDirLockStripes = 64;
+
+  // bucket create/delete take it exclusively, object operations share it.
+  std::shared_mutex bucket_mutex_;
+  // striped object locks hashed by bucket + key: readers of an object share
+  // its stripe, writers own it, so different keys proceed in parallel.
+  std::array<std::shared_mutex, kKeyLockStripes> key_mutexes_;
+  // striped directory locks hashed by path: creating an object file (mkdir +
+  // open) shares the stripe of its directory, pruning a directory owns it, so
+  // the pruning never removes a directory an object is being created in.
+  std::array<std::shared_mutex, kDirLockStripes> dir_mutexes_;
   std::string basepath_;
+  Durability durability_;
+  // keep the crc32c of every object written and check the whole-object
+  // reads against it, see checksums_available().
+  bool checksums_;
+  // syncs the writes if durability_ is kGroupCommit.
+  std::unique_ptr<GroupCommitter> committer_;
 };
 
-LocalObjectStore *create_local_objstore(const std::string_view region,
-                                        const std::string_view *endpoint,
-                                        bool useHttps = true);
+LocalObjectStore *create_local_objstore(
+    const std::string_view region, const std::string_view *endpoint,
+    bool useHttps = true,
+    const ObjectStoreOptions &options = ObjectStoreOptions());
 
 void destroy_local_objstore(LocalObjectStore *s3_obj_store);
 
@@ -0,0 +1,99 @@
+#ifndef MY_OBJSTORE_LRU_CACHE_H_INCLUDED
+#define MY_OBJSTORE_LRU_CACHE_H_INCLUDED
+
+#include <list>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+namespace objstore {
+
+// a thread-safe, size-aware LRU cache. every entry is charged by the caller,
+// usually its size in bytes, and the least recently used entries are evicted
+// to keep the total charge within capacity.
+template <typename V>
+class LruCache {
+ public:
+  explicit LruCache(size_t capacity) : capacity_(capacity) {}
+
+  bool get(const std::string_view &key, V &value) {
+    const std::lock_guard<std::mutex> _(mutex_);
+    auto it = index_.find(key);
+    if (it == index_.end()) {
+      return false;
+    }
+    entries_.splice(entries_.begin(), entries_, it->second);
+    value = it->second->value;
+    return true;
+  }
+
+  // insert or replace the entry of key. an entry charged more than the whole
+  // capacity is not cached. the keys of the evicted entries are appended to
+  // evicted unless it is nullptr.
+  void put(const std::string_view &key, V value, size_t charge,
+           std::vector<std::string> *evicted = nullptr) {
+    const std::lock_guard<std::mutex> _(mutex_);
+    erase_locked(key);
+    if (charge > capacity_) {
+      return;
+    }
+    while (usage_ + charge > capacity_) {
+      if (evicted != nullptr) {
+        evicted->push_back(entries_.back().key);
+      }
+      erase_locked(entries_.back().key);
+    }
+    entries_.push_front(Entry{std::string(key), std::move(value), charge});
+    index_.emplace(entries_.front().key, entries_.begin());
+    usage_ += charge;
+  }
+
+  void erase(const std::string_view &key) {
+    const std::lock_guard<std::mutex> _(mutex_);
+    erase_locked(key);
+  }
+
+  void clear() {
+    const std::lock_guard<std::mutex> _(mutex_);
+    index_.clear();
+    entries_.clear();
+    usage_ = 0;
+  }
+
+  size_t usage() const {
+    const std::lock_guard<std::mutex> _(mutex_);
+    return usage_;
+  }
+
+ private:
+  struct Entry {
+    std::string key;
+    V value;
+    size_t charge;
+  };
+
+  void erase_locked(const std::string_view &key) {
+    auto it = index_.find(key);
+    if (it == index_.end()) {
+      return;
+    }
+    auto entry = it->second;
+    usage_ -= entry->charge;
+    index_.erase(it);
+    entries_.erase(entry);
+  }
+
+  const size_t capacity_;
+  mutable std::mutex mutex_;
+  size_t usage_{0};
+  // the most recently used entry first, index_ refers to the keys in there.
+  std::list<Entry> entries_;
+  std::unordered_map<std::string_view, typename std::list<Entry>::iterator>
+      index_;
+};
+
+}  // namespace objstore
+
+#endif  // MY_OBJSTORE_LRU_CACHE_H_INCLUDED
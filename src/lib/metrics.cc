@@ -0,0 +1,662 @@
+#include "metrics.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <filesystem>
+#include <unordered_set>
+
+namespace objstore {
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+uint64_t elapsed_us(Clock::time_point start) {
+  return std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() -
+                                                               start)
+      .count();
+}
+
+const char *op_name(MetricsOp op) {
+  switch (op) {
+    case MetricsOp::kCreateBucket:
+      return "create_bucket";
+    case MetricsOp::kDeleteBucket:
+      return "delete_bucket";
+    case MetricsOp::kPutFile:
+      return "put_file";
+    case MetricsOp::kGetFile:
+      return "get_file";
+    case MetricsOp::kPut:
+      return "put";
+    case MetricsOp::kGet:
+      return "get";
+    case MetricsOp::kGetRange:
+      return "get_range";
+    case MetricsOp::kGetRanges:
+      return "get_ranges";
+    case MetricsOp::kHead:
+      return "head";
+    case MetricsOp::kList:
+      return "list";
+    case MetricsOp::kDelete:
+      return "delete";
+    case MetricsOp::kDeleteBatch:
+      return "delete_batch";
+    case MetricsOp::kWrite:
+      return "write";
+    case MetricsOp::kUploadPart:
+      return "upload_part";
+  }
+  return "unknown";
+}
+
+// a counter written by one thread only and read by any: a relaxed load and
+// store instead of a locked read-modify-write.
+void add(std::atomic<uint64_t> &counter, uint64_t value) {
+  counter.store(counter.load(std::memory_order_relaxed) + value,
+                std::memory_order_relaxed);
+}
+
+// the ids of the live Metrics, guarding the shards the exiting threads
+// release against the destruction of their Metrics.
+std::mutex g_live_mutex;
+std::unordered_set<uint64_t> g_live_metrics;
+std::atomic<uint64_t> g_next_metrics_id{1};
+
+// set once the shards of the thread are released, a trivially destructible
+// thread_local so that it is still valid in the destructors running later.
+thread_local bool t_shards_released = false;
+
+}  // anonymous namespace
+
+struct Metrics::Histogram {
+  std::atomic<uint64_t> counts[kBuckets] = {};
+  std::atomic<uint64_t> count{0};
+  std::atomic<uint64_t> sum_us{0};
+
+  void record(uint64_t latency_us) {
+    add(counts[bucket_index(latency_us)], 1);
+    add(count, 1);
+    add(sum_us, latency_us);
+  }
+
+  void add_to(LatencyHistogram &histogram) const {
+    if (histogram.buckets.empty()) {
+      histogram.buckets.resize(kBuckets);
+      for (size_t i = 0; i < kBuckets; ++i) {
+        histogram.buckets[i].first = bucket_upper_bound(i);
+      }
+    }
+    for (size_t i = 0; i < kBuckets; ++i) {
+      histogram.buckets[i].second += counts[i].load(std::memory_order_relaxed);
+    }
+    histogram.count += count.load(std::memory_order_relaxed);
+    histogram.sum_us += sum_us.load(std::memory_order_relaxed);
+  }
+};
+
+struct Metrics::OpCounters {
+  // the error codes tracked per thread.
+  static constexpr size_t kErrorCodes = 8;
+
+  std::atomic<uint64_t> count{0};
+  std::atomic<uint64_t> bytes{0};
+  std::atomic<uint64_t> errors{0};
+  // a code is set before its count, and never changes once set.
+  std::atomic<int> error_codes[kErrorCodes] = {};
+  std::atomic<uint64_t> error_counts[kErrorCodes] = {};
+  // allocated on the first record, most threads do a few operations only.
+  std::atomic<Histogram *> latency{nullptr};
+  std::atomic<Histogram *> ttfb{nullptr};
+
+  ~OpCounters() {
+    delete latency.load(std::memory_order_relaxed);
+    delete ttfb.load(std::memory_order_relaxed);
+  }
+
+  static Histogram &histogram(std::atomic<Histogram *> &histogram) {
+    Histogram *h = histogram.load(std::memory_order_relaxed);
+    if (h == nullptr) {
+      h = new Histogram();
+      histogram.store(h, std::memory_order_release);
+    }
+    return *h;
+  }
+
+  void record_error(int code) {
+    add(errors, 1);
+    for (size_t i = 0; i < kErrorCodes; ++i) {
+      const int slot = error_codes[i].load(std::memory_order_relaxed);
+      if (slot == code) {
+        add(error_counts[i], 1);
+        return;
+      } else if (slot == 0) {
+        error_codes[i].store(code, std::memory_order_release);
+        add(error_counts[i], 1);
+        return;
+      }
+    }
+  }
+};
+
+struct Metrics::Shard {
+  // whether a live thread records into this shard.
+  std::atomic<bool> owned{true};
+  OpCounters ops[kNumOps];
+};
+
+// the shards of the calling thread by the id of their Metrics, released for
+// other threads when it exits.
+struct Metrics::ThreadShards {
+  std::vector<std::pair<uint64_t, Shard *>> shards;
+
+  ~ThreadShards() {
+    const std::lock_guard<std::mutex> _(g_live_mutex);
+    for (auto &[id, shard] : shards) {
+      if (g_live_metrics.count(id) > 0) {
+        shard->owned.store(false, std::memory_order_release);
+      }
+    }
+    t_shards_released = true;
+  }
+};
+
+Metrics::Metrics() : id_(g_next_metrics_id.fetch_add(1)) {
+  const std::lock_guard<std::mutex> _(g_live_mutex);
+  g_live_metrics.insert(id_);
+}
+
+Metrics::~Metrics() {
+  const std::lock_guard<std::mutex> _(g_live_mutex);
+  g_live_metrics.erase(id_);
+}
+
+size_t Metrics::bucket_index(uint64_t latency_us) {
+  latency_us = std::min<uint64_t>(latency_us, (1ULL << kMaxLatencyBits) - 1);
+  if (latency_us < kSubBuckets) {
+    return latency_us;
+  }
+  // the highest bit picks the power of two, the 3 bits below it the bucket.
+  const size_t msb = 63 - __builtin_clzll(latency_us);
+  return (msb - 2) * kSubBuckets + ((latency_us >> (msb - 3)) & 7);
+}
+
+uint64_t Metrics::bucket_upper_bound(size_t index) {
+  if (index < kSubBuckets) {
+    return index;
+  }
+  const size_t shift = index / kSubBuckets - 1;
+  const uint64_t lower = (kSubBuckets + index % kSubBuckets) << shift;
+  return lower + (1ULL << shift) - 1;
+}
+
+Metrics::Shard *Metrics::shard() {
+  if (t_shards_released) {
+    return nullptr;
+  }
+  thread_local ThreadShards thread_shards;
+  for (auto &[id, shard] : thread_shards.shards) {
+    if (id == id_) {
+      return shard;
+    }
+  }
+
+  // the first record of this thread: take over the shard of an exited thread
+  // or add one, and forget the shards of the destroyed Metrics.
+  Shard *shard = nullptr;
+  {
+    const std::lock_guard<std::mutex> _(mutex_);
+    for (auto &candidate : shards_) {
+      if (!candidate->owned.load(std::memory_order_acquire)) {
+        candidate->owned.store(true, std::memory_order_relaxed);
+        shard = candidate.get();
+        break;
+      }
+    }
+    if (shard == nullptr) {
+      shards_.push_back(std::make_unique<Shard>());
+      shard = shards_.back().get();
+    }
+  }
+  {
+    const std::lock_guard<std::mutex> _(g_live_mutex);
+    auto &shards = thread_shards.shards;
+    shards.erase(std::remove_if(shards.begin(), shards.end(),
+                                [](const auto &entry) {
+                                  return g_live_metrics.count(entry.first) ==
+                                         0;
+                                }),
+                 shards.end());
+  }
+  thread_shards.shards.emplace_back(id_, shard);
+  return shard;
+}
+
+void Metrics::record(MetricsOp op, uint64_t latency_us, uint64_t bytes,
+                     const Status &status) {
+  Shard *shard = this->shard();
+  if (shard == nullptr) {
+    return;
+  }
+  OpCounters &counters = shard->ops[static_cast<size_t>(op)];
+  add(counters.count, 1);
+  add(counters.bytes, bytes);
+  if (!status.is_succ()) {
+    counters.record_error(status.error_code());
+  }
+  OpCounters::histogram(counters.latency).record(latency_us);
+}
+
+void Metrics::record_ttfb(MetricsOp op, uint64_t latency_us) {
+  Shard *shard = this->shard();
+  if (shard == nullptr) {
+    return;
+  }
+  OpCounters &counters = shard->ops[static_cast<size_t>(op)];
+  OpCounters::histogram(counters.ttfb).record(latency_us);
+}
+
+void Metrics::snapshot(ObjectStoreMetrics &metrics) const {
+  std::vector<OperationMetrics> ops(kNumOps);
+  {
+    const std::lock_guard<std::mutex> _(mutex_);
+    for (const auto &shard : shards_) {
+      for (size_t i = 0; i < kNumOps; ++i) {
+        const OpCounters &counters = shard->ops[i];
+        OperationMetrics &op = ops[i];
+        op.count += counters.count.load(std::memory_order_relaxed);
+        op.bytes += counters.bytes.load(std::memory_order_relaxed);
+        op.errors += counters.errors.load(std::memory_order_relaxed);
+        for (size_t j = 0; j < OpCounters::kErrorCodes; ++j) {
+          const int code =
+              counters.error_codes[j].load(std::memory_order_acquire);
+          if (code != 0) {
+            op.error_codes[code] +=
+                counters.error_counts[j].load(std::memory_order_relaxed);
+          }
+        }
+        if (const Histogram *h =
+                counters.latency.load(std::memory_order_acquire)) {
+          h->add_to(op.latency);
+        }
+        if (const Histogram *h =
+                counters.ttfb.load(std::memory_order_acquire)) {
+          h->add_to(op.ttfb);
+        }
+      }
+    }
+  }
+
+  metrics.operations.clear();
+  for (size_t i = 0; i < kNumOps; ++i) {
+    OperationMetrics &op = ops[i];
+    if (op.count == 0 && op.ttfb.count == 0) {
+      continue;
+    }
+    op.op = op_name(static_cast<MetricsOp>(i));
+    for (LatencyHistogram *h : {&op.latency, &op.ttfb}) {
+      h->buckets.erase(
+          std::remove_if(h->buckets.begin(), h->buckets.end(),
+                         [](const auto &bucket) { return bucket.second == 0; }),
+          h->buckets.end());
+    }
+    metrics.operations.push_back(std::move(op));
+  }
+}
+
+uint64_t LatencyHistogram::percentile(double p) const {
+  if (count == 0) {
+    return 0;
+  }
+  const uint64_t rank = std::max<uint64_t>(
+      1, static_cast<uint64_t>(std::ceil(std::clamp(p, 0.0, 1.0) * count)));
+  uint64_t seen = 0;
+  for (const auto &[upper_bound, bucket_count] : buckets) {
+    seen += bucket_count;
+    if (seen >= rank) {
+      return upper_bound;
+    }
+  }
+  return buckets.empty() ? 0 : buckets.back().first;
+}
+
+namespace {
+
+void append_histogram(std::string &out, const std::string &name,
+                      const std::string &op, const LatencyHistogram &h) {
+  if (h.count == 0) {
+    return;
+  }
+  // cumulative buckets in seconds, at the bounds of the non-empty buckets.
+  uint64_t cumulative = 0;
+  char le[32];
+  for (const auto &[upper_bound, count] : h.buckets) {
+    cumulative += count;
+    snprintf(le, sizeof(le), "%.6f", upper_bound / 1e6);
+    out += name + "_bucket{op=\"" + op + "\",le=\"" + le + "\"} " +
+           std::to_string(cumulative) + "\n";
+  }
+  out += name + "_bucket{op=\"" + op + "\",le=\"+Inf\"} " +
+         std::to_string(h.count) + "\n";
+  snprintf(le, sizeof(le), "%.6f", h.sum_us / 1e6);
+  out += name + "_sum{op=\"" + op + "\"} " + le + "\n";
+  out += name + "_count{op=\"" + op + "\"} " + std::to_string(h.count) + "\n";
+}
+
+}  // anonymous namespace
+
+std::string ObjectStoreMetrics::to_prometheus(
+    const std::string_view &prefix) const {
+  const std::string p(prefix);
+  std::string out;
+
+  out += "# HELP " + p + "_requests_total Requests by operation.\n";
+  out += "# TYPE " + p + "_requests_total counter\n";
+  for (const OperationMetrics &op : operations) {
+    out += p + "_requests_total{op=\"" + op.op + "\"} " +
+           std::to_string(op.count) + "\n";
+  }
+  out += "# HELP " + p + "_bytes_total Bytes put or got by operation.\n";
+  out += "# TYPE " + p + "_bytes_total counter\n";
+  for (const OperationMetrics &op : operations) {
+    out += p + "_bytes_total{op=\"" + op.op + "\"} " +
+           std::to_string(op.bytes) + "\n";
+  }
+  out += "# HELP " + p + "_errors_total Failed requests by error code.\n";
+  out += "# TYPE " + p + "_errors_total counter\n";
+  for (const OperationMetrics &op : operations) {
+    uint64_t untracked = op.errors;
+    for (const auto &[code, count] : op.error_codes) {
+      out += p + "_errors_total{op=\"" + op.op + "\",code=\"" +
+             std::to_string(code) + "\"} " + std::to_string(count) + "\n";
+      untracked -= std::min(untracked, count);
+    }
+    if (untracked > 0) {
+      out += p + "_errors_total{op=\"" + op.op + "\",code=\"other\"} " +
+             std::to_string(untracked) + "\n";
+    }
+  }
+  out += "# HELP " + p +
+         "_request_duration_seconds Request latency by operation.\n";
+  out += "# TYPE " + p + "_request_duration_seconds histogram\n";
+  for (const OperationMetrics &op : operations) {
+    append_histogram(out, p + "_request_duration_seconds", op.op, op.latency);
+  }
+  out += "# HELP " + p +
+         "_time_to_first_byte_seconds Time to the first byte of gets.\n";
+  out += "# TYPE " + p + "_time_to_first_byte_seconds histogram\n";
+  for (const OperationMetrics &op : operations) {
+    append_histogram(out, p + "_time_to_first_byte_seconds", op.op, op.ttfb);
+  }
+  return out;
+}
+
+namespace {
+
+// counts the bytes written, and records the write as a whole on close().
+class MetricsObjectWriter : public ObjectWriter {
+ public:
+  MetricsObjectWriter(std::unique_ptr<ObjectWriter> base,
+                      std::shared_ptr<Metrics> metrics)
+      : base_(std::move(base)),
+        metrics_(std::move(metrics)),
+        start_(Clock::now()) {}
+
+  Status write(const std::string_view &data) override {
+    Status status = base_->write(data);
+    if (status.is_succ()) {
+      bytes_ += data.size();
+    } else {
+      finish(status);
+    }
+    return status;
+  }
+
+  Status close() override {
+    Status status = base_->close();
+    finish(status);
+    return status;
+  }
+
+  void abort() override { base_->abort(); }
+
+ private:
+  void finish(const Status &status) {
+    if (!finished_) {
+      finished_ = true;
+      metrics_->record(MetricsOp::kWrite, elapsed_us(start_), bytes_, status);
+    }
+  }
+
+ private:
+  std::unique_ptr<ObjectWriter> base_;
+  std::shared_ptr<Metrics> metrics_;
+  const Clock::time_point start_;
+  uint64_t bytes_{0};
+  bool finished_{false};
+};
+
+uint64_t file_size_or_zero(const std::string_view &path) {
+  std::error_code ec;
+  const uintmax_t size = std::filesystem::file_size(path, ec);
+  return ec ? 0 : size;
+}
+
+}  // anonymous namespace
+
+MetricsObjectStore::MetricsObjectStore(ObjectStore *base,
+                                       std::shared_ptr<Metrics> metrics)
+    : base_(base), metrics_(std::move(metrics)) {}
+
+template <typename Fn>
+Status MetricsObjectStore::recorded(MetricsOp op, Fn &&fn) {
+  const Clock::time_point start = Clock::now();
+  uint64_t bytes = 0;
+  Status status = fn(bytes);
+  metrics_->record(op, elapsed_us(start), bytes, status);
+  return status;
+}
+
+Status MetricsObjectStore::create_bucket(const std::string_view &bucket) {
+  return recorded(MetricsOp::kCreateBucket,
+                  [&](uint64_t &) { return base_->create_bucket(bucket); });
+}
+
+Status MetricsObjectStore::delete_bucket(const std::string_view &bucket) {
+  return recorded(MetricsOp::kDeleteBucket,
+                  [&](uint64_t &) { return base_->delete_bucket(bucket); });
+}
+
+Status MetricsObjectStore::put_object_from_file(
+    const std::string_view &bucket, const std::string_view &key,
+    const std::string_view &data_file_path) {
+  return recorded(MetricsOp::kPutFile, [&](uint64_t &bytes) {
+    Status status = base_->put_object_from_file(bucket, key, data_file_path);
+    if (status.is_succ()) {
+      bytes = file_size_or_zero(data_file_path);
+    }
+    return status;
+  });
+}
+
+Status MetricsObjectStore::get_object_to_file(
+    const std::string_view &bucket, const std::string_view &key,
+    const std::string_view &output_file_path) {
+  return recorded(MetricsOp::kGetFile, [&](uint64_t &bytes) {
+    Status status = base_->get_object_to_file(bucket, key, output_file_path);
+    if (status.is_succ()) {
+      bytes = file_size_or_zero(output_file_path);
+    }
+    return status;
+  });
+}
+
+Status MetricsObjectStore::put_object(const std::string_view &bucket,
+                                      const std::string_view &key,
+                                      const std::string_view &data) {
+  return recorded(MetricsOp::kPut, [&](uint64_t &bytes) {
+    bytes = data.size();
+    return base_->put_object(bucket, key, data);
+  });
+}
+
+Status MetricsObjectStore::open_object_writer(
+    const std::string_view &bucket, const std::string_view &key,
+    std::unique_ptr<ObjectWriter> &writer) {
+  std::unique_ptr<ObjectWriter> base_writer;
+  Status status = base_->open_object_writer(bucket, key, base_writer);
+  if (!status.is_succ()) {
+    metrics_->record(MetricsOp::kWrite, 0, 0, status);
+    return status;
+  }
+  writer = std::make_unique<MetricsObjectWriter>(std::move(base_writer),
+                                                 metrics_);
+  return status;
+}
+
+Status MetricsObjectStore::get_object(const std::string_view &bucket,
+                                      const std::string_view &key,
+                                      std::string &body) {
+  return recorded(MetricsOp::kGet, [&](uint64_t &bytes) {
+    Status status = base_->get_object(bucket, key, body);
+    bytes = status.is_succ() ? body.size() : 0;
+    return status;
+  });
+}
+
+Status MetricsObjectStore::get_object(const std::string_view &bucket,
+                                      const std::string_view &key,
+                                      size_t off, size_t len,
+                                      std::string &body) {
+  return recorded(MetricsOp::kGetRange, [&](uint64_t &bytes) {
+    Status status = base_->get_object(bucket, key, off, len, body);
+    bytes = status.is_succ() ? body.size() : 0;
+    return status;
+  });
+}
+
+Status MetricsObjectStore::get_object(const std::string_view &bucket,
+                                      const std::string_view &key, char *buf,
+                                      size_t buf_size, size_t &body_size) {
+  return recorded(MetricsOp::kGet, [&](uint64_t &bytes) {
+    Status status = base_->get_object(bucket, key, buf, buf_size, body_size);
+    bytes = status.is_succ() ? body_size : 0;
+    return status;
+  });
+}
+
+Status MetricsObjectStore::get_object(const std::string_view &bucket,
+                                      const std::string_view &key,
+                                      size_t off, size_t len, char *buf,
+                                      size_t &read_len) {
+  return recorded(MetricsOp::kGetRange, [&](uint64_t &bytes) {
+    Status status = base_->get_object(bucket, key, off, len, buf, read_len);
+    bytes = status.is_succ() ? read_len : 0;
+    return status;
+  });
+}
+
+Status MetricsObjectStore::get_object_buffer(
+    const std::string_view &bucket, const std::string_view &key,
+    AccessPattern access, std::shared_ptr<const ObjectBuffer> &buffer) {
+  return recorded(MetricsOp::kGet, [&](uint64_t &bytes) {
+    Status status = base_->get_object_buffer(bucket, key, access, buffer);
+    bytes = status.is_succ() ? buffer->size() : 0;
+    return status;
+  });
+}
+
+Status MetricsObjectStore::get_object_buffer(
+    const std::string_view &bucket, const std::string_view &key, size_t off,
+    size_t len, AccessPattern access,
+    std::shared_ptr<const ObjectBuffer> &buffer) {
+  return recorded(MetricsOp::kGetRange, [&](uint64_t &bytes) {
+    Status status =
+        base_->get_object_buffer(bucket, key, off, len, access, buffer);
+    bytes = status.is_succ() ? buffer->size() : 0;
+    return status;
+  });
+}
+
+Status MetricsObjectStore::get_ranges(const std::string_view &bucket,
+                                      const std::string_view &key,
+                                      const std::vector<Range> &ranges,
+                                      size_t max_gap,
+                                      std::vector<std::string> &bodies) {
+  return recorded(MetricsOp::kGetRanges, [&](uint64_t &bytes) {
+    Status status = base_->get_ranges(bucket, key, ranges, max_gap, bodies);
+    for (size_t i = 0; status.is_succ() && i < bodies.size(); ++i) {
+      bytes += bodies[i].size();
+    }
+    return status;
+  });
+}
+
+Status MetricsObjectStore::get_object_meta(const std::string_view &bucket,
+                                           const std::string_view &key,
+                                           ObjectMeta &meta) {
+  return recorded(MetricsOp::kHead, [&](uint64_t &) {
+    return base_->get_object_meta(bucket, key, meta);
+  });
+}
+
+Status MetricsObjectStore::list_object(const std::string_view &bucket,
+                                       const std::string_view &prefix,
+                                       std::vector<ObjectMeta> &objects) {
+  return recorded(MetricsOp::kList, [&](uint64_t &) {
+    return base_->list_object(bucket, prefix, objects);
+  });
+}
+
+Status MetricsObjectStore::list_object(
+    const std::string_view &bucket, const std::string_view &prefix,
+    const std::string_view &continuation_token, size_t max_keys,
+    std::vector<ObjectMeta> &objects, std::string &next_continuation_token) {
+  return recorded(MetricsOp::kList, [&](uint64_t &) {
+    return base_->list_object(bucket, prefix, continuation_token, max_keys,
+                              objects, next_continuation_token);
+  });
+}
+
+Status MetricsObjectStore::list_object(
+    const std::string_view &bucket, const std::string_view &prefix,
+    const std::string_view &delimiter, std::vector<ObjectMeta> &objects,
+    std::vector<std::string> &common_prefixes) {
+  return recorded(MetricsOp::kList, [&](uint64_t &) {
+    return base_->list_object(bucket, prefix, delimiter, objects,
+                              common_prefixes);
+  });
+}
+
+Status MetricsObjectStore::delete_object(const std::string_view &bucket,
+                                         const std::string_view &key) {
+  return recorded(MetricsOp::kDelete, [&](uint64_t &) {
+    return base_->delete_object(bucket, key);
+  });
+}
+
+Status MetricsObjectStore::delete_objects(
+    const std::string_view &bucket, const std::vector<std::string> &keys,
+    std::vector<Status> &results) {
+  return recorded(MetricsOp::kDeleteBatch, [&](uint64_t &) {
+    return base_->delete_objects(bucket, keys, results);
+  });
+}
+
+Status MetricsObjectStore::get_metrics(ObjectStoreMetrics &metrics) {
+  metrics_->snapshot(metrics);
+  return Status();
+}
+
+ObjectStore *create_metrics_objstore(ObjectStore *base,
+                                     std::shared_ptr<Metrics> metrics) {
+  if (base == nullptr) {
+    return nullptr;
+  }
+  return new MetricsObjectStore(base, std::move(metrics));
+}
+
+}  // namespace objstore
@@ -0,0 +1,166 @@
+#ifndef MY_OBJSTORE_METRICS_H_INCLUDED
+#define MY_OBJSTORE_METRICS_H_INCLUDED
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "objstore.h"
+
+namespace objstore {
+
+// the operations whose requests are recorded.
+enum class MetricsOp {
+  kCreateBucket,
+  kDeleteBucket,
+  kPutFile,
+  kGetFile,
+  kPut,
+  kGet,
+  kGetRange,
+  kGetRanges,
+  kHead,
+  kList,
+  kDelete,
+  kDeleteBatch,
+  kWrite,
+  // the parts of the multipart uploads of s3, recorded by the store itself.
+  kUploadPart,
+};
+
+// the requests of an object store by operation. every thread records into
+// counters of its own by plain loads and stores, so recording takes neither
+// a lock nor an atomic read-modify-write, and snapshot() sums the counters
+// of all threads. the counters of an exited thread are taken over by the
+// next thread recording.
+class Metrics {
+ public:
+  Metrics();
+  ~Metrics();
+
+  Metrics(const Metrics &) = delete;
+  Metrics &operator=(const Metrics &) = delete;
+
+  void record(MetricsOp op, uint64_t latency_us, uint64_t bytes,
+              const Status &status);
+  void record_ttfb(MetricsOp op, uint64_t latency_us);
+
+  void snapshot(ObjectStoreMetrics &metrics) const;
+
+  static constexpr size_t kNumOps =
+      static_cast<size_t>(MetricsOp::kUploadPart) + 1;
+  // latencies up to 2^36us, about 19 hours, the longer ones are clamped.
+  static constexpr size_t kSubBuckets = 8;
+  static constexpr size_t kMaxLatencyBits = 36;
+  static constexpr size_t kBuckets = (kMaxLatencyBits - 2) * kSubBuckets;
+
+  static size_t bucket_index(uint64_t latency_us);
+  // the inclusive upper bound of the bucket.
+  static uint64_t bucket_upper_bound(size_t index);
+
+ private:
+  struct Histogram;
+  struct OpCounters;
+  struct Shard;
+  struct ThreadShards;
+
+  // the shard of the calling thread, nullptr once the thread is exiting.
+  Shard *shard();
+
+ private:
+  const uint64_t id_;
+  mutable std::mutex mutex_;
+  std::vector<std::unique_ptr<Shard>> shards_;
+};
+
+// records the requests of another object store, whose ownership is taken,
+// into metrics, which the base store may record into as well.
+class MetricsObjectStore : public ObjectStore {
+ public:
+  MetricsObjectStore(ObjectStore *base, std::shared_ptr<Metrics> metrics);
+  virtual ~MetricsObjectStore() = default;
+
+  Status create_bucket(const std::string_view &bucket) override;
+
+  Status delete_bucket(const std::string_view &bucket) override;
+
+  Status put_object_from_file(const std::string_view &bucket,
+                              const std::string_view &key,
+                              const std::string_view &data_file_path) override;
+  Status get_object_to_file(const std::string_view &bucket,
+                            const std::string_view &key,
+                            const std::string_view &output_file_path) override;
+
+  Status put_object(const std::string_view &bucket, const std::string_view &key,
+                    const std::string_view &data) override;
+  Status open_object_writer(const std::string_view &bucket,
+                            const std::string_view &key,
+                            std::unique_ptr<ObjectWriter> &writer) override;
+  Status get_object(const std::string_view &bucket, const std::string_view &key,
+                    std::string &body) override;
+  Status get_object(const std::string_view &bucket, const std::string_view &key,
+                    size_t off, size_t len, std::string &body) override;
+  Status get_object(const std::string_view &bucket, const std::string_view &key,
+                    char *buf, size_t buf_size, size_t &body_size) override;
+  Status get_object(const std::string_view &bucket, const std::string_view &key,
+                    size_t off, size_t len, char *buf,
+                    size_t &read_len) override;
+  Status get_object_buffer(
+      const std::string_view &bucket, const std::string_view &key,
+      AccessPattern access,
+      std::shared_ptr<const ObjectBuffer> &buffer) override;
+  Status get_object_buffer(
+      const std::string_view &bucket, const std::string_view &key, size_t off,
+      size_t len, AccessPattern access,
+      std::shared_ptr<const ObjectBuffer> &buffer) override;
+  Status get_ranges(const std::string_view &bucket,
+                    const std::string_view &key,
+                    const std::vector<Range> &ranges, size_t max_gap,
+                    std::vector<std::string> &bodies) override;
+  Status get_object_meta(const std::string_view &bucket,
+                         const std::string_view &key,
+                         ObjectMeta &meta) override;
+
+  Status list_object(const std::string_view &bucket,
+                     const std::string_view &prefix,
+                     std::vector<ObjectMeta> &objects) override;
+  Status list_object(const std::string_view &bucket,
+                     const std::string_view &prefix,
+                     const std::string_view &continuation_token,
+                     size_t max_keys, std::vector<ObjectMeta> &objects,
+                     std::string &next_continuation_token) override;
+  Status list_object(const std::string_view &bucket,
+                     const std::string_view &prefix,
+                     const std::string_view &delimiter,
+                     std::vector<ObjectMeta> &objects,
+                     std::vector<std::string> &common_prefixes) override;
+
+  Status delete_object(const std::string_view &bucket,
+                       const std::string_view &key) override;
+  Status delete_objects(const std::string_view &bucket,
+                        const std::vector<std::string> &keys,
+                        std::vector<Status> &results) override;
+
+  Status get_metrics(ObjectStoreMetrics &metrics) override;
+
+ private:
+  // run fn(bytes) and record it as op, fn sets bytes to the bytes it put or
+  // got. a template, so that recording costs no std::function.
+  template <typename Fn>
+  Status recorded(MetricsOp op, Fn &&fn);
+
+ private:
+  std::unique_ptr<ObjectStore> base_;
+  std::shared_ptr<Metrics> metrics_;
+};
+
+// wrap base, whose ownership is taken, into a store recording its requests
+// into metrics.
+ObjectStore *create_metrics_objstore(ObjectStore *base,
+                                     std::shared_ptr<Metrics> metrics);
+
+}  // namespace objstore
+
+#endif  // MY_OBJSTORE_METRICS_H_INCLUDED
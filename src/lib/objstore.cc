@@ -1,21 +1,277 @@
 #include "objstore.h"
 
+#include <cerrno>
+
+#include "buffer_pool.h"
+#include "cache.h"
+#include "coalesce.h"
+#include "compress.h"
+#include "executor.h"
 #include "local.h"
+#include "metrics.h"
+#include "ranges.h"
+#include "reader.h"
+#include "retry.h"
 #include "s3.h"
 
 namespace objstore {
 
+namespace {
+
+// ranged reads of one get_ranges() call issued at a time.
+constexpr size_t kParallelRanges = 8;
+
+class StringObjectBuffer : public ObjectBuffer {
+ public:
+  explicit StringObjectBuffer(std::string &&body) : body_(std::move(body)) {}
+
+  const char *data() const override { return body_.data(); }
+  size_t size() const override { return body_.size(); }
+
+ private:
+  std::string body_;
+};
+
+// a body read into a buffer of the pool.
+class PooledObjectBuffer : public ObjectBuffer {
+ public:
+  PooledObjectBuffer(PooledBuffer &&buffer, size_t size)
+      : buffer_(std::move(buffer)), size_(size) {}
+
+  const char *data() const override { return buffer_.data(); }
+  size_t size() const override { return size_; }
+
+ private:
+  PooledBuffer buffer_;
+  size_t size_;
+};
+
+}  // anonymous namespace
+
+Status ObjectStore::get_object_buffer(
+    const std::string_view &bucket, const std::string_view &key,
+    AccessPattern access [[maybe_unused]],
+    std::shared_ptr<const ObjectBuffer> &buffer) {
+  std::string body;
+  Status status = get_object(bucket, key, body);
+  if (status.is_succ()) {
+    buffer = std::make_shared<StringObjectBuffer>(std::move(body));
+  }
+  return status;
+}
+
+Status ObjectStore::get_object_buffer(
+    const std::string_view &bucket, const std::string_view &key, size_t off,
+    size_t len, AccessPattern access [[maybe_unused]],
+    std::shared_ptr<const ObjectBuffer> &buffer) {
+  if (len <= BufferPool::kMaxBlockSize) {
+    PooledBuffer body(len);
+    size_t read_len = 0;
+    Status status = get_object(bucket, key, off, len, body.data(), read_len);
+    if (status.is_succ()) {
+      buffer = std::make_shared<PooledObjectBuffer>(std::move(body), read_len);
+    }
+    return status;
+  }
+  std::string body;
+  Status status = get_object(bucket, key, off, len, body);
+  if (status.is_succ()) {
+    buffer = std::make_shared<StringObjectBuffer>(std::move(body));
+  }
+  return status;
+}
+
+Status ObjectStore::get_ranges(const std::string_view &bucket,
+                               const std::string_view &key,
+                               const std::vector<Range> &ranges,
+                               size_t max_gap,
+                               std::vector<std::string> &bodies) {
+  return get_ranges_by_spans(*this, bucket, key, ranges, max_gap,
+                             kParallelRanges, bodies);
+}
+
+Status ObjectStore::open_object_reader(
+    const std::string_view &bucket, const std::string_view &key,
+    const ObjectReaderOptions &options,
+    std::unique_ptr<ObjectReader> &reader) {
+  ObjectMeta meta;
+  Status status = get_object_meta(bucket, key, meta);
+  if (status.is_succ()) {
+    reader = std::make_unique<PrefetchingObjectReader>(
+        *this, bucket, key, static_cast<size_t>(meta.size), options);
+  }
+  return status;
+}
+
+std::future<Status> ObjectStore::put_object_async(
+    const std::string_view &bucket, const std::string_view &key,
+    std::string data) {
+  return run_async([this, bucket = std::string(bucket),
+                    key = std::string(key), data = std::move(data)]() {
+    return put_object(bucket, key, data);
+  });
+}
+
+std::future<Status> ObjectStore::get_object_async(
+    const std::string_view &bucket, const std::string_view &key,
+    std::string &body) {
+  return run_async([this, bucket = std::string(bucket),
+                    key = std::string(key), &body]() {
+    return get_object(bucket, key, body);
+  });
+}
+
+std::future<Status> ObjectStore::get_object_async(
+    const std::string_view &bucket, const std::string_view &key, size_t off,
+    size_t len, std::string &body) {
+  return run_async([this, bucket = std::string(bucket),
+                    key = std::string(key), off, len, &body]() {
+    return get_object(bucket, key, off, len, body);
+  });
+}
+
+std::future<Status> ObjectStore::get_object_meta_async(
+    const std::string_view &bucket, const std::string_view &key,
+    ObjectMeta &meta) {
+  return run_async([this, bucket = std::string(bucket),
+                    key = std::string(key), &meta]() {
+    return get_object_meta(bucket, key, meta);
+  });
+}
+
+std::future<Status> ObjectStore::list_object_async(
+    const std::string_view &bucket, const std::string_view &prefix,
+    std::vector<ObjectMeta> &objects) {
+  return run_async([this, bucket = std::string(bucket),
+                    prefix = std::string(prefix), &objects]() {
+    return list_object(bucket, prefix, objects);
+  });
+}
+
+std::future<Status> ObjectStore::delete_object_async(
+    const std::string_view &bucket, const std::string_view &key) {
+  return run_async(
+      [this, bucket = std::string(bucket), key = std::string(key)]() {
+        return delete_object(bucket, key);
+      });
+}
+
+Status ObjectStore::list_object_stream(
+    const std::string_view &bucket, const std::string_view &prefix,
+    size_t batch_size,
+    const std::function<bool(std::vector<ObjectMeta> &batch)> &on_batch) {
+  std::string token;
+  std::string next_token;
+  std::vector<ObjectMeta> batch;
+  do {
+    Status status =
+        list_object(bucket, prefix, token, batch_size, batch, next_token);
+    if (!status.is_succ()) {
+      return status;
+    }
+    if (!batch.empty() && !on_batch(batch)) {
+      break;
+    }
+    token.swap(next_token);
+  } while (!token.empty());
+  return Status();
+}
+
+Status ObjectStore::delete_objects(const std::string_view &bucket,
+                                   const std::vector<std::string> &keys,
+                                   std::vector<Status> &results) {
+  results.assign(keys.size(), Status());
+  Status first_failure;
+  for (size_t i = 0; i < keys.size(); ++i) {
+    results[i] = delete_object(bucket, keys[i]);
+    if (first_failure.is_succ() && !results[i].is_succ()) {
+      first_failure = results[i];
+    }
+  }
+  return first_failure;
+}
+
+Status ObjectStore::get_metrics(ObjectStoreMetrics &metrics) {
+  metrics.operations.clear();
+  return Status(ENOTSUP, "metrics are not enabled");
+}
+
+void ObjectStore::set_executor(std::shared_ptr<Executor> executor) {
+  const std::lock_guard<std::mutex> _(executor_mutex_);
+  executor_ = std::move(executor);
+}
+
+std::future<Status> ObjectStore::run_async(std::function<Status()> fn) {
+  std::shared_ptr<Executor> executor;
+  {
+    const std::lock_guard<std::mutex> _(executor_mutex_);
+    if (executor_ == nullptr) {
+      executor_ = create_thread_pool_executor(kDefaultAsyncThreads,
+                                              kDefaultAsyncQueueDepth);
+    }
+    executor = executor_;
+  }
+
+  // std::function needs a copyable callable, so share the packaged_task.
+  auto task = std::make_shared<std::packaged_task<Status()>>(std::move(fn));
+  std::future<Status> future = task->get_future();
+  executor->submit([task]() { (*task)(); });
+  return future;
+}
+
 ObjectStore *create_object_store(const std::string_view &provider,
                                  const std::string_view region,
                                  const std::string_view *endpoint,
                                  bool use_https) {
+  return create_object_store(provider, region, endpoint, use_https,
+                             ObjectStoreOptions());
+}
+
+ObjectStore *create_object_store(const std::string_view &provider,
+                                 const std::string_view region,
+                                 const std::string_view *endpoint,
+                                 bool use_https,
+                                 const ObjectStoreOptions &options) {
+  std::shared_ptr<Metrics> metrics;
+  if (options.enable_metrics) {
+    metrics = std::make_shared<Metrics>();
+  }
+  ObjectStore *obj_store = nullptr;
   if (provider == "aws") {
-    return create_s3_objstore(region, endpoint, use_https);
+    S3ObjectStore *s3_store =
+        create_s3_objstore(region, endpoint, use_https, options);
+    if (s3_store != nullptr) {
+      s3_store->set_metrics(metrics);
+    }
+    obj_store = s3_store;
   } else if (provider == "local") {
-    return create_local_objstore(region, endpoint, use_https);
+    obj_store = create_local_objstore(region, endpoint, use_https, options);
   } else {
     return nullptr;
   }
+
+  // the metrics are of the requests reaching the provider, so every retry or
+  // cache miss is counted.
+  if (metrics != nullptr) {
+    obj_store = create_metrics_objstore(obj_store, metrics);
+  }
+  if (options.max_retries > 0 || options.hedge_reads) {
+    obj_store = create_retrying_objstore(obj_store, options);
+  }
+  // the retries resend the compressed bodies, and the cache holds the
+  // decompressed ones.
+  if (options.compression != Compression::kNone) {
+    obj_store = create_compressing_objstore(obj_store, options);
+  }
+  if (options.cache_memory_bytes > 0 || !options.cache_disk_path.empty()) {
+    obj_store = create_caching_objstore(obj_store, options);
+  }
+  // the duplicate reads of the callers share one, whether the cache has the
+  // object or not.
+  if (options.coalesce_reads) {
+    obj_store = create_coalescing_objstore(obj_store);
+  }
+  return obj_store;
 }
 
 void destroy_object_store(ObjectStore *obj_store) {
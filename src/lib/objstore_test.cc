@@ -2,6 +2,30 @@
 
 #include <gflags/gflags.h>
 #include <gtest/gtest.h>
+#include <sys/xattr.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <map>
+#include <stdexcept>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "buffer_pool.h"
+#include "coalesce.h"
+#include "crc32c.h"
+#include "executor.h"
+#include "local.h"
+#include "metrics.h"
+#include "retry.h"
+#include "single_flight.h"
 
 namespace objstore {
 
@@ -121,6 +145,513 @@ TEST_F(ObjstoreTest, PartialRead) {
       << "fail to delete object " << st.error_message();
 }
 
+TEST_F(ObjstoreTest, ReadIntoBuffer) {
+  std::string_view key = "test_obj_key";
+  std::string value(4096, 'v');
+  value.replace(0, 5, "head_");
+  Status st = objstore_->put_object(FLAGS_bucket, key, value);
+  ASSERT_EQ(st.error_code(), 0) << "fail to put object " << st.error_message();
+
+  // read the whole object into a large enough buffer.
+  std::vector<char> buf(8192);
+  size_t body_size = 0;
+  st = objstore_->get_object(FLAGS_bucket, key, buf.data(), buf.size(),
+                             body_size);
+  EXPECT_EQ(st.error_code(), 0) << "fail to get object " << st.error_message();
+  EXPECT_EQ(body_size, value.size());
+  EXPECT_EQ(std::string_view(buf.data(), body_size), value);
+
+  // a too small buffer reports the required size.
+  body_size = 0;
+  st = objstore_->get_object(FLAGS_bucket, key, buf.data(), 16, body_size);
+  EXPECT_EQ(st.error_code(), ENOBUFS);
+  EXPECT_EQ(body_size, value.size());
+
+  // read a range, and a range crossing the end of the object.
+  size_t read_len = 0;
+  st = objstore_->get_object(FLAGS_bucket, key, 0, 5, buf.data(), read_len);
+  EXPECT_EQ(st.error_code(), 0) << "fail to get object " << st.error_message();
+  EXPECT_EQ(std::string_view(buf.data(), read_len), "head_");
+
+  st = objstore_->get_object(FLAGS_bucket, key, 4000, 1000, buf.data(),
+                             read_len);
+  EXPECT_EQ(st.error_code(), 0) << "fail to get object " << st.error_message();
+  EXPECT_EQ(std::string_view(buf.data(), read_len), value.substr(4000));
+
+  st = objstore_->delete_object(FLAGS_bucket, key);
+  ASSERT_EQ(st.error_code(), 0)
+      << "fail to delete object " << st.error_message();
+}
+
+TEST_F(ObjstoreTest, PutLargeObject) {
+  // small parts so that s3 uploads the object by multipart upload.
+  ObjectStoreOptions options;
+  options.multipart_threshold = 6 * 1024 * 1024;
+  options.part_size = 5 * 1024 * 1024;
+  options.max_parallel_parts = 2;
+  std::string_view endpoint = FLAGS_endpoint;
+  ObjectStore *objstore = create_object_store(
+      FLAGS_provider, FLAGS_region, endpoint.size() == 0 ? nullptr : &endpoint,
+      FLAGS_use_https, options);
+  ASSERT_NE(objstore, nullptr);
+
+  constexpr size_t kValueSize = 11 * 1024 * 1024 + 13;
+  std::string value(kValueSize, 0);
+  for (size_t i = 0; i < kValueSize; ++i) {
+    value[i] = static_cast<char>(i * 31 + i / 4096);
+  }
+
+  std::string_view key = "test_large_obj_key";
+  Status st = objstore->put_object(FLAGS_bucket, key, value);
+  ASSERT_EQ(st.error_code(), 0) << "fail to put object " << st.error_message();
+  std::string value_out;
+  st = objstore->get_object(FLAGS_bucket, key, value_out);
+  EXPECT_EQ(st.error_code(), 0) << "fail to get object " << st.error_message();
+  EXPECT_TRUE(value_out == value);
+
+  const std::string file_path = "/tmp/objstore_test_large_obj";
+  {
+    std::ofstream file(file_path, std::ios::binary | std::ios::trunc);
+    file.write(value.data(), value.size());
+  }
+  std::reverse(value.begin(), value.end());
+  st = objstore->put_object(FLAGS_bucket, key, value);
+  ASSERT_EQ(st.error_code(), 0) << "fail to put object " << st.error_message();
+  st = objstore->put_object_from_file(FLAGS_bucket, key, file_path);
+  ASSERT_EQ(st.error_code(), 0) << "fail to put object " << st.error_message();
+  std::remove(file_path.c_str());
+  std::reverse(value.begin(), value.end());
+
+  value_out.clear();
+  st = objstore->get_object(FLAGS_bucket, key, value_out);
+  EXPECT_EQ(st.error_code(), 0) << "fail to get object " << st.error_message();
+  EXPECT_TRUE(value_out == value);
+
+  // s3 downloads the object to the file by ranges in parallel.
+  st = objstore->get_object_to_file(FLAGS_bucket, key, file_path);
+  EXPECT_EQ(st.error_code(), 0) << "fail to get object " << st.error_message();
+  {
+    std::ifstream file(file_path, std::ios::binary);
+    value_out.assign(std::istreambuf_iterator<char>(file),
+                     std::istreambuf_iterator<char>());
+  }
+  std::remove(file_path.c_str());
+  EXPECT_TRUE(value_out == value);
+
+  st = objstore->delete_object(FLAGS_bucket, key);
+  ASSERT_EQ(st.error_code(), 0)
+      << "fail to delete object " << st.error_message();
+  destroy_object_store(objstore);
+}
+
+TEST_F(ObjstoreTest, StreamingWriteRead) {
+  // small parts so that s3 uploads the stream by several parts.
+  ObjectStoreOptions options;
+  options.part_size = 5 * 1024 * 1024;
+  options.max_parallel_parts = 2;
+  std::string_view endpoint = FLAGS_endpoint;
+  ObjectStore *objstore = create_object_store(
+      FLAGS_provider, FLAGS_region, endpoint.size() == 0 ? nullptr : &endpoint,
+      FLAGS_use_https, options);
+  ASSERT_NE(objstore, nullptr);
+
+  constexpr size_t kValueSize = 11 * 1024 * 1024 + 13;
+  std::string value(kValueSize, 0);
+  for (size_t i = 0; i < kValueSize; ++i) {
+    value[i] = static_cast<char>(i * 17 + i / 4096);
+  }
+
+  std::string_view key = "test_stream_key";
+  std::unique_ptr<ObjectWriter> writer;
+  Status st = objstore->open_object_writer(FLAGS_bucket, key, writer);
+  ASSERT_EQ(st.error_code(), 0) << "fail to open writer " << st.error_message();
+  for (size_t off = 0; off < kValueSize; off += 100 * 1024 + 7) {
+    st = writer->write(std::string_view(value).substr(off, 100 * 1024 + 7));
+    ASSERT_EQ(st.error_code(), 0) << "fail to write " << st.error_message();
+  }
+  // nothing is visible before close().
+  ObjectMeta meta;
+  EXPECT_NE(objstore->get_object_meta(FLAGS_bucket, key, meta).error_code(),
+            0);
+  st = writer->close();
+  ASSERT_EQ(st.error_code(), 0) << "fail to close " << st.error_message();
+  EXPECT_NE(writer->write("more").error_code(), 0);
+  std::string value_out;
+  st = objstore->get_object(FLAGS_bucket, key, value_out);
+  EXPECT_EQ(st.error_code(), 0) << "fail to get object " << st.error_message();
+  EXPECT_TRUE(value_out == value);
+
+  // an aborted writer leaves the object as it was.
+  st = objstore->open_object_writer(FLAGS_bucket, key, writer);
+  ASSERT_EQ(st.error_code(), 0) << "fail to open writer " << st.error_message();
+  ASSERT_EQ(writer->write(std::string(6 * 1024 * 1024, 'x')).error_code(), 0);
+  writer->abort();
+  writer.reset();
+  // so does a small writer destroyed without close().
+  st = objstore->open_object_writer(FLAGS_bucket, key, writer);
+  ASSERT_EQ(st.error_code(), 0) << "fail to open writer " << st.error_message();
+  ASSERT_EQ(writer->write("dropped").error_code(), 0);
+  writer.reset();
+  st = objstore->get_object_meta(FLAGS_bucket, key, meta);
+  EXPECT_EQ(st.error_code(), 0) << "fail to get meta " << st.error_message();
+  EXPECT_EQ(meta.size, static_cast<long long>(kValueSize));
+
+  // read by the store's own reader and by the prefetching one, with chunks
+  // not aligned to the reads.
+  ObjectReaderOptions reader_options;
+  reader_options.chunk_size = 1024 * 1024 + 3;
+  reader_options.read_ahead = 3;
+  for (bool prefetching : {false, true}) {
+    std::unique_ptr<ObjectReader> reader;
+    st = prefetching ? objstore->ObjectStore::open_object_reader(
+                           FLAGS_bucket, key, reader_options, reader)
+                     : objstore->open_object_reader(FLAGS_bucket, key,
+                                                    reader_options, reader);
+    ASSERT_EQ(st.error_code(), 0)
+        << "fail to open reader " << st.error_message();
+    EXPECT_EQ(reader->size(), kValueSize);
+    value_out.clear();
+    std::string buf(300 * 1024 + 1, 0);
+    size_t read_len = 0;
+    do {
+      st = reader->read(buf.data(), buf.size(), read_len);
+      ASSERT_EQ(st.error_code(), 0) << "fail to read " << st.error_message();
+      value_out.append(buf.data(), read_len);
+    } while (read_len == buf.size());
+    EXPECT_TRUE(value_out == value) << "prefetching " << prefetching;
+    st = reader->read(buf.data(), buf.size(), read_len);
+    EXPECT_EQ(st.error_code(), 0);
+    EXPECT_EQ(read_len, 0);
+  }
+
+  // a reader dropped in the middle waits for its fetches.
+  {
+    std::unique_ptr<ObjectReader> reader;
+    st = objstore->ObjectStore::open_object_reader(FLAGS_bucket, key,
+                                                   reader_options, reader);
+    ASSERT_EQ(st.error_code(), 0)
+        << "fail to open reader " << st.error_message();
+    char buf[10];
+    size_t read_len = 0;
+    ASSERT_EQ(reader->read(buf, sizeof(buf), read_len).error_code(), 0);
+    EXPECT_EQ(std::string_view(buf, read_len), value.substr(0, 10));
+  }
+
+  std::unique_ptr<ObjectReader> reader;
+  st = objstore->open_object_reader(FLAGS_bucket, "test_no_such_key",
+                                    reader_options, reader);
+  EXPECT_NE(st.error_code(), 0);
+
+  st = objstore->delete_object(FLAGS_bucket, key);
+  ASSERT_EQ(st.error_code(), 0)
+      << "fail to delete object " << st.error_message();
+  destroy_object_store(objstore);
+}
+
+TEST_F(ObjstoreTest, ReaderSeek) {
+  constexpr size_t kValueSize = 3 * 1024 * 1024 + 5;
+  std::string value(kValueSize, 0);
+  for (size_t i = 0; i < kValueSize; ++i) {
+    value[i] = static_cast<char>(i * 13 + i / 1000);
+  }
+  std::string_view key = "test_seek_key";
+  Status st = objstore_->put_object(FLAGS_bucket, key, value);
+  ASSERT_EQ(st.error_code(), 0) << "fail to put object " << st.error_message();
+
+  ObjectReaderOptions options;
+  options.chunk_size = 64 * 1024;
+  options.read_ahead = 1;
+  options.max_read_ahead = 4;
+  // scans, skips within and beyond the window, backward and random seeks.
+  const std::vector<std::pair<size_t, size_t>> reads = {
+      {0, 200 * 1024},        {200 * 1024, 100},     {250 * 1024, 70000},
+      {2 * 1024 * 1024, 10},  {1000, 500 * 1024},    {kValueSize - 7, 100},
+      {64 * 1024, 64 * 1024}, {kValueSize, 10},      {5, 3 * 1024 * 1024},
+  };
+  for (bool prefetching : {false, true}) {
+    std::unique_ptr<ObjectReader> reader;
+    st = prefetching ? objstore_->ObjectStore::open_object_reader(
+                           FLAGS_bucket, key, options, reader)
+                     : objstore_->open_object_reader(FLAGS_bucket, key,
+                                                     options, reader);
+    ASSERT_EQ(st.error_code(), 0)
+        << "fail to open reader " << st.error_message();
+    std::string buf;
+    for (const auto &[off, len] : reads) {
+      st = reader->seek(off);
+      ASSERT_EQ(st.error_code(), 0) << "fail to seek " << st.error_message();
+      buf.assign(len, 0);
+      size_t read_len = 0;
+      st = reader->read(buf.data(), len, read_len);
+      ASSERT_EQ(st.error_code(), 0) << "fail to read " << st.error_message();
+      EXPECT_EQ(std::string_view(buf.data(), read_len), value.substr(off, len))
+          << "prefetching " << prefetching << " off " << off;
+    }
+    EXPECT_EQ(reader->seek(kValueSize + 1).error_code(), ERANGE);
+  }
+
+  st = objstore_->delete_object(FLAGS_bucket, key);
+  ASSERT_EQ(st.error_code(), 0)
+      << "fail to delete object " << st.error_message();
+}
+
+// a local object store which fails or delays its next requests on demand,
+// standing in for a flaky s3 service.
+class FaultyObjectStore : public LocalObjectStore {
+ public:
+  using LocalObjectStore::LocalObjectStore;
+  using LocalObjectStore::get_object;
+
+  // fail the next n requests with error_code.
+  void fail_next(size_t n, int error_code) {
+    error_code_ = error_code;
+    failures_ = n;
+  }
+  // delay the next request by delay_ms.
+  void delay_next(int64_t delay_ms) { delay_ms_ = delay_ms; }
+  size_t calls() const { return calls_; }
+  // report the reader of the local store as the default one, as the other
+  // stores do.
+  void hide_native_reader() { native_reader_ = false; }
+  bool has_native_reader() const override { return native_reader_; }
+
+  Status put_object(const std::string_view &bucket, const std::string_view &key,
+                    const std::string_view &data) override {
+    Status status;
+    return inject(status) ? status
+                          : LocalObjectStore::put_object(bucket, key, data);
+  }
+  Status get_object(const std::string_view &bucket, const std::string_view &key,
+                    std::string &body) override {
+    Status status;
+    return inject(status) ? status
+                          : LocalObjectStore::get_object(bucket, key, body);
+  }
+  Status get_object(const std::string_view &bucket, const std::string_view &key,
+                    size_t off, size_t len, char *buf,
+                    size_t &read_len) override {
+    Status status;
+    return inject(status) ? status
+                          : LocalObjectStore::get_object(bucket, key, off, len,
+                                                         buf, read_len);
+  }
+  Status get_object_buffer(
+      const std::string_view &bucket, const std::string_view &key,
+      AccessPattern access,
+      std::shared_ptr<const ObjectBuffer> &buffer) override {
+    Status status;
+    return inject(status) ? status
+                          : LocalObjectStore::get_object_buffer(
+                                bucket, key, access, buffer);
+  }
+  Status get_object_buffer(
+      const std::string_view &bucket, const std::string_view &key, size_t off,
+      size_t len, AccessPattern access,
+      std::shared_ptr<const ObjectBuffer> &buffer) override {
+    Status status;
+    return inject(status) ? status
+                          : LocalObjectStore::get_object_buffer(
+                                bucket, key, off, len, access, buffer);
+  }
+  Status get_object_meta(const std::string_view &bucket,
+                         const std::string_view &key,
+                         ObjectMeta &meta) override {
+    Status status;
+    return inject(status) ? status
+                          : LocalObjectStore::get_object_meta(bucket, key,
+                                                              meta);
+  }
+
+ private:
+  bool inject(Status &status) {
+    ++calls_;
+    std::this_thread::sleep_for(
+        std::chrono::milliseconds(delay_ms_.exchange(0)));
+    size_t failures = failures_;
+    while (failures > 0 &&
+           !failures_.compare_exchange_weak(failures, failures - 1)) {
+    }
+    if (failures == 0) {
+      return false;
+    }
+    status = Status(error_code_, "injected failure");
+    return true;
+  }
+
+  std::atomic<size_t> calls_{0};
+  std::atomic<size_t> failures_{0};
+  std::atomic<int> error_code_{0};
+  std::atomic<int64_t> delay_ms_{0};
+  std::atomic<bool> native_reader_{true};
+};
+
+TEST_F(ObjstoreTest, RetryAndHedge) {
+  if (FLAGS_provider != "local") {
+    GTEST_SKIP() << "the faulty store stands in for the local one";
+  }
+  ObjectStoreOptions options;
+  options.max_retries = 3;
+  options.retry_base_delay_ms = 1;
+  options.retry_max_delay_ms = 5;
+  options.retry_budget_ratio = 0;
+  options.retry_budget_tokens = 5;
+  auto *faulty = new FaultyObjectStore(FLAGS_region, options);
+  std::unique_ptr<ObjectStore> store(create_retrying_objstore(faulty, options));
+  std::string_view key = "test_retry_key";
+
+  // transient failures are retried.
+  faulty->fail_next(2, 503);
+  Status st = store->put_object(FLAGS_bucket, key, "value");
+  EXPECT_EQ(st.error_code(), 0) << "fail to put object " << st.error_message();
+  EXPECT_EQ(faulty->calls(), 3);
+  // others are not.
+  faulty->fail_next(1, 404);
+  std::string body;
+  EXPECT_EQ(store->get_object(FLAGS_bucket, key, body).error_code(), 404);
+  EXPECT_EQ(faulty->calls(), 4);
+  // max_retries, then the budget of 5 retries runs out.
+  faulty->fail_next(100, 503);
+  EXPECT_EQ(store->put_object(FLAGS_bucket, key, "value").error_code(), 503);
+  EXPECT_EQ(faulty->calls(), 4 + 1 + 3);
+  EXPECT_EQ(store->put_object(FLAGS_bucket, key, "value").error_code(), 503);
+  EXPECT_EQ(faulty->calls(), 8 + 1);
+  faulty->fail_next(0, 0);
+
+  // a read slower than the recent ones is hedged.
+  options.retry_budget_tokens = 10;
+  options.hedge_reads = true;
+  options.hedge_min_delay_ms = 50;
+  faulty = new FaultyObjectStore(FLAGS_region, options);
+  store.reset(create_retrying_objstore(faulty, options));
+  for (int i = 0; i < 64; ++i) {
+    st = store->get_object(FLAGS_bucket, key, body);
+    ASSERT_EQ(st.error_code(), 0) << "fail to get " << st.error_message();
+  }
+  EXPECT_EQ(faulty->calls(), 64);
+  faulty->delay_next(1000);
+  const auto start = std::chrono::steady_clock::now();
+  st = store->get_object(FLAGS_bucket, key, body);
+  EXPECT_EQ(st.error_code(), 0) << "fail to get " << st.error_message();
+  EXPECT_EQ(body, "value");
+  EXPECT_LT(std::chrono::steady_clock::now() - start,
+            std::chrono::milliseconds(500));
+  EXPECT_EQ(faulty->calls(), 66);
+
+  EXPECT_EQ(store->delete_object(FLAGS_bucket, key).error_code(), 0);
+}
+
+TEST_F(ObjstoreTest, RetryReader) {
+  if (FLAGS_provider != "local") {
+    GTEST_SKIP() << "the faulty store stands in for the local one";
+  }
+  ObjectStoreOptions options;
+  options.max_retries = 3;
+  options.retry_base_delay_ms = 1;
+  options.retry_max_delay_ms = 5;
+  auto *faulty = new FaultyObjectStore(FLAGS_region, options);
+  faulty->hide_native_reader();
+  std::unique_ptr<ObjectStore> store(create_retrying_objstore(faulty, options));
+  std::string_view key = "test_retry_reader_key";
+  std::string value;
+  for (int i = 0; value.size() < 100000; ++i) {
+    value.append(std::to_string(i) + ",");
+  }
+  Status st = store->put_object(FLAGS_bucket, key, value);
+  ASSERT_EQ(st.error_code(), 0) << "fail to put object " << st.error_message();
+
+  // the chunks of a store without a reader of its own are fetched through
+  // the retries.
+  ObjectReaderOptions reader_options;
+  reader_options.chunk_size = 16 * 1024;
+  std::unique_ptr<ObjectReader> reader;
+  st = store->open_object_reader(FLAGS_bucket, key, reader_options, reader);
+  ASSERT_EQ(st.error_code(), 0) << "fail to open reader " << st.error_message();
+  const size_t calls = faulty->calls();
+  faulty->fail_next(2, 503);
+  std::string read(value.size(), 0);
+  size_t read_len = 0;
+  st = reader->read(read.data(), read.size(), read_len);
+  ASSERT_EQ(st.error_code(), 0) << "fail to read " << st.error_message();
+  EXPECT_EQ(read_len, value.size());
+  EXPECT_TRUE(read == value);
+  const size_t chunk_size = reader_options.chunk_size;
+  const size_t chunks = (value.size() + chunk_size - 1) / chunk_size;
+  EXPECT_EQ(faulty->calls(), calls + chunks + 2);
+
+  reader.reset();
+  EXPECT_EQ(store->delete_object(FLAGS_bucket, key).error_code(), 0);
+}
+
+TEST_F(ObjstoreTest, Metrics) {
+  // every latency falls in the bucket whose bounds hold it.
+  for (uint64_t us : {0, 1, 7, 8, 9, 15, 16, 17, 1000, 123456, 1 << 30}) {
+    const size_t index = Metrics::bucket_index(us);
+    EXPECT_LE(us, Metrics::bucket_upper_bound(index)) << us;
+    if (index > 0) {
+      EXPECT_GT(us, Metrics::bucket_upper_bound(index - 1)) << us;
+    }
+  }
+
+  ObjectStoreMetrics metrics;
+  EXPECT_EQ(objstore_->get_metrics(metrics).error_code(), ENOTSUP);
+
+  ObjectStoreOptions options;
+  options.max_retries = 0;
+  options.enable_metrics = true;
+  std::string_view endpoint = FLAGS_endpoint;
+  std::unique_ptr<ObjectStore> store(create_object_store(
+      FLAGS_provider, FLAGS_region, endpoint.empty() ? nullptr : &endpoint,
+      FLAGS_use_https, options));
+  ASSERT_NE(store, nullptr);
+  std::string_view key = "test_metrics_key";
+  const std::string value(100, 'm');
+  for (int i = 0; i < 3; ++i) {
+    Status st = store->put_object(FLAGS_bucket, key, value);
+    ASSERT_EQ(st.error_code(), 0) << "fail to put " << st.error_message();
+  }
+  std::string body;
+  std::thread([&]() {
+    EXPECT_EQ(store->get_object(FLAGS_bucket, key, body).error_code(), 0);
+  }).join();
+  EXPECT_EQ(store->get_object(FLAGS_bucket, key, body).error_code(), 0);
+  EXPECT_EQ(store->get_object(FLAGS_bucket, key, 10, 20, body).error_code(),
+            0);
+  const Status missing = store->get_object(FLAGS_bucket, "no_such_key", body);
+  EXPECT_NE(missing.error_code(), 0);
+  EXPECT_EQ(store->delete_object(FLAGS_bucket, key).error_code(), 0);
+
+  Status st = store->get_metrics(metrics);
+  ASSERT_EQ(st.error_code(), 0) << "fail to get metrics " << st.error_message();
+  std::map<std::string, OperationMetrics> ops;
+  for (const OperationMetrics &op : metrics.operations) {
+    ops[op.op] = op;
+  }
+  EXPECT_EQ(ops["put"].count, 3);
+  EXPECT_EQ(ops["put"].bytes, 300);
+  EXPECT_EQ(ops["put"].errors, 0);
+  EXPECT_EQ(ops["put"].latency.count, 3);
+  EXPECT_LE(ops["put"].latency.percentile(0.5),
+            ops["put"].latency.percentile(0.99));
+  EXPECT_EQ(ops["get"].count, 3);
+  EXPECT_EQ(ops["get"].bytes, 200);
+  EXPECT_EQ(ops["get"].errors, 1);
+  EXPECT_EQ(ops["get"].error_codes[missing.error_code()], 1);
+  EXPECT_EQ(ops["get_range"].count, 1);
+  EXPECT_EQ(ops["get_range"].bytes, 20);
+  EXPECT_EQ(ops["delete"].count, 1);
+  EXPECT_EQ(ops.count("list"), 0);
+
+  const std::string text = metrics.to_prometheus();
+  EXPECT_NE(text.find("objstore_requests_total{op=\"put\"} 3\n"),
+            std::string::npos);
+  EXPECT_NE(text.find("objstore_errors_total{op=\"get\",code=\"" +
+                      std::to_string(missing.error_code()) + "\"} 1\n"),
+            std::string::npos);
+  EXPECT_NE(text.find("objstore_request_duration_seconds_count{op=\"put\"} "
+                      "3\n"),
+            std::string::npos);
+}
+
 TEST_F(ObjstoreTest, List) {
   std::string key_prefix = "test_obj_key_";
 
@@ -162,6 +693,1190 @@ TEST_F(ObjstoreTest, List) {
   }
 }
 
+TEST_F(ObjstoreTest, ListPages) {
+  // nested keys, '-' and '.' sort before '/', '0' after it.
+  std::vector<std::string> keys;
+  for (int i = 0; i < 10; ++i) {
+    keys.push_back("page/a/" + std::to_string(i));
+    keys.push_back("page/a-" + std::to_string(i));
+    keys.push_back("page/a0/b/" + std::to_string(i));
+  }
+  keys.push_back("page/a.x");
+  keys.push_back("other/key");
+  for (auto &key : keys) {
+    Status st = objstore_->put_object(FLAGS_bucket, key, key);
+    ASSERT_EQ(st.error_code(), 0)
+        << "fail to put object " << st.error_message();
+  }
+  // "other/key" doesn't match the prefix "page/"
+  keys.pop_back();
+  std::sort(keys.begin(), keys.end());
+
+  std::vector<std::string> listed;
+  std::string token;
+  std::string next_token;
+  std::vector<ObjectMeta> objects;
+  size_t pages = 0;
+  do {
+    Status st = objstore_->list_object(FLAGS_bucket, "page/", token, 7,
+                                       objects, next_token);
+    ASSERT_EQ(st.error_code(), 0)
+        << "fail to list object " << st.error_message();
+    ASSERT_LE(objects.size(), 7);
+    for (auto &meta : objects) {
+      EXPECT_EQ(meta.key.size(), meta.size);
+      listed.push_back(meta.key);
+    }
+    token = next_token;
+    ++pages;
+  } while (!token.empty());
+  EXPECT_EQ(listed, keys);
+  EXPECT_EQ(pages, (keys.size() + 6) / 7);
+
+  // stream the listing in batches, and stop it half way.
+  listed.clear();
+  Status st = objstore_->list_object_stream(
+      FLAGS_bucket, "page/a", 4, [&listed](std::vector<ObjectMeta> &batch) {
+        for (auto &meta : batch) {
+          listed.push_back(meta.key);
+        }
+        return listed.size() < 8;
+      });
+  ASSERT_EQ(st.error_code(), 0) << "fail to list object " << st.error_message();
+  EXPECT_EQ(listed, std::vector<std::string>(keys.begin(), keys.begin() + 8));
+
+  keys.push_back("other/key");
+  for (auto &key : keys) {
+    Status st = objstore_->delete_object(FLAGS_bucket, key);
+    ASSERT_EQ(st.error_code(), 0)
+        << "fail to delete object " << st.error_message();
+  }
+}
+
+TEST_F(ObjstoreTest, ListDelimiter) {
+  std::vector<std::string> keys = {
+      "tbl/part=1/a", "tbl/part=1/b", "tbl/part=2/a", "tbl/part=3/x/y",
+      "tbl/meta",     "tbl/part.idx", "other/key",
+  };
+  for (auto &key : keys) {
+    Status st = objstore_->put_object(FLAGS_bucket, key, key);
+    ASSERT_EQ(st.error_code(), 0)
+        << "fail to put object " << st.error_message();
+  }
+
+  std::vector<ObjectMeta> objects;
+  std::vector<std::string> common_prefixes;
+  Status st = objstore_->list_object(FLAGS_bucket, "tbl/", "/", objects,
+                                     common_prefixes);
+  ASSERT_EQ(st.error_code(), 0) << "fail to list object " << st.error_message();
+  ASSERT_EQ(objects.size(), 2);
+  EXPECT_EQ(objects[0].key, "tbl/meta");
+  EXPECT_EQ(objects[0].size, 8);
+  EXPECT_EQ(objects[1].key, "tbl/part.idx");
+  EXPECT_EQ(common_prefixes,
+            std::vector<std::string>({"tbl/part=1/", "tbl/part=2/",
+                                      "tbl/part=3/"}));
+
+  // a prefix ending in the middle of a name.
+  st = objstore_->list_object(FLAGS_bucket, "tbl/part=", "/", objects,
+                              common_prefixes);
+  ASSERT_EQ(st.error_code(), 0) << "fail to list object " << st.error_message();
+  EXPECT_EQ(objects.size(), 0);
+  EXPECT_EQ(common_prefixes.size(), 3);
+
+  // a delimiter other than '/'.
+  st = objstore_->list_object(FLAGS_bucket, "tbl/", "=", objects,
+                              common_prefixes);
+  ASSERT_EQ(st.error_code(), 0) << "fail to list object " << st.error_message();
+  EXPECT_EQ(objects.size(), 2);
+  EXPECT_EQ(common_prefixes, std::vector<std::string>({"tbl/part="}));
+
+  // a prefix holding no object yet is not common, nor is one whose write
+  // was aborted or failed.
+  std::unique_ptr<ObjectWriter> writer;
+  st = objstore_->open_object_writer(FLAGS_bucket, "tbl/part=4/a", writer);
+  ASSERT_EQ(st.error_code(), 0) << "fail to open writer " << st.error_message();
+  ASSERT_EQ(writer->write("a").error_code(), 0);
+  st = objstore_->list_object(FLAGS_bucket, "tbl/", "/", objects,
+                              common_prefixes);
+  ASSERT_EQ(st.error_code(), 0) << "fail to list object " << st.error_message();
+  EXPECT_EQ(common_prefixes.size(), 3);
+  writer->abort();
+  EXPECT_FALSE(objstore_
+                   ->put_object_from_file(FLAGS_bucket, "tbl/part=5/a",
+                                          "/nonexistent/test_file")
+                   .is_succ());
+  st = objstore_->list_object(FLAGS_bucket, "tbl/", "/", objects,
+                              common_prefixes);
+  ASSERT_EQ(st.error_code(), 0) << "fail to list object " << st.error_message();
+  EXPECT_EQ(common_prefixes.size(), 3);
+  if (FLAGS_provider == "local") {
+    const std::string tbl_path = FLAGS_region + "/" + FLAGS_bucket + "/tbl/";
+    EXPECT_FALSE(std::filesystem::exists(tbl_path + "part=4"));
+    EXPECT_FALSE(std::filesystem::exists(tbl_path + "part=5"));
+  }
+
+  for (auto &key : keys) {
+    Status st = objstore_->delete_object(FLAGS_bucket, key);
+    ASSERT_EQ(st.error_code(), 0)
+        << "fail to delete object " << st.error_message();
+  }
+}
+
+TEST_F(ObjstoreTest, DeleteObjects) {
+  std::vector<std::string> keys;
+  for (int i = 0; i < 20; ++i) {
+    keys.push_back("gc/" + std::to_string(i % 3) + "/sst-" +
+                   std::to_string(i));
+  }
+  for (auto &key : keys) {
+    Status st = objstore_->put_object(FLAGS_bucket, key, key);
+    ASSERT_EQ(st.error_code(), 0)
+        << "fail to put object " << st.error_message();
+  }
+  keys.push_back("gc/not-exist");
+
+  std::vector<Status> results;
+  Status st = objstore_->delete_objects(FLAGS_bucket, keys, results);
+  ASSERT_EQ(st.error_code(), 0)
+      << "fail to delete objects " << st.error_message();
+  ASSERT_EQ(results.size(), keys.size());
+  for (auto &result : results) {
+    EXPECT_TRUE(result.is_succ()) << result.error_message();
+  }
+
+  std::vector<ObjectMeta> objects;
+  st = objstore_->list_object(FLAGS_bucket, "gc/", objects);
+  ASSERT_EQ(st.error_code(), 0) << "fail to list object " << st.error_message();
+  EXPECT_EQ(objects.size(), 0);
+
+  // an empty batch.
+  keys.clear();
+  st = objstore_->delete_objects(FLAGS_bucket, keys, results);
+  ASSERT_EQ(st.error_code(), 0);
+  EXPECT_EQ(results.size(), 0);
+}
+
+TEST_F(ObjstoreTest, ObjectBuffer) {
+  std::string value(3 * 4096 + 100, 0);
+  for (size_t i = 0; i < value.size(); ++i) {
+    value[i] = static_cast<char>(i * 17);
+  }
+  std::string_view key = "test_buffer_key";
+  Status st = objstore_->put_object(FLAGS_bucket, key, value);
+  ASSERT_EQ(st.error_code(), 0) << "fail to put object " << st.error_message();
+
+  std::shared_ptr<const ObjectBuffer> whole;
+  st = objstore_->get_object_buffer(FLAGS_bucket, key,
+                                    AccessPattern::kSequential, whole);
+  ASSERT_EQ(st.error_code(), 0) << "fail to get buffer " << st.error_message();
+  EXPECT_TRUE(whole->view() == value);
+
+  // a range starting off a page boundary, cut short at the end.
+  std::shared_ptr<const ObjectBuffer> range;
+  st = objstore_->get_object_buffer(FLAGS_bucket, key, 4097, 20000,
+                                    AccessPattern::kRandom, range);
+  ASSERT_EQ(st.error_code(), 0) << "fail to get buffer " << st.error_message();
+  EXPECT_TRUE(range->view() == std::string_view(value).substr(4097));
+  st = objstore_->get_object_buffer(FLAGS_bucket, key, value.size(), 1,
+                                    AccessPattern::kNormal, range);
+  EXPECT_NE(st.error_code(), 0);
+
+  // the buffers keep the body they were read with.
+  const std::string old_value = value;
+  value.assign(100, 'x');
+  st = objstore_->put_object(FLAGS_bucket, key, value);
+  ASSERT_EQ(st.error_code(), 0) << "fail to put object " << st.error_message();
+  EXPECT_TRUE(whole->view() == old_value);
+  st = objstore_->get_object_buffer(FLAGS_bucket, key,
+                                    AccessPattern::kWillNeed, whole);
+  ASSERT_EQ(st.error_code(), 0) << "fail to get buffer " << st.error_message();
+  EXPECT_TRUE(whole->view() == value);
+
+  st = objstore_->put_object(FLAGS_bucket, key, "");
+  ASSERT_EQ(st.error_code(), 0) << "fail to put object " << st.error_message();
+  st = objstore_->get_object_buffer(FLAGS_bucket, key, AccessPattern::kNormal,
+                                    whole);
+  ASSERT_EQ(st.error_code(), 0) << "fail to get buffer " << st.error_message();
+  EXPECT_EQ(whole->size(), 0);
+
+  st = objstore_->delete_object(FLAGS_bucket, key);
+  ASSERT_EQ(st.error_code(), 0)
+      << "fail to delete object " << st.error_message();
+  st = objstore_->get_object_buffer(FLAGS_bucket, key, AccessPattern::kNormal,
+                                    whole);
+  EXPECT_NE(st.error_code(), 0);
+}
+
+TEST_F(ObjstoreTest, BufferPool) {
+  BufferPool &pool = BufferPool::instance();
+  BufferPoolStats before = get_buffer_pool_stats();
+
+  // a released buffer is reused by the next allocation of its class.
+  void *ptr = pool.allocate(1000);
+  std::memset(ptr, 1, 1000);
+  pool.release(ptr);
+  EXPECT_EQ(pool.allocate(1024), ptr);
+  pool.release(ptr);
+
+  // and by other threads once their caches miss.
+  std::vector<void *> ptrs;
+  for (int i = 0; i < 100; ++i) {
+    ptrs.push_back(pool.allocate(300 * 1024));
+  }
+  for (void *p : ptrs) {
+    pool.release(p);
+  }
+  std::thread([&]() {
+    void *p = pool.allocate(300 * 1024);
+    EXPECT_NE(std::find(ptrs.begin(), ptrs.end(), p), ptrs.end());
+    pool.release(p);
+  }).join();
+
+  void *aligned = pool.allocate(100, 4096);
+  EXPECT_EQ(reinterpret_cast<uintptr_t>(aligned) % 4096, 0);
+  pool.release(aligned);
+  enable_buffer_pool(false);
+  pool.release(pool.allocate(100));
+  enable_buffer_pool(true);
+
+  BufferPoolStats after = get_buffer_pool_stats();
+  EXPECT_EQ(after.allocations - before.allocations, 105);
+  EXPECT_GE(after.thread_cache_hits - before.thread_cache_hits, 1);
+  EXPECT_GE(after.shared_hits - before.shared_hits, 1);
+  EXPECT_EQ(after.unpooled - before.unpooled, 2);
+
+  // ranged buffers of the base store are read into the pool.
+  std::string value(10000, 'v');
+  std::string_view key = "test_pool_key";
+  Status st = objstore_->put_object(FLAGS_bucket, key, value);
+  ASSERT_EQ(st.error_code(), 0) << "fail to put object " << st.error_message();
+  std::shared_ptr<const ObjectBuffer> range;
+  st = objstore_->ObjectStore::get_object_buffer(
+      FLAGS_bucket, key, 9000, 4096, AccessPattern::kNormal, range);
+  ASSERT_EQ(st.error_code(), 0) << "fail to get buffer " << st.error_message();
+  EXPECT_EQ(range->view(), std::string_view(value).substr(9000));
+  st = objstore_->delete_object(FLAGS_bucket, key);
+  ASSERT_EQ(st.error_code(), 0)
+      << "fail to delete object " << st.error_message();
+}
+
+TEST_F(ObjstoreTest, DefaultStoreReadPaths) {
+  if (FLAGS_provider != "local") {
+    GTEST_SKIP() << "checks the paths of the local store";
+  }
+  // the wrappers of the default store, e.g. the retries, hand the reads on
+  // to the paths of the local store instead of the generic ones.
+  ObjectStoreOptions options;
+  options.enable_metrics = true;
+  std::string_view endpoint = FLAGS_endpoint;
+  std::unique_ptr<ObjectStore> store(create_object_store(
+      FLAGS_provider, FLAGS_region, endpoint.empty() ? nullptr : &endpoint,
+      FLAGS_use_https, options));
+  ASSERT_NE(store, nullptr);
+  std::string_view key = "test_read_paths_key";
+  const std::string value(100000, 'a');
+  Status st = store->put_object(FLAGS_bucket, key, value);
+  ASSERT_EQ(st.error_code(), 0) << "fail to put object " << st.error_message();
+
+  // far apart ranges are still one read of the provider.
+  std::vector<std::string> bodies;
+  st = store->get_ranges(FLAGS_bucket, key, {{10, 10}, {90000, 10}}, 0,
+                         bodies);
+  ASSERT_EQ(st.error_code(), 0) << "fail to get ranges " << st.error_message();
+  ObjectStoreMetrics metrics;
+  ASSERT_EQ(store->get_metrics(metrics).error_code(), 0);
+  std::map<std::string, uint64_t> counts;
+  for (auto &op : metrics.operations) {
+    counts[op.op] = op.count;
+  }
+  EXPECT_EQ(counts["get_ranges"], 1);
+  EXPECT_EQ(counts["get_range"], 0);
+
+  // the object file is mapped, from a page boundary.
+  std::shared_ptr<const ObjectBuffer> buffer;
+  st = store->get_object_buffer(FLAGS_bucket, key, AccessPattern::kNormal,
+                                buffer);
+  ASSERT_EQ(st.error_code(), 0) << "fail to get buffer " << st.error_message();
+  EXPECT_TRUE(buffer->view() == value);
+  EXPECT_EQ(reinterpret_cast<uintptr_t>(buffer->data()) % 4096, 0);
+
+  // the reader of the local store keeps the file it was opened on.
+  std::unique_ptr<ObjectReader> reader;
+  st = objstore_->open_object_reader(FLAGS_bucket, key, ObjectReaderOptions(),
+                                     reader);
+  ASSERT_EQ(st.error_code(), 0) << "fail to open reader " << st.error_message();
+  st = objstore_->put_object(FLAGS_bucket, key, std::string(value.size(), 'b'));
+  ASSERT_EQ(st.error_code(), 0) << "fail to put object " << st.error_message();
+  std::string read(value.size(), 0);
+  size_t read_len = 0;
+  st = reader->read(read.data(), read.size(), read_len);
+  ASSERT_EQ(st.error_code(), 0) << "fail to read " << st.error_message();
+  EXPECT_EQ(read_len, value.size());
+  EXPECT_TRUE(read == value);
+
+  EXPECT_EQ(store->delete_object(FLAGS_bucket, key).error_code(), 0);
+}
+
+TEST_F(ObjstoreTest, GetRanges) {
+  std::string value(100000, 0);
+  for (size_t i = 0; i < value.size(); ++i) {
+    value[i] = static_cast<char>(i * 13 + i / 256);
+  }
+  std::string_view key = "test_ranges_key";
+  Status st = objstore_->put_object(FLAGS_bucket, key, value);
+  ASSERT_EQ(st.error_code(), 0) << "fail to put object " << st.error_message();
+
+  // unordered, adjacent, overlapping, empty, far apart and past the end.
+  std::vector<Range> ranges = {
+      {90000, 100},  {10, 20},    {30, 40},      {35, 10},    {500, 0},
+      {1000, 3000},  {2000, 100}, {60000, 1000}, {61500, 10}, {99990, 100},
+  };
+  for (size_t max_gap : {size_t(0), size_t(4096), size_t(64 * 1024)}) {
+    std::vector<std::string> bodies;
+    st = objstore_->get_ranges(FLAGS_bucket, key, ranges, max_gap, bodies);
+    ASSERT_EQ(st.error_code(), 0)
+        << "fail to get ranges " << st.error_message();
+    ASSERT_EQ(bodies.size(), ranges.size());
+    for (size_t i = 0; i < ranges.size(); ++i) {
+      EXPECT_TRUE(bodies[i] == value.substr(ranges[i].off, ranges[i].len))
+          << "range " << i << " max_gap " << max_gap;
+    }
+  }
+
+  std::vector<std::string> bodies;
+  st = objstore_->get_ranges(FLAGS_bucket, key, {{10, 10}, {200000, 10}},
+                             ObjectStore::kDefaultRangeGap, bodies);
+  EXPECT_NE(st.error_code(), 0);
+
+  st = objstore_->delete_object(FLAGS_bucket, key);
+  ASSERT_EQ(st.error_code(), 0)
+      << "fail to delete object " << st.error_message();
+}
+
+TEST_F(ObjstoreTest, ParallelRun) {
+  std::vector<std::atomic<int>> runs(100);
+  Status st = parallel_run(runs.size(), 8, [&](size_t i) {
+    ++runs[i];
+    return Status();
+  });
+  EXPECT_EQ(st.error_code(), 0);
+  for (auto &n : runs) {
+    EXPECT_EQ(n.load(), 1);
+  }
+
+  // a task throwing fails the call instead of terminating its thread.
+  st = parallel_run(100, 8, [](size_t i) {
+    if (i == 50) {
+      throw std::bad_alloc();
+    }
+    return Status();
+  });
+  EXPECT_EQ(st.error_code(), ENOMEM);
+  st = parallel_run(100, 8, [](size_t i) -> Status {
+    throw std::runtime_error("task " + std::to_string(i));
+  });
+  EXPECT_EQ(st.error_code(), EIO);
+}
+
+TEST_F(ObjstoreTest, SingleFlightThrows) {
+  // a throwing call wakes up its waiters with the exception, and the next
+  // call of the key runs again.
+  SingleFlight<std::shared_ptr<int>> flight;
+  std::atomic<int> runs{0};
+  auto throwing = [&](std::shared_ptr<int> &) -> Status {
+    ++runs;
+    std::this_thread::sleep_for(std::chrono::milliseconds(300));
+    throw std::runtime_error("injected");
+  };
+  std::thread leader([&]() {
+    std::shared_ptr<int> value;
+    EXPECT_THROW(flight.run("key", value, throwing), std::runtime_error);
+  });
+  std::this_thread::sleep_for(std::chrono::milliseconds(100));
+  std::shared_ptr<int> value;
+  EXPECT_THROW(flight.run("key", value, throwing), std::runtime_error);
+  leader.join();
+  EXPECT_EQ(runs, 1);
+
+  Status st = flight.run("key", value, [](std::shared_ptr<int> &fetched) {
+    fetched = std::make_shared<int>(42);
+    return Status();
+  });
+  EXPECT_EQ(st.error_code(), 0);
+  ASSERT_NE(value, nullptr);
+  EXPECT_EQ(*value, 42);
+}
+
+TEST_F(ObjstoreTest, ReadThroughCache) {
+  const std::string cache_path =
+      (std::filesystem::temp_directory_path() / "objstore_test_cache")
+          .native();
+  std::filesystem::remove_all(cache_path);
+  ObjectStoreOptions options;
+  options.cache_memory_bytes = 1024 * 1024;
+  options.cache_disk_path = cache_path;
+  options.cache_disk_bytes = 1024 * 1024;
+  options.cache_block_size = 4096;
+  // validate on every read, so that the writes of objstore_ are seen.
+  options.cache_validate_interval_ms = 0;
+  options.enable_metrics = true;
+  std::string_view endpoint = FLAGS_endpoint;
+  ObjectStore *cached = create_object_store(
+      FLAGS_provider, FLAGS_region, endpoint.size() == 0 ? nullptr : &endpoint,
+      FLAGS_use_https, options);
+  ASSERT_NE(cached, nullptr);
+
+  std::string value(10000, 0);
+  for (size_t i = 0; i < value.size(); ++i) {
+    value[i] = static_cast<char>(i * 7);
+  }
+  std::string_view key = "cached/footer";
+  Status st = cached->put_object(FLAGS_bucket, key, value);
+  ASSERT_EQ(st.error_code(), 0) << "fail to put object " << st.error_message();
+
+  std::string body;
+  for (int i = 0; i < 2; ++i) {
+    st = cached->get_object(FLAGS_bucket, key, body);
+    ASSERT_EQ(st.error_code(), 0)
+        << "fail to get object " << st.error_message();
+    EXPECT_TRUE(body == value);
+    if (i == 0) {
+      // the blocks of a cold read are fetched by one get.
+      ObjectStoreMetrics metrics;
+      ASSERT_EQ(cached->get_metrics(metrics).error_code(), 0);
+      std::map<std::string, uint64_t> counts;
+      for (auto &op : metrics.operations) {
+        counts[op.op] = op.count;
+      }
+      EXPECT_EQ(counts["get_range"], 1);
+    }
+    st = cached->get_object(FLAGS_bucket, key, 4000, 5000, body);
+    ASSERT_EQ(st.error_code(), 0)
+        << "fail to get object " << st.error_message();
+    EXPECT_TRUE(body == value.substr(4000, 5000));
+    st = cached->get_object(FLAGS_bucket, key, 9000, 5000, body);
+    ASSERT_EQ(st.error_code(), 0)
+        << "fail to get object " << st.error_message();
+    EXPECT_TRUE(body == value.substr(9000));
+  }
+  char buf[100];
+  size_t read_len = 0;
+  st = cached->get_object(FLAGS_bucket, key, 4090, sizeof(buf), buf, read_len);
+  ASSERT_EQ(st.error_code(), 0) << "fail to get object " << st.error_message();
+  ASSERT_EQ(read_len, sizeof(buf));
+  EXPECT_EQ(std::string(buf, read_len), value.substr(4090, sizeof(buf)));
+  std::vector<std::string> bodies;
+  st = cached->get_ranges(FLAGS_bucket, key, {{9990, 20}, {10, 5000}},
+                          ObjectStore::kDefaultRangeGap, bodies);
+  ASSERT_EQ(st.error_code(), 0) << "fail to get ranges " << st.error_message();
+  ASSERT_EQ(bodies.size(), 2);
+  EXPECT_TRUE(bodies[0] == value.substr(9990));
+  EXPECT_TRUE(bodies[1] == value.substr(10, 5000));
+
+  // concurrent readers of the same blocks.
+  std::vector<std::thread> readers;
+  std::atomic<int> mismatches{0};
+  for (int i = 0; i < 8; ++i) {
+    readers.emplace_back([&]() {
+      std::string out;
+      Status st = cached->get_object(FLAGS_bucket, key, 1000, 8000, out);
+      if (!st.is_succ() || out != value.substr(1000, 8000)) {
+        ++mismatches;
+      }
+    });
+  }
+  for (auto &reader : readers) {
+    reader.join();
+  }
+  EXPECT_EQ(mismatches.load(), 0);
+
+  // overwritten through the cache, then by another writer.
+  value.assign(5000, 'n');
+  st = cached->put_object(FLAGS_bucket, key, value);
+  ASSERT_EQ(st.error_code(), 0) << "fail to put object " << st.error_message();
+  st = cached->get_object(FLAGS_bucket, key, body);
+  ASSERT_EQ(st.error_code(), 0) << "fail to get object " << st.error_message();
+  EXPECT_TRUE(body == value);
+  value.assign(6000, 'o');
+  st = objstore_->put_object(FLAGS_bucket, key, value);
+  ASSERT_EQ(st.error_code(), 0) << "fail to put object " << st.error_message();
+  st = cached->get_object(FLAGS_bucket, key, body);
+  ASSERT_EQ(st.error_code(), 0) << "fail to get object " << st.error_message();
+  EXPECT_TRUE(body == value);
+  destroy_object_store(cached);
+
+  // the disk tier alone, recovered from the previous store.
+  options.cache_memory_bytes = 0;
+  cached = create_object_store(
+      FLAGS_provider, FLAGS_region, endpoint.size() == 0 ? nullptr : &endpoint,
+      FLAGS_use_https, options);
+  ASSERT_NE(cached, nullptr);
+  st = cached->get_object(FLAGS_bucket, key, 100, 5000, body);
+  ASSERT_EQ(st.error_code(), 0) << "fail to get object " << st.error_message();
+  EXPECT_TRUE(body == value.substr(100, 5000));
+
+  st = cached->delete_object(FLAGS_bucket, key);
+  ASSERT_EQ(st.error_code(), 0)
+      << "fail to delete object " << st.error_message();
+  st = cached->get_object(FLAGS_bucket, key, body);
+  EXPECT_NE(st.error_code(), 0);
+  destroy_object_store(cached);
+  std::filesystem::remove_all(cache_path);
+}
+
+TEST_F(ObjstoreTest, DurableWrites) {
+  for (Durability durability :
+       {Durability::kNone, Durability::kPerObject, Durability::kGroupCommit}) {
+    ObjectStoreOptions options;
+    options.local_durability = durability;
+    std::string_view endpoint = FLAGS_endpoint;
+    ObjectStore *objstore = create_object_store(
+        FLAGS_provider, FLAGS_region,
+        endpoint.size() == 0 ? nullptr : &endpoint, FLAGS_use_https, options);
+    ASSERT_NE(objstore, nullptr);
+
+    // readers of an object being overwritten see one whole version or the
+    // other, never a mix or a truncated one.
+    constexpr size_t kValueSize = 256 * 1024;
+    const std::string key = "durable/overwritten";
+    Status st = objstore->put_object(FLAGS_bucket, key,
+                                     std::string(kValueSize, 'a'));
+    ASSERT_EQ(st.error_code(), 0)
+        << "fail to put object " << st.error_message();
+    std::atomic<bool> stop{false};
+    std::atomic<int> torn_reads{0};
+    std::thread reader([&]() {
+      std::string body;
+      while (!stop) {
+        Status st = objstore->get_object(FLAGS_bucket, key, body);
+        if (!st.is_succ() || body.size() != kValueSize ||
+            body.find_first_not_of(body[0]) != std::string::npos) {
+          ++torn_reads;
+        }
+      }
+    });
+
+    std::vector<std::thread> writers;
+    for (int t = 0; t < 4; ++t) {
+      writers.emplace_back([&, t]() {
+        for (int i = 0; i < 10; ++i) {
+          std::string value(kValueSize, static_cast<char>('a' + (t + i) % 26));
+          EXPECT_TRUE(objstore->put_object(FLAGS_bucket, key, value).is_succ());
+          std::string small_key =
+              "durable/" + std::to_string(t) + "/" + std::to_string(i);
+          EXPECT_TRUE(
+              objstore->put_object(FLAGS_bucket, small_key, small_key)
+                  .is_succ());
+        }
+      });
+    }
+    for (auto &writer : writers) {
+      writer.join();
+    }
+    stop = true;
+    reader.join();
+    EXPECT_EQ(torn_reads.load(), 0);
+
+    // no temporary file is listed.
+    std::vector<ObjectMeta> objects;
+    st = objstore->list_object(FLAGS_bucket, "durable/", objects);
+    ASSERT_EQ(st.error_code(), 0)
+        << "fail to list object " << st.error_message();
+    EXPECT_EQ(objects.size(), 41);
+    std::vector<std::string> keys;
+    for (auto &object : objects) {
+      keys.push_back(object.key);
+    }
+    std::vector<Status> results;
+    st = objstore->delete_objects(FLAGS_bucket, keys, results);
+    ASSERT_EQ(st.error_code(), 0)
+        << "fail to delete objects " << st.error_message();
+    destroy_object_store(objstore);
+  }
+}
+
+TEST_F(ObjstoreTest, PutGetFile) {
+  const std::string dir = std::filesystem::temp_directory_path().native();
+  const std::string in_path = dir + "/objstore_test_in";
+  const std::string out_path = dir + "/objstore_test_out";
+  auto read_file = [](const std::string &path) {
+    std::ifstream file(path, std::ios::binary);
+    return std::string(std::istreambuf_iterator<char>(file),
+                       std::istreambuf_iterator<char>());
+  };
+  const LocalCopyStats before = get_local_copy_stats();
+
+  for (size_t size : {size_t(0), size_t(4096), size_t(3 * 1024 * 1024 + 7)}) {
+    std::string value(size, 0);
+    for (size_t i = 0; i < size; ++i) {
+      value[i] = static_cast<char>(i * 5 + i / 1000);
+    }
+    std::ofstream(in_path, std::ios::binary | std::ios::trunc) << value;
+    // a longer output file is truncated.
+    std::ofstream(out_path, std::ios::binary | std::ios::trunc)
+        << std::string(size + 100, 'z');
+
+    std::string_view key = "test_file_key";
+    Status st = objstore_->put_object_from_file(FLAGS_bucket, key, in_path);
+    ASSERT_EQ(st.error_code(), 0)
+        << "fail to put object " << st.error_message();
+    st = objstore_->get_object_to_file(FLAGS_bucket, key, out_path);
+    ASSERT_EQ(st.error_code(), 0)
+        << "fail to get object " << st.error_message();
+    EXPECT_TRUE(read_file(out_path) == value) << "size " << size;
+    st = objstore_->delete_object(FLAGS_bucket, key);
+    ASSERT_EQ(st.error_code(), 0)
+        << "fail to delete object " << st.error_message();
+  }
+
+  if (FLAGS_provider == "local") {
+    const LocalCopyStats after = get_local_copy_stats();
+    EXPECT_EQ(after.reflink + after.copy_file_range + after.sendfile +
+                  after.userspace,
+              before.reflink + before.copy_file_range + before.sendfile +
+                  before.userspace + 6);
+  }
+  std::remove(in_path.c_str());
+  std::remove(out_path.c_str());
+}
+
+TEST_F(ObjstoreTest, Checksums) {
+  // the check values of crc32c.
+  EXPECT_EQ(crc32c("123456789", 9), 0xe3069283u);
+  EXPECT_EQ(crc32c(std::string(32, '\0').data(), 32), 0x8a9136aau);
+  EXPECT_EQ(crc32c(std::string(32, '\xff').data(), 32), 0x62a8ab43u);
+
+  // every length and alignment agrees with the bytewise definition, however
+  // the crc is split, combined or copied.
+  auto reference = [](const char *buf, size_t len) {
+    uint32_t crc = ~0u;
+    for (size_t i = 0; i < len; ++i) {
+      crc ^= static_cast<uint8_t>(buf[i]);
+      for (int k = 0; k < 8; ++k) {
+        crc = crc & 1 ? (crc >> 1) ^ 0x82f63b78 : crc >> 1;
+      }
+    }
+    return ~crc;
+  };
+  std::string data(64 * 1024, 0);
+  for (size_t i = 0; i < data.size(); ++i) {
+    data[i] = static_cast<char>(i * 7 + i / 251);
+  }
+  for (size_t len : {size_t(0), size_t(1), size_t(7), size_t(8), size_t(767),
+                     size_t(768), size_t(12289), size_t(64 * 1024 - 3)}) {
+    for (size_t off : {size_t(0), size_t(3)}) {
+      len = std::min(len, data.size() - off);
+      const char *buf = data.data() + off;
+      const uint32_t crc = crc32c(buf, len);
+      EXPECT_EQ(crc, reference(buf, len)) << "len " << len;
+      const size_t split = len / 3;
+      EXPECT_EQ(crc32c_extend(crc32c(buf, split), buf + split, len - split),
+                crc);
+      EXPECT_EQ(crc32c_combine(crc32c(buf, split), crc32c(buf + split,
+                                                          len - split),
+                               len - split),
+                crc);
+      std::string copy(len, 0);
+      EXPECT_EQ(crc32c_copy(0, copy.data(), buf, len), crc);
+      EXPECT_EQ(copy, std::string(buf, len));
+    }
+  }
+
+  ObjectStoreOptions options;
+  options.enable_checksums = true;
+  std::string_view endpoint = FLAGS_endpoint;
+  ObjectStore *objstore = create_object_store(
+      FLAGS_provider, FLAGS_region, endpoint.size() == 0 ? nullptr : &endpoint,
+      FLAGS_use_https, options);
+  ASSERT_NE(objstore, nullptr);
+
+  // the checksummed objects read back whole, by every interface.
+  const std::string key = "checksummed";
+  const std::string value = data + data.substr(0, 1234);
+  Status st = objstore->put_object(FLAGS_bucket, key, value);
+  ASSERT_EQ(st.error_code(), 0) << "fail to put object " << st.error_message();
+  std::string body;
+  st = objstore->get_object(FLAGS_bucket, key, body);
+  EXPECT_EQ(st.error_code(), 0) << "fail to get object " << st.error_message();
+  EXPECT_TRUE(body == value);
+  std::string buf(value.size(), 0);
+  size_t body_size = 0;
+  st = objstore->get_object(FLAGS_bucket, key, buf.data(), buf.size(),
+                            body_size);
+  EXPECT_EQ(st.error_code(), 0) << "fail to get object " << st.error_message();
+  EXPECT_EQ(body_size, value.size());
+
+  std::unique_ptr<ObjectWriter> writer;
+  st = objstore->open_object_writer(FLAGS_bucket, key + "_written", writer);
+  ASSERT_EQ(st.error_code(), 0) << "fail to open writer "
+                                << st.error_message();
+  EXPECT_TRUE(writer->write(value.substr(0, 1000)).is_succ());
+  EXPECT_TRUE(writer->write(value.substr(1000)).is_succ());
+  EXPECT_TRUE(writer->close().is_succ());
+  st = objstore->get_object(FLAGS_bucket, key + "_written", body);
+  EXPECT_EQ(st.error_code(), 0) << "fail to get object " << st.error_message();
+  EXPECT_TRUE(body == value);
+
+  const std::string dir = std::filesystem::temp_directory_path().native();
+  const std::string in_path = dir + "/objstore_checksum_in";
+  const std::string out_path = dir + "/objstore_checksum_out";
+  std::ofstream(in_path, std::ios::binary | std::ios::trunc) << value;
+  st = objstore->put_object_from_file(FLAGS_bucket, key + "_file", in_path);
+  ASSERT_EQ(st.error_code(), 0) << "fail to put object " << st.error_message();
+  st = objstore->get_object_to_file(FLAGS_bucket, key + "_file", out_path);
+  EXPECT_EQ(st.error_code(), 0) << "fail to get object " << st.error_message();
+  st = objstore->get_object(FLAGS_bucket, key + "_file", body);
+  EXPECT_EQ(st.error_code(), 0) << "fail to get object " << st.error_message();
+  EXPECT_TRUE(body == value);
+
+  // a file system without user xattrs, e.g. a tmpfs without user_xattr,
+  // keeps no crc for the local objects, which are then read unchecked.
+  const std::string path = FLAGS_region + "/" + FLAGS_bucket + "/" + key;
+  char crc[8];
+  const bool no_xattrs =
+      FLAGS_provider == "local" &&
+      ::getxattr(path.c_str(), "user.objstore.crc32c", crc, sizeof(crc)) < 0 &&
+      errno == ENOTSUP;
+  if (FLAGS_provider == "local") {
+    // which the local store reports.
+    LocalObjectStore local(FLAGS_region, options);
+    EXPECT_EQ(local.checksums_available(), !no_xattrs);
+  }
+  if (FLAGS_provider == "local" && !no_xattrs) {
+    // a byte flipped in place behind the store's back is caught by the
+    // whole-object reads, the ranges are not checked.
+    {
+      std::fstream file(path, std::ios::binary | std::ios::in |
+                                  std::ios::out);
+      file.seekp(4321);
+      file.put(static_cast<char>(value[4321] ^ 1));
+    }
+    st = objstore->get_object(FLAGS_bucket, key, body);
+    EXPECT_EQ(st.error_code(), EBADMSG);
+    st = objstore->get_object(FLAGS_bucket, key, buf.data(), buf.size(),
+                              body_size);
+    EXPECT_EQ(st.error_code(), EBADMSG);
+    st = objstore->get_object_to_file(FLAGS_bucket, key, out_path);
+    EXPECT_EQ(st.error_code(), EBADMSG);
+    st = objstore->get_object(FLAGS_bucket, key, 0, 100, body);
+    EXPECT_EQ(st.error_code(), 0);
+
+    // nor is anything read by a store with the checksums disabled.
+    st = objstore_->get_object(FLAGS_bucket, key, body);
+    EXPECT_EQ(st.error_code(), 0);
+  }
+
+  std::vector<Status> results;
+  st = objstore->delete_objects(
+      FLAGS_bucket, {key, key + "_written", key + "_file"}, results);
+  EXPECT_EQ(st.error_code(), 0);
+  destroy_object_store(objstore);
+  std::remove(in_path.c_str());
+  std::remove(out_path.c_str());
+  if (no_xattrs) {
+    GTEST_SKIP() << "no user xattrs on " << FLAGS_region
+                 << ", corruption is not detected";
+  }
+}
+
+TEST_F(ObjstoreTest, Compression) {
+  // log lines compress well, random bytes do not.
+  std::string logs;
+  for (int i = 0; logs.size() < 50 * 1024 + 123; ++i) {
+    logs += "2024-04-07T20:22:41 INFO request " + std::to_string(i) +
+            " took " + std::to_string(i * 37 % 1000) + "us\n";
+  }
+  std::string noise(20 * 1024, 0);
+  uint32_t seed = 1;
+  for (char &c : noise) {
+    seed = seed * 1103515245 + 12345;
+    c = static_cast<char>(seed >> 16);
+  }
+  const std::string dir = std::filesystem::temp_directory_path().native();
+  const std::string in_path = dir + "/objstore_compress_in";
+  const std::string out_path = dir + "/objstore_compress_out";
+
+  for (Compression codec : {Compression::kZstd, Compression::kLz4}) {
+    ObjectStoreOptions options;
+    options.compression = codec;
+    options.compression_chunk_size = 4096;
+    options.compression_min_bytes = 1024;
+    std::string_view endpoint = FLAGS_endpoint;
+    ObjectStore *objstore = create_object_store(
+        FLAGS_provider, FLAGS_region,
+        endpoint.size() == 0 ? nullptr : &endpoint, FLAGS_use_https, options);
+    ASSERT_NE(objstore, nullptr);
+
+    // stored compressed, read back whole by every interface.
+    const std::string key = "compressed";
+    Status st = objstore->put_object(FLAGS_bucket, key, logs);
+    ASSERT_EQ(st.error_code(), 0) << "fail to put " << st.error_message();
+    ObjectMeta meta;
+    st = objstore_->get_object_meta(FLAGS_bucket, key, meta);
+    EXPECT_EQ(st.error_code(), 0);
+    EXPECT_LT(meta.size, logs.size() / 2);
+    const uint64_t stored_size = meta.size;
+    st = objstore->get_object_meta(FLAGS_bucket, key, meta);
+    EXPECT_EQ(st.error_code(), 0);
+    EXPECT_EQ(meta.size, logs.size());
+    // the listings report the stored size, and so does every page of them.
+    std::vector<ObjectMeta> objects;
+    st = objstore->list_object(FLAGS_bucket, key, objects);
+    EXPECT_EQ(st.error_code(), 0);
+    ASSERT_EQ(objects.size(), 1);
+    EXPECT_EQ(objects[0].size, stored_size);
+    std::string next_token;
+    st = objstore->list_object(FLAGS_bucket, key, "", 10, objects, next_token);
+    EXPECT_EQ(st.error_code(), 0);
+    ASSERT_EQ(objects.size(), 1);
+    EXPECT_EQ(objects[0].size, stored_size);
+    std::unique_ptr<ObjectReader> reader;
+    st = objstore->open_object_reader(FLAGS_bucket, key, ObjectReaderOptions(),
+                                      reader);
+    ASSERT_EQ(st.error_code(), 0);
+    EXPECT_EQ(reader->size(), logs.size());
+    std::string body;
+    st = objstore->get_object(FLAGS_bucket, key, body);
+    EXPECT_EQ(st.error_code(), 0) << "fail to get " << st.error_message();
+    EXPECT_TRUE(body == logs);
+    std::string buf(logs.size(), 0);
+    size_t body_size = 0;
+    st = objstore->get_object(FLAGS_bucket, key, buf.data(), buf.size(),
+                              body_size);
+    EXPECT_EQ(st.error_code(), 0);
+    EXPECT_EQ(body_size, logs.size());
+    EXPECT_TRUE(buf == logs);
+    st = objstore->get_object(FLAGS_bucket, key, buf.data(), 100, body_size);
+    EXPECT_EQ(st.error_code(), ENOBUFS);
+    EXPECT_EQ(body_size, logs.size());
+
+    // ranges within a chunk, across chunks, and cut short by the end.
+    for (auto [off, len] : {std::pair<size_t, size_t>{0, 10},
+                            {4000, 200},
+                            {4096, 4096},
+                            {5000, 20000},
+                            {logs.size() - 10, 100}}) {
+      st = objstore->get_object(FLAGS_bucket, key, off, len, body);
+      EXPECT_EQ(st.error_code(), 0) << "off " << off;
+      EXPECT_TRUE(body == logs.substr(off, len)) << "off " << off;
+      size_t read_len = 0;
+      st = objstore->get_object(FLAGS_bucket, key, off, len, buf.data(),
+                                read_len);
+      EXPECT_EQ(st.error_code(), 0) << "off " << off;
+      EXPECT_EQ(std::string(buf.data(), read_len), logs.substr(off, len));
+    }
+    EXPECT_NE(objstore->get_object(FLAGS_bucket, key, logs.size(), 10, body)
+                  .error_code(),
+              0);
+
+    // overwritten through the store, the ranges are of the new object.
+    st = objstore->put_object(FLAGS_bucket, key, logs.substr(100));
+    EXPECT_EQ(st.error_code(), 0);
+    st = objstore->get_object(FLAGS_bucket, key, 5000, 100, body);
+    EXPECT_TRUE(body == logs.substr(5100, 100));
+
+    // small or incompressible objects are stored as they are, and the
+    // objects put by a store without compression read as they are.
+    for (const std::string &value :
+         {logs.substr(0, 1000), noise, logs.substr(0, 9000)}) {
+      const std::string raw_key = "raw";
+      st = objstore->put_object(FLAGS_bucket, raw_key, value);
+      EXPECT_EQ(st.error_code(), 0);
+      const bool stored_raw = value.size() < 1024 || value == noise;
+      st = objstore_->get_object(FLAGS_bucket, raw_key, body);
+      EXPECT_EQ(body == value, stored_raw);
+      EXPECT_EQ(objstore_->put_object(FLAGS_bucket, raw_key, value)
+                    .error_code(),
+                0);
+      st = objstore->get_object(FLAGS_bucket, raw_key, body);
+      EXPECT_TRUE(body == value);
+      st = objstore->get_object(FLAGS_bucket, raw_key, 500, 300, body);
+      EXPECT_TRUE(body == value.substr(500, 300));
+    }
+
+    // written in pieces, the small head is held until the object is large
+    // enough to compress.
+    std::unique_ptr<ObjectWriter> writer;
+    st = objstore->open_object_writer(FLAGS_bucket, key + "_written", writer);
+    ASSERT_EQ(st.error_code(), 0);
+    for (size_t off = 0; off < logs.size(); off += 700) {
+      EXPECT_TRUE(writer->write(logs.substr(off, 700)).is_succ());
+    }
+    EXPECT_TRUE(writer->close().is_succ());
+    st = objstore->get_object(FLAGS_bucket, key + "_written", body);
+    EXPECT_TRUE(body == logs);
+    st = objstore->get_object(FLAGS_bucket, key + "_written", 7000, 9000,
+                              body);
+    EXPECT_TRUE(body == logs.substr(7000, 9000));
+
+    // a writer frames even the chunks which do not shrink, so the stored
+    // object outgrows the body, whose end is still the end of the ranges.
+    st = objstore->open_object_writer(FLAGS_bucket, key + "_noise", writer);
+    ASSERT_EQ(st.error_code(), 0);
+    EXPECT_TRUE(writer->write(noise).is_succ());
+    EXPECT_TRUE(writer->close().is_succ());
+    st = objstore_->get_object_meta(FLAGS_bucket, key + "_noise", meta);
+    EXPECT_GT(meta.size, noise.size());
+    st = objstore->get_object(FLAGS_bucket, key + "_noise", noise.size() - 10,
+                              100, body);
+    EXPECT_EQ(st.error_code(), 0);
+    EXPECT_TRUE(body == noise.substr(noise.size() - 10));
+    st = objstore->get_object(FLAGS_bucket, key + "_noise", noise.size(), 10,
+                              body);
+    EXPECT_EQ(st.error_code(), ERANGE);
+    EXPECT_TRUE(body.empty());
+    size_t noise_len = 0;
+    st = objstore->get_object(FLAGS_bucket, key + "_noise", noise.size() + 8,
+                              10, buf.data(), noise_len);
+    EXPECT_EQ(st.error_code(), ERANGE);
+    EXPECT_EQ(noise_len, 0);
+
+    std::ofstream(in_path, std::ios::binary | std::ios::trunc) << logs;
+    st = objstore->put_object_from_file(FLAGS_bucket, key + "_file", in_path);
+    ASSERT_EQ(st.error_code(), 0) << "fail to put " << st.error_message();
+    st = objstore->get_object_to_file(FLAGS_bucket, key + "_file", out_path);
+    EXPECT_EQ(st.error_code(), 0) << "fail to get " << st.error_message();
+    std::ifstream file(out_path, std::ios::binary);
+    EXPECT_TRUE(std::string(std::istreambuf_iterator<char>(file), {}) == logs);
+    st = objstore_->get_object_meta(FLAGS_bucket, key + "_file", meta);
+    EXPECT_LT(meta.size, logs.size() / 2);
+
+    std::vector<Status> results;
+    st = objstore->delete_objects(
+        FLAGS_bucket,
+        {key, "raw", key + "_written", key + "_noise", key + "_file"},
+        results);
+    EXPECT_EQ(st.error_code(), 0);
+    destroy_object_store(objstore);
+  }
+  std::remove(in_path.c_str());
+  std::remove(out_path.c_str());
+}
+
+TEST_F(ObjstoreTest, CoalesceReads) {
+  if (FLAGS_provider != "local") {
+    GTEST_SKIP() << "the faulty store stands in for the local one";
+  }
+  auto *faulty = new FaultyObjectStore(FLAGS_region, ObjectStoreOptions());
+  std::unique_ptr<ObjectStore> store(create_coalescing_objstore(faulty));
+  std::string_view key = "test_coalesce_key";
+  std::string value;
+  for (int i = 0; value.size() < 64 * 1024; ++i) {
+    value.append("line " + std::to_string(i) + "\n");
+  }
+  Status st = store->put_object(FLAGS_bucket, key, value);
+  ASSERT_EQ(st.error_code(), 0) << "fail to put object " << st.error_message();
+  size_t calls = faulty->calls();
+
+  // the gets of the object while the first one is slow share its read, and
+  // those into an ObjectBuffer share its buffer as well.
+  constexpr int kThreads = 8;
+  std::vector<std::shared_ptr<const ObjectBuffer>> buffers(kThreads);
+  std::vector<std::string> bodies(kThreads);
+  std::vector<Status> results(kThreads);
+  std::vector<std::thread> threads;
+  faulty->delay_next(300);
+  for (int i = 0; i < kThreads; ++i) {
+    threads.emplace_back([&, i]() {
+      results[i] = store->get_object_buffer(FLAGS_bucket, key,
+                                            AccessPattern::kNormal, buffers[i]);
+    });
+  }
+  for (auto &thread : threads) {
+    thread.join();
+  }
+  threads.clear();
+  faulty->delay_next(300);
+  for (int i = 0; i < kThreads; ++i) {
+    threads.emplace_back([&, i]() {
+      Status status = store->get_object(FLAGS_bucket, key, bodies[i]);
+      if (!status.is_succ()) {
+        results[i] = status;
+      }
+    });
+  }
+  for (auto &thread : threads) {
+    thread.join();
+  }
+  EXPECT_EQ(faulty->calls(), calls + 2);
+  for (int i = 0; i < kThreads; ++i) {
+    ASSERT_EQ(results[i].error_code(), 0) << results[i].error_message();
+    EXPECT_EQ(buffers[i].get(), buffers[0].get());
+    EXPECT_EQ(buffers[i]->view(), value);
+    EXPECT_EQ(bodies[i], value);
+  }
+  // nothing is kept once the read is done.
+  buffers.assign(kThreads, nullptr);
+  std::string body;
+  EXPECT_EQ(store->get_object(FLAGS_bucket, key, body).error_code(), 0);
+  EXPECT_EQ(body, value);
+  EXPECT_EQ(faulty->calls(), calls + 3);
+  calls = faulty->calls();
+
+  // so do the metas, and the gets of the same range, but not those of
+  // another range.
+  std::vector<ObjectMeta> metas(kThreads);
+  std::vector<std::string> ranges(kThreads);
+  threads.clear();
+  faulty->delay_next(300);
+  for (int i = 0; i < kThreads; ++i) {
+    threads.emplace_back([&, i]() {
+      results[i] = store->get_object_meta(FLAGS_bucket, key, metas[i]);
+    });
+  }
+  for (auto &thread : threads) {
+    thread.join();
+  }
+  threads.clear();
+  faulty->delay_next(300);
+  for (int i = 0; i < kThreads; ++i) {
+    threads.emplace_back([&, i]() {
+      char buf[100];
+      size_t read_len = 0;
+      Status status =
+          store->get_object(FLAGS_bucket, key, 1000, 100, buf, read_len);
+      ranges[i].assign(buf, status.is_succ() ? read_len : 0);
+    });
+  }
+  for (auto &thread : threads) {
+    thread.join();
+  }
+  EXPECT_EQ(faulty->calls(), calls + 2);
+  for (int i = 0; i < kThreads; ++i) {
+    EXPECT_EQ(results[i].error_code(), 0) << results[i].error_message();
+    EXPECT_EQ(metas[i].size, value.size());
+    EXPECT_EQ(ranges[i], value.substr(1000, 100));
+  }
+  EXPECT_EQ(store->get_object(FLAGS_bucket, key, 2000, 100, body).error_code(),
+            0);
+  EXPECT_EQ(body, value.substr(2000, 100));
+  EXPECT_EQ(faulty->calls(), calls + 3);
+  calls = faulty->calls();
+
+  // a write of another object does not split the reads of this one.
+  std::string other = std::string(key) + "_other";
+  faulty->delay_next(300);
+  std::thread first([&]() { store->get_object(FLAGS_bucket, key, bodies[0]); });
+  std::this_thread::sleep_for(std::chrono::milliseconds(100));
+  EXPECT_EQ(store->put_object(FLAGS_bucket, other, "other").error_code(), 0);
+  EXPECT_EQ(store->get_object(FLAGS_bucket, key, body).error_code(), 0);
+  first.join();
+  EXPECT_EQ(faulty->calls(), calls + 2);
+  EXPECT_EQ(body, value);
+  EXPECT_EQ(bodies[0], value);
+  EXPECT_EQ(store->delete_object(FLAGS_bucket, other).error_code(), 0);
+
+  // a get after a write does not share a read started before it, which may
+  // return either version.
+  faulty->delay_next(300);
+  std::thread slow([&]() { store->get_object(FLAGS_bucket, key, bodies[0]); });
+  std::this_thread::sleep_for(std::chrono::milliseconds(100));
+  EXPECT_EQ(store->put_object(FLAGS_bucket, key, "new value").error_code(), 0);
+  EXPECT_EQ(store->get_object(FLAGS_bucket, key, body).error_code(), 0);
+  EXPECT_EQ(body, "new value");
+  slow.join();
+
+  EXPECT_EQ(store->delete_object(FLAGS_bucket, key).error_code(), 0);
+  EXPECT_FALSE(store->get_object(FLAGS_bucket, key, body).is_succ());
+}
+
+TEST_F(ObjstoreTest, ConcurrentPutGetDelete) {
+  // keys of different threads share parent directories, so deleting one
+  // key prunes directories that other threads are putting into.
+  constexpr int kThreads = 8;
+  constexpr int kRounds = 20;
+  std::vector<std::thread> threads;
+  std::atomic<int> failures{0};
+  for (int t = 0; t < kThreads; ++t) {
+    threads.emplace_back([this, t, &failures]() {
+      for (int i = 0; i < kRounds; ++i) {
+        std::string key = "concurrent_dir/sub_" + std::to_string(i % 2) +
+                          "/key_" + std::to_string(t);
+        std::string value = key + "_" + std::to_string(i);
+        std::string value_out;
+        if (objstore_->put_object(FLAGS_bucket, key, value).error_code() != 0 ||
+            objstore_->get_object(FLAGS_bucket, key, value_out).error_code() !=
+                0 ||
+            value_out != value ||
+            objstore_->delete_object(FLAGS_bucket, key).error_code() != 0) {
+          failures++;
+        }
+      }
+    });
+  }
+  for (auto &thread : threads) {
+    thread.join();
+  }
+  EXPECT_EQ(failures.load(), 0);
+
+  std::vector<ObjectMeta> objects;
+  Status st = objstore_->list_object(FLAGS_bucket, "concurrent_dir/", objects);
+  ASSERT_EQ(st.error_code(), 0) << "fail to list object " << st.error_message();
+  EXPECT_EQ(objects.size(), 0);
+}
+
+TEST_F(ObjstoreTest, Async) {
+  // a tiny queue makes the producer block on backpressure.
+  objstore_->set_executor(create_thread_pool_executor(4, 2));
+
+  constexpr int kObjects = 32;
+  std::string key_prefix = "test_async_key_";
+  std::vector<std::future<Status>> futures;
+  for (int i = 0; i < kObjects; ++i) {
+    std::string kv = key_prefix + std::to_string(i);
+    futures.push_back(objstore_->put_object_async(FLAGS_bucket, kv, kv));
+  }
+  for (auto &future : futures) {
+    Status st = future.get();
+    ASSERT_EQ(st.error_code(), 0)
+        << "fail to put object " << st.error_message();
+  }
+
+  futures.clear();
+  std::vector<std::string> values(kObjects);
+  std::vector<ObjectMeta> metas(kObjects);
+  for (int i = 0; i < kObjects; ++i) {
+    std::string kv = key_prefix + std::to_string(i);
+    futures.push_back(objstore_->get_object_async(FLAGS_bucket, kv, values[i]));
+    futures.push_back(
+        objstore_->get_object_meta_async(FLAGS_bucket, kv, metas[i]));
+  }
+  for (auto &future : futures) {
+    Status st = future.get();
+    ASSERT_EQ(st.error_code(), 0)
+        << "fail to get object " << st.error_message();
+  }
+  for (int i = 0; i < kObjects; ++i) {
+    std::string kv = key_prefix + std::to_string(i);
+    EXPECT_EQ(values[i], kv);
+    EXPECT_EQ(metas[i].size, kv.size());
+  }
+
+  std::string range;
+  Status st =
+      objstore_->get_object_async(FLAGS_bucket, key_prefix + "0", 5, 5, range)
+          .get();
+  EXPECT_EQ(st.error_code(), 0) << "fail to get object " << st.error_message();
+  EXPECT_EQ(range, "async");
+
+  std::vector<ObjectMeta> objects;
+  st = objstore_->list_object_async(FLAGS_bucket, key_prefix, objects).get();
+  ASSERT_EQ(st.error_code(), 0) << "fail to list object " << st.error_message();
+  EXPECT_EQ(objects.size(), kObjects);
+
+  futures.clear();
+  for (int i = 0; i < kObjects; ++i) {
+    std::string kv = key_prefix + std::to_string(i);
+    futures.push_back(objstore_->delete_object_async(FLAGS_bucket, kv));
+  }
+  for (auto &future : futures) {
+    Status st = future.get();
+    ASSERT_EQ(st.error_code(), 0)
+        << "fail to delete object " << st.error_message();
+  }
+}
+
 } // namespace objstore
 
 int main(int argc, char **argv) {
@@ -0,0 +1,69 @@
+#include "ranges.h"
+
+#include <errno.h>
+
+#include <algorithm>
+#include <numeric>
+
+#include "executor.h"
+
+namespace objstore {
+
+std::vector<RangeSpan> coalesce_ranges(const std::vector<Range> &ranges,
+                                       size_t max_gap) {
+  std::vector<size_t> order(ranges.size());
+  std::iota(order.begin(), order.end(), 0);
+  std::sort(order.begin(), order.end(), [&ranges](size_t a, size_t b) {
+    return ranges[a].off < ranges[b].off;
+  });
+
+  std::vector<RangeSpan> spans;
+  for (size_t index : order) {
+    const Range &range = ranges[index];
+    if (range.len == 0) {
+      continue;
+    }
+    if (!spans.empty()) {
+      RangeSpan &span = spans.back();
+      const size_t span_end = span.off + span.len;
+      if (range.off <= span_end || range.off - span_end <= max_gap) {
+        span.len = std::max(span_end, range.off + range.len) - span.off;
+        span.indexes.push_back(index);
+        continue;
+      }
+    }
+    spans.push_back(RangeSpan{range.off, range.len, {index}});
+  }
+  return spans;
+}
+
+Status get_ranges_by_spans(ObjectStore &store, const std::string_view &bucket,
+                           const std::string_view &key,
+                           const std::vector<Range> &ranges, size_t max_gap,
+                           size_t parallelism,
+                           std::vector<std::string> &bodies) {
+  bodies.assign(ranges.size(), std::string());
+  const std::vector<RangeSpan> spans = coalesce_ranges(ranges, max_gap);
+  return parallel_run(spans.size(), parallelism, [&](size_t i) {
+    const RangeSpan &span = spans[i];
+    std::string data;
+    Status status = store.get_object(bucket, key, span.off, span.len, data);
+    if (!status.is_succ()) {
+      return status;
+    }
+
+    // the object may end within the span, cut the ranges short like
+    // get_object() does.
+    for (size_t index : span.indexes) {
+      const Range &range = ranges[index];
+      const size_t pos = range.off - span.off;
+      if (pos >= data.size()) {
+        return Status(ERANGE, "offset out of range");
+      }
+      bodies[index].assign(data, pos, range.len);
+    }
+    return Status();
+  });
+}
+
+}  // namespace objstore
@@ -0,0 +1,35 @@
+#ifndef MY_OBJSTORE_RANGES_H_INCLUDED
+#define MY_OBJSTORE_RANGES_H_INCLUDED
+
+#include <string>
+#include <vector>
+
+#include "objstore.h"
+
+namespace objstore {
+
+// a span of an object read at once, which covers ranges[i] for every i in
+// indexes, sorted by the offsets of the ranges.
+struct RangeSpan {
+  size_t off;
+  size_t len;
+  std::vector<size_t> indexes;
+};
+
+// group the non-empty ranges into spans in offset order: a range joins the
+// span before it if it starts no more than max_gap bytes after its end, so
+// overlapping ranges always share a span.
+std::vector<RangeSpan> coalesce_ranges(const std::vector<Range> &ranges,
+                                       size_t max_gap);
+
+// get_ranges() by one ranged get_object() of store per span, up to
+// parallelism spans at a time.
+Status get_ranges_by_spans(ObjectStore &store, const std::string_view &bucket,
+                           const std::string_view &key,
+                           const std::vector<Range> &ranges, size_t max_gap,
+                           size_t parallelism,
+                           std::vector<std::string> &bodies);
+
+}  // namespace objstore
+
+#endif  // MY_OBJSTORE_RANGES_H_INCLUDED
@@ -0,0 +1,198 @@
+#include "reader.h"
+
+#include <errno.h>
+#include <string.h>
+
+#include <algorithm>
+#include <cmath>
+
+namespace objstore {
+
+PrefetchingObjectReader::PrefetchingObjectReader(
+    ObjectStore &store, const std::string_view &bucket,
+    const std::string_view &key, size_t size,
+    const ObjectReaderOptions &options)
+    : store_(store),
+      bucket_(bucket),
+      key_(key),
+      size_(size),
+      chunk_size_(std::max<size_t>(options.chunk_size, 1)),
+      read_ahead_(options.read_ahead),
+      max_read_ahead_(std::max(options.max_read_ahead, options.read_ahead)),
+      // a reader is opened to be read from the start.
+      window_(options.read_ahead) {}
+
+PrefetchingObjectReader::~PrefetchingObjectReader() {
+  for (std::shared_ptr<Chunk> &chunk : chunks_) {
+    cancel(std::move(chunk));
+  }
+  for (const std::shared_ptr<Chunk> &chunk : cancelled_) {
+    chunk->fetched.wait();
+  }
+}
+
+void PrefetchingObjectReader::fill_window() {
+  while ((chunks_.empty() || chunks_.size() <= window_) && next_off_ < size_) {
+    auto chunk = std::make_shared<Chunk>();
+    chunk->off = next_off_;
+    chunk->len = std::min(chunk_size_, size_ - next_off_);
+    chunk->prefetched = !chunks_.empty();
+    chunk->issued = Clock::now();
+    // the fetch holds the chunk, so a cancelled one may be dropped before
+    // the fetch gets to it.
+    chunk->fetched = store_.run_async(
+        [&store = store_, bucket = bucket_, key = key_, chunk]() {
+          Status status;
+          if (!chunk->cancelled) {
+            status = store.get_object(bucket, key, chunk->off, chunk->len,
+                                      chunk->data);
+          }
+          chunk->fetched_at = Clock::now();
+          return status;
+        });
+    next_off_ += chunk->len;
+    chunks_.push_back(std::move(chunk));
+  }
+}
+
+Status PrefetchingObjectReader::wait_front() {
+  Chunk &chunk = *chunks_.front();
+  if (!chunk.fetched.valid()) {
+    return Status();
+  }
+  if (chunk.prefetched && chunk.fetched.wait_for(std::chrono::seconds(0)) !=
+                              std::future_status::ready) {
+    stalled_ = true;
+  }
+  Status status = chunk.fetched.get();
+  if (status.is_succ() && chunk.data.size() != chunk.len) {
+    status = Status(EIO, "object changed while being read");
+  }
+  if (status.is_succ()) {
+    const double latency =
+        std::chrono::duration<double>(chunk.fetched_at - chunk.issued).count();
+    fetch_latency_ = fetch_latency_ == 0
+                         ? latency
+                         : fetch_latency_ +
+                               kEwmaWeight * (latency - fetch_latency_);
+  }
+  return status;
+}
+
+void PrefetchingObjectReader::on_chunk_consumed(const Chunk &chunk) {
+  const Clock::time_point now = Clock::now();
+  if (stalled_) {
+    // the window was too small to hide the fetch latency.
+    window_ = std::min(std::max<size_t>(window_ * 2, 1), max_read_ahead_);
+  } else if (chunk.off + chunk.len < size_) {
+    // the time to read a whole chunk which did not keep the reader waiting.
+    const double interval =
+        std::chrono::duration<double>(now - front_started_).count();
+    read_interval_ = read_interval_ == 0
+                         ? interval
+                         : read_interval_ +
+                               kEwmaWeight * (interval - read_interval_);
+    // chunks read during one fetch, which have to be in flight.
+    const double estimate =
+        std::ceil(fetch_latency_ / std::max(read_interval_, 1e-6));
+    const size_t target = std::clamp<size_t>(
+        static_cast<size_t>(std::min(estimate, 1e6)), read_ahead_,
+        max_read_ahead_);
+    if (target > window_) {
+      window_ = target;
+    } else if (target < window_) {
+      --window_;
+    }
+  }
+  stalled_ = false;
+  front_started_ = now;
+}
+
+Status PrefetchingObjectReader::read(char *buf, size_t len,
+                                     size_t &read_len) {
+  read_len = 0;
+  if (!status_.is_succ()) {
+    return status_;
+  }
+  reap_cancelled();
+
+  while (read_len < len && pos_ < size_) {
+    const bool fetched_front = !chunks_.empty();
+    fill_window();
+    if (!fetched_front) {
+      front_started_ = Clock::now();
+    }
+    status_ = wait_front();
+    if (!status_.is_succ()) {
+      return status_;
+    }
+
+    Chunk &chunk = *chunks_.front();
+    const size_t chunk_pos = pos_ - chunk.off;
+    const size_t n = std::min(len - read_len, chunk.len - chunk_pos);
+    memcpy(buf + read_len, chunk.data.data() + chunk_pos, n);
+    read_len += n;
+    pos_ += n;
+    if (pos_ == chunk.off + chunk.len) {
+      // a chunk read to its end makes the reads sequential.
+      window_ = std::max(window_, read_ahead_);
+      on_chunk_consumed(chunk);
+      chunks_.pop_front();
+    }
+  }
+  return Status();
+}
+
+Status PrefetchingObjectReader::seek(size_t off) {
+  if (off > size_) {
+    return Status(ERANGE, "offset out of range");
+  }
+  if (off == pos_) {
+    return Status();
+  }
+  reap_cancelled();
+
+  pos_ = off;
+  // a skip forward within the window keeps the chunks from the one holding
+  // off, the reads stay sequential.
+  while (!chunks_.empty() &&
+         chunks_.front()->off + chunks_.front()->len <= off) {
+    cancel(std::move(chunks_.front()));
+    chunks_.pop_front();
+  }
+  if (!chunks_.empty() && chunks_.front()->off <= off) {
+    stalled_ = false;
+    front_started_ = Clock::now();
+    return Status();
+  }
+
+  // anything else is a random access, nothing is read ahead until a chunk
+  // has been read to its end again.
+  for (std::shared_ptr<Chunk> &chunk : chunks_) {
+    cancel(std::move(chunk));
+  }
+  chunks_.clear();
+  next_off_ = off;
+  window_ = 0;
+  stalled_ = false;
+  return Status();
+}
+
+void PrefetchingObjectReader::cancel(std::shared_ptr<Chunk> chunk) {
+  chunk->cancelled = true;
+  if (chunk->fetched.valid()) {
+    cancelled_.push_back(std::move(chunk));
+  }
+}
+
+void PrefetchingObjectReader::reap_cancelled() {
+  cancelled_.erase(
+      std::remove_if(cancelled_.begin(), cancelled_.end(),
+                     [](const std::shared_ptr<Chunk> &chunk) {
+                       return chunk->fetched.wait_for(std::chrono::seconds(
+                                  0)) == std::future_status::ready;
+                     }),
+      cancelled_.end());
+}
+
+}  // namespace objstore
@@ -0,0 +1,104 @@
+#ifndef MY_OBJSTORE_READER_H_INCLUDED
+#define MY_OBJSTORE_READER_H_INCLUDED
+
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <future>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "objstore.h"
+
+namespace objstore {
+
+// an ObjectReader over the ranged gets of any object store. while the reads
+// are sequential, the chunks after the one being read are fetched on the
+// executor of the store, so reading overlaps the latency of the next
+// requests.
+//
+// the window of chunks fetched ahead follows little's law: it holds the
+// chunks read during one fetch latency, both measured as exponential moving
+// averages. a read which has to wait for its chunk doubles the window at
+// once, a read finding its chunk ready shrinks it towards the estimate one
+// chunk at a time.
+class PrefetchingObjectReader : public ObjectReader {
+ public:
+  PrefetchingObjectReader(ObjectStore &store, const std::string_view &bucket,
+                          const std::string_view &key, size_t size,
+                          const ObjectReaderOptions &options);
+  // cancels the chunks fetched ahead and waits for the running fetches.
+  ~PrefetchingObjectReader() override;
+
+  Status read(char *buf, size_t len, size_t &read_len) override;
+  Status seek(size_t off) override;
+  size_t size() const override { return size_; }
+
+ private:
+  using Clock = std::chrono::steady_clock;
+
+  // shared with its fetch, which skips the get once cancelled.
+  struct Chunk {
+    size_t off;
+    size_t len;
+    std::string data;
+    // issued ahead of the reader rather than when it needed the chunk.
+    bool prefetched;
+    std::atomic<bool> cancelled{false};
+    Clock::time_point issued;
+    Clock::time_point fetched_at;
+    std::future<Status> fetched;
+  };
+
+  // issue the fetches of the chunks up to window_ after the current one.
+  void fill_window();
+  // wait for the fetch of the front chunk, which holds pos_.
+  Status wait_front();
+  // adapt the window once the front chunk has been read to its end.
+  void on_chunk_consumed(const Chunk &chunk);
+  void cancel(std::shared_ptr<Chunk> chunk);
+  // forget the cancelled fetches which are done.
+  void reap_cancelled();
+
+ private:
+  // weight of the newest sample in the moving averages.
+  static constexpr double kEwmaWeight = 0.25;
+
+  ObjectStore &store_;
+  const std::string bucket_;
+  const std::string key_;
+  const size_t size_;
+  const size_t chunk_size_;
+  const size_t read_ahead_;
+  const size_t max_read_ahead_;
+
+  // offset of the next byte returned by read().
+  size_t pos_{0};
+  // offset of the first chunk not fetched yet.
+  size_t next_off_{0};
+  // chunks fetched ahead of the current one, 0 until the reads after a seek
+  // turn out to be sequential.
+  size_t window_;
+  // whether the front chunk was prefetched but not fetched yet when the
+  // reader needed it.
+  bool stalled_{false};
+  // moving averages of the fetch latency and of the time the reader takes
+  // to read a fetched chunk, in seconds, 0 before the first sample.
+  double fetch_latency_{0};
+  double read_interval_{0};
+  // when the reader started on the front chunk.
+  Clock::time_point front_started_;
+
+  // the chunks being fetched or read, in offset order. the front one holds
+  // pos_ once its fetch is done.
+  std::deque<std::shared_ptr<Chunk>> chunks_;
+  // the cancelled chunks whose fetches may still be running.
+  std::vector<std::shared_ptr<Chunk>> cancelled_;
+  // the first failure, every later read() returns it.
+  Status status_;
+};
+
+}  // namespace objstore
+
+#endif  // MY_OBJSTORE_READER_H_INCLUDED
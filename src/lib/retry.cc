@@ -0,0 +1,355 @@
+#include "retry.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <random>
+#include <thread>
+
+namespace objstore {
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+uint64_t elapsed_us(Clock::time_point start) {
+  return std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() -
+                                                               start)
+      .count();
+}
+
+}  // anonymous namespace
+
+bool is_retryable(const Status &status) {
+  const int code = status.error_code();
+  return code == -1 || code == 408 || code == 429 || code >= 500 ||
+         code == EBADMSG;
+}
+
+void LatencyTracker::record(uint64_t latency_us) {
+  const std::lock_guard<std::mutex> _(mutex_);
+  if (samples_.size() < kSamples) {
+    samples_.push_back(latency_us);
+  } else {
+    samples_[count_ % kSamples] = latency_us;
+  }
+  ++count_;
+  if (count_ >= kMinSamples && count_ % kRefreshInterval == 0) {
+    std::vector<uint64_t> sorted(samples_);
+    auto p95 = sorted.begin() + sorted.size() * 95 / 100;
+    std::nth_element(sorted.begin(), p95, sorted.end());
+    p95_us_ = *p95;
+  }
+}
+
+bool LatencyTracker::p95(uint64_t &latency_us) const {
+  const std::lock_guard<std::mutex> _(mutex_);
+  latency_us = p95_us_;
+  return count_ >= kMinSamples;
+}
+
+RetryingObjectStore::RetryingObjectStore(ObjectStore *base,
+                                         const ObjectStoreOptions &options)
+    : base_(base),
+      options_(options),
+      budget_tokens_(static_cast<double>(options.retry_budget_tokens)) {
+  if (options_.hedge_reads) {
+    hedge_executor_ =
+        std::make_unique<ThreadPoolExecutor>(kHedgeThreads, kHedgeQueueDepth);
+  }
+}
+
+Status RetryingObjectStore::with_retries(const std::function<Status()> &fn,
+                                         LatencyTracker *tracker) {
+  earn_budget();
+  for (size_t retry = 0;; ++retry) {
+    const Clock::time_point start = Clock::now();
+    Status status = fn();
+    if (status.is_succ()) {
+      if (tracker != nullptr) {
+        tracker->record(elapsed_us(start));
+      }
+      return status;
+    }
+    if (!is_retryable(status) || retry >= options_.max_retries ||
+        !take_budget()) {
+      return status;
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(backoff_ms(retry)));
+  }
+}
+
+template <typename T>
+Status RetryingObjectStore::hedged(LatencyTracker &tracker,
+                                   const std::function<Status(T &)> &fn,
+                                   T &out) {
+  uint64_t p95_us = 0;
+  if (hedge_executor_ == nullptr || !tracker.p95(p95_us)) {
+    return with_retries([&]() { return fn(out); }, &tracker);
+  }
+
+  // shared by the requests, the first success or the last failure wins.
+  struct Race {
+    std::mutex mutex;
+    std::condition_variable done_cv;
+    size_t running{0};
+    bool done{false};
+    Status status;
+    T value;
+  };
+  auto race = std::make_shared<Race>();
+  auto launch = [&]() {
+    {
+      const std::lock_guard<std::mutex> _(race->mutex);
+      ++race->running;
+    }
+    hedge_executor_->submit([this, race, fn, &tracker]() {
+      T value;
+      Status status = with_retries([&]() { return fn(value); }, &tracker);
+      const std::lock_guard<std::mutex> _(race->mutex);
+      --race->running;
+      if (!race->done && (status.is_succ() || race->running == 0)) {
+        race->done = true;
+        race->status = status;
+        race->value = std::move(value);
+        race->done_cv.notify_all();
+      }
+    });
+  };
+
+  launch();
+  const auto delay = std::max(std::chrono::microseconds(p95_us),
+                              std::chrono::microseconds(
+                                  options_.hedge_min_delay_ms * 1000));
+  std::unique_lock<std::mutex> lock(race->mutex);
+  if (!race->done_cv.wait_for(lock, delay, [&]() { return race->done; }) &&
+      take_budget()) {
+    lock.unlock();
+    launch();
+    lock.lock();
+  }
+  race->done_cv.wait(lock, [&]() { return race->done; });
+  out = std::move(race->value);
+  return race->status;
+}
+
+bool RetryingObjectStore::take_budget() {
+  const std::lock_guard<std::mutex> _(budget_mutex_);
+  if (budget_tokens_ < 1) {
+    return false;
+  }
+  budget_tokens_ -= 1;
+  return true;
+}
+
+void RetryingObjectStore::earn_budget() {
+  const std::lock_guard<std::mutex> _(budget_mutex_);
+  budget_tokens_ =
+      std::min(budget_tokens_ + options_.retry_budget_ratio,
+               static_cast<double>(options_.retry_budget_tokens));
+}
+
+uint64_t RetryingObjectStore::backoff_ms(size_t retry) const {
+  // full jitter: the retries of concurrent requests spread over the whole
+  // window instead of hitting the service again at once.
+  thread_local std::mt19937_64 rng(std::random_device{}());
+  const uint64_t cap =
+      std::min(options_.retry_max_delay_ms,
+               options_.retry_base_delay_ms << std::min<size_t>(retry, 32));
+  return std::uniform_int_distribution<uint64_t>(0, cap)(rng);
+}
+
+Status RetryingObjectStore::create_bucket(const std::string_view &bucket) {
+  return with_retries([&]() { return base_->create_bucket(bucket); });
+}
+
+Status RetryingObjectStore::delete_bucket(const std::string_view &bucket) {
+  return with_retries([&]() { return base_->delete_bucket(bucket); });
+}
+
+Status RetryingObjectStore::put_object_from_file(
+    const std::string_view &bucket, const std::string_view &key,
+    const std::string_view &data_file_path) {
+  return with_retries([&]() {
+    return base_->put_object_from_file(bucket, key, data_file_path);
+  });
+}
+
+Status RetryingObjectStore::get_object_to_file(
+    const std::string_view &bucket, const std::string_view &key,
+    const std::string_view &output_file_path) {
+  return with_retries([&]() {
+    return base_->get_object_to_file(bucket, key, output_file_path);
+  });
+}
+
+Status RetryingObjectStore::put_object(const std::string_view &bucket,
+                                       const std::string_view &key,
+                                       const std::string_view &data) {
+  return with_retries([&]() { return base_->put_object(bucket, key, data); });
+}
+
+Status RetryingObjectStore::open_object_writer(
+    const std::string_view &bucket, const std::string_view &key,
+    std::unique_ptr<ObjectWriter> &writer) {
+  return base_->open_object_writer(bucket, key, writer);
+}
+
+Status RetryingObjectStore::get_object(const std::string_view &bucket,
+                                       const std::string_view &key,
+                                       std::string &body) {
+  return hedged<std::string>(
+      get_latency_,
+      [base = base_.get(), bucket = std::string(bucket),
+       key = std::string(key)](std::string &body) {
+        return base->get_object(bucket, key, body);
+      },
+      body);
+}
+
+Status RetryingObjectStore::get_object(const std::string_view &bucket,
+                                       const std::string_view &key,
+                                       size_t off, size_t len,
+                                       std::string &body) {
+  return hedged<std::string>(
+      range_latency_,
+      [base = base_.get(), bucket = std::string(bucket),
+       key = std::string(key), off, len](std::string &body) {
+        return base->get_object(bucket, key, off, len, body);
+      },
+      body);
+}
+
+Status RetryingObjectStore::get_object(const std::string_view &bucket,
+                                       const std::string_view &key, char *buf,
+                                       size_t buf_size, size_t &body_size) {
+  return with_retries([&]() {
+    return base_->get_object(bucket, key, buf, buf_size, body_size);
+  });
+}
+
+Status RetryingObjectStore::get_object(const std::string_view &bucket,
+                                       const std::string_view &key,
+                                       size_t off, size_t len, char *buf,
+                                       size_t &read_len) {
+  return with_retries([&]() {
+    return base_->get_object(bucket, key, off, len, buf, read_len);
+  });
+}
+
+Status RetryingObjectStore::get_object_buffer(
+    const std::string_view &bucket, const std::string_view &key,
+    AccessPattern access, std::shared_ptr<const ObjectBuffer> &buffer) {
+  return hedged<std::shared_ptr<const ObjectBuffer>>(
+      get_latency_,
+      [base = base_.get(), bucket = std::string(bucket),
+       key = std::string(key),
+       access](std::shared_ptr<const ObjectBuffer> &buffer) {
+        return base->get_object_buffer(bucket, key, access, buffer);
+      },
+      buffer);
+}
+
+Status RetryingObjectStore::get_object_buffer(
+    const std::string_view &bucket, const std::string_view &key, size_t off,
+    size_t len, AccessPattern access,
+    std::shared_ptr<const ObjectBuffer> &buffer) {
+  return hedged<std::shared_ptr<const ObjectBuffer>>(
+      range_latency_,
+      [base = base_.get(), bucket = std::string(bucket),
+       key = std::string(key), off, len,
+       access](std::shared_ptr<const ObjectBuffer> &buffer) {
+        return base->get_object_buffer(bucket, key, off, len, access, buffer);
+      },
+      buffer);
+}
+
+Status RetryingObjectStore::get_ranges(const std::string_view &bucket,
+                                       const std::string_view &key,
+                                       const std::vector<Range> &ranges,
+                                       size_t max_gap,
+                                       std::vector<std::string> &bodies) {
+  // not hedged, its latency grows with the ranges.
+  return with_retries([&]() {
+    return base_->get_ranges(bucket, key, ranges, max_gap, bodies);
+  });
+}
+
+Status RetryingObjectStore::get_object_meta(const std::string_view &bucket,
+                                            const std::string_view &key,
+                                            ObjectMeta &meta) {
+  return hedged<ObjectMeta>(
+      meta_latency_,
+      [base = base_.get(), bucket = std::string(bucket),
+       key = std::string(key)](ObjectMeta &meta) {
+        return base->get_object_meta(bucket, key, meta);
+      },
+      meta);
+}
+
+Status RetryingObjectStore::open_object_reader(
+    const std::string_view &bucket, const std::string_view &key,
+    const ObjectReaderOptions &options, std::unique_ptr<ObjectReader> &reader) {
+  // the default reader gets its chunks from this store, so they are retried
+  // and hedged like any other read.
+  if (!base_->has_native_reader()) {
+    return ObjectStore::open_object_reader(bucket, key, options, reader);
+  }
+  return with_retries([&]() {
+    return base_->open_object_reader(bucket, key, options, reader);
+  });
+}
+
+Status RetryingObjectStore::list_object(const std::string_view &bucket,
+                                        const std::string_view &prefix,
+                                        std::vector<ObjectMeta> &objects) {
+  return with_retries(
+      [&]() { return base_->list_object(bucket, prefix, objects); });
+}
+
+Status RetryingObjectStore::list_object(
+    const std::string_view &bucket, const std::string_view &prefix,
+    const std::string_view &continuation_token, size_t max_keys,
+    std::vector<ObjectMeta> &objects, std::string &next_continuation_token) {
+  return with_retries([&]() {
+    return base_->list_object(bucket, prefix, continuation_token, max_keys,
+                              objects, next_continuation_token);
+  });
+}
+
+Status RetryingObjectStore::list_object(
+    const std::string_view &bucket, const std::string_view &prefix,
+    const std::string_view &delimiter, std::vector<ObjectMeta> &objects,
+    std::vector<std::string> &common_prefixes) {
+  return with_retries([&]() {
+    return base_->list_object(bucket, prefix, delimiter, objects,
+                              common_prefixes);
+  });
+}
+
+Status RetryingObjectStore::delete_object(const std::string_view &bucket,
+                                          const std::string_view &key) {
+  return with_retries([&]() { return base_->delete_object(bucket, key); });
+}
+
+Status RetryingObjectStore::delete_objects(
+    const std::string_view &bucket, const std::vector<std::string> &keys,
+    std::vector<Status> &results) {
+  // deleting is idempotent, so the batch is sent again as a whole.
+  return with_retries(
+      [&]() { return base_->delete_objects(bucket, keys, results); });
+}
+
+Status RetryingObjectStore::get_metrics(ObjectStoreMetrics &metrics) {
+  return base_->get_metrics(metrics);
+}
+
+ObjectStore *create_retrying_objstore(ObjectStore *base,
+                                      const ObjectStoreOptions &options) {
+  if (base == nullptr) {
+    return nullptr;
+  }
+  return new RetryingObjectStore(base, options);
+}
+
+}  // namespace objstore
@@ -0,0 +1,167 @@
+#ifndef MY_OBJSTORE_RETRY_H_INCLUDED
+#define MY_OBJSTORE_RETRY_H_INCLUDED
+
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "executor.h"
+#include "objstore.h"
+
+namespace objstore {
+
+// whether a failed request may succeed if sent again: throttled, timed out,
+// failed by the server, never sent (the sdk reports -1) or got a body not
+// matching its checksum.
+bool is_retryable(const Status &status);
+
+// the latencies of the recent successful requests of one kind.
+class LatencyTracker {
+ public:
+  void record(uint64_t latency_us);
+  // the p95 of the recent latencies, false until there are enough of them.
+  bool p95(uint64_t &latency_us) const;
+
+ private:
+  static constexpr size_t kSamples = 256;
+  static constexpr size_t kMinSamples = 32;
+  // the p95 is refreshed every this many samples.
+  static constexpr size_t kRefreshInterval = 32;
+
+  mutable std::mutex mutex_;
+  // a ring of the last kSamples latencies.
+  std::vector<uint64_t> samples_;
+  size_t count_{0};
+  uint64_t p95_us_{0};
+};
+
+// retries the failed requests of another object store with jittered
+// exponential backoff within a retry budget, and hedges the slow reads, see
+// ObjectStoreOptions. a hedged read runs on a thread of this store, so the
+// caller returns with the first success while the slower request finishes
+// in background and is discarded.
+//
+// requests are retried as a whole: a retried get into a caller-provided
+// buffer writes it again, and an ObjectWriter is not retried at all. the
+// native readers of the base store, e.g. of the local files, are handed on
+// and only their opening is retried, any other reads its chunks through the
+// retries.
+class RetryingObjectStore : public ObjectStore {
+ public:
+  // takes the ownership of base.
+  RetryingObjectStore(ObjectStore *base, const ObjectStoreOptions &options);
+  virtual ~RetryingObjectStore() = default;
+
+  Status create_bucket(const std::string_view &bucket) override;
+
+  Status delete_bucket(const std::string_view &bucket) override;
+
+  Status put_object_from_file(const std::string_view &bucket,
+                              const std::string_view &key,
+                              const std::string_view &data_file_path) override;
+  Status get_object_to_file(const std::string_view &bucket,
+                            const std::string_view &key,
+                            const std::string_view &output_file_path) override;
+
+  Status put_object(const std::string_view &bucket, const std::string_view &key,
+                    const std::string_view &data) override;
+  Status open_object_writer(const std::string_view &bucket,
+                            const std::string_view &key,
+                            std::unique_ptr<ObjectWriter> &writer) override;
+  Status get_object(const std::string_view &bucket, const std::string_view &key,
+                    std::string &body) override;
+  Status get_object(const std::string_view &bucket, const std::string_view &key,
+                    size_t off, size_t len, std::string &body) override;
+  Status get_object(const std::string_view &bucket, const std::string_view &key,
+                    char *buf, size_t buf_size, size_t &body_size) override;
+  Status get_object(const std::string_view &bucket, const std::string_view &key,
+                    size_t off, size_t len, char *buf,
+                    size_t &read_len) override;
+  Status get_object_buffer(
+      const std::string_view &bucket, const std::string_view &key,
+      AccessPattern access,
+      std::shared_ptr<const ObjectBuffer> &buffer) override;
+  Status get_object_buffer(
+      const std::string_view &bucket, const std::string_view &key, size_t off,
+      size_t len, AccessPattern access,
+      std::shared_ptr<const ObjectBuffer> &buffer) override;
+  Status get_ranges(const std::string_view &bucket,
+                    const std::string_view &key,
+                    const std::vector<Range> &ranges, size_t max_gap,
+                    std::vector<std::string> &bodies) override;
+  Status get_object_meta(const std::string_view &bucket,
+                         const std::string_view &key,
+                         ObjectMeta &meta) override;
+  Status open_object_reader(const std::string_view &bucket,
+                            const std::string_view &key,
+                            const ObjectReaderOptions &options,
+                            std::unique_ptr<ObjectReader> &reader) override;
+
+  Status list_object(const std::string_view &bucket,
+                     const std::string_view &prefix,
+                     std::vector<ObjectMeta> &objects) override;
+  Status list_object(const std::string_view &bucket,
+                     const std::string_view &prefix,
+                     const std::string_view &continuation_token,
+                     size_t max_keys, std::vector<ObjectMeta> &objects,
+                     std::string &next_continuation_token) override;
+  Status list_object(const std::string_view &bucket,
+                     const std::string_view &prefix,
+                     const std::string_view &delimiter,
+                     std::vector<ObjectMeta> &objects,
+                     std::vector<std::string> &common_prefixes) override;
+
+  Status delete_object(const std::string_view &bucket,
+                       const std::string_view &key) override;
+  Status delete_objects(const std::string_view &bucket,
+                        const std::vector<std::string> &keys,
+                        std::vector<Status> &results) override;
+
+  Status get_metrics(ObjectStoreMetrics &metrics) override;
+
+ private:
+  // run fn until it succeeds, fails for good or runs out of retries. the
+  // latencies of its successes are recorded into tracker unless nullptr.
+  Status with_retries(const std::function<Status()> &fn,
+                      LatencyTracker *tracker = nullptr);
+  // run fn with retries into out, sending it once more if it is slower than
+  // the p95 of tracker. fn must not refer to the caller's arguments, it may
+  // outlive the call.
+  template <typename T>
+  Status hedged(LatencyTracker &tracker,
+                const std::function<Status(T &)> &fn, T &out);
+  // spend a token of the retry budget, false if there is none.
+  bool take_budget();
+  void earn_budget();
+  // the random backoff before the retry-th retry.
+  uint64_t backoff_ms(size_t retry) const;
+
+ private:
+  static constexpr size_t kHedgeThreads = 64;
+  static constexpr size_t kHedgeQueueDepth = 1024;
+
+  std::unique_ptr<ObjectStore> base_;
+  const ObjectStoreOptions options_;
+
+  std::mutex budget_mutex_;
+  double budget_tokens_;
+
+  LatencyTracker get_latency_;
+  LatencyTracker range_latency_;
+  LatencyTracker meta_latency_;
+  // runs the hedged reads, declared after base_ so that it is destroyed,
+  // finishing the reads left in background, before base_ is.
+  std::unique_ptr<ThreadPoolExecutor> hedge_executor_;
+};
+
+// wrap base, whose ownership is taken, into a store which retries and
+// hedges its requests as configured by options.
+ObjectStore *create_retrying_objstore(ObjectStore *base,
+                                      const ObjectStoreOptions &options);
+
+}  // namespace objstore
+
+#endif  // MY_OBJSTORE_RETRY_H_INCLUDED
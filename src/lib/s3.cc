@@ -2,40 +2,621 @@
 
 #include <aws/core/Aws.h>
 #include <aws/core/auth/AWSCredentials.h>
+#include <aws/core/client/DefaultRetryStrategy.h>
+#include <aws/core/http/HttpResponse.h>
+#include <aws/core/utils/HashingUtils.h>
 #include <aws/s3/S3Client.h>
+#include <aws/s3/model/AbortMultipartUploadRequest.h>
+#include <aws/s3/model/ChecksumAlgorithm.h>
+#include <aws/s3/model/ChecksumMode.h>
+#include <aws/s3/model/CompleteMultipartUploadRequest.h>
+#include <aws/s3/model/CompletedMultipartUpload.h>
+#include <aws/s3/model/CompletedPart.h>
 #include <aws/s3/model/CreateBucketRequest.h>
+#include <aws/s3/model/CreateMultipartUploadRequest.h>
 #include <aws/s3/model/DeleteBucketRequest.h>
+#include <aws/s3/model/Delete.h>
 #include <aws/s3/model/DeleteObjectRequest.h>
+#include <aws/s3/model/DeleteObjectsRequest.h>
+#include <aws/s3/model/ObjectIdentifier.h>
 #include <aws/s3/model/GetObjectRequest.h>
 #include <aws/s3/model/HeadObjectRequest.h>
-#include <aws/s3/model/ListObjectsRequest.h>
+#include <aws/s3/model/ListObjectsV2Request.h>
 #include <aws/s3/model/PutObjectRequest.h>
+#include <aws/s3/model/UploadPartRequest.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <algorithm>
+#include <charconv>
+#include <chrono>
+#include <cstring>
+#include <deque>
 #include <fstream>
+#include <future>
 #include <iostream>
+#include <memory>
+#include <mutex>
+#include <streambuf>
 #include <string>
 #include <string_view>
+#include <unordered_map>
+
+#include "buffer_pool.h"
+#include "crc32c.h"
+#include "executor.h"
+#include "metrics.h"
+#include "objstore_aws.h"
+#include "ranges.h"
 
 namespace objstore {
 
 namespace { // anonymous namespace
 
-class S3ApiGlobalOption {
-public:
-  S3ApiGlobalOption() {
-    Aws::SDKOptions options;
-    Aws::InitAPI(options);
+// guards the state of the sdk below.
+std::mutex g_aws_sdk_mutex;
+// references to the initialized sdk, see AwsSdkRef.
+size_t g_aws_sdk_refs = 0;
+// shutting down takes the options the sdk was initialized with.
+Aws::SDKOptions g_aws_sdk_options;
+
+// the clients shared by the stores created with share_s3_client, keyed by
+// their configuration. a client lives as long as a store holds it.
+std::mutex g_shared_clients_mutex;
+std::unordered_map<std::string, std::weak_ptr<Aws::S3::S3Client>>
+    g_shared_clients;
+
+// a streambuf which writes the response body straight into a caller-provided
+// buffer. bytes beyond its capacity are dropped but counted, so the caller can
+// tell the real body size. the written bytes can be read back, which the sdk
+// needs to parse the body of an error response.
+class BufferStreamBuf : public std::streambuf {
+ public:
+  BufferStreamBuf(char *buf, size_t capacity) : buf_(buf), capacity_(capacity) {
+    reset();
+  }
+
+  void reset() {
+    setp(buf_, buf_ + capacity_);
+    setg(buf_, buf_, buf_);
+    dropped_ = 0;
+    crc_ = 0;
+  }
+
+  // bytes stored in the buffer.
+  size_t stored() const { return pptr() - pbase(); }
+  // bytes written, including the dropped ones.
+  size_t written() const { return stored() + dropped_; }
+
+  // checksum the stored bytes as they are copied in.
+  void enable_checksum() { checksum_ = true; }
+  uint32_t crc() const { return crc_; }
+
+ protected:
+  std::streamsize xsputn(const char *s, std::streamsize n) override {
+    size_t copied = std::min<size_t>(epptr() - pptr(), n);
+    if (checksum_) {
+      crc_ = crc32c_copy(crc_, pptr(), s, copied);
+    } else {
+      memcpy(pptr(), s, copied);
+    }
+    // pbump() takes an int, which is enough for one write.
+    pbump(static_cast<int>(copied));
+    dropped_ += n - copied;
+    return n;
+  }
+
+  int_type overflow(int_type ch) override {
+    if (!traits_type::eq_int_type(ch, traits_type::eof())) {
+      ++dropped_;
+    }
+    return traits_type::not_eof(ch);
+  }
+
+  int_type underflow() override {
+    setg(buf_, gptr(), pptr());
+    return gptr() < egptr() ? traits_type::to_int_type(*gptr())
+                            : traits_type::eof();
+  }
+
+ private:
+  char *buf_;
+  size_t capacity_;
+  size_t dropped_{0};
+  bool checksum_{false};
+  uint32_t crc_{0};
+};
+
+// a streambuf which appends the response body to a std::string. like
+// BufferStreamBuf, the written bytes can be read back.
+class StringStreamBuf : public std::streambuf {
+ public:
+  explicit StringStreamBuf(std::string &body) : body_(body) {}
+
+  void reset() {
+    body_.clear();
+    setg(nullptr, nullptr, nullptr);
+    crc_ = 0;
+  }
+
+  std::string &body() { return body_; }
+
+  // checksum the bytes as they are appended, while they are in the cache.
+  void enable_checksum() { checksum_ = true; }
+  uint32_t crc() const { return crc_; }
+
+ protected:
+  std::streamsize xsputn(const char *s, std::streamsize n) override {
+    body_.append(s, n);
+    if (checksum_) {
+      crc_ = crc32c_extend(crc_, body_.data() + body_.size() - n, n);
+    }
+    return n;
   }
-  ~S3ApiGlobalOption() {
-    Aws::SDKOptions options;
-    Aws::ShutdownAPI(options);
+
+  int_type overflow(int_type ch) override {
+    if (!traits_type::eq_int_type(ch, traits_type::eof())) {
+      body_.push_back(traits_type::to_char_type(ch));
+      if (checksum_) {
+        crc_ = crc32c_extend(crc_, &body_.back(), 1);
+      }
+    }
+    return traits_type::not_eof(ch);
   }
+
+  int_type underflow() override {
+    size_t pos = eback() == nullptr ? 0 : gptr() - eback();
+    setg(body_.data(), body_.data() + pos, body_.data() + body_.size());
+    return gptr() < egptr() ? traits_type::to_int_type(*gptr())
+                            : traits_type::eof();
+  }
+
+ private:
+  std::string &body_;
+  bool checksum_{false};
+  uint32_t crc_{0};
 };
 
-S3ApiGlobalOption g_aws_api_option_initializor;
+// max keys s3 returns by one list request.
+constexpr size_t kMaxListKeys = 1000;
+// the most keys a DeleteObjects request takes.
+constexpr size_t kMaxDeleteKeys = 1000;
+
+// a read-only streambuf over the caller's memory, so the request body is sent
+// without being copied into a string stream first. it is seekable since the
+// sdk seeks the body to compute its length and to rewind it for retries.
+class MemoryStreamBuf : public std::streambuf {
+ public:
+  explicit MemoryStreamBuf(const std::string_view &data) {
+    // the get area is never written through.
+    char *begin = const_cast<char *>(data.data());
+    setg(begin, begin, begin + data.size());
+  }
+
+ protected:
+  pos_type seekoff(off_type off, std::ios_base::seekdir dir,
+                   std::ios_base::openmode which) override {
+    if (!(which & std::ios_base::in)) {
+      return pos_type(off_type(-1));
+    }
+
+    char *target = nullptr;
+    if (dir == std::ios_base::beg) {
+      target = eback() + off;
+    } else if (dir == std::ios_base::cur) {
+      target = gptr() + off;
+    } else {
+      target = egptr() + off;
+    }
+    if (target < eback() || target > egptr()) {
+      return pos_type(off_type(-1));
+    }
+    setg(eback(), target, egptr());
+    return pos_type(target - eback());
+  }
+
+  pos_type seekpos(pos_type pos, std::ios_base::openmode which) override {
+    return seekoff(off_type(pos), std::ios_base::beg, which);
+  }
+};
+
+// a read-only streambuf over the range [off, off + len) of a file, read by
+// pread(2) so that the parts of a multipart upload share one descriptor and
+// the file is never loaded into memory. it is seekable like MemoryStreamBuf.
+class FileRangeStreamBuf : public std::streambuf {
+ public:
+  FileRangeStreamBuf(int fd, size_t off, size_t len)
+      : fd_(fd), off_(off), len_(len), buf_(kBufferSize) {}
+
+ protected:
+  int_type underflow() override {
+    if (gptr() < egptr()) {
+      return traits_type::to_int_type(*gptr());
+    }
+    pos_ += egptr() - eback();
+    size_t to_read = std::min(buf_.size(), len_ - pos_);
+    ssize_t ret = 0;
+    do {
+      ret = ::pread(fd_, buf_.data(), to_read, off_ + pos_);
+    } while (ret < 0 && errno == EINTR);
+    if (ret <= 0) {
+      setg(buf_.data(), buf_.data(), buf_.data());
+      return traits_type::eof();
+    }
+    setg(buf_.data(), buf_.data(), buf_.data() + ret);
+    return traits_type::to_int_type(*gptr());
+  }
+
+  pos_type seekoff(off_type off, std::ios_base::seekdir dir,
+                   std::ios_base::openmode which) override {
+    if (!(which & std::ios_base::in)) {
+      return pos_type(off_type(-1));
+    }
+
+    off_type cur = pos_ + (gptr() - eback());
+    off_type target = 0;
+    if (dir == std::ios_base::beg) {
+      target = off;
+    } else if (dir == std::ios_base::cur) {
+      target = cur + off;
+    } else {
+      target = len_ + off;
+    }
+    if (target < 0 || target > static_cast<off_type>(len_)) {
+      return pos_type(off_type(-1));
+    }
+    // drop the buffered bytes, the next read starts at target.
+    pos_ = target;
+    setg(buf_.data(), buf_.data(), buf_.data());
+    return pos_type(target);
+  }
+
+  pos_type seekpos(pos_type pos, std::ios_base::openmode which) override {
+    return seekoff(off_type(pos), std::ios_base::beg, which);
+  }
+
+ private:
+  static constexpr size_t kBufferSize = 256 * 1024;
+
+  int fd_;
+  size_t off_;
+  size_t len_;
+  // offset in the range of the first byte in the get area.
+  size_t pos_{0};
+  PooledBuffer buf_;
+};
+
+// write len bytes of buf at off, retrying short writes. returns errno on
+// failure.
+int pwrite_full(int fd, const char *buf, size_t len, size_t off) {
+  size_t written = 0;
+  while (written < len) {
+    ssize_t ret = ::pwrite(fd, buf + written, len - written, off + written);
+    if (ret < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return errno;
+    }
+    written += ret;
+  }
+  return 0;
+}
+
+uint64_t elapsed_us(std::chrono::steady_clock::time_point start) {
+  return std::chrono::duration_cast<std::chrono::microseconds>(
+             std::chrono::steady_clock::now() - start)
+      .count();
+}
+
+// the crc32c as s3 takes it: the base64 of its big-endian bytes.
+Aws::String encode_crc32c(uint32_t crc) {
+  const unsigned char bytes[4] = {
+      static_cast<unsigned char>(crc >> 24),
+      static_cast<unsigned char>(crc >> 16),
+      static_cast<unsigned char>(crc >> 8), static_cast<unsigned char>(crc)};
+  return Aws::Utils::HashingUtils::Base64Encode(
+      Aws::Utils::ByteBuffer(bytes, sizeof(bytes)));
+}
+
+// false unless checksum is the crc32c of a whole body. that of a multipart
+// upload is the checksum of the checksums of its parts, "<base64>-<parts>",
+// which a body can't be checked against without the part boundaries.
+bool decode_crc32c(const Aws::String &checksum, uint32_t &crc) {
+  if (checksum.empty() || checksum.find('-') != Aws::String::npos) {
+    return false;
+  }
+  const Aws::Utils::ByteBuffer bytes =
+      Aws::Utils::HashingUtils::Base64Decode(checksum);
+  if (bytes.GetLength() != 4) {
+    return false;
+  }
+  crc = static_cast<uint32_t>(bytes[0]) << 24 |
+        static_cast<uint32_t>(bytes[1]) << 16 |
+        static_cast<uint32_t>(bytes[2]) << 8 | static_cast<uint32_t>(bytes[3]);
+  return true;
+}
+
+// check crc, that of a body got, against the checksum s3 sent with it.
+Status verify_crc32c(const Aws::String &checksum, uint32_t crc) {
+  uint32_t expected = 0;
+  if (decode_crc32c(checksum, expected) && expected != crc) {
+    return Status(EBADMSG, "crc32c mismatch");
+  }
+  return Status();
+}
+
+// have s3 send the checksum of the object with its body. a header rather
+// than SetChecksumMode(), which would have the sdk checksum the body once
+// more besides the streambuf.
+void request_checksum(Aws::S3::Model::GetObjectRequest &request) {
+  request.SetAdditionalCustomHeaderValue("x-amz-checksum-mode", "ENABLED");
+}
+
+// the crc32c of body from its start to its end, it is rewound afterwards to
+// be sent. a checksum in the headers has to be known before the body is
+// sent, so this costs a pass over the body. false on a read failure.
+bool crc32c_of_body(std::streambuf *body, uint32_t &crc) {
+  constexpr size_t kBufferSize = 256 * 1024;
+  crc = 0;
+  if (body->pubseekpos(0, std::ios_base::in) != std::streampos(0)) {
+    return false;
+  }
+  PooledBuffer buf(kBufferSize);
+  std::streamsize n = 0;
+  while ((n = body->sgetn(buf.data(), kBufferSize)) > 0) {
+    crc = crc32c_extend(crc, buf.data(), n);
+  }
+  return body->pubseekpos(0, std::ios_base::in) == std::streampos(0);
+}
+
+// issue the GetObject request, the response body is written into streambuf
+// directly instead of the sdk's own string stream. the factory is called for
+// every attempt of the request, so it rewinds the streambuf. the time to the
+// first byte of the body is recorded into metrics as op unless nullptr.
+template <typename StreamBuf>
+Aws::S3::Model::GetObjectOutcome get_object_into(
+    const Aws::S3::S3Client &client, Aws::S3::Model::GetObjectRequest &request,
+    StreamBuf &streambuf, Metrics *metrics, MetricsOp op) {
+  request.SetResponseStreamFactory([&streambuf]() {
+    streambuf.reset();
+    return Aws::New<Aws::IOStream>("IOStreamAllocationTag", &streambuf);
+  });
+  if (metrics != nullptr) {
+    const auto start = std::chrono::steady_clock::now();
+    bool received = false;
+    request.SetDataReceivedEventHandler(
+        [handler = request.GetDataReceivedEventHandler(), metrics, op, start,
+         &received](const Aws::Http::HttpRequest *request,
+                    Aws::Http::HttpResponse *response, long long len) {
+          if (!received) {
+            received = true;
+            metrics->record_ttfb(op, elapsed_us(start));
+          }
+          if (handler) {
+            handler(request, response, len);
+          }
+        });
+  }
+  return client.GetObject(request);
+}
 
 }  // namespace
 
+AwsSdkRef::AwsSdkRef() {
+  const std::lock_guard<std::mutex> _(g_aws_sdk_mutex);
+  if (g_aws_sdk_refs++ == 0) {
+    Aws::InitAPI(g_aws_sdk_options);
+  }
+}
+
+AwsSdkRef::~AwsSdkRef() {
+  const std::lock_guard<std::mutex> _(g_aws_sdk_mutex);
+  if (--g_aws_sdk_refs == 0) {
+    Aws::ShutdownAPI(g_aws_sdk_options);
+  }
+}
+
+bool set_aws_sdk_options(const Aws::SDKOptions &options) {
+  const std::lock_guard<std::mutex> _(g_aws_sdk_mutex);
+  if (g_aws_sdk_refs > 0) {
+    return false;
+  }
+  g_aws_sdk_options = options;
+  return true;
+}
+
+namespace {
+
+// serves the allocations of the sdk from the buffer pool.
+class BufferPoolMemorySystem
+    : public Aws::Utils::Memory::MemorySystemInterface {
+ public:
+  void Begin() override {}
+  void End() override {}
+
+  void *AllocateMemory(std::size_t block_size, std::size_t alignment,
+                       const char *allocation_tag [[maybe_unused]]) override {
+    return BufferPool::instance().allocate(block_size, alignment);
+  }
+
+  void FreeMemory(void *memory_ptr) override {
+    BufferPool::instance().release(memory_ptr);
+  }
+};
+
+}  // anonymous namespace
+
+Aws::Utils::Memory::MemorySystemInterface *get_buffer_pool_memory_manager() {
+  // leaked like the pool, the sdk may free memory until the process exits.
+  static auto *memory_system = new BufferPoolMemorySystem();
+  return memory_system;
+}
+
+// uploads the object part by part as it is written, up to max_parallel_parts
+// parts at a time on the executor of the store, so the memory is bounded by
+// the parts in flight. an object smaller than one part is put at once on
+// close().
+class S3ObjectWriter : public ObjectWriter {
+ public:
+  S3ObjectWriter(S3ObjectStore &store, const std::string_view &bucket,
+                 const std::string_view &key)
+      : store_(store),
+        bucket_(bucket),
+        key_(key),
+        part_size_(std::max(store.options_.part_size,
+                            S3ObjectStore::kMinPartSize)),
+        max_pending_(std::max<size_t>(store.options_.max_parallel_parts, 1)) {
+    buffer_.reserve(part_size_);
+  }
+  ~S3ObjectWriter() override { abort(); }
+
+  Status write(const std::string_view &data) override {
+    if (done_) {
+      return status_.is_succ() ? Status(EINVAL, "writer is closed") : status_;
+    }
+    size_t pos = 0;
+    while (pos < data.size()) {
+      const size_t n =
+          std::min(part_size_ - buffer_.size(), data.size() - pos);
+      buffer_.append(data.data() + pos, n);
+      pos += n;
+      if (buffer_.size() == part_size_) {
+        Status status = upload_buffer();
+        if (!status.is_succ()) {
+          fail(status);
+          return status;
+        }
+      }
+    }
+    return Status();
+  }
+
+  Status close() override {
+    if (done_) {
+      return status_.is_succ() ? Status(EINVAL, "writer is closed") : status_;
+    }
+    if (upload_id_.empty()) {
+      done_ = true;
+      status_ = store_.put_object(bucket_, key_, buffer_);
+      buffer_.clear();
+      return status_;
+    }
+
+    Status status;
+    if (!buffer_.empty()) {
+      status = upload_buffer();
+    }
+    if (status.is_succ()) {
+      status = wait_parts(0);
+    }
+    if (status.is_succ()) {
+      status = store_.complete_multipart_upload(
+          bucket_, key_, upload_id_,
+          std::vector<Aws::S3::Model::CompletedPart>(parts_.begin(),
+                                                     parts_.end()));
+    }
+    if (!status.is_succ()) {
+      fail(status);
+      return status;
+    }
+    done_ = true;
+    return Status();
+  }
+
+  void abort() override {
+    if (done_) {
+      return;
+    }
+    done_ = true;
+    wait_parts(0);
+    if (!upload_id_.empty()) {
+      store_.abort_multipart_upload(bucket_, key_, upload_id_);
+    }
+    buffer_.clear();
+  }
+
+ private:
+  // s3 allows 10000 parts, the part size doubles every this many parts so
+  // that the object may grow far beyond 10000 initial parts.
+  static constexpr size_t kPartsPerSizeStep = 1000;
+
+  // start uploading buffer_ as the next part, after waiting for a slot.
+  Status upload_buffer() {
+    if (upload_id_.empty()) {
+      Status status =
+          store_.create_multipart_upload(bucket_, key_, upload_id_);
+      if (!status.is_succ()) {
+        return status;
+      }
+    }
+    if (parts_.size() == S3ObjectStore::kMaxParts) {
+      return Status(EFBIG, "too many parts");
+    }
+    Status status = wait_parts(max_pending_ - 1);
+    if (!status.is_succ()) {
+      return status;
+    }
+
+    // deque keeps the parts in place, so the upload may fill its part while
+    // more are appended.
+    parts_.emplace_back();
+    Aws::S3::Model::CompletedPart &part = parts_.back();
+    const size_t part_number = parts_.size();
+    pending_.push_back(store_.run_async(
+        [this, &part, part_number, body = std::move(buffer_)]() {
+          MemoryStreamBuf streambuf(body);
+          return store_.upload_part(bucket_, key_, upload_id_, part_number,
+                                    &streambuf, body.size(), part);
+        }));
+
+    if (part_number % kPartsPerSizeStep == 0) {
+      part_size_ = std::min(part_size_ * 2, S3ObjectStore::kMaxPartSize);
+    }
+    buffer_ = std::string();
+    buffer_.reserve(part_size_);
+    return Status();
+  }
+
+  // wait until at most max_pending uploads are in flight, returns the first
+  // failure of the finished ones.
+  Status wait_parts(size_t max_pending) {
+    Status first_failure;
+    while (pending_.size() > max_pending) {
+      Status status = pending_.front().get();
+      pending_.pop_front();
+      if (!status.is_succ() && first_failure.is_succ()) {
+        first_failure = status;
+      }
+    }
+    return first_failure;
+  }
+
+  void fail(const Status &status) {
+    abort();
+    status_ = status;
+  }
+
+ private:
+  S3ObjectStore &store_;
+  const std::string bucket_;
+  const std::string key_;
+  size_t part_size_;
+  const size_t max_pending_;
+
+  // the bytes of the next part.
+  std::string buffer_;
+  // empty until the first part is uploaded.
+  Aws::String upload_id_;
+  std::deque<Aws::S3::Model::CompletedPart> parts_;
+  std::deque<std::future<Status>> pending_;
+  // set once the writer is closed or aborted.
+  bool done_{false};
+  // the failure which aborted the writer.
+  Status status_;
+};
+
 Status S3ObjectStore::create_bucket(const std::string_view &bucket) {
   Aws::S3::Model::CreateBucketRequest request;
   request.SetBucket(std::string(bucket));
@@ -47,7 +628,7 @@ Status S3ObjectStore::create_bucket(const std::string_view &bucket) {
   request.SetCreateBucketConfiguration(createBucketConfig);
 
   Aws::S3::Model::CreateBucketOutcome outcome =
-      s3_client_.CreateBucket(request);
+      s3_client_->CreateBucket(request);
   if (!outcome.IsSuccess()) {
     const Aws::S3::S3Error &err = outcome.GetError();
     return Status(static_cast<int>(err.GetResponseCode()), err.GetMessage());
@@ -61,7 +642,7 @@ Status S3ObjectStore::delete_bucket(const std::string_view &bucket) {
   request.SetBucket(std::string(bucket));
 
   Aws::S3::Model::DeleteBucketOutcome outcome =
-      s3_client_.DeleteBucket(request);
+      s3_client_->DeleteBucket(request);
 
   if (!outcome.IsSuccess()) {
     const Aws::S3::S3Error &err = outcome.GetError();
@@ -74,6 +655,21 @@ Status S3ObjectStore::delete_bucket(const std::string_view &bucket) {
 Status S3ObjectStore::put_object_from_file(
     const std::string_view &bucket, const std::string_view &key,
     const std::string_view &data_file_path) {
+  struct stat st;
+  if (::stat(std::string(data_file_path).c_str(), &st) == 0 &&
+      static_cast<size_t>(st.st_size) > options_.multipart_threshold) {
+    int fd = ::open(std::string(data_file_path).c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+      return Status(EIO, "Error unable to open input file");
+    }
+    Status status = multipart_upload(
+        bucket, key, st.st_size, [fd](size_t off, size_t len) {
+          return std::make_unique<FileRangeStreamBuf>(fd, off, len);
+        });
+    ::close(fd);
+    return status;
+  }
+
   Aws::S3::Model::PutObjectRequest request;
   request.SetBucket(Aws::String(bucket));
   request.SetKey(Aws::String(key));
@@ -85,10 +681,17 @@ Status S3ObjectStore::put_object_from_file(
   if (!*input_data) {
     return Status(EIO, "Error unable to open input file");
   }
+  if (options_.enable_checksums) {
+    uint32_t crc = 0;
+    if (!crc32c_of_body(input_data->rdbuf(), crc)) {
+      return Status(EIO, "Error unable to read input file");
+    }
+    request.SetChecksumCRC32C(encode_crc32c(crc));
+  }
 
   request.SetBody(input_data);
 
-  Aws::S3::Model::PutObjectOutcome outcome = s3_client_.PutObject(request);
+  Aws::S3::Model::PutObjectOutcome outcome = s3_client_->PutObject(request);
 
   if (!outcome.IsSuccess()) {
     const Aws::S3::S3Error &err = outcome.GetError();
@@ -101,47 +704,92 @@ Status S3ObjectStore::put_object_from_file(
 Status S3ObjectStore::get_object_to_file(
     const std::string_view &bucket, const std::string_view &key,
     const std::string_view &output_file_path) {
-  std::string result;
-  Status status = get_object(bucket, key, result);
+  ObjectMeta meta;
+  Aws::String checksum;
+  Status status = head_object(bucket, key, meta,
+                              options_.enable_checksums ? &checksum : nullptr);
+  if (!status.is_succ()) {
+    return status;
+  }
+  const size_t size = meta.size;
 
-  std::shared_ptr<Aws::IOStream> output_stream = Aws::MakeShared<Aws::FStream>(
-      "IOStreamAllocationTag", output_file_path.data(),
-      std::ios_base::out | std::ios_base::binary | std::ios_base::trunc);
-  if (!*output_stream) {
+  int fd = ::open(std::string(output_file_path).c_str(),
+                  O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if (fd < 0) {
     return Status(EIO, "Error unable to open output file");
   }
 
-  bool fail =
-      output_stream->write(result.c_str(), result.length()).flush().fail();
-  if (fail) {
-    return Status(EIO, "unable to write key's value into file");
-  }
+  // fetch the object by ranges in parallel, every range is written at its
+  // offset of the file, so at most max_parallel_parts ranges are in memory.
+  const size_t part_size = std::max<size_t>(options_.part_size, 1);
+  const size_t num_parts = (size + part_size - 1) / part_size;
+  std::vector<uint32_t> crcs(num_parts);
+  status = parallel_run(
+      num_parts, options_.max_parallel_parts, [&](size_t i) {
+        const size_t off = i * part_size;
+        const size_t len = std::min(part_size, size - off);
+        PooledBuffer buf(len);
+        size_t read_len = 0;
+        Status status =
+            get_range(bucket, key, off, len, buf.data(), read_len,
+                      options_.enable_checksums ? &crcs[i] : nullptr);
+        if (!status.is_succ()) {
+          return status;
+        } else if (read_len != len) {
+          return Status(EIO, "object changed while downloading it");
+        }
+        if (pwrite_full(fd, buf.data(), len, off) != 0) {
+          return Status(EIO, "unable to write key's value into file");
+        }
+        return Status();
+      });
 
-  return Status();
+  if (::close(fd) != 0 && status.is_succ()) {
+    status = Status(EIO, "unable to write key's value into file");
+  }
+  if (status.is_succ() && options_.enable_checksums) {
+    // the ranges were checksummed as they arrived, their crcs make that of
+    // the object, which also catches an object changed between the ranges.
+    uint32_t crc = 0;
+    for (size_t i = 0; i < num_parts; ++i) {
+      crc = crc32c_combine(crc, crcs[i],
+                           std::min(part_size, size - i * part_size));
+    }
+    status = verify_crc32c(checksum, crc);
+  }
+  return status;
 }
 
 Status S3ObjectStore::put_object(const std::string_view &bucket,
                                  const std::string_view &key,
                                  const std::string_view &data) {
+  if (data.size() > options_.multipart_threshold) {
+    return multipart_upload(
+        bucket, key, data.size(), [&data](size_t off, size_t len) {
+          return std::make_unique<MemoryStreamBuf>(data.substr(off, len));
+        });
+  }
 
+  MemoryStreamBuf streambuf(data);
   Aws::S3::Model::PutObjectRequest request;
   request.SetBucket(Aws::String(bucket));
   request.SetKey(Aws::String(key));
 
   const std::shared_ptr<Aws::IOStream> data_stream =
-      Aws::MakeShared<Aws::StringStream>("SStreamAllocationTag");
-  if (!*data_stream) {
-    return Status(EIO, "unable to create data stream to hold input data");
-  }
-
-  *data_stream << data;
+      Aws::MakeShared<Aws::IOStream>("IOStreamAllocationTag", &streambuf);
   if (!*data_stream) {
-    return Status(EIO, "unable to write data into data stream");
+    return Status(EIO, "unable to create data stream over input data");
   }
 
   request.SetBody(data_stream);
+  request.SetContentLength(static_cast<long long>(data.size()));
+  if (options_.enable_checksums) {
+    // s3 rejects the body unless it matches. the crc is set rather than the
+    // algorithm, which would have the sdk compute it by itself.
+    request.SetChecksumCRC32C(encode_crc32c(crc32c(data.data(), data.size())));
+  }
 
-  Aws::S3::Model::PutObjectOutcome outcome = s3_client_.PutObject(request);
+  Aws::S3::Model::PutObjectOutcome outcome = s3_client_->PutObject(request);
   if (!outcome.IsSuccess()) {
     const Aws::S3::S3Error &err = outcome.GetError();
     return Status(static_cast<int>(err.GetResponseCode()), err.GetMessage());
@@ -156,58 +804,156 @@ Status S3ObjectStore::get_object(const std::string_view &bucket,
   Aws::S3::Model::GetObjectRequest request;
   request.SetBucket(Aws::String(bucket));
   request.SetKey(Aws::String(key));
-  Aws::S3::Model::GetObjectOutcome outcome = s3_client_.GetObject(request);
+
+  StringStreamBuf streambuf(body);
+  if (options_.enable_checksums) {
+    streambuf.enable_checksum();
+    request_checksum(request);
+  }
+  // reserve the whole body once the headers arrive, so that appending the
+  // body chunks does not reallocate the string.
+  bool reserved = false;
+  request.SetDataReceivedEventHandler(
+      [&streambuf, &reserved](const Aws::Http::HttpRequest *,
+                              Aws::Http::HttpResponse *response, long long) {
+        // runs on a thread of the sdk, so a malformed length must not throw,
+        // the body is then simply appended without a reserve.
+        if (!reserved && response->HasHeader("content-length")) {
+          const Aws::String &header = response->GetHeader("content-length");
+          const char *end = header.data() + header.size();
+          size_t length = 0;
+          auto [ptr, ec] = std::from_chars(header.data(), end, length);
+          if (ec == std::errc() && ptr == end) {
+            streambuf.body().reserve(length);
+          }
+        }
+        reserved = true;
+      });
+  Aws::S3::Model::GetObjectOutcome outcome =
+      get_object_into(*s3_client_, request, streambuf, metrics_.get(),
+                      MetricsOp::kGet);
 
   if (!outcome.IsSuccess()) {
+    body.clear();
     const Aws::S3::S3Error &err = outcome.GetError();
     return Status(static_cast<int>(err.GetResponseCode()), err.GetMessage());
   }
 
-  std::ostringstream oss;
-  oss << outcome.GetResult().GetBody().rdbuf();
-  if (!oss) {
-    return Status(EIO, "unable to read data from response stream");
+  if (options_.enable_checksums) {
+    return verify_crc32c(outcome.GetResult().GetChecksumCRC32C(),
+                         streambuf.crc());
+  }
+  return Status();
+}
+
+Status S3ObjectStore::get_object(const std::string_view &bucket,
+                                 const std::string_view &key, size_t off,
+                                 size_t len, std::string &body) {
+  body.resize(len);
+  size_t read_len = 0;
+  Status status = get_object(bucket, key, off, len, body.data(), read_len);
+  body.resize(read_len);
+  return status;
+}
+
+Status S3ObjectStore::get_object(const std::string_view &bucket,
+                                 const std::string_view &key, char *buf,
+                                 size_t buf_size, size_t &body_size) {
+  Aws::S3::Model::GetObjectRequest request;
+  request.SetBucket(Aws::String(bucket));
+  request.SetKey(Aws::String(key));
+
+  BufferStreamBuf streambuf(buf, buf_size);
+  if (options_.enable_checksums) {
+    streambuf.enable_checksum();
+    request_checksum(request);
+  }
+  Aws::S3::Model::GetObjectOutcome outcome =
+      get_object_into(*s3_client_, request, streambuf, metrics_.get(),
+                      MetricsOp::kGet);
+
+  if (!outcome.IsSuccess()) {
+    body_size = 0;
+    const Aws::S3::S3Error &err = outcome.GetError();
+    return Status(static_cast<int>(err.GetResponseCode()), err.GetMessage());
   }
 
-  body = oss.str();
+  body_size = streambuf.written();
+  if (body_size > buf_size) {
+    return Status(ENOBUFS, "buffer too small to hold the object");
+  }
 
+  if (options_.enable_checksums) {
+    return verify_crc32c(outcome.GetResult().GetChecksumCRC32C(),
+                         streambuf.crc());
+  }
   return Status();
 }
 
 Status S3ObjectStore::get_object(const std::string_view &bucket,
                                  const std::string_view &key, size_t off,
-                                 size_t len, std::string &body) {
+                                 size_t len, char *buf, size_t &read_len) {
+  return get_range(bucket, key, off, len, buf, read_len, nullptr);
+}
+
+Status S3ObjectStore::get_range(const std::string_view &bucket,
+                                const std::string_view &key, size_t off,
+                                size_t len, char *buf, size_t &read_len,
+                                uint32_t *crc) {
   Aws::S3::Model::GetObjectRequest request;
   request.SetBucket(Aws::String(bucket));
   request.SetKey(Aws::String(key));
   std::string byte_range =
       "bytes=" + std::to_string(off) + "-" + std::to_string(off + len - 1);
   request.SetRange(byte_range);
-  Aws::S3::Model::GetObjectOutcome outcome = s3_client_.GetObject(request);
+
+  BufferStreamBuf streambuf(buf, len);
+  if (crc != nullptr) {
+    streambuf.enable_checksum();
+  }
+  Aws::S3::Model::GetObjectOutcome outcome =
+      get_object_into(*s3_client_, request, streambuf, metrics_.get(),
+                      MetricsOp::kGetRange);
 
   if (!outcome.IsSuccess()) {
+    read_len = 0;
     const Aws::S3::S3Error &err = outcome.GetError();
     return Status(static_cast<int>(err.GetResponseCode()), err.GetMessage());
   }
 
-  std::ostringstream oss;
-  oss << outcome.GetResult().GetBody().rdbuf();
-  if (!oss) {
-    return Status(EIO, "unable to read data from response stream");
+  read_len = streambuf.stored();
+  if (crc != nullptr) {
+    *crc = streambuf.crc();
   }
 
-  body = oss.str();
-
   return Status();
 }
 
+Status S3ObjectStore::get_ranges(const std::string_view &bucket,
+                                 const std::string_view &key,
+                                 const std::vector<Range> &ranges,
+                                 size_t max_gap,
+                                 std::vector<std::string> &bodies) {
+  return get_ranges_by_spans(*this, bucket, key, ranges, max_gap,
+                             options_.max_parallel_parts, bodies);
+}
+
 Status S3ObjectStore::get_object_meta(const std::string_view &bucket,
                                       const std::string_view &key,
                                       ObjectMeta &meta) {
+  return head_object(bucket, key, meta, nullptr);
+}
+
+Status S3ObjectStore::head_object(const std::string_view &bucket,
+                                  const std::string_view &key,
+                                  ObjectMeta &meta, Aws::String *checksum) {
   Aws::S3::Model::HeadObjectRequest request;
   request.SetBucket(Aws::String(bucket));
   request.SetKey(Aws::String(key));
-  Aws::S3::Model::HeadObjectOutcome outcome = s3_client_.HeadObject(request);
+  if (checksum != nullptr) {
+    request.SetChecksumMode(Aws::S3::Model::ChecksumMode::ENABLED);
+  }
+  Aws::S3::Model::HeadObjectOutcome outcome = s3_client_->HeadObject(request);
 
   if (!outcome.IsSuccess()) {
     const Aws::S3::S3Error &err = outcome.GetError();
@@ -217,6 +963,10 @@ Status S3ObjectStore::get_object_meta(const std::string_view &bucket,
   meta.key = key;
   meta.last_modified = outcome.GetResult().GetLastModified().Millis();
   meta.size = outcome.GetResult().GetContentLength();
+  meta.etag = outcome.GetResult().GetETag();
+  if (checksum != nullptr) {
+    *checksum = outcome.GetResult().GetChecksumCRC32C();
+  }
 
   return Status();
 }
@@ -224,22 +974,102 @@ Status S3ObjectStore::get_object_meta(const std::string_view &bucket,
 Status S3ObjectStore::list_object(const std::string_view &bucket,
                                   const std::string_view &prefix,
                                   std::vector<ObjectMeta> &objects) {
-  Aws::S3::Model::ListObjectsRequest request;
+  // one ListObjectsV2 call returns 1000 keys at most, follow the pages.
+  std::string token;
+  std::string next_token;
+  std::vector<ObjectMeta> page;
+  do {
+    Status status =
+        list_object(bucket, prefix, token, kMaxListKeys, page, next_token);
+    if (!status.is_succ()) {
+      return status;
+    }
+    objects.insert(objects.end(), std::make_move_iterator(page.begin()),
+                   std::make_move_iterator(page.end()));
+    token.swap(next_token);
+  } while (!token.empty());
+
+  return Status();
+}
+
+Status S3ObjectStore::list_object(const std::string_view &bucket,
+                                  const std::string_view &prefix,
+                                  const std::string_view &continuation_token,
+                                  size_t max_keys,
+                                  std::vector<ObjectMeta> &objects,
+                                  std::string &next_continuation_token) {
+  Aws::S3::Model::ListObjectsV2Request request;
   request.SetBucket(Aws::String(bucket));
   request.SetPrefix(Aws::String(prefix));
-  Aws::S3::Model::ListObjectsOutcome outcome = s3_client_.ListObjects(request);
+  if (!continuation_token.empty()) {
+    request.SetContinuationToken(Aws::String(continuation_token));
+  }
+  if (max_keys > 0) {
+    request.SetMaxKeys(static_cast<int>(std::min(max_keys, kMaxListKeys)));
+  }
+  Aws::S3::Model::ListObjectsV2Outcome outcome =
+      s3_client_->ListObjectsV2(request);
 
+  objects.clear();
+  next_continuation_token.clear();
   if (!outcome.IsSuccess()) {
     const Aws::S3::S3Error &err = outcome.GetError();
     return Status(static_cast<int>(err.GetResponseCode()), err.GetMessage());
   }
 
-  for (auto obj : outcome.GetResult().GetContents()) {
+  const Aws::S3::Model::ListObjectsV2Result &result = outcome.GetResult();
+  objects.reserve(result.GetContents().size());
+  for (const auto &obj : result.GetContents()) {
     ObjectMeta meta;
     meta.key = obj.GetKey();
     meta.last_modified = obj.GetLastModified().Millis();
     meta.size = obj.GetSize();
-    objects.push_back(meta);
+    meta.etag = obj.GetETag();
+    objects.push_back(std::move(meta));
+  }
+  if (result.GetIsTruncated()) {
+    next_continuation_token = result.GetNextContinuationToken();
+  }
+
+  return Status();
+}
+
+Status S3ObjectStore::list_object(const std::string_view &bucket,
+                                  const std::string_view &prefix,
+                                  const std::string_view &delimiter,
+                                  std::vector<ObjectMeta> &objects,
+                                  std::vector<std::string> &common_prefixes) {
+  Aws::S3::Model::ListObjectsV2Request request;
+  request.SetBucket(Aws::String(bucket));
+  request.SetPrefix(Aws::String(prefix));
+  request.SetDelimiter(Aws::String(delimiter));
+
+  objects.clear();
+  common_prefixes.clear();
+  while (true) {
+    Aws::S3::Model::ListObjectsV2Outcome outcome =
+        s3_client_->ListObjectsV2(request);
+    if (!outcome.IsSuccess()) {
+      const Aws::S3::S3Error &err = outcome.GetError();
+      return Status(static_cast<int>(err.GetResponseCode()), err.GetMessage());
+    }
+
+    const Aws::S3::Model::ListObjectsV2Result &result = outcome.GetResult();
+    for (const auto &obj : result.GetContents()) {
+      ObjectMeta meta;
+      meta.key = obj.GetKey();
+      meta.last_modified = obj.GetLastModified().Millis();
+      meta.size = obj.GetSize();
+      meta.etag = obj.GetETag();
+      objects.push_back(std::move(meta));
+    }
+    for (const auto &common_prefix : result.GetCommonPrefixes()) {
+      common_prefixes.push_back(common_prefix.GetPrefix());
+    }
+    if (!result.GetIsTruncated()) {
+      break;
+    }
+    request.SetContinuationToken(result.GetNextContinuationToken());
   }
 
   return Status();
@@ -251,19 +1081,214 @@ Status S3ObjectStore::delete_object(const std::string_view &bucket,
   request.SetBucket(Aws::String(bucket));
   request.SetKey(Aws::String(key));
   Aws::S3::Model::DeleteObjectOutcome outcome =
-      s3_client_.DeleteObject(request);
+      s3_client_->DeleteObject(request);
+
+  if (!outcome.IsSuccess()) {
+    const Aws::S3::S3Error &err = outcome.GetError();
+    return Status(static_cast<int>(err.GetResponseCode()), err.GetMessage());
+  }
+
+  return Status();
+}
+
+Status S3ObjectStore::delete_objects(const std::string_view &bucket,
+                                     const std::vector<std::string> &keys,
+                                     std::vector<Status> &results) {
+  results.assign(keys.size(), Status());
+  const size_t num_batches =
+      (keys.size() + kMaxDeleteKeys - 1) / kMaxDeleteKeys;
+  // every batch reports into its own results, so none stops the others.
+  parallel_run(
+      num_batches, options_.max_parallel_parts, [&](size_t batch) -> Status {
+        const size_t begin = batch * kMaxDeleteKeys;
+        const size_t end = std::min(begin + kMaxDeleteKeys, keys.size());
+
+        Aws::S3::Model::Delete del;
+        std::unordered_map<std::string_view, size_t> key_index;
+        for (size_t i = begin; i < end; ++i) {
+          del.AddObjects(Aws::S3::Model::ObjectIdentifier().WithKey(
+              Aws::String(keys[i])));
+          key_index.emplace(keys[i], i);
+        }
+        // quiet mode only reports the failed keys.
+        del.SetQuiet(true);
+
+        Aws::S3::Model::DeleteObjectsRequest request;
+        request.SetBucket(Aws::String(bucket));
+        request.SetDelete(del);
+        Aws::S3::Model::DeleteObjectsOutcome outcome =
+            s3_client_->DeleteObjects(request);
+        if (!outcome.IsSuccess()) {
+          const Aws::S3::S3Error &err = outcome.GetError();
+          Status status(static_cast<int>(err.GetResponseCode()),
+                        err.GetMessage());
+          std::fill(results.begin() + begin, results.begin() + end, status);
+          return Status();
+        }
+        for (const auto &err : outcome.GetResult().GetErrors()) {
+          auto it = key_index.find(err.GetKey());
+          if (it != key_index.end()) {
+            results[it->second] =
+                Status(EIO, err.GetCode() + ": " + err.GetMessage());
+          }
+        }
+        return Status();
+      });
+
+  for (auto &status : results) {
+    if (!status.is_succ()) {
+      return status;
+    }
+  }
+  return Status();
+}
+
+Status S3ObjectStore::multipart_upload(
+    const std::string_view &bucket, const std::string_view &key, size_t size,
+    const std::function<std::unique_ptr<std::streambuf>(size_t, size_t)>
+        &make_part_body) {
+  // s3 limits: at least 5MiB for every part but the last, 10000 parts.
+  size_t part_size = std::max(options_.part_size, kMinPartSize);
+  part_size = std::max(part_size, (size + kMaxParts - 1) / kMaxParts);
+  const size_t num_parts =
+      std::max<size_t>((size + part_size - 1) / part_size, 1);
+
+  Aws::String upload_id;
+  Status status = create_multipart_upload(bucket, key, upload_id);
+  if (!status.is_succ()) {
+    return status;
+  }
+
+  std::vector<Aws::S3::Model::CompletedPart> parts(num_parts);
+  status = parallel_run(
+      num_parts, options_.max_parallel_parts, [&](size_t i) {
+        const size_t off = i * part_size;
+        const size_t len = std::min(part_size, size - off);
+        std::unique_ptr<std::streambuf> streambuf = make_part_body(off, len);
+        return upload_part(bucket, key, upload_id, i + 1, streambuf.get(), len,
+                           parts[i]);
+      });
+
+  if (status.is_succ()) {
+    status = complete_multipart_upload(bucket, key, upload_id, parts);
+    if (status.is_succ()) {
+      return status;
+    }
+  }
+  abort_multipart_upload(bucket, key, upload_id);
+  return status;
+}
+
+Status S3ObjectStore::create_multipart_upload(const std::string_view &bucket,
+                                              const std::string_view &key,
+                                              Aws::String &upload_id) {
+  Aws::S3::Model::CreateMultipartUploadRequest request;
+  request.SetBucket(Aws::String(bucket));
+  request.SetKey(Aws::String(key));
+  if (options_.enable_checksums) {
+    // the parts are sent with their crcs, which s3 keeps for the object.
+    request.SetChecksumAlgorithm(Aws::S3::Model::ChecksumAlgorithm::CRC32C);
+  }
+  Aws::S3::Model::CreateMultipartUploadOutcome outcome =
+      s3_client_->CreateMultipartUpload(request);
+  if (!outcome.IsSuccess()) {
+    const Aws::S3::S3Error &err = outcome.GetError();
+    return Status(static_cast<int>(err.GetResponseCode()), err.GetMessage());
+  }
+  upload_id = outcome.GetResult().GetUploadId();
+  return Status();
+}
 
+Status S3ObjectStore::upload_part(const std::string_view &bucket,
+                                  const std::string_view &key,
+                                  const Aws::String &upload_id,
+                                  size_t part_number, std::streambuf *body,
+                                  size_t len,
+                                  Aws::S3::Model::CompletedPart &part) {
+  Aws::S3::Model::UploadPartRequest request;
+  request.SetBucket(Aws::String(bucket));
+  request.SetKey(Aws::String(key));
+  request.SetUploadId(upload_id);
+  request.SetPartNumber(static_cast<int>(part_number));
+  request.SetBody(
+      Aws::MakeShared<Aws::IOStream>("IOStreamAllocationTag", body));
+  request.SetContentLength(static_cast<long long>(len));
+  Aws::String checksum;
+  if (options_.enable_checksums) {
+    uint32_t crc = 0;
+    if (!crc32c_of_body(body, crc)) {
+      return Status(EIO, "unable to read the part");
+    }
+    checksum = encode_crc32c(crc);
+    request.SetChecksumCRC32C(checksum);
+  }
+
+  const auto start = std::chrono::steady_clock::now();
+  Aws::S3::Model::UploadPartOutcome outcome = s3_client_->UploadPart(request);
+  Status status;
+  if (!outcome.IsSuccess()) {
+    const Aws::S3::S3Error &err = outcome.GetError();
+    status =
+        Status(static_cast<int>(err.GetResponseCode()), err.GetMessage());
+  } else {
+    part.SetPartNumber(static_cast<int>(part_number));
+    part.SetETag(outcome.GetResult().GetETag());
+    if (!checksum.empty()) {
+      part.SetChecksumCRC32C(checksum);
+    }
+  }
+  if (metrics_ != nullptr) {
+    metrics_->record(MetricsOp::kUploadPart, elapsed_us(start),
+                     status.is_succ() ? len : 0, status);
+  }
+  return status;
+}
+
+Status S3ObjectStore::complete_multipart_upload(
+    const std::string_view &bucket, const std::string_view &key,
+    const Aws::String &upload_id,
+    const std::vector<Aws::S3::Model::CompletedPart> &parts) {
+  Aws::S3::Model::CompletedMultipartUpload completed_upload;
+  completed_upload.SetParts(parts);
+  Aws::S3::Model::CompleteMultipartUploadRequest request;
+  request.SetBucket(Aws::String(bucket));
+  request.SetKey(Aws::String(key));
+  request.SetUploadId(upload_id);
+  request.SetMultipartUpload(completed_upload);
+  Aws::S3::Model::CompleteMultipartUploadOutcome outcome =
+      s3_client_->CompleteMultipartUpload(request);
   if (!outcome.IsSuccess()) {
     const Aws::S3::S3Error &err = outcome.GetError();
     return Status(static_cast<int>(err.GetResponseCode()), err.GetMessage());
   }
+  return Status();
+}
+
+void S3ObjectStore::abort_multipart_upload(const std::string_view &bucket,
+                                           const std::string_view &key,
+                                           const Aws::String &upload_id) {
+  // don't leave the uploaded parts behind, they are billed until aborted.
+  Aws::S3::Model::AbortMultipartUploadRequest request;
+  request.SetBucket(Aws::String(bucket));
+  request.SetKey(Aws::String(key));
+  request.SetUploadId(upload_id);
+  s3_client_->AbortMultipartUpload(request);
+}
 
+Status S3ObjectStore::open_object_writer(
+    const std::string_view &bucket, const std::string_view &key,
+    std::unique_ptr<ObjectWriter> &writer) {
+  writer = std::make_unique<S3ObjectWriter>(*this, bucket, key);
   return Status();
 }
 
 S3ObjectStore *create_s3_objstore(const std::string_view region,
                                   const std::string_view *endpoint,
-                                  bool use_https) {
+                                  bool use_https,
+                                  const ObjectStoreOptions &options) {
+  // keeps the sdk up while the client is made, the store holds its own
+  // reference afterwards.
+  AwsSdkRef sdk_ref;
   Aws::Client::ClientConfiguration clientConfig;
   clientConfig.region = region;
   if (endpoint != nullptr) {
@@ -271,8 +1296,61 @@ S3ObjectStore *create_s3_objstore(const std::string_view region,
   }
   clientConfig.scheme =
       use_https ? Aws::Http::Scheme::HTTPS : Aws::Http::Scheme::HTTP;
-  Aws::S3::S3Client client(clientConfig);
-  return new S3ObjectStore(region, std::move(client));
+  clientConfig.maxConnections = static_cast<unsigned>(options.max_connections);
+  clientConfig.connectTimeoutMs = static_cast<long>(options.connect_timeout_ms);
+  clientConfig.requestTimeoutMs = static_cast<long>(options.request_timeout_ms);
+  clientConfig.enableTcpKeepAlive = options.tcp_keep_alive;
+  clientConfig.tcpKeepAliveIntervalMs = options.tcp_keep_alive_interval_ms;
+  clientConfig.requestCompressionConfig.useRequestCompression =
+      options.request_compression
+          ? Aws::Client::UseRequestCompression::ENABLE
+          : Aws::Client::UseRequestCompression::DISABLE;
+  clientConfig.requestCompressionConfig.requestMinCompressionSizeBytes =
+      options.request_compression_min_bytes;
+  if (options.http_client == "curl") {
+    clientConfig.httpLibOverride = Aws::Http::TransferLibType::CURL_CLIENT;
+  } else if (options.http_client == "winhttp") {
+    clientConfig.httpLibOverride = Aws::Http::TransferLibType::WIN_HTTP_CLIENT;
+  } else if (options.http_client == "wininet") {
+    clientConfig.httpLibOverride = Aws::Http::TransferLibType::WIN_INET_CLIENT;
+  } else if (!options.http_client.empty()) {
+    return nullptr;
+  }
+  if (options.max_retries > 0 || options.hedge_reads) {
+    // create_object_store() retries the requests, retrying them in the sdk
+    // as well would multiply the attempts.
+    clientConfig.retryStrategy =
+        Aws::MakeShared<Aws::Client::DefaultRetryStrategy>("objstore", 0);
+  }
+
+  std::shared_ptr<Aws::S3::S3Client> client;
+  if (!options.share_s3_client) {
+    client = std::make_shared<Aws::S3::S3Client>(clientConfig);
+  } else {
+    // every setting of the client is part of the key, stores configured
+    // alike share one client and so one connection pool.
+    const std::string config_key =
+        std::string(region) + '\0' +
+        (endpoint != nullptr ? std::string(*endpoint) : std::string()) +
+        '\0' + (use_https ? "https" : "http") + '\0' +
+        std::to_string(options.max_connections) + '\0' +
+        std::to_string(options.connect_timeout_ms) + '\0' +
+        std::to_string(options.request_timeout_ms) + '\0' +
+        std::to_string(options.tcp_keep_alive) + '\0' +
+        std::to_string(options.tcp_keep_alive_interval_ms) + '\0' +
+        std::to_string(options.request_compression) + '\0' +
+        std::to_string(options.request_compression_min_bytes) + '\0' +
+        options.http_client + '\0' +
+        std::to_string(options.max_retries > 0 || options.hedge_reads);
+    const std::lock_guard<std::mutex> _(g_shared_clients_mutex);
+    std::weak_ptr<Aws::S3::S3Client> &shared = g_shared_clients[config_key];
+    client = shared.lock();
+    if (client == nullptr) {
+      client = std::make_shared<Aws::S3::S3Client>(clientConfig);
+      shared = client;
+    }
+  }
+  return new S3ObjectStore(region, std::move(client), options);
 }
 
 void destroy_s3_objstore(S3ObjectStore *s3_objstore) {
@@ -1,19 +1,40 @@
 #ifndef MY_OBJSTORE_S3_H_INCLUDED
 #define MY_OBJSTORE_S3_H_INCLUDED
 
+#include <functional>
+#include <memory>
+#include <streambuf>
 #include <string>
 
 #include <aws/s3/S3Client.h>
+#include <aws/s3/model/CompletedPart.h>
 
 #include "objstore.h"
 
 namespace objstore {
 
+class Metrics;
+
+// keeps the aws sdk initialized while alive: the first reference in the
+// process initializes it, the last one shuts it down.
+class AwsSdkRef {
+ public:
+  AwsSdkRef();
+  ~AwsSdkRef();
+
+  AwsSdkRef(const AwsSdkRef &) = delete;
+  AwsSdkRef &operator=(const AwsSdkRef &) = delete;
+};
+
 class S3ObjectStore : public ObjectStore {
  public:
+  // s3_client may be shared with other stores.
   explicit S3ObjectStore(const std::string_view region,
-                         Aws::S3::S3Client &&s3_client)
-      : region_(region), s3_client_(s3_client) {}
+                         std::shared_ptr<Aws::S3::S3Client> s3_client,
+                         const ObjectStoreOptions &options)
+      : region_(region),
+        s3_client_(std::move(s3_client)),
+        options_(options) {}
   virtual ~S3ObjectStore() = default;
 
   Status create_bucket(const std::string_view &bucket) override;
@@ -33,6 +54,14 @@ class S3ObjectStore : public ObjectStore {
                     std::string &input) override;
   Status get_object(const std::string_view &bucket, const std::string_view &key,
                     size_t off, size_t len, std::string &body) override;
+  Status get_object(const std::string_view &bucket, const std::string_view &key,
+                    char *buf, size_t buf_size, size_t &body_size) override;
+  Status get_object(const std::string_view &bucket, const std::string_view &key,
+                    size_t off, size_t len, char *buf,
+                    size_t &read_len) override;
+  Status get_ranges(const std::string_view &bucket, const std::string_view &key,
+                    const std::vector<Range> &ranges, size_t max_gap,
+                    std::vector<std::string> &bodies) override;
   Status get_object_meta(const std::string_view &bucket,
                          const std::string_view &key,
                          ObjectMeta &meta) override;
@@ -40,18 +69,91 @@ class S3ObjectStore : public ObjectStore {
   Status list_object(const std::string_view &bucket,
                      const std::string_view &prefix,
                      std::vector<ObjectMeta> &objects) override;
+  Status list_object(const std::string_view &bucket,
+                     const std::string_view &prefix,
+                     const std::string_view &continuation_token,
+                     size_t max_keys, std::vector<ObjectMeta> &objects,
+                     std::string &next_continuation_token) override;
+  Status list_object(const std::string_view &bucket,
+                     const std::string_view &prefix,
+                     const std::string_view &delimiter,
+                     std::vector<ObjectMeta> &objects,
+                     std::vector<std::string> &common_prefixes) override;
 
   Status delete_object(const std::string_view &bucket,
                        const std::string_view &key) override;
+  Status delete_objects(const std::string_view &bucket,
+                        const std::vector<std::string> &keys,
+                        std::vector<Status> &results) override;
+
+  Status open_object_writer(const std::string_view &bucket,
+                            const std::string_view &key,
+                            std::unique_ptr<ObjectWriter> &writer) override;
+
+  // record the time to first byte of the gets and the uploaded parts into
+  // metrics, which the requests as a whole are recorded into by a
+  // MetricsObjectStore. nullptr, the default, records nothing.
+  void set_metrics(std::shared_ptr<Metrics> metrics) {
+    metrics_ = std::move(metrics);
+  }
+
+ private:
+  friend class S3ObjectWriter;
+
+  // s3 limits: at least 5MiB for every part but the last, at most 5GiB for
+  // any part, 10000 parts.
+  static constexpr size_t kMinPartSize = 5 * 1024 * 1024;
+  static constexpr size_t kMaxPartSize = 5ULL * 1024 * 1024 * 1024;
+  static constexpr size_t kMaxParts = 10000;
+
+  // get_object_meta(), checksum is set to the crc32c of the object as s3
+  // has it unless nullptr, empty if none.
+  Status head_object(const std::string_view &bucket,
+                     const std::string_view &key, ObjectMeta &meta,
+                     Aws::String *checksum);
+  // get_object() of a range, crc is set to the crc32c of the bytes read
+  // unless nullptr.
+  Status get_range(const std::string_view &bucket, const std::string_view &key,
+                   size_t off, size_t len, char *buf, size_t &read_len,
+                   uint32_t *crc);
+  // upload an object of size bytes by multipart upload, parts are sent in
+  // parallel and their bodies are made by make_part_body(off, len). the
+  // upload is aborted on failure.
+  Status multipart_upload(
+      const std::string_view &bucket, const std::string_view &key,
+      size_t size,
+      const std::function<std::unique_ptr<std::streambuf>(size_t, size_t)>
+          &make_part_body);
+  Status create_multipart_upload(const std::string_view &bucket,
+                                 const std::string_view &key,
+                                 Aws::String &upload_id);
+  // upload len bytes of body as part part_number, part is set on success.
+  Status upload_part(const std::string_view &bucket,
+                     const std::string_view &key, const Aws::String &upload_id,
+                     size_t part_number, std::streambuf *body, size_t len,
+                     Aws::S3::Model::CompletedPart &part);
+  Status complete_multipart_upload(
+      const std::string_view &bucket, const std::string_view &key,
+      const Aws::String &upload_id,
+      const std::vector<Aws::S3::Model::CompletedPart> &parts);
+  void abort_multipart_upload(const std::string_view &bucket,
+                              const std::string_view &key,
+                              const Aws::String &upload_id);
 
  private:
+  // declared first so that the client is destroyed before the sdk is shut
+  // down.
+  AwsSdkRef sdk_ref_;
   std::string region_;
-  Aws::S3::S3Client s3_client_;
+  std::shared_ptr<Aws::S3::S3Client> s3_client_;
+  ObjectStoreOptions options_;
+  std::shared_ptr<Metrics> metrics_;
 };
 
-S3ObjectStore *create_s3_objstore(const std::string_view region,
-                                  const std::string_view *endpoint,
-                                  bool useHttps = true);
+S3ObjectStore *create_s3_objstore(
+    const std::string_view region, const std::string_view *endpoint,
+    bool useHttps = true,
+    const ObjectStoreOptions &options = ObjectStoreOptions());
 
 void destroy_s3_objstore(S3ObjectStore *s3_obj_store);
 
@@ -0,0 +1,118 @@
+#ifndef MY_OBJSTORE_SINGLE_FLIGHT_H_INCLUDED
+#define MY_OBJSTORE_SINGLE_FLIGHT_H_INCLUDED
+
+#include <exception>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+#include "objstore.h"
+
+namespace objstore {
+
+// deduplicate concurrent calls by key: while a call of a key is running, the
+// callers of the same key wait for it and share its result instead of
+// running fn again. T should be cheap to copy, such as a shared_ptr.
+template <typename T>
+class SingleFlight {
+ public:
+  // an exception thrown by fn is rethrown to the caller running it and to
+  // the callers waiting for it.
+  Status run(const std::string &key, T &value,
+             const std::function<Status(T &value)> &fn) {
+    std::shared_ptr<Call> call;
+    if (join(key, call)) {
+      return wait(*call, value);
+    }
+
+    try {
+      call->status = fn(call->value);
+      value = call->value;
+    } catch (...) {
+      forget(key, *call);
+      call->promise.set_exception(std::current_exception());
+      throw;
+    }
+    forget(key, *call);
+    call->promise.set_value();
+    return call->status;
+  }
+
+  // like run(), but fn reads the result into the memory of its caller, and
+  // only if others wait for it and fn succeeds, share() makes their value,
+  // e.g. a copy of the result, so a call not shared costs nothing more.
+  Status run_shared(const std::string &key, T &value,
+                    const std::function<Status()> &fn,
+                    const std::function<T()> &share) {
+    std::shared_ptr<Call> call;
+    if (join(key, call)) {
+      return wait(*call, value);
+    }
+
+    try {
+      call->status = fn();
+      // no caller joins once the call is forgotten, so the waiters counted
+      // are all of them.
+      if (forget(key, *call) > 0 && call->status.is_succ()) {
+        call->value = share();
+      }
+    } catch (...) {
+      forget(key, *call);
+      call->promise.set_exception(std::current_exception());
+      throw;
+    }
+    call->promise.set_value();
+    return call->status;
+  }
+
+ private:
+  struct Call {
+    std::promise<void> promise;
+    std::shared_future<void> done;
+    size_t waiters = 0;
+    Status status;
+    T value;
+  };
+
+  // join the running call of key, or start one and return false.
+  bool join(const std::string &key, std::shared_ptr<Call> &call) {
+    const std::lock_guard<std::mutex> _(mutex_);
+    auto it = calls_.find(key);
+    if (it != calls_.end()) {
+      call = it->second;
+      ++call->waiters;
+      return true;
+    }
+    call = std::make_shared<Call>();
+    call->done = call->promise.get_future().share();
+    calls_.emplace(key, call);
+    return false;
+  }
+
+  Status wait(Call &call, T &value) {
+    call.done.get();
+    value = call.value;
+    return call.status;
+  }
+
+  // forget the call of key, so that the next caller runs it again, and
+  // return its waiters. a call of key started since is left alone.
+  size_t forget(const std::string &key, Call &call) {
+    const std::lock_guard<std::mutex> _(mutex_);
+    auto it = calls_.find(key);
+    if (it != calls_.end() && it->second.get() == &call) {
+      calls_.erase(it);
+    }
+    return call.waiters;
+  }
+
+  std::mutex mutex_;
+  std::unordered_map<std::string, std::shared_ptr<Call>> calls_;
+};
+
+}  // namespace objstore
+
+#endif  // MY_OBJSTORE_SINGLE_FLIGHT_H_INCLUDED